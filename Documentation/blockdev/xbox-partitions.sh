@@ -0,0 +1,144 @@
+#! /bin/sh
+# Checks the Xbox partition parser (CONFIG_XBOX_PARTITION) on sparse
+# disk images attached to a loop device.
+#
+# The parser numbers the partitions from 50, so loop has to be loaded
+# with room for them:
+#
+#	modprobe loop max_part=63
+#
+# Usage: xbox-partitions.sh [dir]
+#
+# The images are created in dir, default /tmp, as sparse files; the
+# file system must allow a 150GB sparse file.  Needs root, losetup
+# and blockdev.
+
+set -e
+me=`basename $0`
+dir=${1:-/tmp}
+img=$dir/xbox-partitions.$$.img
+sysd=${sysfs_dir:-/sys}
+loop=
+fail=0
+
+# sectors, see fs/partitions/xbox.c
+SYSTEM_START=4609024
+DATA_START=5633024
+EXTEND_START=15633072
+EXTEND_G_START=268435455
+
+cleanup() {
+	test -n "$loop" && losetup -d $loop 2>/dev/null
+	rm -f $img
+}
+trap cleanup EXIT
+
+test `cat $sysd/module/loop/parameters/max_part 2>/dev/null || echo 0` \
+	-ge 63 || {
+	echo "$me Error: load loop with max_part=63" 1>&2
+	exit 1
+}
+
+# put <sector> <string>: writes a string at the start of a sector
+put() {
+	printf "$2" | dd of=$img bs=512 seek=$1 conv=notrunc 2>/dev/null
+}
+
+# le32 <value>: a little endian 32 bit value, as printf escapes
+le32() {
+	for s in 0 8 16 24; do
+		printf '\\%03o' $(( ($1 >> $s) & 255 ))
+	done
+}
+
+# new_image <sectors>: a blank image with the stock magics
+new_image() {
+	rm -f $img
+	dd if=/dev/zero of=$img bs=512 count=0 seek=$1 2>/dev/null
+	put 3 BRFR
+	put $SYSTEM_START FATX
+	put $DATA_START FATX
+}
+
+rescan() {
+	blockdev --rereadpt $loop 2>/dev/null || true
+}
+
+# expect <what> <nr> [<start> ...]: the partitions of the loop device
+expect() {
+	what=$1
+	nr=$2
+	shift 2
+	name=`basename $loop`
+	got=`ls -d $sysd/block/$name/${name}p* 2>/dev/null | wc -l`
+	if [ $got -ne $nr ]; then
+		echo "$what: FAIL, $got partitions instead of $nr"
+		fail=1
+		return
+	fi
+	n=50
+	for start in "$@"; do
+		got=`cat $sysd/block/$name/${name}p$n/start 2>/dev/null || echo -1`
+		if [ $got -ne $start ]; then
+			echo "$what: FAIL, p$n starts at $got instead of $start"
+			fail=1
+			return
+		fi
+		n=$(( n + 1 ))
+	done
+	echo "$what: ok"
+}
+
+new_image $EXTEND_START
+loop=`losetup -f`
+losetup $loop $img
+rescan
+expect "8GB stock" 5 $DATA_START $SYSTEM_START 1024
+losetup -d $loop
+
+new_image 19541088
+losetup $loop $img
+rescan
+expect "10GB stock, F" 6 $DATA_START $SYSTEM_START 1024 1537024 \
+	3073024 $EXTEND_START
+
+# a rescan must notice that the data partition lost its FATX magic
+put $DATA_START XXXX
+blockdev --flushbufs $loop
+rescan
+expect "10GB without FATX" 0
+losetup -d $loop
+
+# past 137GB, F takes the rest of the disk unless G has a FATX magic
+new_image 300000000
+losetup $loop $img
+rescan
+expect "150GB stock, one F" 6 $DATA_START $SYSTEM_START 1024 1537024 \
+	3073024 $EXTEND_START
+losetup -d $loop
+
+put $EXTEND_G_START FATX
+losetup $loop $img
+rescan
+expect "150GB stock, F and G" 7 $DATA_START $SYSTEM_START 1024 1537024 \
+	3073024 $EXTEND_START $EXTEND_G_START
+losetup -d $loop
+
+# a table of three partitions, the second one not in use
+new_image 300000000
+put 0 "****PARTINFO****"
+entry() {
+	printf "%-16s" "$1" | dd of=$img bs=1 seek=$2 conv=notrunc 2>/dev/null
+	printf "`le32 $3``le32 $4``le32 $5`" |
+		dd of=$img bs=1 seek=$(( $2 + 16 )) conv=notrunc 2>/dev/null
+}
+entry "XBOX SHELL" 48 2147483648 $DATA_START 9895696
+entry "XBOX DATA" 80 0 $SYSTEM_START 1024000
+entry "XBOX F" 112 2147483648 $EXTEND_START 200000000
+losetup $loop $img
+rescan
+expect "PARTINFO table" 2 $DATA_START $EXTEND_START
+losetup -d $loop
+loop=
+
+exit $fail
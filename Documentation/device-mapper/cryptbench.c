@@ -0,0 +1,165 @@
+/*
+ * cryptbench: measure the throughput of a block device with several
+ * concurrent readers or writers
+ *
+ * Forks the given number of processes, each of which reads or writes
+ * its own slice of the device sequentially with O_DIRECT, and reports
+ * the aggregate throughput.  Meant to show how dm-crypt scales with the
+ * number of CPUs, on top of a RAM disk so that the disk is not the
+ * bottleneck, see Documentation/device-mapper/dm-crypt.txt.
+ *
+ * Compile by:
+ *
+ * gcc -O2 -o cryptbench cryptbench.c
+ *
+ * Usage: cryptbench [-w] [-j jobs] [-b block_kb] [-t seconds] device
+ *
+ *	-w	write instead of read (destroys the contents of the device)
+ *	-j	number of processes, default: 1
+ *	-b	size of each I/O in kbytes, default: 64
+ *	-t	duration of the run in seconds, default: 10
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <linux/fs.h>
+
+static void fatal(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void usage(void)
+{
+	printf("Usage: cryptbench [-w] [-j jobs] [-b block_kb] [-t seconds] "
+	       "device\n");
+	exit(1);
+}
+
+/*
+ * Does I/O until the deadline, and returns the number of bytes done
+ * through the pipe @out.
+ */
+static void job(const char *dev, int do_write, unsigned long long start,
+		unsigned long long len, size_t bs, double deadline, int out)
+{
+	unsigned long long pos = 0, done = 0;
+	char *buf;
+	int fd;
+
+	fd = open(dev, (do_write ? O_WRONLY : O_RDONLY) | O_DIRECT);
+	if (fd < 0)
+		fatal(dev);
+	buf = mmap(NULL, bs, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED)
+		fatal("mmap");
+	memset(buf, 0x5a, bs);
+
+	while (now() < deadline) {
+		ssize_t ret;
+
+		if (pos + bs > len)
+			pos = 0;
+		if (do_write)
+			ret = pwrite(fd, buf, bs, start + pos);
+		else
+			ret = pread(fd, buf, bs, start + pos);
+		if (ret != (ssize_t)bs)
+			fatal(do_write ? "pwrite" : "pread");
+		pos += bs;
+		done += bs;
+	}
+	if (do_write && fdatasync(fd))
+		fatal("fdatasync");
+	if (write(out, &done, sizeof(done)) != sizeof(done))
+		fatal("write");
+	exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long size, slice, total = 0, done;
+	int do_write = 0, jobs = 1, seconds = 10, i, c, fd, pipefd[2];
+	size_t bs = 64 << 10;
+	double t, deadline;
+	const char *dev;
+
+	while ((c = getopt(argc, argv, "wj:b:t:")) != -1) {
+		switch (c) {
+		case 'w':
+			do_write = 1;
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'b':
+			bs = strtoul(optarg, NULL, 0) << 10;
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1 || jobs < 1 || !bs || seconds < 1)
+		usage();
+	dev = argv[optind];
+
+	fd = open(dev, O_RDONLY);
+	if (fd < 0)
+		fatal(dev);
+	if (ioctl(fd, BLKGETSIZE64, &size))
+		fatal("BLKGETSIZE64");
+	close(fd);
+
+	slice = size / jobs / bs * bs;
+	if (!slice) {
+		fprintf(stderr, "%s: too small for %d jobs\n", dev, jobs);
+		return 1;
+	}
+	if (pipe(pipefd))
+		fatal("pipe");
+
+	t = now();
+	deadline = t + seconds;
+	for (i = 0; i < jobs; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0)
+			fatal("fork");
+		if (!pid)
+			job(dev, do_write, i * slice, slice, bs, deadline,
+			    pipefd[1]);
+	}
+	close(pipefd[1]);
+
+	while (read(pipefd[0], &done, sizeof(done)) == sizeof(done))
+		total += done;
+	while (wait(NULL) > 0)
+		;
+	t = now() - t;
+
+	printf("%s %d jobs %zu kB: %.1f MB/s\n", do_write ? "write" : "read",
+	       jobs, bs >> 10, total / t / (1 << 20));
+	return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * fatbench: measure the sequential read throughput of a file
+ *
+ * Reads the file from start to end through the page cache, so that
+ * readahead goes through the file system's ->readpages, and drops the
+ * file's cached pages before each pass.  When given the block device
+ * the file lives on, also reports the average size of the read
+ * requests the device completed, from /sys/block/<dev>/stat, which
+ * shows how large the bios built by mpage were.  Meant to compare FAT
+ * and FATX before and after a change to the block mapping, on a loop
+ * device, see Documentation/filesystems/vfat.txt.
+ *
+ * Compile by:
+ *
+ * gcc -O2 -o fatbench fatbench.c
+ *
+ * Usage: fatbench [-b block_kb] [-n passes] [-d device] file
+ *
+ *	-b	size of each read() in kbytes, default: 1024
+ *	-n	number of passes over the file, default: 3
+ *	-d	the whole block device the file is on, e.g. loop0
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/time.h>
+
+static void fatal(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void usage(void)
+{
+	printf("Usage: fatbench [-b block_kb] [-n passes] [-d device] file\n");
+	exit(1);
+}
+
+/*
+ * Reads the completed reads and sectors read of @dev, returns 0 if
+ * there is no such device.
+ */
+static int dev_stat(const char *dev, unsigned long long *ios,
+		    unsigned long long *sectors)
+{
+	char path[256];
+	FILE *f;
+	int ret;
+
+	snprintf(path, sizeof(path), "/sys/block/%s/stat", dev);
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	ret = fscanf(f, "%llu %*u %llu", ios, sectors);
+	fclose(f);
+	return ret == 2;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long done, ios0, ios1, sect0, sect1;
+	int passes = 3, pass, c, fd, have_stat = 0;
+	size_t bs = 1 << 20;
+	const char *file, *dev = NULL;
+	double t;
+	char *buf;
+
+	while ((c = getopt(argc, argv, "b:n:d:")) != -1) {
+		switch (c) {
+		case 'b':
+			bs = strtoul(optarg, NULL, 0) << 10;
+			break;
+		case 'n':
+			passes = atoi(optarg);
+			break;
+		case 'd':
+			dev = optarg;
+			if (!strncmp(dev, "/dev/", 5))
+				dev += 5;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1 || !bs || passes < 1)
+		usage();
+	file = argv[optind];
+
+	buf = malloc(bs);
+	if (!buf)
+		fatal("malloc");
+	fd = open(file, O_RDONLY);
+	if (fd < 0)
+		fatal(file);
+
+	for (pass = 0; pass < passes; pass++) {
+		ssize_t ret;
+
+		/* the file is only read, so all its pages are clean */
+		if (posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED))
+			fatal("posix_fadvise");
+		if (lseek(fd, 0, SEEK_SET))
+			fatal("lseek");
+
+		if (dev)
+			have_stat = dev_stat(dev, &ios0, &sect0);
+		done = 0;
+		t = now();
+		while ((ret = read(fd, buf, bs)) > 0)
+			done += ret;
+		if (ret < 0)
+			fatal("read");
+		t = now() - t;
+
+		printf("pass %d: %llu MB in %.2f s, %.1f MB/s", pass + 1,
+		       done >> 20, t, done / t / (1 << 20));
+		if (have_stat && dev_stat(dev, &ios1, &sect1) && ios1 > ios0)
+			printf(", %llu reads of %.1f kB", ios1 - ios0,
+			       (sect1 - sect0) / 2.0 / (ios1 - ios0));
+		printf("\n");
+	}
+	return 0;
+}
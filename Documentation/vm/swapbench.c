@@ -0,0 +1,171 @@
+/*
+ * swapbench: measure the throughput of reclaim and swap-out
+ *
+ * Maps an anonymous area larger than the free memory, and writes every
+ * page of it in several passes, so that each pass swaps out what the
+ * previous one touched.  Reports the elapsed time of each pass, and the
+ * reclaim and swap counters of /proc/vmstat over it.
+ *
+ * Compile by:
+ *
+ * gcc -O2 -o swapbench swapbench.c
+ *
+ * Usage: swapbench [-s size_mb] [-p passes] [-r]
+ *
+ *	-s	size of the area, default: 1.5 times MemTotal
+ *	-p	number of passes, default: 3
+ *	-r	touch the pages in random order instead of sequentially
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+struct counters {
+	unsigned long long pswpin, pswpout;
+	unsigned long long pgscan, pgsteal;
+	unsigned long long allocstall;
+};
+
+static void fatal(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static void read_vmstat(struct counters *c)
+{
+	char name[64];
+	unsigned long long val;
+	FILE *f;
+
+	memset(c, 0, sizeof(*c));
+	f = fopen("/proc/vmstat", "r");
+	if (!f)
+		fatal("/proc/vmstat");
+	while (fscanf(f, "%63s %llu", name, &val) == 2) {
+		if (!strcmp(name, "pswpin"))
+			c->pswpin = val;
+		else if (!strcmp(name, "pswpout"))
+			c->pswpout = val;
+		else if (!strncmp(name, "pgscan_", 7))
+			c->pgscan += val;
+		else if (!strncmp(name, "pgsteal_", 8))
+			c->pgsteal += val;
+		else if (!strcmp(name, "allocstall"))
+			c->allocstall = val;
+	}
+	fclose(f);
+}
+
+static unsigned long mem_total_mb(void)
+{
+	char line[128];
+	unsigned long kb = 0;
+	FILE *f;
+
+	f = fopen("/proc/meminfo", "r");
+	if (!f)
+		fatal("/proc/meminfo");
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "MemTotal: %lu kB", &kb) == 1)
+			break;
+	}
+	fclose(f);
+	return kb >> 10;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void usage(void)
+{
+	printf("Usage: swapbench [-s size_mb] [-p passes] [-r]\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long size_mb = 0, nr_pages, i, page_size, *order = NULL;
+	int passes = 3, random_order = 0, pass, c;
+	struct counters before, after;
+	char *area;
+	double t, secs;
+
+	while ((c = getopt(argc, argv, "s:p:r")) != -1) {
+		switch (c) {
+		case 's':
+			size_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			passes = atoi(optarg);
+			break;
+		case 'r':
+			random_order = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!size_mb)
+		size_mb = mem_total_mb() * 3 / 2;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	nr_pages = (size_mb << 20) / page_size;
+	area = mmap(NULL, nr_pages * page_size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (area == MAP_FAILED)
+		fatal("mmap");
+
+	if (random_order) {
+		order = malloc(nr_pages * sizeof(*order));
+		if (!order)
+			fatal("malloc");
+		for (i = 0; i < nr_pages; i++)
+			order[i] = i;
+		srandom(getpid());
+		for (i = nr_pages - 1; i > 0; i--) {
+			unsigned long j = random() % (i + 1), tmp = order[i];
+
+			order[i] = order[j];
+			order[j] = tmp;
+		}
+	}
+
+	printf("%lu MB, %lu pages, %s order\n", size_mb, nr_pages,
+	       random_order ? "random" : "sequential");
+	printf("pass     secs    MB/s   pswpout    pswpin    pgscan   pgsteal"
+	       "  stalls\n");
+
+	for (pass = 0; pass < passes; pass++) {
+		read_vmstat(&before);
+		t = now();
+		for (i = 0; i < nr_pages; i++) {
+			unsigned long n = order ? order[i] : i;
+
+			area[n * page_size] = pass + 1;
+		}
+		secs = now() - t;
+		read_vmstat(&after);
+
+		printf("%4d %8.2f %7.1f %9llu %9llu %9llu %9llu %7llu\n",
+		       pass, secs, size_mb / secs,
+		       after.pswpout - before.pswpout,
+		       after.pswpin - before.pswpin,
+		       after.pgscan - before.pgscan,
+		       after.pgsteal - before.pgsteal,
+		       after.allocstall - before.allocstall);
+	}
+
+	munmap(area, nr_pages * page_size);
+	free(order);
+	return 0;
+}
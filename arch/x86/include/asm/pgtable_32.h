@@ -130,6 +130,7 @@ static inline int pud_large(pud_t pud) { return 0; }
 	((pte_t *)pmd_page_vaddr(*(dir)) +  pte_index((address)))
 
 #define pmd_page(pmd) (pfn_to_page(pmd_val((pmd)) >> PAGE_SHIFT))
+#define pmd_pfn(pmd) ((pmd_val((pmd)) & PTE_PFN_MASK) >> PAGE_SHIFT)
 
 #define pmd_page_vaddr(pmd)					\
 	((unsigned long)__va(pmd_val((pmd)) & PTE_PFN_MASK))
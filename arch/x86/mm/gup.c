@@ -125,6 +125,16 @@ static noinline int gup_huge_pmd(pmd_t pmd, unsigned long addr,
 	refs = 0;
 	head = pte_page(pte);
 	page = head + ((addr & ~PMD_MASK) >> PAGE_SHIFT);
+	if (!PageCompound(head)) {
+		/* a transparent huge pmd, mapping small pages */
+		do {
+			get_page(page);
+			pages[*nr] = page;
+			(*nr)++;
+			page++;
+		} while (addr += PAGE_SIZE, addr != end);
+		return 1;
+	}
 	do {
 		VM_BUG_ON(compound_head(page) != head);
 		pages[*nr] = page;
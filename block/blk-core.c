@@ -46,6 +46,10 @@ DEFINE_TRACE(block_remap);	/* Also used in drivers/md/dm.c */
 EXPORT_TRACEPOINT_SYMBOL_GPL(block_remap);
 
 static int __make_request(struct request_queue *q, struct bio *bio);
+static void blk_stage_flush(struct request_queue *q, int can_sleep,
+			    int unplug);
+static void blk_stage_work(struct work_struct *work);
+static int blk_stage_pending(struct request_queue *q);
 
 /*
  * For the allocated request tables
@@ -258,6 +262,16 @@ int blk_remove_plug(struct request_queue *q)
 		return 0;
 
 	del_timer(&q->unplug_timer);
+
+	/*
+	 * The plug was what would have taken the staged bios along.
+	 * Pairs with the barrier in blk_stage_bio().
+	 */
+	if (q->stage) {
+		smp_mb();
+		if (blk_stage_pending(q))
+			kblockd_schedule_work(q, &q->stage_work);
+	}
 	return 1;
 }
 EXPORT_SYMBOL(blk_remove_plug);
@@ -293,6 +307,12 @@ void generic_unplug_device(struct request_queue *q)
 		__generic_unplug_device(q);
 		spin_unlock_irq(q->queue_lock);
 	}
+
+	if (q->stage) {
+		/* pairs with the barrier in blk_stage_bio() */
+		smp_mb();
+		blk_stage_flush(q, 0, 1);
+	}
 }
 EXPORT_SYMBOL(generic_unplug_device);
 
@@ -409,6 +429,7 @@ void blk_sync_queue(struct request_queue *q)
 	del_timer_sync(&q->unplug_timer);
 	del_timer_sync(&q->timeout);
 	cancel_work_sync(&q->unplug_work);
+	cancel_work_sync(&q->stage_work);
 }
 EXPORT_SYMBOL(blk_sync_queue);
 
@@ -467,6 +488,8 @@ void blk_cleanup_queue(struct request_queue *q)
 	 * are done before moving on. Going into this function, we should
 	 * not have processes doing IO to this device.
 	 */
+	if (q->stage)
+		blk_stage_flush(q, 1, 1);
 	blk_sync_queue(q);
 
 	mutex_lock(&q->sysfs_lock);
@@ -527,6 +550,7 @@ struct request_queue *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 	setup_timer(&q->timeout, blk_rq_timed_out_timer, (unsigned long) q);
 	INIT_LIST_HEAD(&q->timeout_list);
 	INIT_WORK(&q->unplug_work, blk_unplug_work);
+	INIT_WORK(&q->stage_work, blk_stage_work);
 
 	kobject_init(&q->kobj, &blk_queue_ktype);
 
@@ -586,6 +610,7 @@ blk_init_queue_node(request_fn_proc *rfn, spinlock_t *lock, int node_id)
 
 	q->node = node_id;
 	if (blk_init_free_list(q)) {
+		bdi_destroy(&q->backing_dev_info);
 		kmem_cache_free(blk_requestq_cachep, q);
 		return NULL;
 	}
@@ -1137,99 +1162,121 @@ void init_request_from_bio(struct request *req, struct bio *bio)
 	blk_rq_bio_prep(req->q, req, bio);
 }
 
-static int __make_request(struct request_queue *q, struct bio *bio)
+static int bio_attempt_back_merge(struct request_queue *q,
+				  struct request *req, struct bio *bio)
 {
-	struct request *req;
-	int el_ret, nr_sectors;
-	const unsigned short prio = bio_prio(bio);
-	const int sync = bio_sync(bio);
-	const int unplug = bio_unplug(bio);
-	int rw_flags;
+	if (!ll_back_merge_fn(q, req, bio))
+		return 0;
+
+	trace_block_bio_backmerge(q, bio);
+
+	req->biotail->bi_next = bio;
+	req->biotail = bio;
+	req->nr_sectors = req->hard_nr_sectors += bio_sectors(bio);
+	req->ioprio = ioprio_best(req->ioprio, bio_prio(bio));
+	if (!blk_rq_cpu_valid(req))
+		req->cpu = bio->bi_comp_cpu;
+	drive_stat_acct(req, 0);
+	return 1;
+}
 
-	nr_sectors = bio_sectors(bio);
+static int bio_attempt_front_merge(struct request_queue *q,
+				   struct request *req, struct bio *bio)
+{
+	if (!ll_front_merge_fn(q, req, bio))
+		return 0;
+
+	trace_block_bio_frontmerge(q, bio);
+
+	bio->bi_next = req->bio;
+	req->bio = bio;
 
 	/*
-	 * low level driver can indicate that it wants pages above a
-	 * certain limit bounced to low memory (ie for highmem, or even
-	 * ISA dma in theory)
+	 * may not be valid. if the low level driver said
+	 * it didn't need a bounce buffer then it better
+	 * not touch req->buffer either...
 	 */
-	blk_queue_bounce(q, &bio);
+	req->buffer = bio_data(bio);
+	req->current_nr_sectors = bio_cur_sectors(bio);
+	req->hard_cur_sectors = req->current_nr_sectors;
+	req->sector = req->hard_sector = bio->bi_sector;
+	req->nr_sectors = req->hard_nr_sectors += bio_sectors(bio);
+	req->ioprio = ioprio_best(req->ioprio, bio_prio(bio));
+	if (!blk_rq_cpu_valid(req))
+		req->cpu = bio->bi_comp_cpu;
+	drive_stat_acct(req, 0);
+	return 1;
+}
 
-	spin_lock_irq(q->queue_lock);
+/*
+ * Try to merge @bio into a request of the elevator, queue lock held.
+ */
+static int __make_request_merge(struct request_queue *q, struct bio *bio)
+{
+	struct request *req;
+	int el_ret;
 
 	if (unlikely(bio_barrier(bio)) || elv_queue_empty(q))
-		goto get_rq;
+		return 0;
 
 	el_ret = elv_merge(q, &req, bio);
 	switch (el_ret) {
 	case ELEVATOR_BACK_MERGE:
 		BUG_ON(!rq_mergeable(req));
 
-		if (!ll_back_merge_fn(q, req, bio))
+		if (!bio_attempt_back_merge(q, req, bio))
 			break;
-
-		trace_block_bio_backmerge(q, bio);
-
-		req->biotail->bi_next = bio;
-		req->biotail = bio;
-		req->nr_sectors = req->hard_nr_sectors += nr_sectors;
-		req->ioprio = ioprio_best(req->ioprio, prio);
-		if (!blk_rq_cpu_valid(req))
-			req->cpu = bio->bi_comp_cpu;
-		drive_stat_acct(req, 0);
 		if (!attempt_back_merge(q, req))
 			elv_merged_request(q, req, el_ret);
-		goto out;
+		return 1;
 
 	case ELEVATOR_FRONT_MERGE:
 		BUG_ON(!rq_mergeable(req));
 
-		if (!ll_front_merge_fn(q, req, bio))
+		if (!bio_attempt_front_merge(q, req, bio))
 			break;
-
-		trace_block_bio_frontmerge(q, bio);
-
-		bio->bi_next = req->bio;
-		req->bio = bio;
-
-		/*
-		 * may not be valid. if the low level driver said
-		 * it didn't need a bounce buffer then it better
-		 * not touch req->buffer either...
-		 */
-		req->buffer = bio_data(bio);
-		req->current_nr_sectors = bio_cur_sectors(bio);
-		req->hard_cur_sectors = req->current_nr_sectors;
-		req->sector = req->hard_sector = bio->bi_sector;
-		req->nr_sectors = req->hard_nr_sectors += nr_sectors;
-		req->ioprio = ioprio_best(req->ioprio, prio);
-		if (!blk_rq_cpu_valid(req))
-			req->cpu = bio->bi_comp_cpu;
-		drive_stat_acct(req, 0);
 		if (!attempt_front_merge(q, req))
 			elv_merged_request(q, req, el_ret);
-		goto out;
+		return 1;
 
 	/* ELV_NO_MERGE: elevator says don't/can't merge. */
 	default:
 		;
 	}
+	return 0;
+}
+
+/*
+ * Get a request for @bio, queue lock held.  Returns it filled in, with
+ * the queue lock dropped.  Unless @can_sleep, returns NULL with the lock
+ * still held rather than waiting for a free request.
+ */
+static struct request *__make_request_getrq(struct request_queue *q,
+					    struct bio *bio, int can_sleep)
+{
+	struct request *req;
+	int rw_flags;
 
-get_rq:
 	/*
 	 * This sync check and mask will be re-done in init_request_from_bio(),
 	 * but we need to set it earlier to expose the sync flag to the
 	 * rq allocator and io schedulers.
 	 */
 	rw_flags = bio_data_dir(bio);
-	if (sync)
+	if (bio_sync(bio))
 		rw_flags |= REQ_RW_SYNC;
 
 	/*
 	 * Grab a free request. This is might sleep but can not fail.
 	 * Returns with the queue unlocked.
 	 */
-	req = get_request_wait(q, rw_flags, bio);
+	if (can_sleep)
+		req = get_request_wait(q, rw_flags, bio);
+	else {
+		req = get_request(q, rw_flags, bio, GFP_ATOMIC);
+		if (!req)
+			return NULL;
+	}
 
 	/*
 	 * After dropping the lock and possibly sleeping here, our request
@@ -1239,14 +1286,486 @@ get_rq:
 	 */
 	init_request_from_bio(req, bio);
 
-	spin_lock_irq(q->queue_lock);
+	/* only a hint, so no need to keep the cpu */
 	if (test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags) ||
 	    bio_flagged(bio, BIO_CPU_AFFINE))
-		req->cpu = blk_cpu_to_group(smp_processor_id());
+		req->cpu = blk_cpu_to_group(raw_smp_processor_id());
+	return req;
+}
+
+/*
+ * Queue @bio, merging it into a request if possible.  Called with the
+ * queue lock held, and returns with it held, though it is dropped to
+ * allocate a new request.  Unless @can_sleep, returns -EAGAIN rather
+ * than waiting for a free request, and leaves @bio alone.
+ */
+static int __make_request_locked(struct request_queue *q, struct bio *bio,
+				 int can_sleep)
+{
+	struct request *req;
+
+	if (__make_request_merge(q, bio))
+		return 0;
+
+	req = __make_request_getrq(q, bio, can_sleep);
+	if (!req)
+		return -EAGAIN;
+
+	spin_lock_irq(q->queue_lock);
 	if (!blk_queue_nonrot(q) && elv_queue_empty(q))
 		blk_plug_device(q);
 	add_request(q, req);
-out:
+	return 0;
+}
+
+/*
+ * Per-cpu staging of bios in front of the elevator.  A queue set up with
+ * blk_queue_stage() chains the bios submitted to it on a list of the
+ * submitting cpu, under a lock of that list alone, and takes them to
+ * the elevator q->stage_batch at a time: sorted by sector, so that most
+ * of them merge through q->last_merge, under a single hold of the queue
+ * lock, and handed to the driver together.  An unplug of the queue
+ * takes the bios of all the cpus along.
+ */
+struct blk_stage {
+	spinlock_t		lock;
+	struct bio		*head;
+	struct bio		*tail;
+	unsigned int		nr;
+};
+
+/*
+ * Detach the bios of @st, called with @st->lock held.
+ */
+static struct bio *blk_stage_take(struct blk_stage *st, unsigned int *nr)
+{
+	struct bio *bio = st->head;
+
+	*nr += st->nr;
+	st->head = st->tail = NULL;
+	st->nr = 0;
+	return bio;
+}
+
+/*
+ * Give back to the current cpu the bios a non-sleeping blk_stage_run()
+ * found no request for.  They go first, they were there first.  Called
+ * with the queue lock held.
+ */
+static void blk_stage_putback(struct request_queue *q, struct bio *bio)
+{
+	struct blk_stage *st = per_cpu_ptr(q->stage, raw_smp_processor_id());
+	struct bio *tail = bio;
+	unsigned long flags;
+	unsigned int nr = 1;
+
+	while (tail->bi_next) {
+		tail = tail->bi_next;
+		nr++;
+	}
+
+	spin_lock_irqsave(&st->lock, flags);
+	tail->bi_next = st->head;
+	if (!st->head)
+		st->tail = tail;
+	st->head = bio;
+	st->nr += nr;
+	spin_unlock_irqrestore(&st->lock, flags);
+}
+
+/*
+ * Insertion sort by start sector, keeping the submission order of bios
+ * starting at the same sector.  A batch is a few dozen bios at most.
+ */
+static struct bio *blk_stage_sort(struct bio *bio)
+{
+	struct bio *sorted = NULL, *next, **p;
+
+	for (; bio; bio = next) {
+		next = bio->bi_next;
+		p = &sorted;
+		while (*p && (*p)->bi_sector <= bio->bi_sector)
+			p = &(*p)->bi_next;
+		bio->bi_next = *p;
+		*p = bio;
+	}
+	return sorted;
+}
+
+/*
+ * Take a chain of @nr staged bios to the elevator under one hold of the
+ * queue lock, and unplug the queue after them if @unplug or if one of
+ * them asks for it.  Unless @can_sleep, the bios which find no free
+ * request are staged again, and the queue plugged so that its unplug
+ * retries them once the driver has had a go at the queued requests.
+ */
+static void blk_stage_run(struct request_queue *q, struct bio *bio,
+			  unsigned int nr, int can_sleep, int unplug)
+{
+	unsigned int queued = 0;
+	ktime_t start, held __maybe_unused;
+
+	bio = blk_stage_sort(bio);
+	unplug |= blk_queue_nonrot(q);
+
+	spin_lock_irq(q->queue_lock);
+	start = ktime_get();
+	while (bio) {
+		struct bio *next = bio->bi_next;
+
+		bio->bi_next = NULL;
+		unplug |= bio_unplug(bio);
+		if (__make_request_locked(q, bio, can_sleep)) {
+			bio->bi_next = next;
+			unplug = 1;
+			break;
+		}
+		queued++;
+		bio = next;
+	}
+	if (unplug)
+		__generic_unplug_device(q);
+	if (bio) {
+		blk_stage_putback(q, bio);
+		blk_plug_device(q);
+	}
+	held = ktime_sub(ktime_get(), start);
+	spin_unlock_irq(q->queue_lock);
+
+	blk_add_trace_msg(q, "stage %u/%u bios %llu ns", queued, nr,
+			  (unsigned long long)ktime_to_ns(held));
+}
+
+/*
+ * Take the bios staged on all the cpus to the elevator.
+ */
+static void blk_stage_flush(struct request_queue *q, int can_sleep,
+			    int unplug)
+{
+	struct bio *head = NULL, **tail = &head;
+	unsigned int nr = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct blk_stage *st = per_cpu_ptr(q->stage, cpu);
+		unsigned long flags;
+
+		if (!st->nr)
+			continue;
+
+		spin_lock_irqsave(&st->lock, flags);
+		if (st->head) {
+			*tail = st->head;
+			tail = &st->tail->bi_next;
+			blk_stage_take(st, &nr);
+		}
+		spin_unlock_irqrestore(&st->lock, flags);
+	}
+
+	if (head)
+		blk_stage_run(q, head, nr, can_sleep, unplug);
+}
+
+/*
+ * Runs on kblockd, which must not wait for requests: what finds none is
+ * retried on the next unplug.
+ */
+static void blk_stage_work(struct work_struct *work)
+{
+	struct request_queue *q =
+		container_of(work, struct request_queue, stage_work);
+
+	blk_stage_flush(q, 0, 1);
+}
+
+/*
+ * Whether any cpu has bios staged.  Lockless, the callers order it
+ * against the staging with a barrier.
+ */
+static int blk_stage_pending(struct request_queue *q)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		if (per_cpu_ptr(q->stage, cpu)->nr)
+			return 1;
+	return 0;
+}
+
+/*
+ * Stage @bio on the current cpu, and take the batch to the elevator if
+ * it is complete or if @bio is in a hurry.
+ */
+static void blk_stage_bio(struct request_queue *q, struct bio *bio)
+{
+	struct blk_stage *st = per_cpu_ptr(q->stage, raw_smp_processor_id());
+	struct bio *batch = NULL;
+	unsigned int nr = 0;
+	unsigned long flags;
+
+	spin_lock_irqsave(&st->lock, flags);
+	if (st->tail)
+		st->tail->bi_next = bio;
+	else
+		st->head = bio;
+	st->tail = bio;
+	if (++st->nr >= q->stage_batch || bio_sync(bio) || bio_unplug(bio))
+		batch = blk_stage_take(st, &nr);
+	spin_unlock_irqrestore(&st->lock, flags);
+
+	if (batch) {
+		blk_stage_run(q, batch, nr, 1, 0);
+		return;
+	}
+
+	/*
+	 * Make sure an unplug comes for it.  Pairs with the barriers in
+	 * blk_remove_plug() and generic_unplug_device(), which clear the
+	 * plug before they look at the stages.
+	 */
+	smp_mb();
+	if (!blk_queue_plugged(q))
+		blk_plug_device_unlocked(q);
+}
+
+/**
+ * blk_queue_stage - collect bios per cpu in front of the elevator
+ * @q:     the request queue, as set up by blk_init_queue()
+ * @batch: number of bios a cpu collects before queueing them
+ *
+ * Description:
+ *   Every bio takes q->queue_lock on its way to the elevator, which
+ *   bounds the rate at which many cpus can submit to a fast device.
+ *   With staging, each cpu collects @batch bios on a list of its own
+ *   before taking them to the elevator in one go, see blk_stage_run().
+ *   An unplug of the queue, or a sync or barrier bio, queues the bios
+ *   collected so far.  A @batch of 1 disables staging, and so can the
+ *   stage_batch queue attribute in sysfs.
+ *
+ *   Queued requests are charged to the task which takes the batch to the
+ *   elevator, so this is meant for devices running noop or deadline.
+ *   Returns -ENOMEM if the per-cpu lists can't be allocated.
+ **/
+int blk_queue_stage(struct request_queue *q, unsigned int batch)
+{
+	int cpu;
+
+	if (!q->stage) {
+		q->stage = alloc_percpu(struct blk_stage);
+		if (!q->stage)
+			return -ENOMEM;
+		for_each_possible_cpu(cpu)
+			spin_lock_init(&per_cpu_ptr(q->stage, cpu)->lock);
+	}
+	q->stage_batch = clamp_t(unsigned int, batch, 1, BLK_STAGE_MAX_BATCH);
+	return 0;
+}
+EXPORT_SYMBOL(blk_queue_stage);
+
+/**
+ * blk_start_plug - batch up the IO the current task submits
+ * @plug: the &struct blk_plug to use, usually on the stack
+ *
+ * Description:
+ *   Until blk_finish_plug(), the bios the task submits are made into
+ *   requests, merged with each other without any lock, and held on
+ *   @plug instead of being queued.  blk_finish_plug() then queues them
+ *   in sector order and runs the queue, taking each queue lock once.
+ *   Meant for code submitting a batch of IO at a time, where merging
+ *   would otherwise depend on when the unplug timer fires.
+ *
+ *   The requests held are queued early if the task is about to sleep,
+ *   it might be waiting for them, or if there are too many of them.
+ *   Plugs don't nest: an inner one is a no-op and the outer one wins.
+ **/
+void blk_start_plug(struct blk_plug *plug)
+{
+	INIT_LIST_HEAD(&plug->list);
+	plug->count = 0;
+
+	if (!current->plug)
+		current->plug = plug;
+}
+EXPORT_SYMBOL(blk_start_plug);
+
+/**
+ * blk_finish_plug - queue the IO batched up since blk_start_plug()
+ * @plug: the &struct blk_plug passed to blk_start_plug()
+ **/
+void blk_finish_plug(struct blk_plug *plug)
+{
+	blk_flush_plug_list(plug, 0);
+
+	if (current->plug == plug)
+		current->plug = NULL;
+}
+EXPORT_SYMBOL(blk_finish_plug);
+
+/*
+ * Done adding the requests of a plug to @q, queue lock held.
+ */
+static void blk_plug_queue_done(struct request_queue *q, int from_schedule)
+{
+	if (!from_schedule) {
+		__generic_unplug_device(q);
+		return;
+	}
+
+	/*
+	 * schedule() can be reached at any stack depth, and the driver
+	 * may need more than is left: leave the unplug to kblockd.
+	 */
+	blk_plug_device(q);
+	kblockd_schedule_work(q, &q->unplug_work);
+}
+
+/**
+ * blk_flush_plug_list - queue the requests held by a plug
+ * @plug: the &struct blk_plug
+ * @from_schedule: called on the way to schedule()
+ *
+ * Description:
+ *   The requests are kept by queue and by sector, so this takes each
+ *   queue lock once, and unplugs each queue after its last request.
+ *   Doesn't sleep.  From schedule(), only adds the requests to the
+ *   elevators, without the unplug threshold running the queue, and
+ *   lets kblockd unplug the queues.
+ **/
+void blk_flush_plug_list(struct blk_plug *plug, int from_schedule)
+{
+	struct request_queue *q = NULL;
+	unsigned long flags;
+
+	if (list_empty(&plug->list))
+		return;
+
+	local_irq_save(flags);
+	while (!list_empty(&plug->list)) {
+		struct request *req = list_entry_rq(plug->list.next);
+
+		list_del_init(&req->queuelist);
+		if (req->q != q) {
+			if (q) {
+				blk_plug_queue_done(q, from_schedule);
+				spin_unlock(q->queue_lock);
+			}
+			q = req->q;
+			spin_lock(q->queue_lock);
+			trace_block_unplug_io(q);
+		}
+		if (from_schedule) {
+			drive_stat_acct(req, 1);
+			__elv_add_request(q, req,
+					  ELEVATOR_INSERT_SORT_NOKICK, 0);
+			continue;
+		}
+		if (!blk_queue_nonrot(q) && elv_queue_empty(q))
+			blk_plug_device(q);
+		add_request(q, req);
+	}
+	blk_plug_queue_done(q, from_schedule);
+	spin_unlock(q->queue_lock);
+	local_irq_restore(flags);
+
+	plug->count = 0;
+}
+EXPORT_SYMBOL(blk_flush_plug_list);
+
+/*
+ * Keep @req with the other requests of its queue, in sector order.
+ */
+static void blk_plug_add(struct blk_plug *plug, struct request *req)
+{
+	struct list_head *pos;
+
+	list_for_each_prev(pos, &plug->list) {
+		struct request *prev = list_entry_rq(pos);
+
+		if (prev->q == req->q ? prev->sector <= req->sector :
+		    prev->q < req->q)
+			break;
+	}
+	list_add(&req->queuelist, pos);
+	plug->count++;
+}
+
+/*
+ * Try to merge @bio into one of the requests @plug holds for @q.  They
+ * are the task's own until the plug is flushed, so no lock is needed,
+ * and the io scheduler, which hasn't seen them yet, isn't asked.
+ */
+static int blk_plug_merge(struct blk_plug *plug, struct request_queue *q,
+			  struct bio *bio)
+{
+	struct request *req;
+
+	if (blk_queue_nomerges(q))
+		return 0;
+
+	list_for_each_entry_reverse(req, &plug->list, queuelist) {
+		if (req->q != q || !blk_rq_merge_ok(req, bio))
+			continue;
+
+		if (req->sector + req->nr_sectors == bio->bi_sector) {
+			if (bio_attempt_back_merge(q, req, bio))
+				return 1;
+		} else if (req->sector - bio_sectors(bio) == bio->bi_sector) {
+			if (bio_attempt_front_merge(q, req, bio))
+				return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Make @bio into a request held by @plug, unless it merges.
+ */
+static void blk_plug_bio(struct blk_plug *plug, struct request_queue *q,
+			 struct bio *bio)
+{
+	struct request *req;
+
+	if (blk_plug_merge(plug, q, bio))
+		return;
+
+	if (plug->count >= BLK_MAX_PLUG_REQUESTS)
+		blk_flush_plug_list(plug, 0);
+
+	spin_lock_irq(q->queue_lock);
+	if (__make_request_merge(q, bio)) {
+		spin_unlock_irq(q->queue_lock);
+		return;
+	}
+	req = __make_request_getrq(q, bio, 1);
+	blk_plug_add(plug, req);
+}
+
+static int __make_request(struct request_queue *q, struct bio *bio)
+{
+	const int unplug = bio_unplug(bio);
+
+	/*
+	 * low level driver can indicate that it wants pages above a
+	 * certain limit bounced to low memory (ie for highmem, or even
+	 * ISA dma in theory)
+	 */
+	blk_queue_bounce(q, &bio);
+
+	if (unlikely(bio_barrier(bio))) {
+		/* nothing held back before a barrier may pass it */
+		blk_flush_plug(current);
+		if (q->stage)
+			blk_stage_flush(q, 1, 0);
+	} else if (current->plug) {
+		blk_plug_bio(current->plug, q, bio);
+		return 0;
+	} else if (q->stage && q->stage_batch > 1) {
+		blk_stage_bio(q, bio);
+		return 0;
+	}
+
+	spin_lock_irq(q->queue_lock);
+	__make_request_locked(q, bio, 1);
 	if (unplug || blk_queue_nonrot(q))
 		__generic_unplug_device(q);
 	spin_unlock_irq(q->queue_lock);
@@ -172,6 +172,28 @@ static ssize_t queue_nomerges_store(struct request_queue *q, const char *page,
 	return ret;
 }
 
+static ssize_t queue_stage_batch_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(q->stage_batch, page);
+}
+
+static ssize_t
+queue_stage_batch_store(struct request_queue *q, const char *page, size_t count)
+{
+	unsigned long batch;
+	ssize_t ret;
+
+	/* only drivers which can take it set up the per-cpu stages */
+	if (!q->stage)
+		return -EINVAL;
+
+	ret = queue_var_store(&batch, page, count);
+	if (!batch || batch > BLK_STAGE_MAX_BATCH)
+		return -EINVAL;
+	q->stage_batch = batch;
+	return ret;
+}
+
 static ssize_t queue_rq_affinity_show(struct request_queue *q, char *page)
 {
 	unsigned int set = test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags);
@@ -264,6 +286,12 @@ static struct queue_sysfs_entry queue_nomerges_entry = {
 	.store = queue_nomerges_store,
 };
 
+static struct queue_sysfs_entry queue_stage_batch_entry = {
+	.attr = {.name = "stage_batch", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_stage_batch_show,
+	.store = queue_stage_batch_store,
+};
+
 static struct queue_sysfs_entry queue_rq_affinity_entry = {
 	.attr = {.name = "rq_affinity", .mode = S_IRUGO | S_IWUSR },
 	.show = queue_rq_affinity_show,
@@ -285,6 +313,7 @@ static struct attribute *default_attrs[] = {
 	&queue_hw_sector_size_entry.attr,
 	&queue_nonrot_entry.attr,
 	&queue_nomerges_entry.attr,
+	&queue_stage_batch_entry.attr,
 	&queue_rq_affinity_entry.attr,
 	&queue_iostats_entry.attr,
 	NULL,
@@ -363,6 +392,9 @@ static void blk_release_queue(struct kobject *kobj)
 	if (q->queue_tags)
 		__blk_queue_free_tags(q);
 
+	if (q->stage)
+		free_percpu(q->stage);
+
 	blk_trace_shutdown(q);
 
 	bdi_destroy(&q->backing_dev_info);
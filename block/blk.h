@@ -62,6 +62,7 @@ int ll_back_merge_fn(struct request_queue *q, struct request *req,
 int ll_front_merge_fn(struct request_queue *q, struct request *req, 
 		      struct bio *bio);
 int attempt_back_merge(struct request_queue *q, struct request *rq);
+int blk_rq_merge_ok(struct request *rq, struct bio *bio);
 int attempt_front_merge(struct request_queue *q, struct request *rq);
 void blk_recalc_rq_segments(struct request *rq);
 void blk_recalc_rq_sectors(struct request *rq, int nsect);
@@ -27,6 +27,8 @@ static const int cfq_slice_sync = HZ / 10;
 static int cfq_slice_async = HZ / 25;
 static const int cfq_slice_async_rq = 2;
 static int cfq_slice_idle = HZ / 125;
+/* low latency mode: serve all busy queues within this, see cfq_scaled_slice */
+static const int cfq_target_latency = HZ * 3 / 10;
 
 /*
  * offset from end of service tree
@@ -129,6 +131,21 @@ struct cfq_data {
 	unsigned int cfq_slice[2];
 	unsigned int cfq_slice_async_rq;
 	unsigned int cfq_slice_idle;
+	unsigned int cfq_latency;
+	unsigned int cfq_target_latency;
+
+	/*
+	 * sum of the slices of the busy queues, for low latency mode
+	 */
+	unsigned int busy_slice;
+
+	/*
+	 * how long busy queues waited for service, see cfq_account_wait()
+	 */
+	unsigned long wait_count;
+	u64 wait_total;
+	unsigned long wait_max;
+	unsigned long wait_over_target;
 
 	struct list_head cic_list;
 };
@@ -158,8 +175,13 @@ struct cfq_queue {
 	/* fifo list of requests in sort_list */
 	struct list_head fifo;
 
+	unsigned long slice_start;
 	unsigned long slice_end;
 	long slice_resid;
+	/* slice accounted in cfqd->busy_slice */
+	unsigned int busy_slice;
+	/* when the queue started waiting for service */
+	unsigned long wait_start;
 
 	/* pending metadata requests */
 	int meta_pending;
@@ -289,10 +311,30 @@ cfq_prio_to_slice(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 	return cfq_prio_slice(cfqd, cfq_cfqq_sync(cfqq), cfqq->ioprio);
 }
 
+/*
+ * In low latency mode, slices are shortened in proportion so that a round
+ * of service of all the busy queues fits in the target latency.  But not
+ * below two idle windows, or idling would eat most of the slice.
+ */
+static unsigned int
+cfq_scaled_slice(struct cfq_data *cfqd, struct cfq_queue *cfqq)
+{
+	unsigned int slice = cfq_prio_to_slice(cfqd, cfqq);
+	unsigned int low_slice;
+
+	if (!cfqd->cfq_latency || cfqd->busy_slice <= cfqd->cfq_target_latency)
+		return slice;
+
+	low_slice = min(slice, 2 * cfqd->cfq_slice_idle);
+	return max(slice * cfqd->cfq_target_latency / cfqd->busy_slice,
+		   low_slice);
+}
+
 static inline void
 cfq_set_prio_slice(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 {
-	cfqq->slice_end = cfq_prio_to_slice(cfqd, cfqq) + jiffies;
+	cfqq->slice_start = jiffies;
+	cfqq->slice_end = cfq_scaled_slice(cfqd, cfqq) + jiffies;
 	cfq_log_cfqq(cfqd, cfqq, "set_slice=%lu", cfqq->slice_end - jiffies);
 }
 
@@ -569,6 +611,11 @@ static void cfq_add_cfqq_rr(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 	cfqd->busy_queues++;
 	if (cfq_class_rt(cfqq))
 		cfqd->busy_rt_queues++;
+	if (!cfq_class_idle(cfqq)) {
+		cfqq->busy_slice = cfq_prio_to_slice(cfqd, cfqq);
+		cfqd->busy_slice += cfqq->busy_slice;
+	}
+	cfqq->wait_start = jiffies;
 
 	cfq_resort_rr_list(cfqd, cfqq);
 }
@@ -590,6 +637,8 @@ static void cfq_del_cfqq_rr(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 	cfqd->busy_queues--;
 	if (cfq_class_rt(cfqq))
 		cfqd->busy_rt_queues--;
+	cfqd->busy_slice -= cfqq->busy_slice;
+	cfqq->busy_slice = 0;
 }
 
 /*
@@ -768,11 +817,33 @@ static int cfq_allow_merge(struct request_queue *q, struct request *rq,
 	return 0;
 }
 
+/*
+ * A busy queue is getting service: account for how long it waited since
+ * it turned busy or its previous slice ended.  Idle class queues are
+ * expected to wait and are left out.
+ */
+static void cfq_account_wait(struct cfq_data *cfqd, struct cfq_queue *cfqq)
+{
+	unsigned long wait = jiffies - cfqq->wait_start;
+
+	if (!cfq_cfqq_on_rr(cfqq) || cfq_class_idle(cfqq))
+		return;
+
+	cfqd->wait_count++;
+	cfqd->wait_total += wait;
+	if (wait > cfqd->wait_max)
+		cfqd->wait_max = wait;
+	if (wait > cfqd->cfq_target_latency)
+		cfqd->wait_over_target++;
+	cfq_log_cfqq(cfqd, cfqq, "waited=%lu", wait);
+}
+
 static void __cfq_set_active_queue(struct cfq_data *cfqd,
 				   struct cfq_queue *cfqq)
 {
 	if (cfqq) {
 		cfq_log_cfqq(cfqd, cfqq, "set_active");
+		cfq_account_wait(cfqd, cfqq);
 		cfqq->slice_end = 0;
 		cfq_clear_cfqq_must_alloc_slice(cfqq);
 		cfq_clear_cfqq_fifo_expire(cfqq);
@@ -807,6 +878,7 @@ __cfq_slice_expired(struct cfq_data *cfqd, struct cfq_queue *cfqq,
 	}
 
 	cfq_resort_rr_list(cfqd, cfqq);
+	cfqq->wait_start = jiffies;
 
 	if (cfqq == cfqd->active_queue)
 		cfqd->active_queue = NULL;
@@ -936,6 +1008,17 @@ static void cfq_arm_slice_timer(struct cfq_data *cfqd)
 	if (sample_valid(cic->seek_samples) && CIC_SEEKY(cic))
 		sl = min(sl, msecs_to_jiffies(CFQ_MIN_TT));
 
+	/*
+	 * in low latency mode, don't idle past the end of the slice while
+	 * other queues wait
+	 */
+	if (cfqd->cfq_latency && cfqd->busy_queues &&
+	    time_after(jiffies + sl, cfqq->slice_end)) {
+		cfq_clear_cfqq_must_dispatch(cfqq);
+		cfq_clear_cfqq_wait_request(cfqq);
+		return;
+	}
+
 	mod_timer(&cfqd->idle_slice_timer, jiffies + sl);
 	cfq_log(cfqd, "arm_idle: %lu", sl);
 }
@@ -1013,6 +1096,23 @@ static struct cfq_queue *cfq_select_queue(struct cfq_data *cfqd)
 	if (cfq_slice_used(cfqq))
 		goto expire;
 
+	/*
+	 * In low latency mode, queues which turned busy during the slice
+	 * shorten it, so that they are served within the target latency.
+	 */
+	if (cfqd->cfq_latency && !cfq_cfqq_slice_new(cfqq)) {
+		unsigned long end = cfqq->slice_start +
+				    cfq_scaled_slice(cfqd, cfqq);
+
+		if (time_before(end, cfqq->slice_end)) {
+			cfq_log_cfqq(cfqd, cfqq, "shrink_slice=%lu",
+				     cfqq->slice_end - end);
+			cfqq->slice_end = end;
+			if (cfq_slice_used(cfqq))
+				goto expire;
+		}
+	}
+
 	/*
 	 * If we have a RT cfqq waiting, then we pre-empt the current non-rt
 	 * cfqq.
@@ -2277,6 +2377,7 @@ static void *cfq_init_queue(struct request_queue *q)
 	cfqd->cfq_slice[1] = cfq_slice_sync;
 	cfqd->cfq_slice_async_rq = cfq_slice_async_rq;
 	cfqd->cfq_slice_idle = cfq_slice_idle;
+	cfqd->cfq_target_latency = cfq_target_latency;
 	cfqd->hw_tag = 1;
 
 	return cfqd;
@@ -2346,6 +2447,8 @@ SHOW_FUNCTION(cfq_slice_idle_show, cfqd->cfq_slice_idle, 1);
 SHOW_FUNCTION(cfq_slice_sync_show, cfqd->cfq_slice[1], 1);
 SHOW_FUNCTION(cfq_slice_async_show, cfqd->cfq_slice[0], 1);
 SHOW_FUNCTION(cfq_slice_async_rq_show, cfqd->cfq_slice_async_rq, 0);
+SHOW_FUNCTION(cfq_low_latency_show, cfqd->cfq_latency, 0);
+SHOW_FUNCTION(cfq_target_latency_show, cfqd->cfq_target_latency, 1);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -2377,8 +2480,44 @@ STORE_FUNCTION(cfq_slice_sync_store, &cfqd->cfq_slice[1], 1, UINT_MAX, 1);
 STORE_FUNCTION(cfq_slice_async_store, &cfqd->cfq_slice[0], 1, UINT_MAX, 1);
 STORE_FUNCTION(cfq_slice_async_rq_store, &cfqd->cfq_slice_async_rq, 1,
 		UINT_MAX, 0);
+STORE_FUNCTION(cfq_low_latency_store, &cfqd->cfq_latency, 0, 1, 0);
+STORE_FUNCTION(cfq_target_latency_store, &cfqd->cfq_target_latency, 1,
+		UINT_MAX, 1);
 #undef STORE_FUNCTION
 
+/*
+ * Number of times busy queues got service, their average and longest
+ * wait for it in ms, and how many of the waits exceeded target_latency.
+ * Writing anything resets them.
+ */
+static ssize_t cfq_wait_stats_show(struct elevator_queue *e, char *page)
+{
+	struct cfq_data *cfqd = e->elevator_data;
+	u64 avg = 0;
+
+	if (cfqd->wait_count) {
+		avg = cfqd->wait_total;
+		do_div(avg, cfqd->wait_count);
+	}
+	return sprintf(page, "%lu %u %u %lu\n", cfqd->wait_count,
+		       jiffies_to_msecs(avg), jiffies_to_msecs(cfqd->wait_max),
+		       cfqd->wait_over_target);
+}
+
+static ssize_t
+cfq_wait_stats_store(struct elevator_queue *e, const char *page, size_t count)
+{
+	struct cfq_data *cfqd = e->elevator_data;
+
+	spin_lock_irq(cfqd->queue->queue_lock);
+	cfqd->wait_count = 0;
+	cfqd->wait_total = 0;
+	cfqd->wait_max = 0;
+	cfqd->wait_over_target = 0;
+	spin_unlock_irq(cfqd->queue->queue_lock);
+	return count;
+}
+
 #define CFQ_ATTR(name) \
 	__ATTR(name, S_IRUGO|S_IWUSR, cfq_##name##_show, cfq_##name##_store)
 
@@ -2392,6 +2531,9 @@ static struct elv_fs_entry cfq_attrs[] = {
 	CFQ_ATTR(slice_async),
 	CFQ_ATTR(slice_async_rq),
 	CFQ_ATTR(slice_idle),
+	CFQ_ATTR(low_latency),
+	CFQ_ATTR(target_latency),
+	CFQ_ATTR(wait_stats),
 	__ATTR_NULL
 };
 
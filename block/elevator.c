@@ -74,9 +74,10 @@ static int elv_iosched_allow_merge(struct request *rq, struct bio *bio)
 }
 
 /*
- * can we safely merge with this request?
+ * can we safely merge with this request, as far as the request itself
+ * goes? doesn't ask the io scheduler, so it needs no queue lock.
  */
-int elv_rq_merge_ok(struct request *rq, struct bio *bio)
+int blk_rq_merge_ok(struct request *rq, struct bio *bio)
 {
 	if (!rq_mergeable(rq))
 		return 0;
@@ -105,6 +106,17 @@ int elv_rq_merge_ok(struct request *rq, struct bio *bio)
 	if (bio_integrity(bio) != blk_integrity_rq(rq))
 		return 0;
 
+	return 1;
+}
+
+/*
+ * can we safely merge with this request?
+ */
+int elv_rq_merge_ok(struct request *rq, struct bio *bio)
+{
+	if (!blk_rq_merge_ok(rq, bio))
+		return 0;
+
 	if (!elv_iosched_allow_merge(rq, bio))
 		return 0;
 
@@ -622,6 +634,21 @@ void elv_insert(struct request_queue *q, struct request *rq, int where)
 		blk_start_queueing(q);
 		break;
 
+	case ELEVATOR_INSERT_SORT_NOKICK:
+		/*
+		 * As ELEVATOR_INSERT_SORT, or at the back if it can't be
+		 * sorted, but the queue is never run from here: the caller
+		 * may be short of stack and leaves that to kblockd.
+		 */
+		unplug_it = 0;
+		if ((rq->cmd_flags & (REQ_SOFTBARRIER | REQ_HARDBARRIER)) ||
+		    !(rq->cmd_flags & REQ_ELVPRIV)) {
+			rq->cmd_flags |= REQ_SOFTBARRIER;
+			elv_drain_elevator(q);
+			list_add_tail(&rq->queuelist, &q->queue_head);
+			break;
+		}
+		/* fall through */
 	case ELEVATOR_INSERT_SORT:
 		BUG_ON(!blk_fs_request(rq) && !blk_discard_rq(rq));
 		rq->cmd_flags |= REQ_SORTED;
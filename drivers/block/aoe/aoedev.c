@@ -105,6 +105,7 @@ aoedev_freedev(struct aoedev *d)
 		aoedisk_rm_sysfs(d);
 		del_gendisk(d->gd);
 		put_disk(d->gd);
+		bdi_destroy(&d->blkq.backing_dev_info);
 	}
 	t = d->targets;
 	e = t + NTARGETS;
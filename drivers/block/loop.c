@@ -43,6 +43,9 @@
  * operations write_begin is not available on the backing filesystem.
  * Anton Altaparmakov, 16 Feb 2005
  *
+ * LO_FLAGS_DIRECT_IO remaps bios straight to the blocks of the backing file,
+ * bypassing its page cache and the loop thread.
+ *
  * Still To Fix:
  * - Advisory locking is ignored here.
  * - Should use an own CAP_* category instead of CAP_SYS_ADMIN
@@ -75,6 +78,8 @@
 #include <linux/gfp.h>
 #include <linux/kthread.h>
 #include <linux/splice.h>
+#include <linux/mempool.h>
+#include <linux/vmalloc.h>
 
 #include <asm/uaccess.h>
 
@@ -510,6 +515,353 @@ static struct bio *loop_get_bio(struct loop_device *lo)
 	return bio;
 }
 
+/*
+ * Direct I/O: the blocks of the backing file are mapped once and for all
+ * with bmap() when LO_FLAGS_DIRECT_IO is set, and the bios are remapped
+ * to them and submitted to the underlying device from make_request, as
+ * many at a time as the submitters send.  The page cache of the file is
+ * bypassed, so the data is not cached twice.  The file must not be
+ * truncated or moved while the flag is set, like a swap file.
+ */
+struct loop_dio {
+	struct loop_device	*lo;
+	struct bio		*bio;		/* the loop device bio */
+	atomic_t		remaining;	/* clones in flight, plus one */
+	int			error;
+};
+
+#define LOOP_DIO_POOL_SIZE	16
+static mempool_t *loop_dio_pool;
+
+static struct loop_extent *loop_find_extent(struct loop_device *lo,
+					    sector_t sector)
+{
+	unsigned int first = 0, last = lo->lo_nr_extents;
+
+	while (first < last) {
+		unsigned int mid = (first + last) / 2;
+		struct loop_extent *ext = &lo->lo_extents[mid];
+
+		if (sector < ext->lo_sector)
+			last = mid;
+		else if (sector >= ext->lo_sector + ext->nr_sects)
+			first = mid + 1;
+		else
+			return ext;
+	}
+	return NULL;
+}
+
+/*
+ * Trims a clone to the @len bytes which are @skip bytes into it.
+ * The clone has its own copy of the bio_vecs.
+ */
+static void loop_trim_bio(struct bio *bio, unsigned int skip,
+			  unsigned int len)
+{
+	unsigned int idx = bio->bi_idx;
+	struct bio_vec *bvec;
+
+	while (skip) {
+		bvec = bio_iovec_idx(bio, idx);
+		if (skip < bvec->bv_len) {
+			bvec->bv_offset += skip;
+			bvec->bv_len -= skip;
+			break;
+		}
+		skip -= bvec->bv_len;
+		idx++;
+	}
+	bio->bi_idx = idx;
+	bio->bi_size = len;
+
+	for (;; idx++) {
+		bvec = bio_iovec_idx(bio, idx);
+		if (len <= bvec->bv_len) {
+			bvec->bv_len = len;
+			break;
+		}
+		len -= bvec->bv_len;
+	}
+	bio->bi_vcnt = idx + 1;
+	bio->bi_flags &= ~(1 << BIO_SEG_VALID);
+}
+
+static void loop_dio_put(struct loop_dio *dio)
+{
+	struct loop_device *lo = dio->lo;
+
+	if (!atomic_dec_and_test(&dio->remaining))
+		return;
+
+	bio_endio(dio->bio, dio->error);
+	mempool_free(dio, loop_dio_pool);
+	if (atomic_dec_and_test(&lo->lo_direct_pending))
+		wake_up(&lo->lo_direct_wait);
+}
+
+static void loop_dio_end_io(struct bio *clone, int error)
+{
+	struct loop_dio *dio = clone->bi_private;
+
+	if (error)
+		dio->error = error;
+	bio_put(clone);
+	loop_dio_put(dio);
+}
+
+static void loop_dio_submit(struct loop_device *lo, struct loop_dio *dio,
+			    struct bio *clone)
+{
+	clone->bi_bdev = lo->lo_direct_bdev;
+	clone->bi_end_io = loop_dio_end_io;
+	clone->bi_private = dio;
+
+	atomic_inc(&dio->remaining);
+	generic_make_request(clone);
+}
+
+/*
+ * Submits a clone of @bio for each extent it covers, or for the whole
+ * underlying device if it is an empty barrier.  Called with
+ * lo_direct_pending raised.
+ */
+static void loop_direct_bio(struct loop_device *lo, struct bio *bio)
+{
+	sector_t sector = bio->bi_sector;
+	struct loop_extent *ext;
+	struct loop_dio *dio;
+	struct bio *clone;
+	unsigned int done = 0, len;
+
+	dio = mempool_alloc(loop_dio_pool, GFP_NOIO);
+	dio->lo = lo;
+	dio->bio = bio;
+	dio->error = 0;
+	atomic_set(&dio->remaining, 1);
+
+	/* covers no extent, but has to flush the device the data went to */
+	if (bio_empty_barrier(bio)) {
+		clone = bio_clone(bio, GFP_NOIO);
+		if (clone)
+			loop_dio_submit(lo, dio, clone);
+		else
+			dio->error = -ENOMEM;
+	}
+
+	while (done < bio->bi_size) {
+		ext = loop_find_extent(lo, sector);
+		if (!ext) {
+			dio->error = -EIO;
+			break;
+		}
+		len = min_t(sector_t, ext->lo_sector + ext->nr_sects - sector,
+			    (bio->bi_size - done) >> 9) << 9;
+
+		clone = bio_clone(bio, GFP_NOIO);
+		if (!clone) {
+			dio->error = -ENOMEM;
+			break;
+		}
+		loop_trim_bio(clone, done, len);
+		clone->bi_sector = ext->disk_sector + (sector - ext->lo_sector);
+		loop_dio_submit(lo, dio, clone);
+
+		done += len;
+		sector += len >> 9;
+	}
+	loop_dio_put(dio);
+}
+
+/*
+ * Maps the blocks of @inode backing the loop device into @extents, or
+ * only counts the extents if @extents is NULL.  Returns their number.
+ */
+static int loop_map_extents(struct loop_device *lo, struct inode *inode,
+			    struct loop_extent *extents)
+{
+	unsigned int shift = inode->i_blkbits - 9;
+	sector_t first = lo->lo_offset >> 9;
+	sector_t end = first + get_capacity(lo->lo_disk);
+	sector_t block, phys, start, stop;
+	struct loop_extent cur = { 0, };
+	int nr = 0;
+
+	for (block = first >> shift; (block << shift) < end; block++) {
+		phys = bmap(inode, block);
+		if (!phys)		/* a hole */
+			return -EINVAL;
+
+		start = max(block << shift, first);
+		stop = min((block + 1) << shift, end);
+		phys = (phys << shift) + (start - (block << shift));
+
+		if (nr && cur.lo_sector + cur.nr_sects == start - first &&
+		    cur.disk_sector + cur.nr_sects == phys) {
+			cur.nr_sects += stop - start;
+		} else {
+			if (nr && extents)
+				extents[nr - 1] = cur;
+			cur.lo_sector = start - first;
+			cur.nr_sects = stop - start;
+			cur.disk_sector = phys;
+			nr++;
+		}
+
+		cond_resched();
+		if (fatal_signal_pending(current))
+			return -EINTR;
+	}
+	if (nr && extents)
+		extents[nr - 1] = cur;
+	return nr;
+}
+
+/*
+ * The backing file of a direct I/O loop device is marked S_SWAPFILE like
+ * a swapfile, whose blocks are mapped once in the same way: so that it
+ * can't be truncated, nor swapped on, while the extents are in use.
+ */
+static int loop_pin_blocks(struct inode *inode)
+{
+	int err = 0;
+
+	if (!S_ISREG(inode->i_mode))
+		return 0;
+	mutex_lock(&inode->i_mutex);
+	if (IS_SWAPFILE(inode))
+		err = -EBUSY;
+	else
+		inode->i_flags |= S_SWAPFILE;
+	mutex_unlock(&inode->i_mutex);
+	return err;
+}
+
+static void loop_unpin_blocks(struct inode *inode)
+{
+	if (!S_ISREG(inode->i_mode))
+		return;
+	mutex_lock(&inode->i_mutex);
+	inode->i_flags &= ~S_SWAPFILE;
+	mutex_unlock(&inode->i_mutex);
+}
+
+/*
+ * Give back to the queue the limits it had before loop_set_direct_io()
+ * stacked those of the backing device on it: the defaults set by
+ * blk_queue_make_request() in loop_set_fd().
+ */
+static void loop_reset_limits(struct request_queue *q)
+{
+	blk_queue_max_phys_segments(q, MAX_PHYS_SEGMENTS);
+	blk_queue_max_hw_segments(q, MAX_HW_SEGMENTS);
+	blk_queue_segment_boundary(q, BLK_SEG_BOUNDARY_MASK);
+	blk_queue_max_segment_size(q, MAX_SEGMENT_SIZE);
+	blk_queue_max_sectors(q, SAFE_MAX_SECTORS);
+	blk_queue_hardsect_size(q, 512);
+	queue_flag_set_unlocked(QUEUE_FLAG_CLUSTER, q);
+}
+
+/*
+ * Sets LO_FLAGS_DIRECT_IO.  It can only be done while nobody else has
+ * the loop device open, so that no I/O is in flight through the page
+ * cache of the backing file.
+ */
+static int loop_set_direct_io(struct loop_device *lo)
+{
+	struct address_space *mapping = lo->lo_backing_file->f_mapping;
+	struct inode *inode = mapping->host;
+	struct loop_extent *extents;
+	struct block_device *bdev;
+	struct request_queue *q;
+	int nr, err;
+
+	/* this writes to the blocks of the file behind the fs' back */
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if (lo->lo_refcnt > 1)
+		return -EBUSY;
+	/* the data goes to the disk as it is */
+	if (lo->lo_encryption || (lo->lo_offset & 511))
+		return -EINVAL;
+
+	if (S_ISBLK(inode->i_mode)) {
+		bdev = inode->i_bdev;
+	} else {
+		bdev = inode->i_sb->s_bdev;
+		if (!bdev || !mapping->a_ops->bmap || inode->i_blkbits < 9)
+			return -EINVAL;
+	}
+
+	err = loop_pin_blocks(inode);
+	if (err)
+		return err;
+
+	/* allocate delayed blocks, and write back what the cache holds */
+	err = filemap_write_and_wait(mapping);
+	if (err)
+		goto out_unpin;
+
+	if (S_ISBLK(inode->i_mode))
+		nr = get_capacity(lo->lo_disk) ? 1 : 0;
+	else
+		nr = loop_map_extents(lo, inode, NULL);
+	if (nr <= 0) {
+		err = nr ? nr : -EINVAL;
+		goto out_unpin;
+	}
+
+	err = -ENOMEM;
+	extents = vmalloc(nr * sizeof(*extents));
+	if (!extents)
+		goto out_unpin;
+	if (S_ISBLK(inode->i_mode)) {
+		extents[0].lo_sector = 0;
+		extents[0].nr_sects = get_capacity(lo->lo_disk);
+		extents[0].disk_sector = lo->lo_offset >> 9;
+	} else if (loop_map_extents(lo, inode, extents) != nr) {
+		vfree(extents);
+		err = -EBUSY;
+		goto out_unpin;
+	}
+	invalidate_inode_pages2(mapping);
+
+	q = bdev_get_queue(bdev);
+	blk_queue_stack_limits(lo->lo_queue, q);
+	if (q->merge_bvec_fn)
+		blk_queue_max_sectors(lo->lo_queue, PAGE_SIZE >> 9);
+
+	spin_lock_irq(&lo->lo_lock);
+	lo->lo_direct_bdev = bdev;
+	lo->lo_extents = extents;
+	lo->lo_nr_extents = nr;
+	lo->lo_flags |= LO_FLAGS_DIRECT_IO;
+	spin_unlock_irq(&lo->lo_lock);
+	return 0;
+
+out_unpin:
+	loop_unpin_blocks(inode);
+	return err;
+}
+
+static void loop_clear_direct_io(struct loop_device *lo)
+{
+	spin_lock_irq(&lo->lo_lock);
+	lo->lo_flags &= ~LO_FLAGS_DIRECT_IO;
+	spin_unlock_irq(&lo->lo_lock);
+
+	wait_event(lo->lo_direct_wait, !atomic_read(&lo->lo_direct_pending));
+
+	vfree(lo->lo_extents);
+	lo->lo_extents = NULL;
+	lo->lo_nr_extents = 0;
+	lo->lo_direct_bdev = NULL;
+	loop_reset_limits(lo->lo_queue);
+	loop_unpin_blocks(lo->lo_backing_file->f_mapping->host);
+	/* the cached pages of the file may predate direct writes */
+	invalidate_inode_pages2(lo->lo_backing_file->f_mapping);
+}
+
 static int loop_make_request(struct request_queue *q, struct bio *old_bio)
 {
 	struct loop_device *lo = q->queuedata;
@@ -525,6 +877,13 @@ static int loop_make_request(struct request_queue *q, struct bio *old_bio)
 		goto out;
 	if (unlikely(rw == WRITE && (lo->lo_flags & LO_FLAGS_READ_ONLY)))
 		goto out;
+	/* loop_switch() bios have no bi_bdev, they go to the thread */
+	if ((lo->lo_flags & LO_FLAGS_DIRECT_IO) && old_bio->bi_bdev) {
+		atomic_inc(&lo->lo_direct_pending);
+		spin_unlock_irq(&lo->lo_lock);
+		loop_direct_bio(lo, old_bio);
+		return 0;
+	}
 	loop_add_bio(lo, old_bio);
 	wake_up(&lo->lo_event);
 	spin_unlock_irq(&lo->lo_lock);
@@ -683,6 +1042,10 @@ static int loop_change_fd(struct loop_device *lo, struct block_device *bdev,
 	if (!(lo->lo_flags & LO_FLAGS_READ_ONLY))
 		goto out;
 
+	/* and not mapped to the blocks of the old file */
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO)
+		goto out;
+
 	error = -EBADF;
 	file = fget(arg);
 	if (!file)
@@ -917,6 +1280,8 @@ static int loop_clr_fd(struct loop_device *lo, struct block_device *bdev)
 	spin_unlock_irq(&lo->lo_lock);
 
 	kthread_stop(lo->lo_thread);
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO)
+		loop_clear_direct_io(lo);
 
 	lo->lo_queue->unplug_fn = NULL;
 	lo->lo_backing_file = NULL;
@@ -965,6 +1330,14 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 	if ((unsigned int) info->lo_encrypt_key_size > LO_KEY_SIZE)
 		return -EINVAL;
 
+	/* the extents depend on the offset and size, and don't encrypt */
+	if ((lo->lo_flags & LO_FLAGS_DIRECT_IO) &&
+	    (!(info->lo_flags & LO_FLAGS_DIRECT_IO) ||
+	     info->lo_encrypt_type ||
+	     lo->lo_offset != info->lo_offset ||
+	     lo->lo_sizelimit != info->lo_sizelimit))
+		loop_clear_direct_io(lo);
+
 	err = loop_release_xfer(lo);
 	if (err)
 		return err;
@@ -1015,6 +1388,10 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 		lo->lo_key_owner = uid;
 	}	
 
+	if ((info->lo_flags & LO_FLAGS_DIRECT_IO) &&
+	    !(lo->lo_flags & LO_FLAGS_DIRECT_IO))
+		return loop_set_direct_io(lo);
+
 	return 0;
 }
 
@@ -1465,6 +1842,7 @@ static struct loop_device *loop_alloc(int i)
 	lo->lo_number		= i;
 	lo->lo_thread		= NULL;
 	init_waitqueue_head(&lo->lo_event);
+	init_waitqueue_head(&lo->lo_direct_wait);
 	spin_lock_init(&lo->lo_lock);
 	disk->major		= LOOP_MAJOR;
 	disk->first_minor	= i << part_shift;
@@ -1563,8 +1941,15 @@ static int __init loop_init(void)
 		range = 1UL << (MINORBITS - part_shift);
 	}
 
-	if (register_blkdev(LOOP_MAJOR, "loop"))
+	loop_dio_pool = mempool_create_kmalloc_pool(LOOP_DIO_POOL_SIZE,
+						    sizeof(struct loop_dio));
+	if (!loop_dio_pool)
+		return -ENOMEM;
+
+	if (register_blkdev(LOOP_MAJOR, "loop")) {
+		mempool_destroy(loop_dio_pool);
 		return -EIO;
+	}
 
 	for (i = 0; i < nr; i++) {
 		lo = loop_alloc(i);
@@ -1591,6 +1976,7 @@ Enomem:
 		loop_free(lo);
 
 	unregister_blkdev(LOOP_MAJOR, "loop");
+	mempool_destroy(loop_dio_pool);
 	return -ENOMEM;
 }
 
@@ -1606,6 +1992,7 @@ static void __exit loop_exit(void)
 
 	blk_unregister_region(MKDEV(LOOP_MAJOR, 0), range);
 	unregister_blkdev(LOOP_MAJOR, "loop");
+	mempool_destroy(loop_dio_pool);
 }
 
 module_init(loop_init);
@@ -251,6 +251,15 @@ static int virtblk_probe(struct virtio_device *vdev)
 
 	queue_flag_set_unlocked(QUEUE_FLAG_VIRT, vblk->disk->queue);
 
+	/*
+	 * Guests submit from all their vcpus: allow batching up bios per
+	 * cpu, off by default as it doesn't suit cfq.  See stage_batch in
+	 * Documentation/block/queue-sysfs.txt.
+	 */
+	err = blk_queue_stage(vblk->disk->queue, 1);
+	if (err)
+		goto out_cleanup_queue;
+
 	if (index < 26) {
 		sprintf(vblk->disk->disk_name, "vd%c", 'a' + index % 26);
 	} else if (index < (26 + 1) * 26) {
@@ -318,6 +327,8 @@ static int virtblk_probe(struct virtio_device *vdev)
 	add_disk(vblk->disk);
 	return 0;
 
+out_cleanup_queue:
+	blk_cleanup_queue(vblk->disk->queue);
 out_put_disk:
 	put_disk(vblk->disk);
 out_mempool:
@@ -0,0 +1,593 @@
+/*
+ * Compressed RAM block device, meant to be used as swap.
+ *
+ * Each page written to the device is compressed with LZO and kept in
+ * kernel memory.  The device is addressed in whole pages only: a table
+ * indexed by page number holds the handle of every stored page, which
+ * is either kmalloc'd compressed data, or a whole (possibly highmem)
+ * page for data which doesn't compress well.  Pages which are all
+ * zeroes aren't stored at all.
+ *
+ * Memory is given back when a page is overwritten, when its sectors
+ * are discarded, and when the swap code frees the slot, through
+ * ->swap_slot_free_notify().
+ *
+ * Parts derived from drivers/block/brd.c.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/genhd.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/swap.h>
+#include <linux/lzo.h>
+#include <linux/math64.h>
+
+#define SECTOR_SHIFT		9
+#define PAGE_SECTORS_SHIFT	(PAGE_SHIFT - SECTOR_SHIFT)
+#define PAGE_SECTORS		(1 << PAGE_SECTORS_SHIFT)
+
+/* Pages compressing to more than this are stored uncompressed */
+#define ZRAM_MAX_COMPR_SIZE	(PAGE_SIZE / 4 * 3)
+
+/* Flags of a table entry */
+#define ZRAM_ZERO		0x01	/* all zeroes, nothing stored */
+#define ZRAM_UNCOMPRESSED	0x02	/* ->handle is a struct page */
+
+struct zram_table {
+	void		*handle;	/* compressed data, or a page */
+	u16		size;		/* of the data at ->handle */
+	u8		flags;
+};
+
+struct zram_stats {
+	u64		num_reads;
+	u64		num_writes;
+	u64		failed_reads;
+	u64		failed_writes;
+	u64		invalid_io;	/* unaligned or out of range */
+	u64		notify_free;	/* slots freed by the swap code */
+	u64		discard;	/* pages discarded */
+	u64		zero_pages;	/* pages which are all zeroes */
+	u64		pages_stored;	/* other pages in the device */
+	u64		pages_expand;	/* of them, stored uncompressed */
+	u64		compr_data_size;
+	u64		mem_used_total;	/* including the slab rounding */
+};
+
+struct zram {
+	int			number;
+	struct request_queue	*queue;
+	struct gendisk		*disk;
+
+	/*
+	 * One entry per page of the device.  The table and the stats are
+	 * protected by ->lock, which ->swap_slot_free_notify() takes under
+	 * swap_lock, so nothing may sleep under it.
+	 */
+	spinlock_t		lock;
+	struct zram_table	*table;
+	unsigned long		nr_pages;
+	struct zram_stats	stats;
+
+	/* the compressor state, protected by ->compress_lock */
+	struct mutex		compress_lock;
+	void			*compress_workmem;
+	void			*compress_buffer;
+};
+
+static int zram_major;
+static struct zram *zram_devices;
+
+static unsigned int num_devices = 1;
+static unsigned long disksize_kb;
+module_param(num_devices, uint, 0);
+MODULE_PARM_DESC(num_devices, "Number of zram devices");
+module_param(disksize_kb, ulong, 0);
+MODULE_PARM_DESC(disksize_kb,
+		 "Size of each device in kbytes (default: 25% of RAM)");
+MODULE_LICENSE("GPL");
+
+/* Releases what the entry at @index holds. Called with ->lock held. */
+static void zram_free_page(struct zram *zram, unsigned long index)
+{
+	struct zram_table *t = &zram->table[index];
+
+	if (t->flags & ZRAM_ZERO) {
+		t->flags = 0;
+		zram->stats.zero_pages--;
+		return;
+	}
+	if (!t->handle)
+		return;
+
+	if (t->flags & ZRAM_UNCOMPRESSED) {
+		__free_page(t->handle);
+		zram->stats.mem_used_total -= PAGE_SIZE;
+		zram->stats.pages_expand--;
+	} else {
+		zram->stats.mem_used_total -= ksize(t->handle);
+		kfree(t->handle);
+	}
+	zram->stats.compr_data_size -= t->size;
+	zram->stats.pages_stored--;
+
+	t->handle = NULL;
+	t->size = 0;
+	t->flags = 0;
+}
+
+static int zram_page_zero_filled(const void *ptr)
+{
+	const unsigned long *page = ptr;
+	unsigned int pos;
+
+	for (pos = 0; pos < PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos])
+			return 0;
+	}
+	return 1;
+}
+
+static int zram_read(struct zram *zram, struct page *page,
+		     unsigned long index)
+{
+	struct zram_table *t = &zram->table[index];
+	size_t clen = PAGE_SIZE;
+	void *dst, *src;
+	int ret = LZO_E_OK;
+
+	spin_lock(&zram->lock);
+	dst = kmap_atomic(page, KM_USER0);
+	if (!t->handle)
+		memset(dst, 0, PAGE_SIZE);	/* zero or never written */
+	else if (t->flags & ZRAM_UNCOMPRESSED) {
+		src = kmap_atomic(t->handle, KM_USER1);
+		copy_page(dst, src);
+		kunmap_atomic(src, KM_USER1);
+	} else {
+		ret = lzo1x_decompress_safe(t->handle, t->size, dst, &clen);
+		if (ret == LZO_E_OK && clen != PAGE_SIZE)
+			ret = LZO_E_ERROR;
+	}
+	kunmap_atomic(dst, KM_USER0);
+
+	zram->stats.num_reads++;
+	if (ret != LZO_E_OK)
+		zram->stats.failed_reads++;
+	spin_unlock(&zram->lock);
+
+	if (ret != LZO_E_OK) {
+		printk(KERN_ERR "zram%d: decompression of page %lu failed: "
+		       "%d\n", zram->number, index, ret);
+		return -EIO;
+	}
+	flush_dcache_page(page);
+	return 0;
+}
+
+/*
+ * Compresses a page into ->compress_buffer, then copies the result to
+ * its own allocation.  GFP_NOIO: we are on the swap-out path.
+ */
+static int zram_write(struct zram *zram, struct page *page,
+		      unsigned long index)
+{
+	struct zram_table *t = &zram->table[index];
+	struct page *store_page;
+	size_t clen;
+	void *src, *dst, *handle;
+	size_t mem;
+	u8 flags = 0;
+	int ret;
+
+	mutex_lock(&zram->compress_lock);
+	src = kmap_atomic(page, KM_USER0);
+	if (zram_page_zero_filled(src)) {
+		kunmap_atomic(src, KM_USER0);
+		spin_lock(&zram->lock);
+		zram_free_page(zram, index);
+		t->flags = ZRAM_ZERO;
+		zram->stats.zero_pages++;
+		zram->stats.num_writes++;
+		spin_unlock(&zram->lock);
+		mutex_unlock(&zram->compress_lock);
+		return 0;
+	}
+	ret = lzo1x_1_compress(src, PAGE_SIZE, zram->compress_buffer, &clen,
+			       zram->compress_workmem);
+	kunmap_atomic(src, KM_USER0);
+	if (ret != LZO_E_OK) {
+		printk(KERN_ERR "zram%d: compression of page %lu failed: "
+		       "%d\n", zram->number, index, ret);
+		goto out_fail;
+	}
+
+	if (clen > ZRAM_MAX_COMPR_SIZE) {
+		store_page = alloc_page(GFP_NOIO | __GFP_HIGHMEM |
+					__GFP_NOWARN);
+		if (!store_page)
+			goto out_fail;
+		src = kmap_atomic(page, KM_USER0);
+		dst = kmap_atomic(store_page, KM_USER1);
+		copy_page(dst, src);
+		kunmap_atomic(dst, KM_USER1);
+		kunmap_atomic(src, KM_USER0);
+		handle = store_page;
+		clen = PAGE_SIZE;
+		mem = PAGE_SIZE;
+		flags = ZRAM_UNCOMPRESSED;
+	} else {
+		handle = kmalloc(clen, GFP_NOIO | __GFP_NOWARN);
+		if (!handle)
+			goto out_fail;
+		memcpy(handle, zram->compress_buffer, clen);
+		mem = ksize(handle);
+	}
+
+	spin_lock(&zram->lock);
+	zram_free_page(zram, index);
+	t->handle = handle;
+	t->size = clen;
+	t->flags = flags;
+	zram->stats.num_writes++;
+	zram->stats.pages_stored++;
+	if (flags & ZRAM_UNCOMPRESSED)
+		zram->stats.pages_expand++;
+	zram->stats.compr_data_size += clen;
+	zram->stats.mem_used_total += mem;
+	spin_unlock(&zram->lock);
+
+	mutex_unlock(&zram->compress_lock);
+	return 0;
+
+out_fail:
+	spin_lock(&zram->lock);
+	zram->stats.num_writes++;
+	zram->stats.failed_writes++;
+	spin_unlock(&zram->lock);
+	mutex_unlock(&zram->compress_lock);
+	return -ENOMEM;
+}
+
+/* Frees the pages wholly covered by a discard */
+static void zram_discard(struct zram *zram, struct bio *bio)
+{
+	sector_t start = bio->bi_sector + PAGE_SECTORS - 1;
+	sector_t end = bio->bi_sector + (bio->bi_size >> SECTOR_SHIFT);
+	unsigned long index;
+
+	spin_lock(&zram->lock);
+	for (index = start >> PAGE_SECTORS_SHIFT;
+	     index < (end >> PAGE_SECTORS_SHIFT); index++) {
+		if (zram->table[index].handle ||
+		    (zram->table[index].flags & ZRAM_ZERO)) {
+			zram_free_page(zram, index);
+			zram->stats.discard++;
+		}
+	}
+	spin_unlock(&zram->lock);
+}
+
+static int zram_valid_io(struct zram *zram, struct bio *bio)
+{
+	if (bio->bi_sector & (PAGE_SECTORS - 1) ||
+	    bio->bi_size & (PAGE_SIZE - 1))
+		return 0;
+	if ((bio->bi_sector >> PAGE_SECTORS_SHIFT) +
+	    (bio->bi_size >> PAGE_SHIFT) > zram->nr_pages)
+		return 0;
+	return 1;
+}
+
+static int zram_make_request(struct request_queue *q, struct bio *bio)
+{
+	struct zram *zram = q->queuedata;
+	struct bio_vec *bvec;
+	unsigned long index;
+	int i, rw, err = 0;
+
+	if (bio_discard(bio)) {
+		zram_discard(zram, bio);
+		bio_endio(bio, 0);
+		return 0;
+	}
+
+	if (!zram_valid_io(zram, bio)) {
+		spin_lock(&zram->lock);
+		zram->stats.invalid_io++;
+		spin_unlock(&zram->lock);
+		bio_io_error(bio);
+		return 0;
+	}
+
+	rw = bio_rw(bio);
+	if (rw == READA)
+		rw = READ;
+
+	index = bio->bi_sector >> PAGE_SECTORS_SHIFT;
+	bio_for_each_segment(bvec, bio, i) {
+		if (bvec->bv_len != PAGE_SIZE || bvec->bv_offset) {
+			err = -EIO;
+			break;
+		}
+		if (rw == READ)
+			err = zram_read(zram, bvec->bv_page, index);
+		else
+			err = zram_write(zram, bvec->bv_page, index);
+		if (err)
+			break;
+		index++;
+	}
+
+	bio_endio(bio, err);
+	return 0;
+}
+
+/* Only called for request based queues, but it enables discard bios */
+static int zram_prepare_discard(struct request_queue *q, struct request *rq)
+{
+	return 0;
+}
+
+static void zram_slot_free_notify(struct block_device *bdev,
+				  unsigned long index)
+{
+	struct zram *zram = bdev->bd_disk->private_data;
+
+	spin_lock(&zram->lock);
+	zram_free_page(zram, index);
+	zram->stats.notify_free++;
+	spin_unlock(&zram->lock);
+}
+
+static struct block_device_operations zram_fops = {
+	.owner =		THIS_MODULE,
+	.swap_slot_free_notify = zram_slot_free_notify,
+};
+
+/*
+ * Statistics, in /sys/block/zram<N>/
+ */
+static inline struct zram *dev_to_zram(struct device *dev)
+{
+	return dev_to_disk(dev)->private_data;
+}
+
+#define ZRAM_STAT_ATTR(name)						\
+static ssize_t name##_show(struct device *dev,				\
+			   struct device_attribute *attr, char *buf)	\
+{									\
+	struct zram *zram = dev_to_zram(dev);				\
+	u64 val;							\
+									\
+	spin_lock(&zram->lock);						\
+	val = zram->stats.name;						\
+	spin_unlock(&zram->lock);					\
+	return sprintf(buf, "%llu\n", (unsigned long long)val);		\
+}									\
+static DEVICE_ATTR(name, S_IRUGO, name##_show, NULL)
+
+ZRAM_STAT_ATTR(num_reads);
+ZRAM_STAT_ATTR(num_writes);
+ZRAM_STAT_ATTR(failed_reads);
+ZRAM_STAT_ATTR(failed_writes);
+ZRAM_STAT_ATTR(invalid_io);
+ZRAM_STAT_ATTR(notify_free);
+ZRAM_STAT_ATTR(discard);
+ZRAM_STAT_ATTR(zero_pages);
+ZRAM_STAT_ATTR(pages_expand);
+ZRAM_STAT_ATTR(compr_data_size);
+ZRAM_STAT_ATTR(mem_used_total);
+
+static ssize_t orig_data_size_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	u64 val;
+
+	spin_lock(&zram->lock);
+	val = zram->stats.pages_stored + zram->stats.zero_pages;
+	spin_unlock(&zram->lock);
+	return sprintf(buf, "%llu\n", (unsigned long long)val << PAGE_SHIFT);
+}
+static DEVICE_ATTR(orig_data_size, S_IRUGO, orig_data_size_show, NULL);
+
+/* Memory used in percent of the size of the data stored, zeroes included */
+static ssize_t compr_ratio_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	u64 orig, used;
+
+	spin_lock(&zram->lock);
+	orig = (zram->stats.pages_stored + zram->stats.zero_pages)
+		<< PAGE_SHIFT;
+	used = zram->stats.mem_used_total;
+	spin_unlock(&zram->lock);
+	return sprintf(buf, "%llu\n",
+		       orig ? (unsigned long long)div64_u64(used * 100, orig)
+			    : 0ULL);
+}
+static DEVICE_ATTR(compr_ratio, S_IRUGO, compr_ratio_show, NULL);
+
+static ssize_t disksize_show(struct device *dev,
+			     struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		       (unsigned long long)zram->nr_pages << PAGE_SHIFT);
+}
+static DEVICE_ATTR(disksize, S_IRUGO, disksize_show, NULL);
+
+static struct attribute *zram_disk_attrs[] = {
+	&dev_attr_disksize.attr,
+	&dev_attr_num_reads.attr,
+	&dev_attr_num_writes.attr,
+	&dev_attr_failed_reads.attr,
+	&dev_attr_failed_writes.attr,
+	&dev_attr_invalid_io.attr,
+	&dev_attr_notify_free.attr,
+	&dev_attr_discard.attr,
+	&dev_attr_zero_pages.attr,
+	&dev_attr_pages_expand.attr,
+	&dev_attr_orig_data_size.attr,
+	&dev_attr_compr_data_size.attr,
+	&dev_attr_mem_used_total.attr,
+	&dev_attr_compr_ratio.attr,
+	NULL,
+};
+
+static struct attribute_group zram_disk_attr_group = {
+	.attrs = zram_disk_attrs,
+};
+
+static int zram_alloc(struct zram *zram, int i, unsigned long nr_pages)
+{
+	struct gendisk *disk;
+
+	zram->number = i;
+	zram->nr_pages = nr_pages;
+	spin_lock_init(&zram->lock);
+	mutex_init(&zram->compress_lock);
+
+	zram->table = vmalloc(nr_pages * sizeof(*zram->table));
+	if (!zram->table)
+		goto out;
+	memset(zram->table, 0, nr_pages * sizeof(*zram->table));
+
+	zram->compress_workmem = vmalloc(LZO1X_MEM_COMPRESS);
+	if (!zram->compress_workmem)
+		goto out_free_table;
+	/* the output of lzo can be larger than its input */
+	zram->compress_buffer = (void *)__get_free_pages(GFP_KERNEL, 1);
+	if (!zram->compress_buffer)
+		goto out_free_workmem;
+
+	zram->queue = blk_alloc_queue(GFP_KERNEL);
+	if (!zram->queue)
+		goto out_free_buffer;
+	zram->queue->queuedata = zram;
+	blk_queue_make_request(zram->queue, zram_make_request);
+	blk_queue_hardsect_size(zram->queue, PAGE_SIZE);
+	blk_queue_bounce_limit(zram->queue, BLK_BOUNCE_ANY);
+	blk_queue_set_discard(zram->queue, zram_prepare_discard);
+	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->queue);
+
+	disk = zram->disk = alloc_disk(1);
+	if (!disk)
+		goto out_free_queue;
+	disk->major		= zram_major;
+	disk->first_minor	= i;
+	disk->fops		= &zram_fops;
+	disk->private_data	= zram;
+	disk->queue		= zram->queue;
+	disk->flags |= GENHD_FL_SUPPRESS_PARTITION_INFO;
+	sprintf(disk->disk_name, "zram%d", i);
+	set_capacity(disk, (sector_t)nr_pages << PAGE_SECTORS_SHIFT);
+
+	return 0;
+
+out_free_queue:
+	blk_cleanup_queue(zram->queue);
+out_free_buffer:
+	free_pages((unsigned long)zram->compress_buffer, 1);
+out_free_workmem:
+	vfree(zram->compress_workmem);
+out_free_table:
+	vfree(zram->table);
+out:
+	return -ENOMEM;
+}
+
+static void zram_free(struct zram *zram)
+{
+	unsigned long index;
+
+	put_disk(zram->disk);
+	blk_cleanup_queue(zram->queue);
+	for (index = 0; index < zram->nr_pages; index++)
+		zram_free_page(zram, index);
+	free_pages((unsigned long)zram->compress_buffer, 1);
+	vfree(zram->compress_workmem);
+	vfree(zram->table);
+}
+
+static int __init zram_init(void)
+{
+	unsigned long nr_pages;
+	int i, err;
+
+	if (!num_devices || num_devices > 1U << MINORBITS)
+		return -EINVAL;
+
+	if (disksize_kb)
+		nr_pages = disksize_kb >> (PAGE_SHIFT - 10);
+	else
+		nr_pages = totalram_pages / 4;
+	if (!nr_pages)
+		return -EINVAL;
+
+	zram_major = register_blkdev(0, "zram");
+	if (zram_major <= 0)
+		return -EBUSY;
+
+	zram_devices = kcalloc(num_devices, sizeof(struct zram), GFP_KERNEL);
+	if (!zram_devices) {
+		err = -ENOMEM;
+		goto out_unregister;
+	}
+
+	for (i = 0; i < num_devices; i++) {
+		err = zram_alloc(&zram_devices[i], i, nr_pages);
+		if (err)
+			goto out_free;
+	}
+
+	/* point of no return */
+
+	for (i = 0; i < num_devices; i++) {
+		add_disk(zram_devices[i].disk);
+		if (sysfs_create_group(&disk_to_dev(zram_devices[i].disk)->kobj,
+				       &zram_disk_attr_group))
+			printk(KERN_WARNING "zram%d: no statistics in sysfs\n",
+			       i);
+	}
+
+	printk(KERN_INFO "zram: %u device(s) of %lu KB\n", num_devices,
+	       nr_pages << (PAGE_SHIFT - 10));
+	return 0;
+
+out_free:
+	while (--i >= 0)
+		zram_free(&zram_devices[i]);
+	kfree(zram_devices);
+out_unregister:
+	unregister_blkdev(zram_major, "zram");
+	return err;
+}
+
+static void __exit zram_exit(void)
+{
+	struct zram *zram;
+	int i;
+
+	for (i = 0; i < num_devices; i++) {
+		zram = &zram_devices[i];
+		sysfs_remove_group(&disk_to_dev(zram->disk)->kobj,
+				   &zram_disk_attr_group);
+		del_gendisk(zram->disk);
+		zram_free(zram);
+	}
+	kfree(zram_devices);
+	unregister_blkdev(zram_major, "zram");
+}
+
+module_init(zram_init);
+module_exit(zram_exit);
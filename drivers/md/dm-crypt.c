@@ -25,6 +25,8 @@
 
 #include <linux/device-mapper.h>
 
+#include "dm-bio-list.h"
+
 #define DM_MSG_PREFIX "crypt"
 #define MESG_STR(x) x, sizeof(x)
 
@@ -41,6 +43,7 @@ struct convert_context {
 	unsigned int idx_out;
 	sector_t sector;
 	atomic_t pending;
+	struct ablkcipher_request *req;	/* kept for the next block */
 };
 
 /*
@@ -65,6 +68,17 @@ struct dm_crypt_request {
 	struct scatterlist sg_out;
 };
 
+/*
+ * The bs bioset puts this in front of every clone: the place of a
+ * write fragment in the submission order.
+ */
+struct dm_crypt_clone {
+	struct list_head write_list;	/* in crypt_config write_ready */
+	unsigned long write_seq;
+	int write_error;
+	struct bio bio;			/* must be last */
+};
+
 struct crypt_config;
 
 struct crypt_iv_operations {
@@ -96,6 +110,20 @@ struct crypt_config {
 	struct workqueue_struct *io_queue;
 	struct workqueue_struct *crypt_queue;
 
+	/*
+	 * Writes are encrypted in parallel on all CPUs, but submitted by
+	 * one thread at a time in the order of write_seq.  A clone gets
+	 * its number only once it has its pages and bio, so the clones it
+	 * waits for in write_ready already have theirs and only wait for
+	 * the cipher, never for the pools.
+	 */
+	spinlock_t write_lock;
+	struct list_head write_ready;	/* encrypted clones, by write_seq */
+	unsigned long write_seq;	/* for the next clone allocated */
+	unsigned long write_next;	/* of the next clone to submit */
+	int write_flushing;
+	struct work_struct write_work;
+
 	/*
 	 * crypto related data
 	 */
@@ -122,7 +150,6 @@ struct crypt_config {
 	 * correctly aligned.
 	 */
 	unsigned int dmreq_start;
-	struct ablkcipher_request *req;
 
 	char cipher[CRYPTO_MAX_ALG_NAME];
 	char chainmode[CRYPTO_MAX_ALG_NAME];
@@ -333,6 +360,7 @@ static void crypt_convert_init(struct crypt_config *cc,
 	ctx->idx_in = bio_in ? bio_in->bi_idx : 0;
 	ctx->idx_out = bio_out ? bio_out->bi_idx : 0;
 	ctx->sector = sector + cc->iv_offset;
+	ctx->req = NULL;
 	init_completion(&ctx->restart);
 }
 
@@ -402,16 +430,29 @@ static int crypt_convert_block(struct crypt_config *cc,
 
 static void kcryptd_async_done(struct crypto_async_request *async_req,
 			       int error);
+/*
+ * The request is per conversion rather than per device, so that
+ * conversions can run on several CPUs at once.
+ */
 static void crypt_alloc_req(struct crypt_config *cc,
 			    struct convert_context *ctx)
 {
-	if (!cc->req)
-		cc->req = mempool_alloc(cc->req_pool, GFP_NOIO);
-	ablkcipher_request_set_tfm(cc->req, cc->tfm);
-	ablkcipher_request_set_callback(cc->req, CRYPTO_TFM_REQ_MAY_BACKLOG |
+	if (!ctx->req)
+		ctx->req = mempool_alloc(cc->req_pool, GFP_NOIO);
+	ablkcipher_request_set_tfm(ctx->req, cc->tfm);
+	ablkcipher_request_set_callback(ctx->req, CRYPTO_TFM_REQ_MAY_BACKLOG |
 					CRYPTO_TFM_REQ_MAY_SLEEP,
 					kcryptd_async_done,
-					dmreq_of_req(cc, cc->req));
+					dmreq_of_req(cc, ctx->req));
+}
+
+static void crypt_free_req(struct crypt_config *cc,
+			   struct convert_context *ctx)
+{
+	if (ctx->req) {
+		mempool_free(ctx->req, cc->req_pool);
+		ctx->req = NULL;
+	}
 }
 
 /*
@@ -431,7 +472,7 @@ static int crypt_convert(struct crypt_config *cc,
 
 		atomic_inc(&ctx->pending);
 
-		r = crypt_convert_block(cc, ctx, cc->req);
+		r = crypt_convert_block(cc, ctx, ctx->req);
 
 		switch (r) {
 		/* async */
@@ -440,7 +481,7 @@ static int crypt_convert(struct crypt_config *cc,
 			INIT_COMPLETION(ctx->restart);
 			/* fall through*/
 		case -EINPROGRESS:
-			cc->req = NULL;
+			ctx->req = NULL;
 			ctx->sector++;
 			continue;
 
@@ -454,10 +495,12 @@ static int crypt_convert(struct crypt_config *cc,
 		/* error */
 		default:
 			atomic_dec(&ctx->pending);
+			crypt_free_req(cc, ctx);
 			return r;
 		}
 	}
 
+	crypt_free_req(cc, ctx);
 	return 0;
 }
 
@@ -592,9 +635,11 @@ static void crypt_dec_pending(struct dm_crypt_io *io)
  * Needed because it would be very unwise to do decryption in an
  * interrupt context.
  *
- * kcryptd performs the actual encryption or decryption.
+ * kcryptd performs the actual encryption or decryption, on the CPU
+ * which mapped the write or completed the read.
  *
- * kcryptd_io performs the IO submission.
+ * kcryptd_io performs the IO submission which couldn't be done from
+ * the map function or the crypto callbacks.
  *
  * They must be separated as otherwise the final stages could be
  * starved by new requests which can block in the first stages due
@@ -639,25 +684,22 @@ static void clone_init(struct dm_crypt_io *io, struct bio *clone)
 	clone->bi_destructor = dm_crypt_bio_destructor;
 }
 
-static void kcryptd_io_read(struct dm_crypt_io *io)
+static int kcryptd_io_read(struct dm_crypt_io *io, gfp_t gfp)
 {
 	struct crypt_config *cc = io->target->private;
 	struct bio *base_bio = io->base_bio;
 	struct bio *clone;
 
-	crypt_inc_pending(io);
-
 	/*
 	 * The block layer might modify the bvec array, so always
 	 * copy the required bvecs because we need the original
 	 * one in order to decrypt the whole bio data *afterwards*.
 	 */
-	clone = bio_alloc_bioset(GFP_NOIO, bio_segments(base_bio), cc->bs);
-	if (unlikely(!clone)) {
-		io->error = -ENOMEM;
-		crypt_dec_pending(io);
-		return;
-	}
+	clone = bio_alloc_bioset(gfp, bio_segments(base_bio), cc->bs);
+	if (unlikely(!clone))
+		return 1;
+
+	crypt_inc_pending(io);
 
 	clone_init(io, clone);
 	clone->bi_idx = 0;
@@ -668,22 +710,17 @@ static void kcryptd_io_read(struct dm_crypt_io *io)
 	       sizeof(struct bio_vec) * clone->bi_vcnt);
 
 	generic_make_request(clone);
-}
-
-static void kcryptd_io_write(struct dm_crypt_io *io)
-{
-	struct bio *clone = io->ctx.bio_out;
-	generic_make_request(clone);
+	return 0;
 }
 
 static void kcryptd_io(struct work_struct *work)
 {
 	struct dm_crypt_io *io = container_of(work, struct dm_crypt_io, work);
 
-	if (bio_data_dir(io->base_bio) == READ)
-		kcryptd_io_read(io);
-	else
-		kcryptd_io_write(io);
+	crypt_inc_pending(io);
+	if (kcryptd_io_read(io, GFP_NOIO))
+		io->error = -ENOMEM;
+	crypt_dec_pending(io);
 }
 
 static void kcryptd_queue_io(struct dm_crypt_io *io)
@@ -694,29 +731,119 @@ static void kcryptd_queue_io(struct dm_crypt_io *io)
 	queue_work(cc->io_queue, &io->work);
 }
 
+static struct dm_crypt_clone *crypt_clone(struct bio *clone)
+{
+	return container_of(clone, struct dm_crypt_clone, bio);
+}
+
+/*
+ * Gives a write fragment, which has its buffers, its place in the
+ * submission order.
+ */
+static void crypt_write_number(struct crypt_config *cc, struct bio *clone)
+{
+	spin_lock_irq(&cc->write_lock);
+	crypt_clone(clone)->write_seq = cc->write_seq++;
+	spin_unlock_irq(&cc->write_lock);
+}
+
+/*
+ * Queues a write fragment for submission once encrypted, or to be
+ * failed with -EIO in its turn if @error.
+ */
+static void crypt_write_ready(struct crypt_config *cc, struct bio *clone,
+			      int error)
+{
+	struct dm_crypt_clone *cl = crypt_clone(clone), *pos;
+	unsigned long flags;
+
+	cl->write_error = error;
+
+	spin_lock_irqsave(&cc->write_lock, flags);
+	list_for_each_entry_reverse(pos, &cc->write_ready, write_list)
+		if ((long)(pos->write_seq - cl->write_seq) < 0)
+			break;
+	list_add(&cl->write_list, &pos->write_list);
+	spin_unlock_irqrestore(&cc->write_lock, flags);
+}
+
+/*
+ * Submits the write fragments which are next in order.  Only one thread
+ * submits at a time, so that they reach the device in that order.
+ */
+static void crypt_write_flush(struct crypt_config *cc)
+{
+	struct dm_crypt_clone *cl;
+	struct bio_list bios;
+	struct bio *clone;
+
+	spin_lock_irq(&cc->write_lock);
+	if (cc->write_flushing) {
+		/* the other thread will see our clones on its next pass */
+		spin_unlock_irq(&cc->write_lock);
+		return;
+	}
+	cc->write_flushing = 1;
+
+	for (;;) {
+		bio_list_init(&bios);
+		while (!list_empty(&cc->write_ready)) {
+			cl = list_first_entry(&cc->write_ready,
+					      struct dm_crypt_clone, write_list);
+			if (cl->write_seq != cc->write_next)
+				break;
+			list_del(&cl->write_list);
+			cc->write_next++;
+			bio_list_add(&bios, &cl->bio);
+		}
+		if (bio_list_empty(&bios))
+			break;
+		spin_unlock_irq(&cc->write_lock);
+
+		while ((clone = bio_list_pop(&bios))) {
+			if (unlikely(crypt_clone(clone)->write_error))
+				bio_endio(clone, -EIO);
+			else
+				generic_make_request(clone);
+		}
+
+		spin_lock_irq(&cc->write_lock);
+	}
+
+	cc->write_flushing = 0;
+	spin_unlock_irq(&cc->write_lock);
+}
+
+static void kcryptd_write_flush(struct work_struct *work)
+{
+	struct crypt_config *cc = container_of(work, struct crypt_config,
+					       write_work);
+
+	crypt_write_flush(cc);
+}
+
 static void kcryptd_crypt_write_io_submit(struct dm_crypt_io *io,
 					  int error, int async)
 {
 	struct bio *clone = io->ctx.bio_out;
 	struct crypt_config *cc = io->target->private;
 
-	if (unlikely(error < 0)) {
-		crypt_free_buffer_pages(cc, clone);
-		bio_put(clone);
-		io->error = -EIO;
-		crypt_dec_pending(io);
-		return;
-	}
-
-	/* crypt_convert should have filled the clone bio */
-	BUG_ON(io->ctx.idx_out < clone->bi_vcnt);
+	if (unlikely(error < 0))
+		/* crypt_endio() frees it, after the clones before it */
+		crypt_write_ready(cc, clone, 1);
+	else {
+		/* crypt_convert should have filled the clone bio */
+		BUG_ON(io->ctx.idx_out < clone->bi_vcnt);
 
-	clone->bi_sector = cc->start + io->sector;
+		clone->bi_sector = cc->start + io->sector;
+		crypt_write_ready(cc, clone, 0);
+	}
 
+	/* the crypto callbacks can't submit bios */
 	if (async)
-		kcryptd_queue_io(io);
+		queue_work(cc->io_queue, &cc->write_work);
 	else
-		generic_make_request(clone);
+		crypt_write_flush(cc);
 }
 
 static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
@@ -746,6 +873,7 @@ static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
 			io->error = -ENOMEM;
 			break;
 		}
+		crypt_write_number(cc, clone);
 
 		io->ctx.bio_out = clone;
 		io->ctx.idx_out = 0;
@@ -1071,15 +1199,13 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		ti->error = "Cannot allocate crypt request mempool";
 		goto bad_req_pool;
 	}
-	cc->req = NULL;
-
 	cc->page_pool = mempool_create_page_pool(MIN_POOL_PAGES, 0);
 	if (!cc->page_pool) {
 		ti->error = "Cannot allocate page mempool";
 		goto bad_page_pool;
 	}
 
-	cc->bs = bioset_create(MIN_IOS, 0);
+	cc->bs = bioset_create(MIN_IOS, offsetof(struct dm_crypt_clone, bio));
 	if (!cc->bs) {
 		ti->error = "Cannot allocate crypt bioset";
 		goto bad_bs;
@@ -1126,12 +1252,16 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		goto bad_io_queue;
 	}
 
-	cc->crypt_queue = create_singlethread_workqueue("kcryptd");
+	cc->crypt_queue = create_workqueue("kcryptd");
 	if (!cc->crypt_queue) {
 		ti->error = "Couldn't create kcryptd queue";
 		goto bad_crypt_queue;
 	}
 
+	spin_lock_init(&cc->write_lock);
+	INIT_LIST_HEAD(&cc->write_ready);
+	INIT_WORK(&cc->write_work, kcryptd_write_flush);
+
 	ti->private = cc;
 	return 0;
 
@@ -1168,9 +1298,6 @@ static void crypt_dtr(struct dm_target *ti)
 	destroy_workqueue(cc->io_queue);
 	destroy_workqueue(cc->crypt_queue);
 
-	if (cc->req)
-		mempool_free(cc->req, cc->req_pool);
-
 	bioset_free(cc->bs);
 	mempool_destroy(cc->page_pool);
 	mempool_destroy(cc->req_pool);
@@ -1194,9 +1321,11 @@ static int crypt_map(struct dm_target *ti, struct bio *bio,
 
 	io = crypt_io_alloc(ti, bio, bio->bi_sector - ti->begin);
 
-	if (bio_data_dir(io->base_bio) == READ)
-		kcryptd_queue_io(io);
-	else
+	if (bio_data_dir(io->base_bio) == READ) {
+		/* submit at once, unless that means waiting for memory */
+		if (kcryptd_io_read(io, GFP_NOWAIT))
+			kcryptd_queue_io(io);
+	} else
 		kcryptd_queue_crypt(io);
 
 	return DM_MAPIO_SUBMITTED;
@@ -1309,7 +1438,7 @@ static int crypt_merge(struct dm_target *ti, struct bvec_merge_data *bvm,
 
 static struct target_type crypt_target = {
 	.name   = "crypt",
-	.version= {1, 6, 0},
+	.version= {1, 7, 0},
 	.module = THIS_MODULE,
 	.ctr    = crypt_ctr,
 	.dtr    = crypt_dtr,
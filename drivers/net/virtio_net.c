@@ -92,14 +92,28 @@ static void trim_pages(struct virtnet_info *vi, struct sk_buff *skb)
 	skb->data_len = 0;
 }
 
+/* Refills the page chain with up to a packet's worth of pages at once. */
+static void refill_pages(struct virtnet_info *vi, gfp_t gfp_mask)
+{
+	struct page *p, *n;
+	LIST_HEAD(pages);
+
+	alloc_pages_bulk(gfp_mask, MAX_SKB_FRAGS, &pages);
+	list_for_each_entry_safe(p, n, &pages, lru) {
+		list_del(&p->lru);
+		give_a_page(vi, p);
+	}
+}
+
 static struct page *get_a_page(struct virtnet_info *vi, gfp_t gfp_mask)
 {
-	struct page *p = vi->pages;
+	struct page *p;
 
+	if (!vi->pages)
+		refill_pages(vi, gfp_mask);
+	p = vi->pages;
 	if (p)
 		vi->pages = (struct page *)p->private;
-	else
-		p = alloc_page(gfp_mask);
 	return p;
 }
 
@@ -10,13 +10,18 @@
 
 #include <linux/fs.h>
 #include <linux/buffer_head.h>
+#include <linux/dcache.h>
 #include "fat.h"
 
-/* this must be > 0. */
-#define FAT_MAX_CACHE	8
-
+/*
+ * Each inode keeps the contiguous runs of its cluster chain found so far
+ * in an rbtree sorted by the cluster number in the file, so once a chain
+ * was walked, any cluster of it is found in O(log n).  There is no limit
+ * per inode.  Instead, the inodes having caches are on an LRU list, and
+ * the shrinker drops the caches of the least recently used inodes.
+ */
 struct fat_cache {
-	struct list_head cache_list;
+	struct rb_node cache_node;
 	int nr_contig;	/* number of contiguous clusters */
 	int fcluster;	/* cluster number in the file. */
 	int dcluster;	/* cluster number on disk. */
@@ -29,175 +34,208 @@ struct fat_cache_id {
 	int dcluster;
 };
 
-static inline int fat_max_cache(struct inode *inode)
+static LIST_HEAD(fat_cache_lru);
+static DEFINE_SPINLOCK(fat_cache_lru_lock);
+static atomic_t fat_nr_caches = ATOMIC_INIT(0);
+
+static struct kmem_cache *fat_cache_cachep;
+
+static inline struct fat_cache *fat_cache_alloc(struct inode *inode)
 {
-	return FAT_MAX_CACHE;
+	struct fat_cache *cache;
+
+	cache = kmem_cache_alloc(fat_cache_cachep, GFP_NOFS);
+	if (cache)
+		atomic_inc(&fat_nr_caches);
+	return cache;
 }
 
-static struct kmem_cache *fat_cache_cachep;
+static inline void fat_cache_free(struct fat_cache *cache)
+{
+	atomic_dec(&fat_nr_caches);
+	kmem_cache_free(fat_cache_cachep, cache);
+}
+
+/* Frees all caches of inode. Called with ->cache_lock held. */
+static void fat_cache_drop_tree(struct msdos_inode_info *i)
+{
+	struct rb_node *node;
+
+	while ((node = rb_first(&i->cache_tree)) != NULL) {
+		rb_erase(node, &i->cache_tree);
+		fat_cache_free(rb_entry(node, struct fat_cache, cache_node));
+	}
+	i->nr_caches = 0;
+}
 
-static void init_once(void *foo)
+/*
+ * The inode locks are taken with trylock, because fat_cache_update_lru()
+ * takes fat_cache_lru_lock with ->cache_lock held.
+ */
+static int fat_cache_shrink(int nr_to_scan, gfp_t gfp_mask)
 {
-	struct fat_cache *cache = (struct fat_cache *)foo;
+	struct msdos_inode_info *i, *next;
 
-	INIT_LIST_HEAD(&cache->cache_list);
+	if (nr_to_scan) {
+		spin_lock(&fat_cache_lru_lock);
+		list_for_each_entry_safe_reverse(i, next, &fat_cache_lru,
+						 cache_lru) {
+			if (nr_to_scan <= 0)
+				break;
+			if (!spin_trylock(&i->cache_lock))
+				continue;
+			nr_to_scan -= i->nr_caches;
+			fat_cache_drop_tree(i);
+			list_del_init(&i->cache_lru);
+			spin_unlock(&i->cache_lock);
+		}
+		spin_unlock(&fat_cache_lru_lock);
+	}
+	return (atomic_read(&fat_nr_caches) / 100) * sysctl_vfs_cache_pressure;
 }
 
+static struct shrinker fat_cache_shrinker = {
+	.shrink = fat_cache_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
 int __init fat_cache_init(void)
 {
 	fat_cache_cachep = kmem_cache_create("fat_cache",
 				sizeof(struct fat_cache),
 				0, SLAB_RECLAIM_ACCOUNT|SLAB_MEM_SPREAD,
-				init_once);
+				NULL);
 	if (fat_cache_cachep == NULL)
 		return -ENOMEM;
+	register_shrinker(&fat_cache_shrinker);
 	return 0;
 }
 
 void fat_cache_destroy(void)
 {
+	unregister_shrinker(&fat_cache_shrinker);
 	kmem_cache_destroy(fat_cache_cachep);
 }
 
-static inline struct fat_cache *fat_cache_alloc(struct inode *inode)
+/* Called with ->cache_lock held */
+static inline void fat_cache_update_lru(struct inode *inode)
 {
-	return kmem_cache_alloc(fat_cache_cachep, GFP_NOFS);
-}
-
-static inline void fat_cache_free(struct fat_cache *cache)
-{
-	BUG_ON(!list_empty(&cache->cache_list));
-	kmem_cache_free(fat_cache_cachep, cache);
-}
+	struct msdos_inode_info *i = MSDOS_I(inode);
 
-static inline void fat_cache_update_lru(struct inode *inode,
-					struct fat_cache *cache)
-{
-	if (MSDOS_I(inode)->cache_lru.next != &cache->cache_list)
-		list_move(&cache->cache_list, &MSDOS_I(inode)->cache_lru);
+	spin_lock(&fat_cache_lru_lock);
+	if (fat_cache_lru.next != &i->cache_lru)
+		list_move(&i->cache_lru, &fat_cache_lru);
+	spin_unlock(&fat_cache_lru_lock);
 }
 
 static int fat_cache_lookup(struct inode *inode, int fclus,
 			    struct fat_cache_id *cid,
 			    int *cached_fclus, int *cached_dclus)
 {
-	static struct fat_cache nohit = { .fcluster = 0, };
-
-	struct fat_cache *hit = &nohit, *p;
+	struct msdos_inode_info *i = MSDOS_I(inode);
+	struct fat_cache *hit = NULL, *p;
+	struct rb_node *node;
 	int offset = -1;
 
-	spin_lock(&MSDOS_I(inode)->cache_lru_lock);
-	list_for_each_entry(p, &MSDOS_I(inode)->cache_lru, cache_list) {
-		/* Find the cache of "fclus" or nearest cache. */
-		if (p->fcluster <= fclus && hit->fcluster < p->fcluster) {
+	spin_lock(&i->cache_lock);
+	node = i->cache_tree.rb_node;
+	while (node) {
+		p = rb_entry(node, struct fat_cache, cache_node);
+		if (fclus < p->fcluster)
+			node = node->rb_left;
+		else {
+			/* Find the cache of "fclus" or nearest cache. */
 			hit = p;
-			if ((hit->fcluster + hit->nr_contig) < fclus) {
-				offset = hit->nr_contig;
-			} else {
-				offset = fclus - hit->fcluster;
+			if (fclus <= p->fcluster + p->nr_contig)
 				break;
-			}
+			node = node->rb_right;
 		}
 	}
-	if (hit != &nohit) {
-		fat_cache_update_lru(inode, hit);
+	if (hit) {
+		fat_cache_update_lru(inode);
 
-		cid->id = MSDOS_I(inode)->cache_valid_id;
+		offset = min(fclus - hit->fcluster, hit->nr_contig);
+		cid->id = i->cache_valid_id;
 		cid->nr_contig = hit->nr_contig;
 		cid->fcluster = hit->fcluster;
 		cid->dcluster = hit->dcluster;
 		*cached_fclus = cid->fcluster + offset;
 		*cached_dclus = cid->dcluster + offset;
 	}
-	spin_unlock(&MSDOS_I(inode)->cache_lru_lock);
+	spin_unlock(&i->cache_lock);
 
 	return offset;
 }
 
-static struct fat_cache *fat_cache_merge(struct inode *inode,
-					 struct fat_cache_id *new)
-{
-	struct fat_cache *p;
-
-	list_for_each_entry(p, &MSDOS_I(inode)->cache_lru, cache_list) {
-		/* Find the same part as "new" in cluster-chain. */
-		if (p->fcluster == new->fcluster) {
-			BUG_ON(p->dcluster != new->dcluster);
-			if (new->nr_contig > p->nr_contig)
-				p->nr_contig = new->nr_contig;
-			return p;
-		}
-	}
-	return NULL;
-}
-
 static void fat_cache_add(struct inode *inode, struct fat_cache_id *new)
 {
-	struct fat_cache *cache, *tmp;
+	struct msdos_inode_info *i = MSDOS_I(inode);
+	struct fat_cache *cache, *tmp = NULL;
+	struct rb_node **p, *parent;
 
 	if (new->fcluster == -1) /* dummy cache */
 		return;
 
-	spin_lock(&MSDOS_I(inode)->cache_lru_lock);
-	if (new->id != FAT_CACHE_VALID &&
-	    new->id != MSDOS_I(inode)->cache_valid_id)
+	spin_lock(&i->cache_lock);
+retry:
+	if (new->id != FAT_CACHE_VALID && new->id != i->cache_valid_id)
 		goto out;	/* this cache was invalidated */
 
-	cache = fat_cache_merge(inode, new);
-	if (cache == NULL) {
-		if (MSDOS_I(inode)->nr_caches < fat_max_cache(inode)) {
-			MSDOS_I(inode)->nr_caches++;
-			spin_unlock(&MSDOS_I(inode)->cache_lru_lock);
-
-			tmp = fat_cache_alloc(inode);
-			spin_lock(&MSDOS_I(inode)->cache_lru_lock);
-			cache = fat_cache_merge(inode, new);
-			if (cache != NULL) {
-				MSDOS_I(inode)->nr_caches--;
-				fat_cache_free(tmp);
-				goto out_update_lru;
-			}
-			cache = tmp;
-		} else {
-			struct list_head *p = MSDOS_I(inode)->cache_lru.prev;
-			cache = list_entry(p, struct fat_cache, cache_list);
+	p = &i->cache_tree.rb_node;
+	parent = NULL;
+	while (*p) {
+		parent = *p;
+		cache = rb_entry(parent, struct fat_cache, cache_node);
+		if (new->fcluster < cache->fcluster)
+			p = &parent->rb_left;
+		else if (new->fcluster > cache->fcluster)
+			p = &parent->rb_right;
+		else {
+			/* Find the same part as "new" in cluster-chain. */
+			BUG_ON(cache->dcluster != new->dcluster);
+			if (new->nr_contig > cache->nr_contig)
+				cache->nr_contig = new->nr_contig;
+			goto out;
 		}
-		cache->fcluster = new->fcluster;
-		cache->dcluster = new->dcluster;
-		cache->nr_contig = new->nr_contig;
 	}
-out_update_lru:
-	fat_cache_update_lru(inode, cache);
+	if (!tmp) {
+		spin_unlock(&i->cache_lock);
+		tmp = fat_cache_alloc(inode);
+		if (!tmp)
+			return;
+		spin_lock(&i->cache_lock);
+		goto retry;
+	}
+	tmp->fcluster = new->fcluster;
+	tmp->dcluster = new->dcluster;
+	tmp->nr_contig = new->nr_contig;
+	rb_link_node(&tmp->cache_node, parent, p);
+	rb_insert_color(&tmp->cache_node, &i->cache_tree);
+	i->nr_caches++;
+	tmp = NULL;
+
+	fat_cache_update_lru(inode);
 out:
-	spin_unlock(&MSDOS_I(inode)->cache_lru_lock);
+	spin_unlock(&i->cache_lock);
+	if (tmp)
+		fat_cache_free(tmp);
 }
 
-/*
- * Cache invalidation occurs rarely, thus the LRU chain is not updated. It
- * fixes itself after a while.
- */
-static void __fat_cache_inval_inode(struct inode *inode)
+void fat_cache_inval_inode(struct inode *inode)
 {
 	struct msdos_inode_info *i = MSDOS_I(inode);
-	struct fat_cache *cache;
 
-	while (!list_empty(&i->cache_lru)) {
-		cache = list_entry(i->cache_lru.next, struct fat_cache, cache_list);
-		list_del_init(&cache->cache_list);
-		i->nr_caches--;
-		fat_cache_free(cache);
-	}
+	spin_lock(&i->cache_lock);
+	fat_cache_drop_tree(i);
+	spin_lock(&fat_cache_lru_lock);
+	list_del_init(&i->cache_lru);
+	spin_unlock(&fat_cache_lru_lock);
+
 	/* Update. The copy of caches before this id is discarded. */
 	i->cache_valid_id++;
 	if (i->cache_valid_id == FAT_CACHE_VALID)
 		i->cache_valid_id++;
-}
-
-void fat_cache_inval_inode(struct inode *inode)
-{
-	spin_lock(&MSDOS_I(inode)->cache_lru_lock);
-	__fat_cache_inval_inode(inode);
-	spin_unlock(&MSDOS_I(inode)->cache_lru_lock);
+	spin_unlock(&i->cache_lock);
 }
 
 static inline int cache_contiguous(struct fat_cache_id *cid, int dclus)
@@ -263,8 +301,12 @@ int fat_get_cluster(struct inode *inode, int cluster, int *fclus, int *dclus)
 		}
 		(*fclus)++;
 		*dclus = nr;
-		if (!cache_contiguous(&cid, *dclus))
+		if (!cache_contiguous(&cid, *dclus)) {
+			/* remember every run on the way, not only the last */
+			cid.nr_contig--;
+			fat_cache_add(inode, &cid);
 			cache_init(&cid, *fclus, *dclus);
+		}
 	}
 	nr = 0;
 	fat_cache_add(inode, &cid);
@@ -273,6 +315,42 @@ out:
 	return nr;
 }
 
+/*
+ * Returns how many clusters after dclus (the cluster fclus of the file)
+ * follow it contiguously on disk, up to max. The run is taken from the
+ * cache and extended by reading ahead in the FAT, and the result is
+ * cached for the next calls.
+ */
+static int fat_get_contig(struct inode *inode, int fclus, int dclus, int max)
+{
+	struct fat_entry fatent;
+	struct fat_cache_id cid;
+	int cached_fclus, cached_dclus, contig, nr;
+
+	if (fat_cache_lookup(inode, fclus, &cid, &cached_fclus,
+			     &cached_dclus) < 0 || cached_fclus != fclus)
+		cache_init(&cid, fclus, dclus);
+	contig = cid.fcluster + cid.nr_contig - fclus;
+	if (contig >= max)
+		return max;
+
+	fatent_init(&fatent);
+	dclus += contig;
+	while (contig < max) {
+		/* stops on EOF and on errors too, fat_get_cluster() sees them */
+		nr = fat_ent_read(inode, &fatent, dclus);
+		if (nr != dclus + 1)
+			break;
+		dclus = nr;
+		contig++;
+		cid.nr_contig++;
+	}
+	fatent_brelse(&fatent);
+	fat_cache_add(inode, &cid);
+
+	return contig;
+}
+
 static int fat_bmap_cluster(struct inode *inode, int cluster)
 {
 	struct super_block *sb = inode->i_sb;
@@ -292,6 +370,13 @@ static int fat_bmap_cluster(struct inode *inode, int cluster)
 	return dclus;
 }
 
+/*
+ * Maps sector of inode to *phys. On entry, *mapped_blocks is how many
+ * blocks the caller wants to map. On return, it is how many blocks are
+ * contiguous from *phys, which may be less or more than that: the
+ * whole run of the cluster chain is mapped if it is known already, and
+ * the FAT is read ahead for the wanted blocks past the first cluster.
+ */
 int fat_bmap(struct inode *inode, sector_t sector, sector_t *phys,
 	     unsigned long *mapped_blocks, int create)
 {
@@ -299,8 +384,10 @@ int fat_bmap(struct inode *inode, sector_t sector, sector_t *phys,
 	struct msdos_sb_info *sbi = MSDOS_SB(sb);
 	const unsigned long blocksize = sb->s_blocksize;
 	const unsigned char blocksize_bits = sb->s_blocksize_bits;
+	const int clus_bits = sbi->cluster_bits - blocksize_bits;
+	unsigned long wanted = *mapped_blocks;
 	sector_t last_block;
-	int cluster, offset;
+	int fclus, cluster, offset, contig;
 
 	*phys = 0;
 	*mapped_blocks = 0;
@@ -327,14 +414,24 @@ int fat_bmap(struct inode *inode, sector_t sector, sector_t *phys,
 			return 0;
 	}
 
-	cluster = sector >> (sbi->cluster_bits - sb->s_blocksize_bits);
+	fclus = sector >> clus_bits;
 	offset  = sector & (sbi->sec_per_clus - 1);
-	cluster = fat_bmap_cluster(inode, cluster);
+	cluster = fat_bmap_cluster(inode, fclus);
 	if (cluster < 0)
 		return cluster;
 	else if (cluster) {
 		*phys = fat_clus_to_blknr(sbi, cluster) + offset;
 		*mapped_blocks = sbi->sec_per_clus - offset;
+
+		if (wanted > last_block - sector)
+			wanted = last_block - sector;
+		if (wanted > *mapped_blocks) {
+			int max = (wanted - *mapped_blocks
+				   + sbi->sec_per_clus - 1) >> clus_bits;
+
+			contig = fat_get_contig(inode, fclus, cluster, max);
+			*mapped_blocks += (unsigned long)contig << clus_bits;
+		}
 		if (*mapped_blocks > last_block - sector)
 			*mapped_blocks = last_block - sector;
 	}
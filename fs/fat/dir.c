@@ -53,6 +53,34 @@ static inline void fat_dir_readahead(struct inode *dir, sector_t iblock,
 	brelse(bh);
 }
 
+/* Window of a directory read ahead at once, see fat_dir_readahead_chain() */
+#define FAT_DIR_RA_SIZE		(128 * 1024)
+
+/*
+ * Reads ahead the cluster chain of dir from iblock, up to FAT_DIR_RA_SIZE
+ * bytes, so a scan of a large directory isn't a synchronous read per
+ * cluster.  The chain is mapped by runs, see fat_bmap().
+ */
+static void fat_dir_readahead_chain(struct inode *dir, sector_t iblock)
+{
+	struct super_block *sb = dir->i_sb;
+	sector_t last_block, phys;
+	unsigned long mapped_blocks, i;
+
+	last_block = (i_size_read(dir) + sb->s_blocksize - 1)
+		>> sb->s_blocksize_bits;
+	last_block = min_t(sector_t, last_block,
+			   iblock + (FAT_DIR_RA_SIZE >> sb->s_blocksize_bits));
+	while (iblock < last_block) {
+		mapped_blocks = last_block - iblock;
+		if (fat_bmap(dir, iblock, &phys, &mapped_blocks, 0) || !phys)
+			break;
+		for (i = 0; i < mapped_blocks; i++)
+			sb_breadahead(sb, phys + i);
+		iblock += mapped_blocks;
+	}
+}
+
 /* Returns the inode number of the directory entry at offset pos. If bh is
    non-NULL, it is brelse'd before. Pos is incremented. The buffer header is
    returned in bh.
@@ -77,6 +105,7 @@ next:
 
 	*bh = NULL;
 	iblock = *pos >> sb->s_blocksize_bits;
+	mapped_blocks = 1;
 	err = fat_bmap(dir, iblock, &phys, &mapped_blocks, 0);
 	if (err || !phys)
 		return -1;	/* beyond EOF or error */
@@ -338,28 +367,240 @@ parse_long:
 #define FAT_MAX_UNI_SIZE	(FAT_MAX_UNI_CHARS * sizeof(wchar_t))
 
 /*
- * Return values: negative -> error, 0 -> not found, positive -> found,
- * value is the total amount of slots, including the shortname entry.
+ * Convert the shortname of de to the io charset, as fat_search_long()
+ * compares it. Returns the length, or 0 if the shortname is empty.
  */
-int fat_search_long(struct inode *inode, const unsigned char *name,
-		    int name_len, struct fat_slot_info *sinfo)
+static int fat_shortname_x8(struct msdos_sb_info *sbi,
+			    struct msdos_dir_entry *de, unsigned char *bufname)
+{
+	struct nls_table *nls_disk = sbi->nls_disk;
+	unsigned short opt_shortname = sbi->options.shortname;
+	wchar_t bufuname[14];
+	unsigned char work[MSDOS_NAME];
+	int chl, i, j, last_u;
+
+	memcpy(work, de->name, sizeof(de->name));
+	/* see namei.c, msdos_format_name */
+	if (work[0] == 0x05)
+		work[0] = 0xE5;
+	for (i = 0, j = 0, last_u = 0; i < 8;) {
+		if (!work[i])
+			break;
+		chl = fat_shortname2uni(nls_disk, &work[i], 8 - i,
+					&bufuname[j++], opt_shortname,
+					de->lcase & CASE_LOWER_BASE);
+		if (chl <= 1) {
+			if (work[i] != ' ')
+				last_u = j;
+		} else {
+			last_u = j;
+		}
+		i += chl;
+	}
+	j = last_u;
+	fat_short2uni(nls_disk, ".", 1, &bufuname[j++]);
+	for (i = 8; i < MSDOS_NAME;) {
+		if (!work[i])
+			break;
+		chl = fat_shortname2uni(nls_disk, &work[i],
+					MSDOS_NAME - i,
+					&bufuname[j++], opt_shortname,
+					de->lcase & CASE_LOWER_EXT);
+		if (chl <= 1) {
+			if (work[i] != ' ')
+				last_u = j;
+		} else {
+			last_u = j;
+		}
+		i += chl;
+	}
+	if (!last_u)
+		return 0;
+
+	bufuname[last_u] = 0x0000;
+	return fat_uni_to_x8(sbi, bufuname, bufname, FAT_MAX_SHORT_SIZE);
+}
+
+/*
+ * The directories smaller than this are scanned without index even
+ * with "dirhash".
+ */
+#define FAT_DIR_INDEX_MIN_SIZE	(256 * sizeof(struct msdos_dir_entry))
+
+/*
+ * Hash of the name of a short entry, as fat_scan() compares it. The
+ * low bit tells these apart from the hashes by fat_name_hash(), whose
+ * positions are the start of the record instead of the short entry.
+ */
+static inline u32 fat_short_hash(const unsigned char *name)
+{
+	return full_name_hash(name, strnlen(name, MSDOS_NAME)) | 1;
+}
+
+/* Hash of the name in the io charset, as fat_name_match() compares it */
+static u32 fat_name_hash(struct msdos_sb_info *sbi,
+			 const unsigned char *name, int len)
+{
+	unsigned long hash = init_name_hash();
+
+	if (sbi->options.name_check != 's') {
+		while (len--)
+			hash = partial_name_hash(nls_tolower(sbi->nls_io,
+							     *name++), hash);
+	} else {
+		while (len--)
+			hash = partial_name_hash(*name++, hash);
+	}
+	return end_name_hash(hash) & ~1;
+}
+
+/*
+ * Add the names of vfat record at pos to the index. unicode is the
+ * longname read from the slots, or NULL if the record has no longname.
+ */
+static int fat_dir_index_insert_names(struct msdos_sb_info *sbi,
+				      struct fat_dir_index *idx,
+				      struct msdos_dir_entry *de,
+				      wchar_t *unicode, loff_t pos)
+{
+	unsigned char bufname[FAT_MAX_SHORT_SIZE];
+	int len, err;
+
+	len = fat_shortname_x8(sbi, de, bufname);
+	if (!len)
+		return 0;	/* fat_search_long() skips this record */
+	err = fat_dir_index_insert(idx, fat_name_hash(sbi, bufname, len), pos);
+	if (!err && unicode) {
+		void *longname = unicode + FAT_MAX_UNI_CHARS;
+		int size = PATH_MAX - FAT_MAX_UNI_SIZE;
+
+		len = fat_uni_to_x8(sbi, unicode, longname, size);
+		err = fat_dir_index_insert(idx,
+					   fat_name_hash(sbi, longname, len),
+					   pos);
+	}
+	return err;
+}
+
+/*
+ * Scan whole directory, and build its index. Every short entry is
+ * indexed by its name on disk at the position of the short entry, and
+ * on vfat also by its shortname and longname in the io charset at the
+ * position of the first slot.
+ */
+static struct fat_dir_index *fat_dir_index_build(struct inode *dir)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(dir->i_sb);
+	struct fat_dir_index *idx;
+	struct buffer_head *bh = NULL;
+	struct msdos_dir_entry *de;
+	unsigned char nr_slots;
+	wchar_t *unicode = NULL;
+	loff_t cpos = 0, start;
+	int err = 0;
+
+	idx = fat_dir_index_alloc(dir);
+	if (!idx)
+		return NULL;
+	idx->free_hint = -1;
+
+	while (fat_get_entry(dir, &cpos, &bh, &de) != -1) {
+parse_record:
+		start = cpos - sizeof(*de);
+		nr_slots = 0;
+		if (IS_FREE(de->name)) {
+			if (idx->free_hint < 0)
+				idx->free_hint = start;
+			continue;
+		}
+		if (de->attr != ATTR_EXT && (de->attr & ATTR_VOLUME))
+			continue;
+		if (de->attr == ATTR_EXT) {
+			int status;
+
+			if (!sbi->options.isvfat)
+				continue;
+			status = fat_parse_long(dir, &cpos, &bh, &de,
+						&unicode, &nr_slots);
+			if (status < 0) {
+				err = status;
+				break;
+			} else if (status == PARSE_INVALID)
+				continue;
+			else if (status == PARSE_NOT_LONGNAME)
+				goto parse_record;
+			else if (status == PARSE_EOF)
+				break;
+		}
+
+		err = fat_dir_index_insert(idx, fat_short_hash(de->name),
+					   cpos - sizeof(*de));
+		if (!err && sbi->options.isvfat)
+			err = fat_dir_index_insert_names(sbi, idx, de,
+						nr_slots ? unicode : NULL,
+						start);
+		if (err) {
+			brelse(bh);
+			break;
+		}
+	}
+	if (unicode)
+		__putname(unicode);
+	if (err) {
+		fat_dir_index_release(idx);
+		return NULL;
+	}
+	if (idx->free_hint < 0)
+		idx->free_hint = dir->i_size;
+
+	return idx;
+}
+
+/*
+ * Return the index of dir, and build it on the first lookup if dir is
+ * large enough. Returns NULL if dir is to be scanned.
+ */
+static struct fat_dir_index *fat_dir_index_lookup(struct inode *dir)
+{
+	struct fat_dir_index *idx;
+
+	if (!MSDOS_SB(dir->i_sb)->options.dirhash)
+		return NULL;
+	idx = fat_dir_index_get(dir);
+	if (!idx && dir->i_size >= FAT_DIR_INDEX_MIN_SIZE) {
+		idx = fat_dir_index_build(dir);
+		if (idx)
+			fat_dir_index_attach(dir, idx);
+	}
+	return idx;
+}
+
+/*
+ * Search the names from cpos. If one_record, only the record starting
+ * at cpos is compared.
+ *
+ * Return values: negative -> error, 0 -> found, -ENOENT -> not found.
+ */
+static int __fat_search_long(struct inode *inode, const unsigned char *name,
+			     int name_len, struct fat_slot_info *sinfo,
+			     loff_t cpos, int one_record)
 {
 	struct super_block *sb = inode->i_sb;
 	struct msdos_sb_info *sbi = MSDOS_SB(sb);
 	struct buffer_head *bh = NULL;
 	struct msdos_dir_entry *de;
-	struct nls_table *nls_disk = sbi->nls_disk;
 	unsigned char nr_slots;
-	wchar_t bufuname[14];
 	wchar_t *unicode = NULL;
-	unsigned char work[MSDOS_NAME];
 	unsigned char bufname[FAT_MAX_SHORT_SIZE];
-	unsigned short opt_shortname = sbi->options.shortname;
-	loff_t cpos = 0;
-	int chl, i, j, last_u, err, len;
+	loff_t start = cpos;
+	int err, len;
 
 	err = -ENOENT;
 	while (1) {
+		if (one_record && cpos != start) {
+			brelse(bh);
+			goto end_of_dir;
+		}
 		if (fat_get_entry(inode, &cpos, &bh, &de) == -1)
 			goto end_of_dir;
 parse_record:
@@ -384,47 +625,10 @@ parse_record:
 				goto end_of_dir;
 		}
 
-		memcpy(work, de->name, sizeof(de->name));
-		/* see namei.c, msdos_format_name */
-		if (work[0] == 0x05)
-			work[0] = 0xE5;
-		for (i = 0, j = 0, last_u = 0; i < 8;) {
-			if (!work[i])
-				break;
-			chl = fat_shortname2uni(nls_disk, &work[i], 8 - i,
-						&bufuname[j++], opt_shortname,
-						de->lcase & CASE_LOWER_BASE);
-			if (chl <= 1) {
-				if (work[i] != ' ')
-					last_u = j;
-			} else {
-				last_u = j;
-			}
-			i += chl;
-		}
-		j = last_u;
-		fat_short2uni(nls_disk, ".", 1, &bufuname[j++]);
-		for (i = 8; i < MSDOS_NAME;) {
-			if (!work[i])
-				break;
-			chl = fat_shortname2uni(nls_disk, &work[i],
-						MSDOS_NAME - i,
-						&bufuname[j++], opt_shortname,
-						de->lcase & CASE_LOWER_EXT);
-			if (chl <= 1) {
-				if (work[i] != ' ')
-					last_u = j;
-			} else {
-				last_u = j;
-			}
-			i += chl;
-		}
-		if (!last_u)
-			continue;
-
 		/* Compare shortname */
-		bufuname[last_u] = 0x0000;
-		len = fat_uni_to_x8(sbi, bufuname, bufname, sizeof(bufname));
+		len = fat_shortname_x8(sbi, de, bufname);
+		if (!len)
+			continue;
 		if (fat_name_match(sbi, name, name_len, bufname, len))
 			goto found;
 
@@ -454,6 +658,32 @@ end_of_dir:
 	return err;
 }
 
+/*
+ * Return values: negative -> error, 0 -> found, -ENOENT -> not found.
+ */
+int fat_search_long(struct inode *inode, const unsigned char *name,
+		    int name_len, struct fat_slot_info *sinfo)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(inode->i_sb);
+	struct fat_dir_index_entry *cursor = NULL;
+	struct fat_dir_index *idx;
+	loff_t pos;
+	u32 hash;
+	int err;
+
+	idx = fat_dir_index_lookup(inode);
+	if (!idx)
+		return __fat_search_long(inode, name, name_len, sinfo, 0, 0);
+
+	hash = fat_name_hash(sbi, name, name_len);
+	while ((pos = fat_dir_index_find(idx, hash, &cursor)) >= 0) {
+		err = __fat_search_long(inode, name, name_len, sinfo, pos, 1);
+		if (err != -ENOENT)
+			return err;
+	}
+	return -ENOENT;
+}
+
 EXPORT_SYMBOL_GPL(fat_search_long);
 
 struct fat_ioctl_filldir_callback {
@@ -510,6 +740,8 @@ static int __fat_readdir(struct inode *inode, struct file *filp, void *dirent,
 		ret = -ENOENT;
 		goto out;
 	}
+	if (cpos == 0)
+		fat_dir_readahead_chain(inode, 0);
 
 	bh = NULL;
 get_new:
@@ -678,9 +910,101 @@ out:
 	return ret;
 }
 
+/*
+ * FATX entries have a fixed size and a counted name of up to FATX_NAME
+ * bytes, with neither long name slots nor "." and ".." entries.  So the
+ * names are given to filldir as they are on disk, without any parsing
+ * or charset conversion.  "." and ".." are faked at f_pos 0 and 1, and
+ * the entry at the byte offset cpos in the directory is at f_pos
+ * cpos + 2.
+ */
+static int fatx_readdir(struct file *filp, void *dirent, filldir_t filldir)
+{
+	struct inode *inode = filp->f_path.dentry->d_inode, *tmp;
+	struct super_block *sb = inode->i_sb;
+	struct buffer_head *bh;
+	struct fatx_dir_entry *de, *endp;
+	unsigned long mapped_blocks, inum;
+	sector_t iblock, phys;
+	loff_t cpos, i_pos;
+	int err, ret = 0;
+
+	lock_super(sb);
+
+	while (filp->f_pos < 2) {
+		if (filp->f_pos == 0)
+			inum = inode->i_ino;
+		else
+			inum = parent_ino(filp->f_path.dentry);
+		if (filldir(dirent, "..", filp->f_pos + 1, filp->f_pos, inum,
+			    DT_DIR) < 0)
+			goto out;
+		filp->f_pos++;
+	}
+	cpos = filp->f_pos - 2;
+	if (cpos & (sizeof(struct fatx_dir_entry) - 1)) {
+		ret = -ENOENT;
+		goto out;
+	}
+	while (1) {
+		iblock = cpos >> sb->s_blocksize_bits;
+		/* read ahead a window each time the scan reaches one */
+		if (!(cpos & (FAT_DIR_RA_SIZE - 1)))
+			fat_dir_readahead_chain(inode, iblock);
+		mapped_blocks = 1;
+		err = fat_bmap(inode, iblock, &phys, &mapped_blocks, 0);
+		if (err || !phys)
+			break;		/* beyond EOF or error */
+		bh = sb_bread(sb, phys);
+		if (!bh) {
+			printk(KERN_ERR "FAT: Directory bread(block %llu) "
+			       "failed\n", (llu)phys);
+			ret = -EIO;
+			break;
+		}
+
+		de = (struct fatx_dir_entry *)(bh->b_data
+				+ (cpos & (sb->s_blocksize - 1)));
+		endp = (struct fatx_dir_entry *)(bh->b_data + sb->s_blocksize);
+		for (; de < endp; de++, cpos += sizeof(*de)) {
+			if (FATX_END_OF_DIR(de)) {
+				brelse(bh);
+				goto out;
+			}
+			if (FATX_IS_FREE(de) || de->name_length > FATX_NAME)
+				continue;
+
+			/* in units of msdos entries, as fat_build_inode() */
+			i_pos = fat_make_i_pos(sb, bh,
+					       (struct msdos_dir_entry *)de);
+			tmp = fat_iget(sb, i_pos);
+			if (tmp) {
+				inum = tmp->i_ino;
+				iput(tmp);
+			} else
+				inum = iunique(sb, MSDOS_ROOT_INO);
+			if (filldir(dirent, de->name, de->name_length,
+				    cpos + 2, inum,
+				    (de->attr & ATTR_DIR) ? DT_DIR : DT_REG) < 0) {
+				brelse(bh);
+				goto out;
+			}
+			filp->f_pos = cpos + sizeof(*de) + 2;
+		}
+		brelse(bh);
+		filp->f_pos = cpos + 2;
+	}
+out:
+	unlock_super(sb);
+	return ret;
+}
+
 static int fat_readdir(struct file *filp, void *dirent, filldir_t filldir)
 {
 	struct inode *inode = filp->f_path.dentry->d_inode;
+
+	if (MSDOS_SB(inode->i_sb)->options.isfatx)
+		return fatx_readdir(filp, dirent, filldir);
 	return __fat_readdir(inode, filp, dirent, filldir, 0, 0);
 }
 
@@ -773,6 +1097,8 @@ static int fat_dir_ioctl(struct inode *inode, struct file *filp,
 		short_only = 0;
 		both = 1;
 		break;
+	case FAT_IOCTL_VERIFY:
+		return fat_ioctl_verify(inode, (void __user *)arg);
 	default:
 		return fat_generic_ioctl(inode, filp, cmd, arg);
 	}
@@ -813,6 +1139,8 @@ static long fat_compat_dir_ioctl(struct file *filp, unsigned cmd,
 		short_only = 0;
 		both = 1;
 		break;
+	case FAT_IOCTL_VERIFY:
+		return fat_ioctl_verify(inode, compat_ptr(arg));
 	default:
 		return -ENOIOCTLCMD;
 	}
@@ -929,19 +1257,47 @@ int fat_scan(struct inode *dir, const unsigned char *name,
 	     struct fat_slot_info *sinfo)
 {
 	struct super_block *sb = dir->i_sb;
+	struct fat_dir_index_entry *cursor = NULL;
+	struct fat_dir_index *idx;
+	loff_t pos;
 
 	sinfo->slot_off = 0;
 	sinfo->bh = NULL;
+	idx = fat_dir_index_lookup(dir);
+	if (idx) {
+		u32 hash = fat_short_hash(name);
+
+		while ((pos = fat_dir_index_find(idx, hash, &cursor)) >= 0) {
+			/* not sequential, so don't let fat_get_entry() use bh */
+			brelse(sinfo->bh);
+			sinfo->bh = NULL;
+			sinfo->slot_off = pos;
+			if (fat_get_entry(dir, &sinfo->slot_off, &sinfo->bh,
+					  &sinfo->de) < 0)
+				break;
+			if (IS_FREE(sinfo->de->name) ||
+			    (sinfo->de->attr & ATTR_VOLUME))
+				continue;
+			if (!strncmp(sinfo->de->name, name, MSDOS_NAME))
+				goto found;
+		}
+		brelse(sinfo->bh);
+		sinfo->bh = NULL;
+		return -ENOENT;
+	}
+
 	while (fat_get_short_entry(dir, &sinfo->slot_off, &sinfo->bh,
 				   &sinfo->de) >= 0) {
-		if (!strncmp(sinfo->de->name, name, MSDOS_NAME)) {
-			sinfo->slot_off -= sizeof(*sinfo->de);
-			sinfo->nr_slots = 1;
-			sinfo->i_pos = fat_make_i_pos(sb, sinfo->bh, sinfo->de);
-			return 0;
-		}
+		if (!strncmp(sinfo->de->name, name, MSDOS_NAME))
+			goto found;
 	}
 	return -ENOENT;
+
+found:
+	sinfo->slot_off -= sizeof(*sinfo->de);
+	sinfo->nr_slots = 1;
+	sinfo->i_pos = fat_make_i_pos(sb, sinfo->bh, sinfo->de);
+	return 0;
 }
 
 EXPORT_SYMBOL_GPL(fat_scan);
@@ -985,8 +1341,22 @@ int fat_remove_entries(struct inode *dir, struct fat_slot_info *sinfo)
 {
 	struct msdos_dir_entry *de;
 	struct buffer_head *bh;
+	struct fat_dir_index *idx;
 	int err = 0, nr_slots;
 
+	/* Drop the names of the slots, and they are free after this */
+	idx = fat_dir_index_get(dir);
+	if (idx) {
+		loff_t pos = sinfo->slot_off;
+
+		for (nr_slots = 0; nr_slots < sinfo->nr_slots; nr_slots++) {
+			fat_dir_index_remove(idx, pos);
+			pos += sizeof(*de);
+		}
+		if (sinfo->slot_off < idx->free_hint)
+			idx->free_hint = sinfo->slot_off;
+	}
+
 	/*
 	 * First stage: Remove the shortname. By this, the directory
 	 * entry is removed.
@@ -1155,6 +1525,57 @@ error:
 
 EXPORT_SYMBOL_GPL(fat_alloc_new_dir);
 
+/* Rebuild the longname from the slots of a new record */
+static void fat_slots_to_unicode(struct msdos_dir_slot *ds, int nr_slots,
+				 wchar_t *unicode)
+{
+	int offset;
+
+	while (nr_slots--) {
+		offset = ((ds->id & ~0x40) - 1) * 13;
+		fat16_towchar(unicode + offset, ds->name0_4, 5);
+		fat16_towchar(unicode + offset + 5, ds->name5_10, 6);
+		fat16_towchar(unicode + offset + 11, ds->name11_12, 2);
+		if (ds->id & 0x40)
+			unicode[offset + 13] = 0;
+		ds++;
+	}
+}
+
+/*
+ * Add the names of the record just written by fat_add_entries() to the
+ * index. If that fails, the index can't be coherent anymore, so drop it.
+ */
+static void fat_dir_index_add_slots(struct inode *dir,
+				    struct fat_dir_index *idx, void *slots,
+				    struct fat_slot_info *sinfo)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(dir->i_sb);
+	int nr_long = sinfo->nr_slots - 1;
+	struct msdos_dir_entry *de = (struct msdos_dir_entry *)slots + nr_long;
+	wchar_t *unicode = NULL;
+	int err;
+
+	err = fat_dir_index_insert(idx, fat_short_hash(de->name),
+				   sinfo->slot_off + nr_long * sizeof(*de));
+	if (!err && sbi->options.isvfat) {
+		if (nr_long) {
+			unicode = __getname();
+			if (!unicode)
+				err = -ENOMEM;
+			else
+				fat_slots_to_unicode(slots, nr_long, unicode);
+		}
+		if (!err)
+			err = fat_dir_index_insert_names(sbi, idx, de, unicode,
+							 sinfo->slot_off);
+		if (unicode)
+			__putname(unicode);
+	}
+	if (err)
+		fat_dir_index_free(dir);
+}
+
 static int fat_add_new_entries(struct inode *dir, void *slots, int nr_slots,
 			       int *nr_cluster, struct msdos_dir_entry **de,
 			       struct buffer_head **bh, loff_t *i_pos)
@@ -1246,15 +1667,22 @@ int fat_add_entries(struct inode *dir, void *slots, int nr_slots,
 	struct msdos_sb_info *sbi = MSDOS_SB(sb);
 	struct buffer_head *bh, *prev, *bhs[3]; /* 32*slots (672bytes) */
 	struct msdos_dir_entry *de;
+	struct fat_dir_index *idx;
+	void *new_slots = slots;
 	int err, free_slots, i, nr_bhs;
-	loff_t pos, i_pos;
+	loff_t pos, i_pos, first_free;
 
 	sinfo->nr_slots = nr_slots;
+	idx = fat_dir_index_get(dir);
 
-	/* First stage: search free direcotry entries */
+	/*
+	 * First stage: search free direcotry entries. If dir is indexed,
+	 * there is no free entry before the hint.
+	 */
 	free_slots = nr_bhs = 0;
 	bh = prev = NULL;
-	pos = 0;
+	pos = idx ? idx->free_hint : 0;
+	first_free = -1;
 	err = -ENOSPC;
 	while (fat_get_entry(dir, &pos, &bh, &de) > -1) {
 		/* check the maximum size of directory */
@@ -1267,6 +1695,8 @@ int fat_add_entries(struct inode *dir, void *slots, int nr_slots,
 				goto error;
 		}
 		if (IS_FREE(de->name)) {
+			if (first_free < 0)
+				first_free = pos - sizeof(*de);
 			if (prev != bh) {
 				get_bh(bh);
 				bhs[nr_bhs] = prev = bh;
@@ -1363,6 +1793,15 @@ found:
 	sinfo->bh = bh;
 	sinfo->i_pos = fat_make_i_pos(sb, sinfo->bh, sinfo->de);
 
+	if (idx) {
+		/* the free entries before first_free weren't enough */
+		if (first_free < 0 || first_free == pos)
+			idx->free_hint = pos + sinfo->nr_slots * sizeof(*de);
+		else
+			idx->free_hint = first_free;
+		fat_dir_index_add_slots(dir, idx, new_slots, sinfo);
+	}
+
 	return 0;
 
 error:
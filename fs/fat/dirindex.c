@@ -0,0 +1,358 @@
+/*
+ *  linux/fs/fat/dirindex.c
+ *
+ *  In-memory name index of large directories (the "dirhash" option).
+ *
+ *  Lookups in a directory are linear scans of its entries, so creating
+ *  N files in one directory costs O(N^2).  With "dirhash", the first
+ *  lookup in a large directory builds a hash table of the name hashes
+ *  of its entries, keyed by the name hash and by the slot position.
+ *  A hash only gives the candidate positions, each is verified against
+ *  the directory entry on disk, so the index never has to be exact
+ *  about collisions.  It has to be exact about positions: dir.c keeps
+ *  it coherent on every fat_add_entries() and fat_remove_entries().
+ *
+ *  The index and its free slot hint are protected by the directory's
+ *  ->i_mutex.  The indexed directories are on an LRU list, and the
+ *  shrinker drops the indexes of the least recently used ones.
+ */
+
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/hash.h>
+#include <linux/dcache.h>
+#include "fat.h"
+
+#define FAT_DIR_INDEX_MIN_BITS	6
+#define FAT_DIR_INDEX_MAX_BITS	13
+
+struct fat_dir_index_entry {
+	struct hlist_node name_node;	/* on ->name_hash */
+	struct hlist_node pos_node;	/* on ->pos_hash */
+	loff_t pos;			/* slot position of the name */
+	u32 hash;			/* name hash */
+};
+
+static LIST_HEAD(fat_dir_index_lru);
+static DEFINE_SPINLOCK(fat_dir_index_lock);
+static atomic_t fat_nr_dir_index_entries = ATOMIC_INIT(0);
+
+static struct kmem_cache *fat_dir_index_cachep;
+
+static inline struct hlist_head *fat_name_bucket(struct fat_dir_index *idx,
+						 u32 hash)
+{
+	return &idx->name_hash[hash_32(hash, idx->bits)];
+}
+
+static inline struct hlist_head *fat_pos_bucket(struct fat_dir_index *idx,
+						loff_t pos)
+{
+	u32 slot = pos >> MSDOS_DIR_BITS;
+
+	return &idx->pos_hash[hash_32(slot, idx->bits)];
+}
+
+static struct hlist_head *fat_dir_index_alloc_table(unsigned int bits)
+{
+	struct hlist_head *table;
+	unsigned int i;
+
+	table = kmalloc(sizeof(*table) << bits, GFP_NOFS);
+	if (table) {
+		for (i = 0; i < (1U << bits); i++)
+			INIT_HLIST_HEAD(&table[i]);
+	}
+	return table;
+}
+
+/**
+ * fat_dir_index_alloc - allocate an empty index
+ * @dir: the directory to index
+ *
+ * The hash tables are sized by the current size of @dir, and grow
+ * while entries are inserted.  The index isn't visible until it is
+ * attached by fat_dir_index_attach().
+ */
+struct fat_dir_index *fat_dir_index_alloc(struct inode *dir)
+{
+	struct fat_dir_index *idx;
+	unsigned long nr_entries;
+	unsigned int bits;
+
+	nr_entries = dir->i_size >> MSDOS_DIR_BITS;
+	bits = FAT_DIR_INDEX_MIN_BITS;
+	while (bits < FAT_DIR_INDEX_MAX_BITS && (1UL << bits) < nr_entries)
+		bits++;
+
+	idx = kmalloc(sizeof(*idx), GFP_NOFS);
+	if (!idx)
+		return NULL;
+	idx->dir = dir;
+	INIT_LIST_HEAD(&idx->lru);
+	idx->free_hint = 0;
+	idx->nr_entries = 0;
+	idx->bits = bits;
+	idx->name_hash = fat_dir_index_alloc_table(bits);
+	idx->pos_hash = fat_dir_index_alloc_table(bits);
+	if (!idx->name_hash || !idx->pos_hash) {
+		kfree(idx->name_hash);
+		kfree(idx->pos_hash);
+		kfree(idx);
+		return NULL;
+	}
+	return idx;
+}
+
+/**
+ * fat_dir_index_release - free an index which isn't attached
+ * @idx: the index
+ */
+void fat_dir_index_release(struct fat_dir_index *idx)
+{
+	struct fat_dir_index_entry *entry;
+	struct hlist_node *node, *next;
+	unsigned int i;
+
+	for (i = 0; i < (1U << idx->bits); i++) {
+		hlist_for_each_entry_safe(entry, node, next,
+					  &idx->name_hash[i], name_node)
+			kmem_cache_free(fat_dir_index_cachep, entry);
+	}
+	atomic_sub(idx->nr_entries, &fat_nr_dir_index_entries);
+	kfree(idx->name_hash);
+	kfree(idx->pos_hash);
+	kfree(idx);
+}
+
+/* Doubles the hash tables. On failure, the index just stays smaller. */
+static void fat_dir_index_grow(struct fat_dir_index *idx)
+{
+	struct hlist_head *old_name = idx->name_hash, *name_hash, *pos_hash;
+	struct fat_dir_index_entry *entry;
+	struct hlist_node *node, *next;
+	unsigned int i, old_bits = idx->bits;
+
+	name_hash = fat_dir_index_alloc_table(old_bits + 1);
+	pos_hash = fat_dir_index_alloc_table(old_bits + 1);
+	if (!name_hash || !pos_hash) {
+		kfree(name_hash);
+		kfree(pos_hash);
+		return;
+	}
+
+	kfree(idx->pos_hash);
+	idx->name_hash = name_hash;
+	idx->pos_hash = pos_hash;
+	idx->bits = old_bits + 1;
+	for (i = 0; i < (1U << old_bits); i++) {
+		hlist_for_each_entry_safe(entry, node, next, &old_name[i],
+					  name_node) {
+			hlist_add_head(&entry->name_node,
+				       fat_name_bucket(idx, entry->hash));
+			hlist_add_head(&entry->pos_node,
+				       fat_pos_bucket(idx, entry->pos));
+		}
+	}
+	kfree(old_name);
+}
+
+/**
+ * fat_dir_index_insert - add a name hash to the index
+ * @idx: the index
+ * @hash: hash of the name
+ * @pos: position of the first slot of the name
+ */
+int fat_dir_index_insert(struct fat_dir_index *idx, u32 hash, loff_t pos)
+{
+	struct fat_dir_index_entry *entry;
+
+	entry = kmem_cache_alloc(fat_dir_index_cachep, GFP_NOFS);
+	if (!entry)
+		return -ENOMEM;
+	entry->hash = hash;
+	entry->pos = pos;
+	hlist_add_head(&entry->name_node, fat_name_bucket(idx, hash));
+	hlist_add_head(&entry->pos_node, fat_pos_bucket(idx, pos));
+	idx->nr_entries++;
+	atomic_inc(&fat_nr_dir_index_entries);
+
+	if (idx->nr_entries > (2 << idx->bits) &&
+	    idx->bits < FAT_DIR_INDEX_MAX_BITS)
+		fat_dir_index_grow(idx);
+	return 0;
+}
+
+/**
+ * fat_dir_index_remove - remove all names at a slot position
+ * @idx: the index
+ * @pos: position of the slot
+ */
+void fat_dir_index_remove(struct fat_dir_index *idx, loff_t pos)
+{
+	struct fat_dir_index_entry *entry;
+	struct hlist_node *node, *next;
+
+	hlist_for_each_entry_safe(entry, node, next, fat_pos_bucket(idx, pos),
+				  pos_node) {
+		if (entry->pos != pos)
+			continue;
+		hlist_del(&entry->pos_node);
+		hlist_del(&entry->name_node);
+		kmem_cache_free(fat_dir_index_cachep, entry);
+		idx->nr_entries--;
+		atomic_dec(&fat_nr_dir_index_entries);
+	}
+}
+
+/**
+ * fat_dir_index_find - find the next candidate position of a name
+ * @idx: the index
+ * @hash: hash of the name
+ * @cursor: NULL for the first call, then the previous result
+ *
+ * Returns the position of the next entry having @hash, or -1.
+ */
+loff_t fat_dir_index_find(struct fat_dir_index *idx, u32 hash,
+			  struct fat_dir_index_entry **cursor)
+{
+	struct fat_dir_index_entry *entry = *cursor;
+	struct hlist_node *node;
+
+	if (entry)
+		node = entry->name_node.next;
+	else
+		node = fat_name_bucket(idx, hash)->first;
+	for (; node; node = node->next) {
+		entry = hlist_entry(node, struct fat_dir_index_entry,
+				    name_node);
+		if (entry->hash == hash) {
+			*cursor = entry;
+			return entry->pos;
+		}
+	}
+	return -1;
+}
+
+/**
+ * fat_dir_index_get - return the index of a directory
+ * @dir: the directory, ->i_mutex must be held
+ *
+ * Returns NULL if @dir has no index, otherwise marks it recently used.
+ */
+struct fat_dir_index *fat_dir_index_get(struct inode *dir)
+{
+	struct fat_dir_index *idx = MSDOS_I(dir)->i_dir_index;
+
+	if (idx) {
+		spin_lock(&fat_dir_index_lock);
+		list_move(&idx->lru, &fat_dir_index_lru);
+		spin_unlock(&fat_dir_index_lock);
+	}
+	return idx;
+}
+
+/**
+ * fat_dir_index_attach - make a built index visible
+ * @dir: the directory, ->i_mutex must be held
+ * @idx: the index from fat_dir_index_alloc()
+ */
+void fat_dir_index_attach(struct inode *dir, struct fat_dir_index *idx)
+{
+	BUG_ON(MSDOS_I(dir)->i_dir_index);
+
+	spin_lock(&fat_dir_index_lock);
+	MSDOS_I(dir)->i_dir_index = idx;
+	list_add(&idx->lru, &fat_dir_index_lru);
+	spin_unlock(&fat_dir_index_lock);
+}
+
+/**
+ * fat_dir_index_free - drop the index of a directory
+ * @dir: the directory
+ *
+ * Called with ->i_mutex held, or from ->clear_inode().
+ */
+void fat_dir_index_free(struct inode *dir)
+{
+	struct fat_dir_index *idx;
+
+	spin_lock(&fat_dir_index_lock);
+	idx = MSDOS_I(dir)->i_dir_index;
+	if (idx) {
+		MSDOS_I(dir)->i_dir_index = NULL;
+		list_del(&idx->lru);
+	}
+	spin_unlock(&fat_dir_index_lock);
+
+	if (idx)
+		fat_dir_index_release(idx);
+}
+
+/* Directories looked at by one pass of the shrinker */
+#define FAT_DIR_INDEX_SHRINK_BATCH	16
+
+/*
+ * The index is used under ->i_mutex of the directory, so the shrinker
+ * only drops the indexes of the directories which aren't busy.  The
+ * least recently used ones are pinned with igrab() under the LRU lock,
+ * which can't be held while trying ->i_mutex, and then looked at one by
+ * one.  iput() may write the inode, so only __GFP_FS allocations shrink.
+ */
+static int fat_dir_index_shrink(int nr_to_scan, gfp_t gfp_mask)
+{
+	struct inode *batch[FAT_DIR_INDEX_SHRINK_BATCH];
+	struct fat_dir_index *idx;
+	int i, n = 0;
+
+	if (nr_to_scan) {
+		if (!(gfp_mask & __GFP_FS))
+			return -1;
+
+		spin_lock(&fat_dir_index_lock);
+		list_for_each_entry_reverse(idx, &fat_dir_index_lru, lru) {
+			if (nr_to_scan <= 0 || n == FAT_DIR_INDEX_SHRINK_BATCH)
+				break;
+			/* NULL if it's being freed, which drops the index */
+			batch[n] = igrab(idx->dir);
+			if (!batch[n])
+				continue;
+			nr_to_scan -= idx->nr_entries;
+			n++;
+		}
+		spin_unlock(&fat_dir_index_lock);
+
+		for (i = 0; i < n; i++) {
+			if (mutex_trylock(&batch[i]->i_mutex)) {
+				fat_dir_index_free(batch[i]);
+				mutex_unlock(&batch[i]->i_mutex);
+			}
+			iput(batch[i]);
+		}
+	}
+	return (atomic_read(&fat_nr_dir_index_entries) / 100)
+		* sysctl_vfs_cache_pressure;
+}
+
+static struct shrinker fat_dir_index_shrinker = {
+	.shrink = fat_dir_index_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+int __init fat_dir_index_init(void)
+{
+	fat_dir_index_cachep = kmem_cache_create("fat_dir_index",
+				sizeof(struct fat_dir_index_entry),
+				0, SLAB_RECLAIM_ACCOUNT|SLAB_MEM_SPREAD,
+				NULL);
+	if (fat_dir_index_cachep == NULL)
+		return -ENOMEM;
+	register_shrinker(&fat_dir_index_shrinker);
+	return 0;
+}
+
+void fat_dir_index_destroy(void)
+{
+	unregister_shrinker(&fat_dir_index_shrinker);
+	kmem_cache_destroy(fat_dir_index_cachep);
+}
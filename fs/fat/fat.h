@@ -6,6 +6,8 @@
 #include <linux/nls.h>
 #include <linux/fs.h>
 #include <linux/mutex.h>
+#include <linux/completion.h>
+#include <linux/rbtree.h>
 #include <linux/msdos_fs.h>
 #include <linux/fatx_fs.h>
 
@@ -41,7 +43,11 @@ struct fat_mount_options {
 		 nocase:1,	  /* Does this need case conversion? 0=need case conversion*/
 		 usefree:1,	  /* Use free_clusters for FAT32 */
 		 tz_utc:1,	  /* Filesystem timestamps are in UTC */
-		 rodir:1;	  /* allow ATTR_RO for directory */
+		 rodir:1,	  /* allow ATTR_RO for directory */
+		 freemap:1,	  /* keep a free cluster bitmap in memory */
+		 prealloc:1,	  /* preallocate clusters for appending writes */
+		 dirhash:1,	  /* index the names of large directories */
+		 lazymirror:1;	  /* update backup FATs at sync time */
 };
 
 #define FAT_HASH_BITS	8
@@ -67,6 +73,16 @@ struct msdos_sb_info {
 	unsigned int prev_free;      /* previously allocated cluster number */
 	unsigned int free_clusters;  /* -1 if undefined */
 	unsigned int free_clus_valid; /* is free_clusters valid? */
+	unsigned long *free_map;     /* bitmap of used clusters, or NULL */
+	/* background count of the free clusters, see fatent.c */
+	struct task_struct *free_count_task;
+	struct completion free_count_done;
+	struct completion free_count_begun; /* first chunk counted */
+	int free_scan_next;	     /* entries before this are counted */
+	int free_scan_count;	     /* free clusters counted so far */
+	unsigned long *free_scan_map; /* bitmap being built, or NULL */
+	int free_scan_abort;	     /* stop counting for umount */
+	unsigned long *mirror_map;   /* FAT blocks to copy to the backups */
 	struct fat_mount_options options;
 	struct nls_table *nls_disk;  /* Codepage used on disk */
 	struct nls_table *nls_io;    /* Charset used for input and display */
@@ -87,14 +103,25 @@ struct msdos_sb_info {
  * MS-DOS file system inode data in memory
  */
 struct msdos_inode_info {
-	spinlock_t cache_lru_lock;
-	struct list_head cache_lru;
+	spinlock_t cache_lock;
+	struct rb_root cache_tree;	/* runs of the cluster chain */
 	int nr_caches;
+	struct list_head cache_lru;	/* on the LRU of inodes having caches */
 	/* for avoiding the race between fat_free() and fat_get_cluster() */
 	unsigned int cache_valid_id;
 
-	/* NOTE: mmu_private is 64bits, so must hold ->i_mutex to access */
+	/*
+	 * NOTE: mmu_private is 64bits, so must hold ->i_mutex to access.
+	 * Growing it is also serialized by ->i_prealloc_mutex, which
+	 * protects the clusters chained after it. The prealloc mutex
+	 * nests inside ->i_mutex and outside lock_fat().
+	 */
 	loff_t mmu_private;	/* physically allocated size */
+	struct mutex i_prealloc_mutex;
+	int i_prealloc;		/* preallocated clusters not used yet */
+	int i_prealloc_win;	/* size of the next preallocation */
+	/* name index of a large directory, protected by ->i_mutex */
+	struct fat_dir_index *i_dir_index;
 
 	int i_start;		/* first cluster or 0 */
 	int i_logstart;		/* logical first cluster */
@@ -117,6 +144,16 @@ static inline struct msdos_sb_info *MSDOS_SB(struct super_block *sb)
 	return sb->s_fs_info;
 }
 
+static inline void lock_fat(struct msdos_sb_info *sbi)
+{
+	mutex_lock(&sbi->fat_lock);
+}
+
+static inline void unlock_fat(struct msdos_sb_info *sbi)
+{
+	mutex_unlock(&sbi->fat_lock);
+}
+
 static inline struct msdos_inode_info *MSDOS_I(struct inode *inode)
 {
 	return container_of(inode, struct msdos_inode_info, vfs_inode);
@@ -228,6 +265,31 @@ extern int fat_get_cluster(struct inode *inode, int cluster,
 extern int fat_bmap(struct inode *inode, sector_t sector, sector_t *phys,
 		    unsigned long *mapped_blocks, int create);
 
+/* fat/dirindex.c */
+struct fat_dir_index_entry;
+
+struct fat_dir_index {
+	struct inode *dir;
+	struct list_head lru;		/* on the LRU of indexed directories */
+	loff_t free_hint;		/* no free slot before this position */
+	int nr_entries;
+	unsigned int bits;		/* log2 of the hash table size */
+	struct hlist_head *name_hash;	/* entries by name hash */
+	struct hlist_head *pos_hash;	/* entries by slot position */
+};
+
+extern struct fat_dir_index *fat_dir_index_alloc(struct inode *dir);
+extern void fat_dir_index_release(struct fat_dir_index *idx);
+extern int fat_dir_index_insert(struct fat_dir_index *idx, u32 hash,
+				loff_t pos);
+extern void fat_dir_index_remove(struct fat_dir_index *idx, loff_t pos);
+extern loff_t fat_dir_index_find(struct fat_dir_index *idx, u32 hash,
+				 struct fat_dir_index_entry **cursor);
+extern struct fat_dir_index *fat_dir_index_get(struct inode *dir);
+extern void fat_dir_index_attach(struct inode *dir,
+				 struct fat_dir_index *idx);
+extern void fat_dir_index_free(struct inode *dir);
+
 /* fat/dir.c */
 extern const struct file_operations fat_dir_operations;
 extern int fat_search_long(struct inode *inode, const unsigned char *name,
@@ -288,6 +350,13 @@ extern int fat_alloc_clusters(struct inode *inode, int *cluster,
 			      int nr_cluster);
 extern int fat_free_clusters(struct inode *inode, int cluster);
 extern int fat_count_free_clusters(struct super_block *sb);
+extern int fat_mirror_flush(struct super_block *sb);
+extern void fat_start_count_free_clusters(struct super_block *sb);
+extern void fat_stop_count_free_clusters(struct super_block *sb);
+extern int fat_counting_free_clusters(struct super_block *sb);
+extern unsigned int fat_estimate_free_clusters(struct super_block *sb);
+extern int fat_ent_scan_refs(struct super_block *sb, unsigned long *used,
+			     unsigned long *ref, struct fat_verify_info *info);
 
 /* fat/file.c */
 extern int fat_generic_ioctl(struct inode *inode, struct file *filp,
@@ -296,6 +365,7 @@ extern const struct file_operations fat_file_operations;
 extern const struct inode_operations fat_file_inode_operations;
 extern int fat_setattr(struct dentry * dentry, struct iattr * attr);
 extern void fat_truncate(struct inode *inode);
+extern int fat_drop_prealloc(struct inode *inode);
 extern int fat_getattr(struct vfsmount *mnt, struct dentry *dentry,
 		       struct kstat *stat);
 
@@ -307,7 +377,8 @@ extern struct inode *fat_build_inode(struct super_block *sb,
 			struct msdos_dir_entry *de, loff_t i_pos);
 extern int fat_sync_inode(struct inode *inode);
 extern int fat_fill_super(struct super_block *sb, void *data, int silent,
-			const struct inode_operations *fs_dir_inode_ops, int isvfat);
+			const struct inode_operations *fs_dir_inode_ops,
+			int isvfat, int isfatx);
 
 extern int fat_flush_inodes(struct super_block *sb, struct inode *i1,
 		            struct inode *i2);
@@ -322,8 +393,14 @@ extern void fat_time_unix2fat(struct msdos_sb_info *sbi, struct timespec *ts,
 			      __le16 *time, __le16 *date, u8 *time_cs);
 extern int fat_sync_bhs(struct buffer_head **bhs, int nr_bhs);
 
+/* fat/verify.c */
+extern int fat_ioctl_verify(struct inode *dir,
+			    struct fat_verify_info __user *arg);
+
 int fat_cache_init(void);
 void fat_cache_destroy(void);
+int fat_dir_index_init(void);
+void fat_dir_index_destroy(void);
 
 /* helper for printk */
 typedef unsigned long long	llu;
@@ -7,6 +7,9 @@
 #include <linux/fs.h>
 #include <linux/msdos_fs.h>
 #include <linux/blkdev.h>
+#include <linux/vmalloc.h>
+#include <linux/kthread.h>
+#include <linux/math64.h>
 #include "fat.h"
 
 struct fatent_operations {
@@ -15,6 +18,7 @@ struct fatent_operations {
 	int (*ent_bread)(struct super_block *, struct fat_entry *,
 			 int, sector_t);
 	int (*ent_get)(struct fat_entry *);
+	int (*ent_bad)(struct fat_entry *);
 	void (*ent_put)(struct fat_entry *, int);
 	int (*ent_next)(struct fat_entry *);
 };
@@ -114,7 +118,7 @@ static int fat_ent_bread(struct super_block *sb, struct fat_entry *fatent,
 	return 0;
 }
 
-static int fat12_ent_get(struct fat_entry *fatent)
+static int fat12_ent_raw(struct fat_entry *fatent)
 {
 	u8 **ent12_p = fatent->u.ent12_p;
 	int next;
@@ -126,7 +130,12 @@ static int fat12_ent_get(struct fat_entry *fatent)
 		next = (*ent12_p[1] << 8) | *ent12_p[0];
 	spin_unlock(&fat12_entry_lock);
 
-	next &= 0x0fff;
+	return next & 0x0fff;
+}
+
+static int fat12_ent_get(struct fat_entry *fatent)
+{
+	int next = fat12_ent_raw(fatent);
 	if (next >= BAD_FAT12)
 		next = FAT_ENT_EOF;
 	return next;
@@ -150,6 +159,22 @@ static int fat32_ent_get(struct fat_entry *fatent)
 	return next;
 }
 
+/* ent_get() reads a bad cluster mark as FAT_ENT_EOF, these tell it apart */
+static int fat12_ent_bad(struct fat_entry *fatent)
+{
+	return fat12_ent_raw(fatent) == BAD_FAT12;
+}
+
+static int fat16_ent_bad(struct fat_entry *fatent)
+{
+	return le16_to_cpu(*fatent->u.ent16_p) == BAD_FAT16;
+}
+
+static int fat32_ent_bad(struct fat_entry *fatent)
+{
+	return (le32_to_cpu(*fatent->u.ent32_p) & 0x0fffffff) == BAD_FAT32;
+}
+
 static void fat12_ent_put(struct fat_entry *fatent, int new)
 {
 	u8 **ent12_p = fatent->u.ent12_p;
@@ -251,6 +276,7 @@ static struct fatent_operations fat12_ops = {
 	.ent_set_ptr	= fat12_ent_set_ptr,
 	.ent_bread	= fat12_ent_bread,
 	.ent_get	= fat12_ent_get,
+	.ent_bad	= fat12_ent_bad,
 	.ent_put	= fat12_ent_put,
 	.ent_next	= fat12_ent_next,
 };
@@ -260,6 +286,7 @@ static struct fatent_operations fat16_ops = {
 	.ent_set_ptr	= fat16_ent_set_ptr,
 	.ent_bread	= fat_ent_bread,
 	.ent_get	= fat16_ent_get,
+	.ent_bad	= fat16_ent_bad,
 	.ent_put	= fat16_ent_put,
 	.ent_next	= fat16_ent_next,
 };
@@ -269,20 +296,11 @@ static struct fatent_operations fat32_ops = {
 	.ent_set_ptr	= fat32_ent_set_ptr,
 	.ent_bread	= fat_ent_bread,
 	.ent_get	= fat32_ent_get,
+	.ent_bad	= fat32_ent_bad,
 	.ent_put	= fat32_ent_put,
 	.ent_next	= fat32_ent_next,
 };
 
-static inline void lock_fat(struct msdos_sb_info *sbi)
-{
-	mutex_lock(&sbi->fat_lock);
-}
-
-static inline void unlock_fat(struct msdos_sb_info *sbi)
-{
-	mutex_unlock(&sbi->fat_lock);
-}
-
 void fat_ent_access_init(struct super_block *sb)
 {
 	struct msdos_sb_info *sbi = MSDOS_SB(sb);
@@ -362,8 +380,8 @@ int fat_ent_read(struct inode *inode, struct fat_entry *fatent, int entry)
 }
 
 /* FIXME: We can write the blocks as more big chunk. */
-static int fat_mirror_bhs(struct super_block *sb, struct buffer_head **bhs,
-			  int nr_bhs)
+static int __fat_mirror_bhs(struct super_block *sb, struct buffer_head **bhs,
+			    int nr_bhs)
 {
 	struct msdos_sb_info *sbi = MSDOS_SB(sb);
 	struct buffer_head *c_bh;
@@ -393,6 +411,76 @@ error:
 	return err;
 }
 
+/*
+ * With the "lazymirror" option, the backup FATs are not written here.
+ * The changed blocks of the primary FAT are only marked in ->mirror_map,
+ * and fat_mirror_flush() copies them at ->write_super() time.
+ */
+static int fat_mirror_bhs(struct super_block *sb, struct buffer_head **bhs,
+			  int nr_bhs)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	int n;
+
+	if (!sbi->mirror_map || (sb->s_flags & MS_SYNCHRONOUS))
+		return __fat_mirror_bhs(sb, bhs, nr_bhs);
+
+	/* the changes of the blocks must be visible before the bits */
+	smp_mb();
+	for (n = 0; n < nr_bhs; n++)
+		set_bit(bhs[n]->b_blocknr - sbi->fat_start, sbi->mirror_map);
+	sb->s_dirt = 1;
+	return 0;
+}
+
+/**
+ * fat_mirror_flush - update the backup FATs
+ * @sb: the superblock
+ *
+ * Copies the blocks of the primary FAT changed since the last call into
+ * the backup FATs.  This is called from ->write_super(), so the FATs are
+ * identical again after sync(2), fsync(2) and umount.
+ */
+int fat_mirror_flush(struct super_block *sb)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	struct buffer_head *bh;
+	unsigned long block;
+	int err = 0;
+
+	if (!sbi->mirror_map)
+		return 0;
+
+	lock_fat(sbi);
+	block = 0;
+	while (1) {
+		block = find_next_bit(sbi->mirror_map, sbi->fat_length, block);
+		if (block >= sbi->fat_length)
+			break;
+		clear_bit(block, sbi->mirror_map);
+
+		bh = sb_bread(sb, sbi->fat_start + block);
+		if (!bh) {
+			printk(KERN_ERR "FAT: FAT read failed (blocknr %llu),"
+			       " backup FAT not updated\n",
+			       (llu)(sbi->fat_start + block));
+			set_bit(block, sbi->mirror_map);
+			err = -EIO;
+			break;
+		}
+		err = __fat_mirror_bhs(sb, &bh, 1);
+		brelse(bh);
+		if (err) {
+			set_bit(block, sbi->mirror_map);
+			break;
+		}
+		block++;
+	}
+	unlock_fat(sbi);
+
+	return err;
+}
+
 int fat_ent_write(struct inode *inode, struct fat_entry *fatent,
 		  int new, int wait)
 {
@@ -449,6 +537,94 @@ static void fat_collect_bhs(struct buffer_head **bhs, int *nr_bhs,
 	}
 }
 
+/* Writes the collected FAT blocks to the backup FATs, and releases them */
+static int fat_flush_alloc_bhs(struct inode *inode, struct buffer_head **bhs,
+			       int *nr_bhs)
+{
+	int i, err = 0;
+
+	if (inode_needs_sync(inode))
+		err = fat_sync_bhs(bhs, *nr_bhs);
+	if (!err)
+		err = fat_mirror_bhs(inode->i_sb, bhs, *nr_bhs);
+	for (i = 0; i < *nr_bhs; i++)
+		brelse(bhs[i]);
+	*nr_bhs = 0;
+	return err;
+}
+
+static int fat_scan_free_clusters(struct super_block *sb, int async);
+
+/*
+ * While the free clusters are counted in background, the entries
+ * before ->free_scan_next were counted already, so a change of those
+ * has to be applied to the running count as well.
+ */
+static inline void fat_scan_update(struct msdos_sb_info *sbi, int entry,
+				   int freed)
+{
+	if (entry >= sbi->free_scan_next)
+		return;
+	if (freed) {
+		sbi->free_scan_count++;
+		if (sbi->free_scan_map)
+			__clear_bit(entry, sbi->free_scan_map);
+	} else {
+		sbi->free_scan_count--;
+		if (sbi->free_scan_map)
+			__set_bit(entry, sbi->free_scan_map);
+	}
+}
+
+/*
+ * Find nr_cluster free clusters in the free cluster bitmap. A run of
+ * contiguous clusters at or after @hint is preferred, then one anywhere
+ * on the volume; if there is none, the first free clusters found from
+ * @hint are used.  Returns the number of clusters stored in @cluster.
+ */
+static int fat_free_map_find(struct msdos_sb_info *sbi, int hint,
+			     int *cluster, int nr_cluster)
+{
+	unsigned long *map = sbi->free_map;
+	unsigned long max = sbi->max_cluster;
+	unsigned long start, end, limit;
+	int pass, n;
+
+	if (hint < FAT_START_ENT || hint >= max)
+		hint = FAT_START_ENT;
+
+	for (pass = 0; pass < 2; pass++) {
+		start = pass ? FAT_START_ENT : hint;
+		limit = pass ? hint : max;
+		while (start < limit) {
+			start = find_next_zero_bit(map, limit, start);
+			if (start >= limit)
+				break;
+			end = find_next_bit(map, max, start);
+			if (end - start >= nr_cluster) {
+				for (n = 0; n < nr_cluster; n++)
+					cluster[n] = start + n;
+				return nr_cluster;
+			}
+			start = end;
+		}
+	}
+
+	/* No contiguous run, so take what we can find */
+	n = 0;
+	for (pass = 0; pass < 2 && n < nr_cluster; pass++) {
+		start = pass ? FAT_START_ENT : hint;
+		limit = pass ? hint : max;
+		while (n < nr_cluster) {
+			start = find_next_zero_bit(map, limit, start);
+			if (start >= limit)
+				break;
+			cluster[n++] = start++;
+		}
+	}
+	return n;
+}
+
 int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 {
 	struct super_block *sb = inode->i_sb;
@@ -458,8 +634,6 @@ int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 	struct buffer_head *bhs[MAX_BUF_PER_PAGE];
 	int i, count, err, nr_bhs, idx_clus;
 
-	BUG_ON(nr_cluster > (MAX_BUF_PER_PAGE / 2));	/* fixed limit */
-
 	lock_fat(sbi);
 	if (sbi->free_clusters != -1 && sbi->free_clus_valid &&
 	    sbi->free_clusters < nr_cluster) {
@@ -471,6 +645,58 @@ int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 	count = FAT_START_ENT;
 	fatent_init(&prev_ent);
 	fatent_init(&fatent);
+
+	/*
+	 * If the bitmap can't be built (no memory, or I/O error), the
+	 * freemap option is dropped, and while it is still being built in
+	 * background, just fall back to scanning the FAT.
+	 */
+	if (sbi->options.freemap && !sbi->free_map && !sbi->free_scan_next)
+		fat_scan_free_clusters(sb, 0);
+	if (sbi->free_map) {
+		if (fat_free_map_find(sbi, sbi->prev_free + 1, cluster,
+				      nr_cluster) < nr_cluster) {
+			err = -ENOSPC;
+			goto out;
+		}
+		for (i = 0; i < nr_cluster; i++) {
+			int entry = cluster[i];
+
+			err = fat_ent_read(inode, &fatent, entry);
+			if (err < 0)
+				goto out;
+			if (err != FAT_ENT_FREE) {
+				fat_fs_panic(sb, "%s: free cluster bitmap is "
+					     "out of sync (entry 0x%08x)",
+					     __func__, entry);
+				err = -EIO;
+				goto out;
+			}
+			err = 0;
+
+			ops->ent_put(&fatent, FAT_ENT_EOF);
+			if (prev_ent.nr_bhs)
+				ops->ent_put(&prev_ent, entry);
+
+			__set_bit(entry, sbi->free_map);
+			sbi->prev_free = entry;
+			if (sbi->free_clusters != -1)
+				sbi->free_clusters--;
+			sb->s_dirt = 1;
+			idx_clus++;
+
+			/* prev_ent is done, so the collected bhs can go */
+			if (nr_bhs + fatent.nr_bhs > MAX_BUF_PER_PAGE) {
+				err = fat_flush_alloc_bhs(inode, bhs, &nr_bhs);
+				if (err)
+					goto out;
+			}
+			fat_collect_bhs(bhs, &nr_bhs, &fatent);
+			prev_ent = fatent;
+		}
+		goto out;
+	}
+
 	fatent_set_entry(&fatent, sbi->prev_free + 1);
 	while (count < sbi->max_cluster) {
 		if (fatent.entry >= sbi->max_cluster)
@@ -490,15 +716,22 @@ int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 				if (prev_ent.nr_bhs)
 					ops->ent_put(&prev_ent, entry);
 
-				fat_collect_bhs(bhs, &nr_bhs, &fatent);
-
 				sbi->prev_free = entry;
 				if (sbi->free_clusters != -1)
 					sbi->free_clusters--;
+				fat_scan_update(sbi, entry, 0);
 				sb->s_dirt = 1;
 
 				cluster[idx_clus] = entry;
 				idx_clus++;
+
+				if (nr_bhs + fatent.nr_bhs > MAX_BUF_PER_PAGE) {
+					err = fat_flush_alloc_bhs(inode, bhs,
+								  &nr_bhs);
+					if (err)
+						goto out;
+				}
+				fat_collect_bhs(bhs, &nr_bhs, &fatent);
 				if (idx_clus == nr_cluster)
 					goto out;
 
@@ -576,6 +809,9 @@ int fat_free_clusters(struct inode *inode, int cluster)
 		}
 
 		ops->ent_put(&fatent, FAT_ENT_FREE);
+		if (sbi->free_map)
+			__clear_bit(fatent.entry, sbi->free_map);
+		fat_scan_update(sbi, fatent.entry, 1);
 		if (sbi->free_clusters != -1) {
 			sbi->free_clusters++;
 			sb->s_dirt = 1;
@@ -630,17 +866,67 @@ static void fat_ent_reada(struct super_block *sb, struct fat_entry *fatent,
 		sb_breadahead(sb, blocknr + i);
 }
 
-int fat_count_free_clusters(struct super_block *sb)
+/*
+ * Drops lock_fat() between the chunks of the background count, so that
+ * allocations aren't blocked for the whole pass.
+ */
+static int fat_scan_yield(struct super_block *sb, struct fat_entry *fatent,
+			  int *free)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+
+	fatent_brelse(fatent);
+	sbi->free_scan_count += *free;
+	sbi->free_scan_next = fatent->entry;
+	*free = 0;
+	unlock_fat(sbi);
+
+	/* fat_statfs() may be waiting for something to estimate from */
+	if (!completion_done(&sbi->free_count_begun))
+		complete_all(&sbi->free_count_begun);
+	cond_resched();
+
+	lock_fat(sbi);
+	return sbi->free_scan_abort ? -EINTR : 0;
+}
+
+/*
+ * Counts the free clusters by reading the whole FAT. With the "freemap"
+ * mount option this pass also builds the free cluster bitmap, which
+ * fat_alloc_clusters() and fat_free_clusters() keep up to date
+ * afterwards.  Called with lock_fat() held.  If async, lock_fat() is
+ * dropped between the chunks of the FAT.
+ */
+static int fat_scan_free_clusters(struct super_block *sb, int async)
 {
 	struct msdos_sb_info *sbi = MSDOS_SB(sb);
 	struct fatent_operations *ops = sbi->fatent_ops;
 	struct fat_entry fatent;
 	unsigned long reada_blocks, reada_mask, cur_block;
+	unsigned long *map = NULL, map_size = 0, start = 0;
 	int err = 0, free;
 
-	lock_fat(sbi);
-	if (sbi->free_clusters != -1 && sbi->free_clus_valid)
-		goto out;
+	if (sbi->options.freemap && !sbi->free_map) {
+		map_size = BITS_TO_LONGS(sbi->max_cluster) * sizeof(long);
+		map = vmalloc(map_size);
+		if (!map) {
+			printk(KERN_WARNING "FAT: not enough memory for the "
+			       "free cluster bitmap (dev %s), disabled\n",
+			       sb->s_id);
+			sbi->options.freemap = 0;
+		} else {
+			memset(map, 0, map_size);
+			/* the reserved entries are never free */
+			__set_bit(0, map);
+			__set_bit(1, map);
+			start = jiffies;
+		}
+	}
+	if (async) {
+		sbi->free_scan_map = map;
+		sbi->free_scan_count = 0;
+		sbi->free_scan_next = FAT_START_ENT;
+	}
 
 	reada_blocks = FAT_READA_SIZE >> sb->s_blocksize_bits;
 	reada_mask = reada_blocks - 1;
@@ -653,24 +939,236 @@ int fat_count_free_clusters(struct super_block *sb)
 		/* readahead of fat blocks */
 		if ((cur_block & reada_mask) == 0) {
 			unsigned long rest = sbi->fat_length - cur_block;
+
+			if (async && cur_block) {
+				err = fat_scan_yield(sb, &fatent, &free);
+				if (err)
+					break;
+			}
 			fat_ent_reada(sb, &fatent, min(reada_blocks, rest));
 		}
 		cur_block++;
 
 		err = fat_ent_read_block(sb, &fatent);
 		if (err)
-			goto out;
+			break;
 
 		do {
 			if (ops->ent_get(&fatent) == FAT_ENT_FREE)
 				free++;
+			else if (map)
+				__set_bit(fatent.entry, map);
 		} while (fat_ent_next(sbi, &fatent));
 	}
+	fatent_brelse(&fatent);
+	if (async) {
+		free += sbi->free_scan_count;
+		sbi->free_scan_next = 0;
+		sbi->free_scan_map = NULL;
+	}
+	if (err) {
+		/* don't read the whole FAT again on every allocation */
+		if (map && err != -EINTR) {
+			printk(KERN_WARNING "FAT: I/O error building the free "
+			       "cluster bitmap (dev %s), disabled\n",
+			       sb->s_id);
+			sbi->options.freemap = 0;
+		}
+		vfree(map);
+		return err;
+	}
 	sbi->free_clusters = free;
 	sbi->free_clus_valid = 1;
 	sb->s_dirt = 1;
+
+	if (map) {
+		sbi->free_map = map;
+		printk(KERN_INFO "FAT: free cluster bitmap for %s built in "
+		       "%u ms, using %lu KB\n", sb->s_id,
+		       jiffies_to_msecs(jiffies - start),
+		       (map_size + 1023) >> 10);
+	}
+	return 0;
+}
+
+/**
+ * fat_ent_scan_refs - read the whole FAT for fat_ioctl_verify()
+ * @sb: the volume
+ * @used: bitmap of the clusters which aren't free
+ * @ref: bitmap of the clusters some FAT entry points to
+ * @info: counts free, bad, invalid and cross-linked clusters
+ *
+ * lock_fat() is taken for one FAT block at a time, so that allocations
+ * aren't held off for the whole scan.  Bad clusters aren't counted as
+ * used, they belong to no chain.
+ */
+int fat_ent_scan_refs(struct super_block *sb, unsigned long *used,
+		      unsigned long *ref, struct fat_verify_info *info)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	struct fatent_operations *ops = sbi->fatent_ops;
+	struct fat_entry fatent;
+	unsigned long reada_blocks, reada_mask, cur_block;
+	int err = 0, next;
+
+	reada_blocks = FAT_READA_SIZE >> sb->s_blocksize_bits;
+	reada_mask = reada_blocks - 1;
+	cur_block = 0;
+
+	fatent_init(&fatent);
+	fatent_set_entry(&fatent, FAT_START_ENT);
+	while (fatent.entry < sbi->max_cluster) {
+		if ((cur_block & reada_mask) == 0) {
+			unsigned long rest = sbi->fat_length - cur_block;
+			fat_ent_reada(sb, &fatent, min(reada_blocks, rest));
+			cond_resched();
+		}
+		cur_block++;
+
+		lock_fat(sbi);
+		err = fat_ent_read_block(sb, &fatent);
+		if (err) {
+			unlock_fat(sbi);
+			break;
+		}
+
+		do {
+			next = ops->ent_get(&fatent);
+			if (next == FAT_ENT_FREE) {
+				info->free_clusters++;
+				continue;
+			}
+			if (next == FAT_ENT_EOF && ops->ent_bad(&fatent)) {
+				info->bad_clusters++;
+				continue;
+			}
+			__set_bit(fatent.entry, used);
+			if (next == FAT_ENT_EOF)
+				continue;
+			if (next < FAT_START_ENT || next >= sbi->max_cluster)
+				info->invalid++;
+			else if (__test_and_set_bit(next, ref))
+				info->cross_linked++;
+		} while (fat_ent_next(sbi, &fatent));
+		unlock_fat(sbi);
+	}
 	fatent_brelse(&fatent);
-out:
+	return err;
+}
+
+/* Does the FAT have to be read for the count, or for the bitmap? */
+static inline int fat_need_scan(struct msdos_sb_info *sbi)
+{
+	return sbi->free_clusters == -1 || !sbi->free_clus_valid ||
+		(sbi->options.freemap && !sbi->free_map);
+}
+
+int fat_count_free_clusters(struct super_block *sb)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	int err = 0;
+
+	lock_fat(sbi);
+	if (fat_need_scan(sbi))
+		err = fat_scan_free_clusters(sb, 0);
 	unlock_fat(sbi);
 	return err;
 }
+
+static int fat_count_thread(void *data)
+{
+	struct super_block *sb = data;
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	int err = 0;
+
+	lock_fat(sbi);
+	if (fat_need_scan(sbi))
+		err = fat_scan_free_clusters(sb, 1);
+	unlock_fat(sbi);
+	if (err && err != -EINTR) {
+		printk(KERN_WARNING "FAT: couldn't count free clusters "
+		       "(dev %s, err %d)\n", sb->s_id, err);
+	}
+
+	if (!completion_done(&sbi->free_count_begun))
+		complete_all(&sbi->free_count_begun);
+	complete_and_exit(&sbi->free_count_done, 0);
+}
+
+/**
+ * fat_start_count_free_clusters - count the free clusters in background
+ * @sb: the superblock
+ *
+ * Called at mount for the freemap bitmap, and by the first fat_statfs()
+ * which needs the count.  Does nothing if the FAT doesn't have to be
+ * read, or if the count was started already.  Until the count is done,
+ * fat_statfs() reports the estimate by fat_estimate_free_clusters()
+ * instead of reading the FAT itself.
+ */
+void fat_start_count_free_clusters(struct super_block *sb)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	struct task_struct *task;
+
+	lock_fat(sbi);
+	if (sbi->free_count_task || !fat_need_scan(sbi))
+		goto out;
+
+	init_completion(&sbi->free_count_done);
+	init_completion(&sbi->free_count_begun);
+	sbi->free_scan_abort = 0;
+	task = kthread_run(fat_count_thread, sb, "fat_count/%s", sb->s_id);
+	if (IS_ERR(task)) {
+		/* fat_statfs() will count it */
+		printk(KERN_WARNING "FAT: couldn't start counting free "
+		       "clusters (dev %s)\n", sb->s_id);
+		goto out;
+	}
+	sbi->free_count_task = task;
+out:
+	unlock_fat(sbi);
+}
+
+/* Stops the background count, called before the sb goes away */
+void fat_stop_count_free_clusters(struct super_block *sb)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+
+	if (sbi->free_count_task) {
+		sbi->free_scan_abort = 1;
+		wait_for_completion(&sbi->free_count_done);
+		sbi->free_count_task = NULL;
+	}
+}
+
+/* Is the background count still running? */
+int fat_counting_free_clusters(struct super_block *sb)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+
+	return sbi->free_count_task && !completion_done(&sbi->free_count_done);
+}
+
+/*
+ * The estimate of the free clusters while they are counted. It is the
+ * count from the FAT32 fsinfo sector if any, otherwise the ratio of
+ * free clusters in the part of the FAT counted so far, or -1 if none
+ * of it is counted yet. This is read without lock_fat(), so it may be
+ * a bit off even in the counted part.
+ */
+unsigned int fat_estimate_free_clusters(struct super_block *sb)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	unsigned long next = sbi->free_scan_next;
+	unsigned long total = sbi->max_cluster - FAT_START_ENT;
+	unsigned long counted;
+	unsigned int free = sbi->free_scan_count;
+
+	if (sbi->free_clusters != -1)
+		return sbi->free_clusters;
+	if (next <= FAT_START_ENT)
+		return -1;
+
+	counted = next - FAT_START_ENT;
+	return free + div_u64((u64)free * (total - counted), counted);
+}
@@ -125,6 +125,18 @@ up_no_drop_write:
 
 static int fat_file_release(struct inode *inode, struct file *filp)
 {
+	/*
+	 * The last writer gives back the clusters it didn't use. This must
+	 * not take ->i_mutex (->release can run under ->mmap_sem), so it is
+	 * serialized against the allocation by ->i_prealloc_mutex only. If
+	 * a new writer opens the file meanwhile, it just allocates again.
+	 */
+	if ((filp->f_mode & FMODE_WRITE) && MSDOS_I(inode)->i_prealloc) {
+		mutex_lock(&MSDOS_I(inode)->i_prealloc_mutex);
+		if (atomic_read(&inode->i_writecount) == 1)
+			fat_drop_prealloc(inode);
+		mutex_unlock(&MSDOS_I(inode)->i_prealloc_mutex);
+	}
 	if ((filp->f_mode & FMODE_WRITE) &&
 	     MSDOS_SB(inode->i_sb)->options.flush) {
 		fat_flush_inodes(inode->i_sb, inode, NULL);
@@ -164,10 +176,47 @@ out:
 	return err;
 }
 
+/* Write a new EOF after the skip'th cluster, and free the rest of chain. */
+static int fat_free_tail(struct inode *inode, int skip, int wait)
+{
+	struct super_block *sb = inode->i_sb;
+	struct fat_entry fatent;
+	int err, ret, fclus, dclus;
+
+	ret = fat_get_cluster(inode, skip - 1, &fclus, &dclus);
+	if (ret < 0)
+		return ret;
+	else if (ret == FAT_ENT_EOF)
+		return 0;
+
+	fatent_init(&fatent);
+	ret = fat_ent_read(inode, &fatent, dclus);
+	if (ret == FAT_ENT_EOF) {
+		fatent_brelse(&fatent);
+		return 0;
+	} else if (ret == FAT_ENT_FREE) {
+		fat_fs_panic(sb,
+			     "%s: invalid cluster chain (i_pos %lld)",
+			     __func__, MSDOS_I(inode)->i_pos);
+		ret = -EIO;
+	} else if (ret > 0) {
+		err = fat_ent_write(inode, &fatent, FAT_ENT_EOF, wait);
+		if (err)
+			ret = err;
+	}
+	fatent_brelse(&fatent);
+	if (ret < 0)
+		return ret;
+
+	inode->i_blocks = skip << (MSDOS_SB(sb)->cluster_bits - 9);
+
+	/* Freeing the remained cluster chain */
+	return fat_free_clusters(inode, ret);
+}
+
 /* Free all clusters after the skip'th cluster. */
 static int fat_free(struct inode *inode, int skip)
 {
-	struct super_block *sb = inode->i_sb;
 	int err, wait, free_start, i_start, i_logstart;
 
 	if (MSDOS_I(inode)->i_start == 0)
@@ -197,59 +246,59 @@ static int fat_free(struct inode *inode, int skip)
 		mark_inode_dirty(inode);
 
 	/* Write a new EOF, and get the remaining cluster chain for freeing. */
-	if (skip) {
-		struct fat_entry fatent;
-		int ret, fclus, dclus;
-
-		ret = fat_get_cluster(inode, skip - 1, &fclus, &dclus);
-		if (ret < 0)
-			return ret;
-		else if (ret == FAT_ENT_EOF)
-			return 0;
-
-		fatent_init(&fatent);
-		ret = fat_ent_read(inode, &fatent, dclus);
-		if (ret == FAT_ENT_EOF) {
-			fatent_brelse(&fatent);
-			return 0;
-		} else if (ret == FAT_ENT_FREE) {
-			fat_fs_panic(sb,
-				     "%s: invalid cluster chain (i_pos %lld)",
-				     __func__, MSDOS_I(inode)->i_pos);
-			ret = -EIO;
-		} else if (ret > 0) {
-			err = fat_ent_write(inode, &fatent, FAT_ENT_EOF, wait);
-			if (err)
-				ret = err;
-		}
-		fatent_brelse(&fatent);
-		if (ret < 0)
-			return ret;
-
-		free_start = ret;
-	}
-	inode->i_blocks = skip << (MSDOS_SB(sb)->cluster_bits - 9);
+	if (skip)
+		return fat_free_tail(inode, skip, wait);
+	inode->i_blocks = 0;
 
 	/* Freeing the remained cluster chain */
 	return fat_free_clusters(inode, free_start);
 }
 
+/*
+ * Free the clusters preallocated after ->mmu_private. The caller must
+ * hold ->i_prealloc_mutex.
+ */
+int fat_drop_prealloc(struct inode *inode)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(inode->i_sb);
+	struct msdos_inode_info *i = MSDOS_I(inode);
+	int skip;
+
+	if (!i->i_prealloc)
+		return 0;
+
+	skip = (i->mmu_private + (sbi->cluster_size - 1)) >> sbi->cluster_bits;
+	i->i_prealloc = 0;
+	i->i_prealloc_win = 0;
+	if (!skip)
+		return fat_free(inode, 0);
+
+	fat_cache_inval_inode(inode);
+	return fat_free_tail(inode, skip, IS_SYNC(inode));
+}
+
 void fat_truncate(struct inode *inode)
 {
 	struct msdos_sb_info *sbi = MSDOS_SB(inode->i_sb);
 	const unsigned int cluster_size = sbi->cluster_size;
 	int nr_clusters;
 
+	nr_clusters = (inode->i_size + (cluster_size - 1)) >> sbi->cluster_bits;
+
+	mutex_lock(&MSDOS_I(inode)->i_prealloc_mutex);
 	/*
 	 * This protects against truncating a file bigger than it was then
-	 * trying to write into the hole.
+	 * trying to write into the hole.  __fat_get_block() grows
+	 * ->mmu_private under ->i_prealloc_mutex, so lower it under it too.
 	 */
 	if (MSDOS_I(inode)->mmu_private > inode->i_size)
 		MSDOS_I(inode)->mmu_private = inode->i_size;
 
-	nr_clusters = (inode->i_size + (cluster_size - 1)) >> sbi->cluster_bits;
-
+	/* The preallocated clusters are beyond ->i_size, so they go too. */
+	MSDOS_I(inode)->i_prealloc = 0;
+	MSDOS_I(inode)->i_prealloc_win = 0;
 	fat_free(inode, nr_clusters);
+	mutex_unlock(&MSDOS_I(inode)->i_prealloc_mutex);
 	fat_flush_inodes(inode->i_sb, inode, NULL);
 }
 
@@ -27,6 +27,7 @@
 #include <linux/writeback.h>
 #include <linux/log2.h>
 #include <linux/hash.h>
+#include <linux/vmalloc.h>
 #include <asm/unaligned.h>
 #include "fat.h"
 
@@ -39,19 +40,46 @@ static int fat_default_codepage = CONFIG_FAT_DEFAULT_CODEPAGE;
 static char fat_default_iocharset[] = CONFIG_FAT_DEFAULT_IOCHARSET;
 
 
+/* Upper bound of clusters allocated at once with the "prealloc" option */
+#define FAT_MAX_PREALLOC	32
+
 static int fat_add_cluster(struct inode *inode)
 {
-	int err, cluster;
+	struct msdos_inode_info *i = MSDOS_I(inode);
+	int err, nr_cluster, cluster[FAT_MAX_PREALLOC];
+
+	/*
+	 * With "prealloc", a file growing at EOF gets a run of clusters
+	 * in one go, and the run doubles each time it is used up. So a
+	 * large sequential write allocates (contiguous, if possible) runs
+	 * of clusters, and dirties the FAT blocks once per run instead of
+	 * once per cluster. The unused part is freed on the last close.
+	 * Called with ->i_prealloc_mutex held.
+	 */
+	nr_cluster = 1;
+	if (MSDOS_SB(inode->i_sb)->options.prealloc) {
+		i->i_prealloc_win = clamp(i->i_prealloc_win * 2, 2,
+					  FAT_MAX_PREALLOC);
+		nr_cluster = i->i_prealloc_win;
+	}
 
-	err = fat_alloc_clusters(inode, &cluster, 1);
+	err = fat_alloc_clusters(inode, cluster, nr_cluster);
+	if (err == -ENOSPC && nr_cluster > 1) {
+		i->i_prealloc_win = 0;
+		nr_cluster = 1;
+		err = fat_alloc_clusters(inode, cluster, nr_cluster);
+	}
 	if (err)
 		return err;
 	/* FIXME: this cluster should be added after data of this
 	 * cluster is writed */
-	err = fat_chain_add(inode, cluster, 1);
-	if (err)
-		fat_free_clusters(inode, cluster);
-	return err;
+	err = fat_chain_add(inode, cluster[0], nr_cluster);
+	if (err) {
+		fat_free_clusters(inode, cluster[0]);
+		return err;
+	}
+	i->i_prealloc = nr_cluster - 1;
+	return 0;
 }
 
 static inline int __fat_get_block(struct inode *inode, sector_t iblock,
@@ -64,6 +92,8 @@ static inline int __fat_get_block(struct inode *inode, sector_t iblock,
 	sector_t phys;
 	int err, offset;
 
+	/* the whole contiguous run, so mpage can build large bios */
+	mapped_blocks = *max_blocks;
 	err = fat_bmap(inode, iblock, &phys, &mapped_blocks, create);
 	if (err)
 		return err;
@@ -81,19 +111,28 @@ static inline int __fat_get_block(struct inode *inode, sector_t iblock,
 		return -EIO;
 	}
 
+	mutex_lock(&MSDOS_I(inode)->i_prealloc_mutex);
 	offset = (unsigned long)iblock & (sbi->sec_per_clus - 1);
 	if (!offset) {
-		/* TODO: multiple cluster allocation would be desirable. */
-		err = fat_add_cluster(inode);
-		if (err)
-			return err;
+		if (MSDOS_I(inode)->i_prealloc) {
+			/* the next cluster is already on the chain */
+			MSDOS_I(inode)->i_prealloc--;
+		} else {
+			err = fat_add_cluster(inode);
+			if (err) {
+				mutex_unlock(&MSDOS_I(inode)->i_prealloc_mutex);
+				return err;
+			}
+		}
 	}
 	/* available blocks on this cluster */
 	mapped_blocks = sbi->sec_per_clus - offset;
 
 	*max_blocks = min(mapped_blocks, *max_blocks);
 	MSDOS_I(inode)->mmu_private += *max_blocks << sb->s_blocksize_bits;
+	mutex_unlock(&MSDOS_I(inode)->i_prealloc_mutex);
 
+	mapped_blocks = *max_blocks;
 	err = fat_bmap(inode, iblock, &phys, &mapped_blocks, create);
 	if (err)
 		return err;
@@ -435,6 +474,7 @@ static void fat_delete_inode(struct inode *inode)
 
 static void fat_clear_inode(struct inode *inode)
 {
+	fat_dir_index_free(inode);
 	fat_cache_inval_inode(inode);
 	fat_detach(inode);
 }
@@ -443,14 +483,21 @@ static void fat_write_super(struct super_block *sb)
 {
 	sb->s_dirt = 0;
 
-	if (!(sb->s_flags & MS_RDONLY))
+	if (!(sb->s_flags & MS_RDONLY)) {
+		fat_mirror_flush(sb);
 		fat_clusters_flush(sb);
+	}
 }
 
 static void fat_put_super(struct super_block *sb)
 {
 	struct msdos_sb_info *sbi = MSDOS_SB(sb);
 
+	fat_stop_count_free_clusters(sb);
+	if (!(sb->s_flags & MS_RDONLY))
+		fat_mirror_flush(sb);
+	vfree(sbi->mirror_map);
+
 	if (sbi->nls_disk) {
 		unload_nls(sbi->nls_disk);
 		sbi->nls_disk = NULL;
@@ -464,6 +511,7 @@ static void fat_put_super(struct super_block *sb)
 		kfree(sbi->options.iocharset);
 		sbi->options.iocharset = fat_default_iocharset;
 	}
+	vfree(sbi->free_map);
 
 	sb->s_fs_info = NULL;
 	kfree(sbi);
@@ -477,6 +525,9 @@ static struct inode *fat_alloc_inode(struct super_block *sb)
 	ei = kmem_cache_alloc(fat_inode_cachep, GFP_NOFS);
 	if (!ei)
 		return NULL;
+	ei->i_prealloc = 0;
+	ei->i_prealloc_win = 0;
+	ei->i_dir_index = NULL;
 	return &ei->vfs_inode;
 }
 
@@ -489,11 +540,13 @@ static void init_once(void *foo)
 {
 	struct msdos_inode_info *ei = (struct msdos_inode_info *)foo;
 
-	spin_lock_init(&ei->cache_lru_lock);
+	spin_lock_init(&ei->cache_lock);
+	ei->cache_tree = RB_ROOT;
 	ei->nr_caches = 0;
 	ei->cache_valid_id = FAT_CACHE_VALID + 1;
 	INIT_LIST_HEAD(&ei->cache_lru);
 	INIT_HLIST_NODE(&ei->i_fat_hash);
+	mutex_init(&ei->i_prealloc_mutex);
 	inode_init_once(&ei->vfs_inode);
 }
 
@@ -518,25 +571,47 @@ static int fat_remount(struct super_block *sb, int *flags, char *data)
 {
 	struct msdos_sb_info *sbi = MSDOS_SB(sb);
 	*flags |= MS_NODIRATIME | (sbi->options.isvfat ? 0 : MS_NOATIME);
+	/* FATX is read-only for now, see fatx_fill_super() */
+	if (sbi->options.isfatx && !(*flags & MS_RDONLY))
+		return -EROFS;
 	return 0;
 }
 
 static int fat_statfs(struct dentry *dentry, struct kstatfs *buf)
 {
 	struct msdos_sb_info *sbi = MSDOS_SB(dentry->d_sb);
+	unsigned int free_clusters;
 
-	/* If the count of free cluster is still unknown, counts it here. */
-	if (sbi->free_clusters == -1 || !sbi->free_clus_valid) {
-		int err = fat_count_free_clusters(dentry->d_sb);
-		if (err)
-			return err;
+	/*
+	 * While the free clusters are counted in background, don't wait
+	 * for it, but report the estimate, once there is something to
+	 * estimate from. Otherwise, if the count of free cluster is still
+	 * unknown, counts it here.
+	 */
+	fat_start_count_free_clusters(dentry->d_sb);
+	free_clusters = -1;
+	if (fat_counting_free_clusters(dentry->d_sb)) {
+		free_clusters = fat_estimate_free_clusters(dentry->d_sb);
+		if (free_clusters == -1) {
+			if (wait_for_completion_killable(&sbi->free_count_begun))
+				return -EINTR;
+			free_clusters = fat_estimate_free_clusters(dentry->d_sb);
+		}
+	}
+	if (free_clusters == -1) {
+		if (sbi->free_clusters == -1 || !sbi->free_clus_valid) {
+			int err = fat_count_free_clusters(dentry->d_sb);
+			if (err)
+				return err;
+		}
+		free_clusters = sbi->free_clusters;
 	}
 
 	buf->f_type = dentry->d_sb->s_magic;
 	buf->f_bsize = sbi->cluster_size;
 	buf->f_blocks = sbi->max_cluster - FAT_START_ENT;
-	buf->f_bfree = sbi->free_clusters;
-	buf->f_bavail = sbi->free_clusters;
+	buf->f_bfree = free_clusters;
+	buf->f_bavail = free_clusters;
 	buf->f_namelen = sbi->options.isvfat ? 260 : 12;
 
 	return 0;
@@ -568,6 +643,19 @@ static int fat_write_inode(struct inode *inode, int wait)
 	if (inode->i_ino == MSDOS_ROOT_INO)
 		return 0;
 
+	/*
+	 * Nobody has it open for write (e.g. nfsd is done with it): give
+	 * back the preallocated clusters before the entry goes to disk, so
+	 * they are not left on the chain once the inode is evicted. The
+	 * drop itself may sync the inode with ->i_prealloc_mutex held,
+	 * hence the trylock.
+	 */
+	if (MSDOS_I(inode)->i_prealloc && !atomic_read(&inode->i_writecount) &&
+	    mutex_trylock(&MSDOS_I(inode)->i_prealloc_mutex)) {
+		fat_drop_prealloc(inode);
+		mutex_unlock(&MSDOS_I(inode)->i_prealloc_mutex);
+	}
+
 retry:
 	i_pos = fat_i_pos_read(sbi, inode);
 	if (!i_pos)
@@ -805,6 +893,14 @@ static int fat_show_options(struct seq_file *m, struct vfsmount *mnt)
 		seq_printf(m, ",check=%c", opts->name_check);
 	if (opts->usefree)
 		seq_puts(m, ",usefree");
+	if (opts->freemap)
+		seq_puts(m, ",freemap");
+	if (opts->prealloc)
+		seq_puts(m, ",prealloc");
+	if (opts->dirhash)
+		seq_puts(m, ",dirhash");
+	if (opts->lazymirror)
+		seq_puts(m, ",lazymirror");
 	if (opts->quiet)
 		seq_puts(m, ",quiet");
 	if (opts->showexec)
@@ -842,7 +938,8 @@ enum {
 	Opt_charset, Opt_shortname_lower, Opt_shortname_win95,
 	Opt_shortname_winnt, Opt_shortname_mixed, Opt_utf8_no, Opt_utf8_yes,
 	Opt_uni_xl_no, Opt_uni_xl_yes, Opt_nonumtail_no, Opt_nonumtail_yes,
-	Opt_obsolate, Opt_flush, Opt_tz_utc, Opt_rodir, Opt_err,
+	Opt_obsolate, Opt_flush, Opt_tz_utc, Opt_rodir, Opt_freemap,
+	Opt_prealloc, Opt_dirhash, Opt_lazymirror, Opt_err,
 };
 
 static const match_table_t fat_tokens = {
@@ -860,6 +957,10 @@ static const match_table_t fat_tokens = {
 	{Opt_allow_utime, "allow_utime=%o"},
 	{Opt_codepage, "codepage=%u"},
 	{Opt_usefree, "usefree"},
+	{Opt_freemap, "freemap"},
+	{Opt_prealloc, "prealloc"},
+	{Opt_dirhash, "dirhash"},
+	{Opt_lazymirror, "lazymirror"},
 	{Opt_nocase, "nocase"},
 	{Opt_quiet, "quiet"},
 	{Opt_showexec, "showexec"},
@@ -946,6 +1047,8 @@ static int parse_options(char *options, int is_vfat, int silent, int *debug,
 	opts->utf8 = opts->unicode_xlate = 0;
 	opts->numtail = 1;
 	opts->usefree = opts->nocase = 0;
+	opts->freemap = opts->prealloc = opts->dirhash = 0;
+	opts->lazymirror = 0;
 	opts->tz_utc = 0;
 	*debug = 0;
 
@@ -977,6 +1080,18 @@ static int parse_options(char *options, int is_vfat, int silent, int *debug,
 		case Opt_usefree:
 			opts->usefree = 1;
 			break;
+		case Opt_freemap:
+			opts->freemap = 1;
+			break;
+		case Opt_prealloc:
+			opts->prealloc = 1;
+			break;
+		case Opt_dirhash:
+			opts->dirhash = 1;
+			break;
+		case Opt_lazymirror:
+			opts->lazymirror = 1;
+			break;
 		case Opt_nocase:
 			if (!is_vfat)
 				opts->nocase = 1;
@@ -1167,8 +1282,76 @@ static int fat_read_root(struct inode *inode)
 /*
  * Read the super block of an MS-DOS FS.
  */
+/*
+ * FATX, of the Xbox: a 4KB superblock, one FAT right after it, and a
+ * root directory of one cluster, cluster 1, which is handled like the
+ * fixed root directory of FAT12/16.  There is no BPB, the size of the
+ * FAT follows from the size of the partition.
+ */
+static int fatx_read_super(struct super_block *sb, struct buffer_head *bh,
+			   int silent)
+{
+	struct fatx_super_block *b = (struct fatx_super_block *)bh->b_data;
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	u32 total_sectors, total_clusters, fat_bytes, sec_per_clus;
+
+	if (b->magic != FATX_SUPER_MAGIC) {
+		if (!silent)
+			printk(KERN_ERR "FAT: no FATX signature\n");
+		return -EINVAL;
+	}
+	if (sb->s_blocksize != SECTOR_SIZE) {
+		if (!silent)
+			printk(KERN_ERR "FAT: FATX needs 512 bytes blocks\n");
+		return -EINVAL;
+	}
+	sec_per_clus = le32_to_cpu(b->sec_per_clus);
+	if (!is_power_of_2(sec_per_clus) || sec_per_clus > 128) {
+		if (!silent)
+			printk(KERN_ERR "FAT: bogus sectors per cluster %u\n",
+			       sec_per_clus);
+		return -EINVAL;
+	}
+
+	total_sectors = i_size_read(sb->s_bdev->bd_inode) >> SECTOR_BITS;
+	total_clusters = total_sectors / sec_per_clus;
+
+	sbi->sec_per_clus = sec_per_clus;
+	sbi->cluster_size = sb->s_blocksize * sbi->sec_per_clus;
+	sbi->cluster_bits = ffs(sbi->cluster_size) - 1;
+	sbi->fats = 1;
+	sbi->fat_bits = total_clusters > MAX_FAT16 ? 32 : 16;
+	fat_bytes = ALIGN((total_clusters + 1) * (sbi->fat_bits / 8),
+			  FATX_FAT_START);
+	sbi->fat_start = FATX_FAT_START >> SECTOR_BITS;
+	sbi->fat_length = fat_bytes >> SECTOR_BITS;
+	sbi->root_cluster = 0;
+	sbi->free_clusters = -1;
+	sbi->free_clus_valid = 0;
+	sbi->prev_free = FAT_START_ENT;
+	if (sbi->fat_bits == 32)
+		sb->s_maxbytes = 0xffffffff;
+
+	sbi->dir_per_block = sb->s_blocksize / sizeof(struct msdos_dir_entry);
+	sbi->dir_per_block_bits = ffs(sbi->dir_per_block) - 1;
+	sbi->dir_start = sbi->fat_start + sbi->fat_length;
+	sbi->dir_entries = sbi->cluster_size / sizeof(struct msdos_dir_entry);
+	sbi->data_start = sbi->dir_start + sbi->sec_per_clus;
+	if (sbi->data_start >= total_sectors) {
+		if (!silent)
+			printk(KERN_ERR "FAT: FATX volume too small\n");
+		return -EINVAL;
+	}
+
+	/* cluster 1 is the root directory, 2 the first data cluster */
+	total_clusters = (total_sectors - sbi->data_start) / sbi->sec_per_clus;
+	sbi->max_cluster = total_clusters + FAT_START_ENT;
+	return 0;
+}
+
 int fat_fill_super(struct super_block *sb, void *data, int silent,
-		   const struct inode_operations *fs_dir_inode_ops, int isvfat)
+		   const struct inode_operations *fs_dir_inode_ops, int isvfat,
+		   int isfatx)
 {
 	struct inode *root_inode = NULL;
 	struct buffer_head *bh;
@@ -1201,6 +1384,7 @@ int fat_fill_super(struct super_block *sb, void *data, int silent,
 	error = parse_options(data, isvfat, silent, &debug, &sbi->options);
 	if (error)
 		goto out_fail;
+	sbi->options.isfatx = isfatx;
 
 	error = -EIO;
 	sb_min_blocksize(sb, 512);
@@ -1210,6 +1394,14 @@ int fat_fill_super(struct super_block *sb, void *data, int silent,
 		goto out_fail;
 	}
 
+	if (isfatx) {
+		error = fatx_read_super(sb, bh, silent);
+		brelse(bh);
+		if (error)
+			goto out_invalid;
+		goto read_root;
+	}
+
 	b = (struct fat_boot_sector *) bh->b_data;
 	if (!b->reserved) {
 		if (!silent)
@@ -1379,6 +1571,7 @@ int fat_fill_super(struct super_block *sb, void *data, int silent,
 
 	brelse(bh);
 
+read_root:
 	/* set up enough so that it can read an inode */
 	fat_hash_init(sb);
 	fat_ent_access_init(sb);
@@ -1426,6 +1619,23 @@ int fat_fill_super(struct super_block *sb, void *data, int silent,
 		goto out_fail;
 	}
 
+	if (sbi->options.lazymirror && sbi->fats > 1) {
+		size_t size = BITS_TO_LONGS(sbi->fat_length) * sizeof(long);
+
+		sbi->mirror_map = vmalloc(size);
+		if (sbi->mirror_map)
+			memset(sbi->mirror_map, 0, size);
+		else {
+			printk(KERN_WARNING "FAT: not enough memory for "
+			       "lazymirror (dev %s), disabled\n", sb->s_id);
+			sbi->options.lazymirror = 0;
+		}
+	}
+
+	/* the count itself waits for the first statfs */
+	if (sbi->options.freemap)
+		fat_start_count_free_clusters(sb);
+
 	return 0;
 
 out_invalid:
@@ -1508,12 +1718,18 @@ static int __init init_fat_fs(void)
 	if (err)
 		return err;
 
-	err = fat_init_inodecache();
+	err = fat_dir_index_init();
 	if (err)
 		goto failed;
 
+	err = fat_init_inodecache();
+	if (err)
+		goto failed_dir_index;
+
 	return 0;
 
+failed_dir_index:
+	fat_dir_index_destroy();
 failed:
 	fat_cache_destroy();
 	return err;
@@ -1522,6 +1738,7 @@ failed:
 static void __exit exit_fat_fs(void)
 {
 	fat_cache_destroy();
+	fat_dir_index_destroy();
 	fat_destroy_inodecache();
 }
 
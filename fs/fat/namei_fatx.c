@@ -594,18 +594,52 @@ static int fatx_fill_super(struct super_block *sb, void *data, int silent)
 {
 	int res;
 
-	res = fat_fill_super(sb, data, silent, &fatx_dir_inode_operations,0);
+	res = fat_fill_super(sb, data, silent, &fatx_dir_inode_operations, 0,
+			     1);
 	if (res)
 		return res;
 
+	/*
+	 * Lookup and the creation of entries still go through the msdos
+	 * entry layout, which would corrupt FATX directories.
+	 */
+	if (!(sb->s_flags & MS_RDONLY)) {
+		printk(KERN_NOTICE "FATX: %s is mounted read-only\n", sb->s_id);
+		sb->s_flags |= MS_RDONLY;
+	}
+
 	sb->s_root->d_op = &fatx_dentry_operations;
 	return 0;
 }
 
-int fatx_get_sb(struct file_system_type *fs_type,
+static int fatx_get_sb(struct file_system_type *fs_type,
 			int flags, const char *dev_name,
 			void *data, struct vfsmount *mnt)
 {
 	return get_sb_bdev(fs_type, flags, dev_name, data, fatx_fill_super,
 			   mnt);
 }
+
+static struct file_system_type fatx_fs_type = {
+	.owner		= THIS_MODULE,
+	.name		= "fatx",
+	.get_sb		= fatx_get_sb,
+	.kill_sb	= kill_block_super,
+	.fs_flags	= FS_REQUIRES_DEV,
+};
+
+static int __init init_fatx_fs(void)
+{
+	return register_filesystem(&fatx_fs_type);
+}
+
+static void __exit exit_fatx_fs(void)
+{
+	unregister_filesystem(&fatx_fs_type);
+}
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Xbox FATX filesystem support");
+
+module_init(init_fatx_fs)
+module_exit(exit_fatx_fs)
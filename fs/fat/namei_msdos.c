@@ -663,7 +663,8 @@ static int msdos_fill_super(struct super_block *sb, void *data, int silent)
 {
 	int res;
 
-	res = fat_fill_super(sb, data, silent, &msdos_dir_inode_operations, 0);
+	res = fat_fill_super(sb, data, silent, &msdos_dir_inode_operations, 0,
+			     0);
 	if (res)
 		return res;
 
@@ -1052,7 +1052,8 @@ static int vfat_fill_super(struct super_block *sb, void *data, int silent)
 {
 	int res;
 
-	res = fat_fill_super(sb, data, silent, &vfat_dir_inode_operations, 1);
+	res = fat_fill_super(sb, data, silent, &vfat_dir_inode_operations, 1,
+			     0);
 	if (res)
 		return res;
 
@@ -0,0 +1,348 @@
+/*
+ *  linux/fs/fat/verify.c
+ *
+ *  Online consistency check of a FAT volume (FAT_IOCTL_VERIFY).
+ *
+ *  The FAT is read once, sequentially and with readahead, into two
+ *  bitmaps: the clusters which are used, and the clusters some FAT
+ *  entry points to.  A used cluster nobody points to is the head of a
+ *  chain.  Then the directory tree is walked from the root, and each
+ *  directory entry claims the chain it starts.  Heads nobody claims
+ *  are lost chains; a claimed cluster which is also pointed to by the
+ *  FAT, or claimed twice, is cross-linked.  Finally the chains of the
+ *  cached regular files are measured against their size.
+ *
+ *  The directories are walked iteratively, from a bitmap of the ones
+ *  not walked yet, so deep trees don't use any stack.  lock_fat() is
+ *  only held for a block of the FAT, or a chain, at a time, so the
+ *  volume stays usable during the check; the counts are only exact on
+ *  a quiescent volume.  Clusters marked bad are counted apart and are
+ *  not part of any chain.  Nothing is repaired.
+ */
+
+#include <linux/fs.h>
+#include <linux/msdos_fs.h>
+#include <linux/buffer_head.h>
+#include <linux/capability.h>
+#include <linux/vmalloc.h>
+#include <linux/sched.h>
+#include <asm/uaccess.h>
+#include "fat.h"
+
+struct fat_verify {
+	struct inode *dir;		/* for fat_ent_read() */
+	unsigned long *used;		/* the cluster isn't free */
+	unsigned long *ref;		/* some FAT entry points to it */
+	unsigned long *claimed;		/* some dir entry points to it */
+	unsigned long *pending;		/* directories not walked yet */
+	struct fat_verify_info info;
+};
+
+/*
+ * Returns the length of the chain from @start, or -1 if it is broken.
+ * Called with lock_fat() held.
+ */
+static int fat_verify_chain_len(struct fat_verify *v, int start)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(v->dir->i_sb);
+	struct fat_entry fatent;
+	int cluster = start, len = 0;
+
+	fatent_init(&fatent);
+	while (cluster >= FAT_START_ENT && cluster < sbi->max_cluster) {
+		/* a chain longer than the volume loops */
+		if (++len > sbi->max_cluster) {
+			len = -1;
+			break;
+		}
+		cluster = fat_ent_read(v->dir, &fatent, cluster);
+	}
+	fatent_brelse(&fatent);
+	if (cluster != FAT_ENT_EOF)
+		len = -1;
+	return len;
+}
+
+/* A directory entry refers to the chain starting at @start */
+static void fat_verify_claim(struct fat_verify *v, int start, int is_dir)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(v->dir->i_sb);
+
+	if (start < FAT_START_ENT || start >= sbi->max_cluster ||
+	    !test_bit(start, v->used)) {
+		v->info.invalid++;
+		return;
+	}
+	/* in the middle of another chain, or claimed by another entry */
+	if (test_bit(start, v->ref) || __test_and_set_bit(start, v->claimed)) {
+		v->info.cross_linked++;
+		return;
+	}
+	if (is_dir)
+		__set_bit(start, v->pending);
+}
+
+/*
+ * Claims the chains of the entries in @nr blocks from @blocknr.
+ * Returns 1 at the end of the directory.
+ */
+static int fat_verify_dir_blocks(struct fat_verify *v, sector_t blocknr,
+				 int nr)
+{
+	struct super_block *sb = v->dir->i_sb;
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	struct msdos_dir_entry *de, *endp;
+	struct buffer_head *bh;
+	int i, start;
+
+	for (i = 1; i < nr; i++)
+		sb_breadahead(sb, blocknr + i);
+
+	for (i = 0; i < nr; i++) {
+		bh = sb_bread(sb, blocknr + i);
+		if (!bh)
+			return -EIO;
+		de = (struct msdos_dir_entry *)bh->b_data;
+		endp = de + sbi->dir_per_block;
+		for (; de < endp; de++) {
+			if (de->name[0] == 0) {
+				brelse(bh);
+				return 1;
+			}
+			if (IS_FREE(de->name) || de->attr == ATTR_EXT ||
+			    (de->attr & ATTR_VOLUME))
+				continue;
+			if (!strncmp(de->name, MSDOS_DOT, MSDOS_NAME) ||
+			    !strncmp(de->name, MSDOS_DOTDOT, MSDOS_NAME))
+				continue;
+			start = le16_to_cpu(de->start);
+			if (sbi->fat_bits == 32)
+				start |= le16_to_cpu(de->starthi) << 16;
+			if (start)
+				fat_verify_claim(v, start, de->attr & ATTR_DIR);
+		}
+		brelse(bh);
+	}
+	return 0;
+}
+
+static int fat_verify_dir(struct fat_verify *v, int cluster)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(v->dir->i_sb);
+	struct fat_entry fatent;
+	int err, steps = 0;
+
+	fatent_init(&fatent);
+	do {
+		err = fat_verify_dir_blocks(v, fat_clus_to_blknr(sbi, cluster),
+					    sbi->sec_per_clus);
+		if (err)
+			break;
+		lock_fat(sbi);
+		cluster = fat_ent_read(v->dir, &fatent, cluster);
+		unlock_fat(sbi);
+		if (cluster < 0)
+			err = cluster;
+	} while (cluster >= FAT_START_ENT && cluster < sbi->max_cluster &&
+		 ++steps < sbi->max_cluster);
+	fatent_brelse(&fatent);
+
+	return err < 0 ? err : 0;
+}
+
+static int fat_verify_tree(struct fat_verify *v)
+{
+	struct super_block *sb = v->dir->i_sb;
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	unsigned long pos;
+	int err;
+
+	if (sbi->fat_bits == 32)
+		fat_verify_claim(v, sbi->root_cluster, 1);
+	else {
+		err = fat_verify_dir_blocks(v, sbi->dir_start,
+				sbi->dir_entries >> sbi->dir_per_block_bits);
+		if (err < 0)
+			return err;
+	}
+
+	pos = 0;
+	for (;;) {
+		pos = find_next_bit(v->pending, sbi->max_cluster, pos);
+		if (pos >= sbi->max_cluster) {
+			pos = find_first_bit(v->pending, sbi->max_cluster);
+			if (pos >= sbi->max_cluster)
+				break;
+		}
+		__clear_bit(pos, v->pending);
+		err = fat_verify_dir(v, pos);
+		if (err)
+			return err;
+		cond_resched();
+	}
+	return 0;
+}
+
+/* The heads of the chains no directory entry claimed are lost */
+static void fat_verify_lost(struct fat_verify *v)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(v->dir->i_sb);
+	unsigned long i, heads;
+	int bit, len;
+
+	for (i = 0; i < BITS_TO_LONGS(sbi->max_cluster); i++) {
+		heads = v->used[i] & ~(v->ref[i] | v->claimed[i]);
+		while (heads) {
+			bit = __ffs(heads);
+			heads &= heads - 1;
+			v->info.lost_chains++;
+			lock_fat(sbi);
+			len = fat_verify_chain_len(v, i * BITS_PER_LONG + bit);
+			unlock_fat(sbi);
+			if (len > 0)
+				v->info.lost_clusters += len;
+		}
+		cond_resched();
+	}
+}
+
+static void fat_verify_inode(struct fat_verify *v, struct inode *inode)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(inode->i_sb);
+	struct msdos_inode_info *i = MSDOS_I(inode);
+	loff_t size;
+	int len, min_len, max_len;
+
+	if (!S_ISREG(inode->i_mode))
+		return;
+
+	mutex_lock(&inode->i_mutex);
+	mutex_lock(&i->i_prealloc_mutex);
+	lock_fat(sbi);
+	len = i->i_start ? fat_verify_chain_len(v, i->i_start) : 0;
+	unlock_fat(sbi);
+
+	/* clusters of the data, plus the ones allocated ahead of it */
+	size = i_size_read(inode);
+	min_len = (size + sbi->cluster_size - 1) >> sbi->cluster_bits;
+	size = max(size, i->mmu_private);
+	max_len = ((size + sbi->cluster_size - 1) >> sbi->cluster_bits)
+		+ i->i_prealloc;
+	mutex_unlock(&i->i_prealloc_mutex);
+	mutex_unlock(&inode->i_mutex);
+
+	v->info.inodes_checked++;
+	if (len < min_len || len > max_len)
+		v->info.size_mismatch++;
+}
+
+/*
+ * Measures the chains of the cached inodes.  They are all grabbed in
+ * one pass under the hash lock, so that none is missed or measured
+ * twice when the hash changes meanwhile, then measured without it.
+ */
+static int fat_verify_inodes(struct fat_verify *v)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(v->dir->i_sb);
+	struct inode **inodes = NULL;
+	struct msdos_inode_info *i;
+	struct hlist_node *node;
+	int h, nr, max = 0, n, k;
+
+	/* size the array, the lock is kept once it is large enough */
+	for (;;) {
+		nr = 0;
+		spin_lock(&sbi->inode_hash_lock);
+		for (h = 0; h < FAT_HASH_SIZE; h++)
+			hlist_for_each(node, &sbi->inode_hashtable[h])
+				nr++;
+		if (nr <= max)
+			break;
+		spin_unlock(&sbi->inode_hash_lock);
+
+		vfree(inodes);
+		max = nr + nr / 8 + 16;
+		inodes = vmalloc(max * sizeof(*inodes));
+		if (!inodes)
+			return -ENOMEM;
+	}
+
+	n = 0;
+	for (h = 0; h < FAT_HASH_SIZE; h++) {
+		hlist_for_each_entry(i, node, &sbi->inode_hashtable[h],
+				     i_fat_hash) {
+			inodes[n] = igrab(&i->vfs_inode);
+			if (inodes[n])
+				n++;
+		}
+	}
+	spin_unlock(&sbi->inode_hash_lock);
+
+	for (k = 0; k < n; k++) {
+		fat_verify_inode(v, inodes[k]);
+		iput(inodes[k]);
+		cond_resched();
+	}
+	vfree(inodes);
+	return 0;
+}
+
+static int fat_verify(struct inode *dir, struct fat_verify_info *info)
+{
+	struct super_block *sb = dir->i_sb;
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	struct fat_verify v;
+	unsigned long map_size;
+	int err = -ENOMEM;
+
+	memset(&v, 0, sizeof(v));
+	v.dir = dir;
+	map_size = BITS_TO_LONGS(sbi->max_cluster) * sizeof(long);
+	v.used = vmalloc(map_size);
+	v.ref = vmalloc(map_size);
+	v.claimed = vmalloc(map_size);
+	v.pending = vmalloc(map_size);
+	if (!v.used || !v.ref || !v.claimed || !v.pending)
+		goto out;
+	memset(v.used, 0, map_size);
+	memset(v.ref, 0, map_size);
+	memset(v.claimed, 0, map_size);
+	memset(v.pending, 0, map_size);
+	v.info.clusters = sbi->max_cluster - FAT_START_ENT;
+
+	err = fat_ent_scan_refs(sb, v.used, v.ref, &v.info);
+	if (!err)
+		err = fat_verify_tree(&v);
+	if (!err)
+		fat_verify_lost(&v);
+
+	if (!err)
+		err = fat_verify_inodes(&v);
+	if (!err)
+		*info = v.info;
+out:
+	vfree(v.used);
+	vfree(v.ref);
+	vfree(v.claimed);
+	vfree(v.pending);
+	return err;
+}
+
+/**
+ * fat_ioctl_verify - FAT_IOCTL_VERIFY
+ * @dir: a directory of the volume
+ * @arg: where to copy the struct fat_verify_info
+ */
+int fat_ioctl_verify(struct inode *dir, struct fat_verify_info __user *arg)
+{
+	struct fat_verify_info info;
+	int err;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	err = fat_verify(dir, &info);
+	if (!err && copy_to_user(arg, &info, sizeof(info)))
+		err = -EFAULT;
+	return err;
+}
@@ -164,6 +164,8 @@ void __mark_inode_dirty(struct inode *inode, int flags)
 		if (!was_dirty) {
 			inode->dirtied_when = jiffies;
 			list_move(&inode->i_list, &sb->s_dirty);
+			/* make sure a flusher thread will see it */
+			bdi_inode_dirtied(inode->i_mapping->backing_dev_info);
 		}
 	}
 out:
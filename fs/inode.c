@@ -280,6 +280,9 @@ void clear_inode(struct inode *inode)
 	might_sleep();
 	invalidate_inode_buffers(inode);
        
+	/* evicted pages may have left shadow entries behind */
+	if (inode->i_data.nrshadows)
+		truncate_inode_pages(&inode->i_data, 0);
 	BUG_ON(inode->i_data.nrpages);
 	BUG_ON(!(inode->i_state & I_FREEING));
 	BUG_ON(inode->i_state & I_CLEAR);
@@ -29,6 +29,8 @@
 #define XBOX_SYSTEM_START	0x00465400L
 #define XBOX_DATA_START		0x0055F400L
 #define XBOX_EXTEND_START	0x00EE8AB0L
+/* upgraded drives: F ends at the LBA28 limit (137GB), G takes the rest */
+#define XBOX_EXTEND_G_START	0x0FFFFFFFL
 
 #define XBOX_CONFIG_SIZE	(XBOX_CACHE1_START - XBOX_CONFIG_START)
 #define XBOX_CACHE1_SIZE	(XBOX_CACHE2_START - XBOX_CACHE1_START)
@@ -36,9 +38,41 @@
 #define XBOX_CACHE3_SIZE	(XBOX_SYSTEM_START - XBOX_CACHE3_START)
 #define XBOX_SYSTEM_SIZE	(XBOX_DATA_START - XBOX_SYSTEM_START)
 #define XBOX_DATA_SIZE		(XBOX_EXTEND_START - XBOX_DATA_START)
+#define XBOX_EXTEND_F_SIZE	(XBOX_EXTEND_G_START - XBOX_EXTEND_START)
 
 #define XBOX_MAGIC_SECT		3L
 
+/*
+ * Upgraded drives carry a partition table at the start of the config
+ * area. An entry is used if XBOX_PARTINFO_IN_USE is set in its flags.
+ */
+#define XBOX_PARTINFO_MAGIC	"****PARTINFO****"
+#define XBOX_PARTINFO_ENTRIES	14
+#define XBOX_PARTINFO_IN_USE	0x80000000
+
+struct xbox_partinfo_entry {
+	char name[16];
+	__le32 flags;
+	__le32 start;		/* in sectors */
+	__le32 size;		/* in sectors */
+	__le32 reserved;
+};
+
+struct xbox_partinfo {
+	char magic[16];
+	char reserved[32];
+	struct xbox_partinfo_entry entry[XBOX_PARTINFO_ENTRIES];
+};
+
+#define XBOX_MAX_PARTS		(XBOX_PARTINFO_ENTRIES)
+
+struct xbox_layout {
+	int nr_parts;
+	struct {
+		sector_t from;
+		sector_t size;
+	} part[XBOX_MAX_PARTS];
+};
 
 static int xbox_check_magic(struct block_device *bdev, sector_t at_sect,
 		char *magic)
@@ -61,9 +95,9 @@ static int xbox_check_magic(struct block_device *bdev, sector_t at_sect,
 static inline int xbox_drive_detect(struct block_device *bdev)
 {
 	/** 
-	* "BRFR" is apparently the magic number in the config area
-	* the others are just paranoid checks to assure the expected
-	* "FATX" tags for the other xbox partitions
+	* "BRFR" is apparently the magic number in the config area, the
+	* caller checked it already. These are just paranoid checks to
+	* assure the expected "FATX" tags for the other xbox partitions
 	*
 	* the odds against a non-xbox drive having random data to match is
 	* astronomical...but it's possible I guess...you should only include
@@ -72,46 +106,120 @@ static inline int xbox_drive_detect(struct block_device *bdev)
 	*
 	* @see check.c
 	*/
-	return (xbox_check_magic(bdev, XBOX_MAGIC_SECT, "BRFR") &&
-		xbox_check_magic(bdev, XBOX_SYSTEM_START, "FATX") &&
-		xbox_check_magic(bdev, XBOX_DATA_START, "FATX")) ?
+	return (xbox_check_magic(bdev, XBOX_SYSTEM_START, "FATX") == 1 &&
+		xbox_check_magic(bdev, XBOX_DATA_START, "FATX") == 1) ?
 		0 : -ENODEV;
 }
 
-int xbox_partition(struct parsed_partitions *state, struct block_device *bdev)
+static void xbox_add_part(struct xbox_layout *layout, sector_t from,
+			  sector_t size)
 {
-	int slot, err;
-	sector_t last, size;
-
-	err = xbox_drive_detect(bdev);
-	if (err)
-		return err;
+	if (layout->nr_parts < XBOX_MAX_PARTS) {
+		layout->part[layout->nr_parts].from = from;
+		layout->part[layout->nr_parts].size = size;
+		layout->nr_parts++;
+	}
+}
 
-	slot = 50;
-	printk(" [xbox]");
+/* Returns the number of partitions in the table, 0 if there is none. */
+static int xbox_parse_partinfo(const struct xbox_partinfo *info,
+			       sector_t last, struct xbox_layout *layout)
+{
+	int i;
+
+	if (memcmp(info->magic, XBOX_PARTINFO_MAGIC, sizeof(info->magic)))
+		return 0;
+
+	for (i = 0; i < XBOX_PARTINFO_ENTRIES; i++) {
+		const struct xbox_partinfo_entry *e = &info->entry[i];
+		sector_t from = le32_to_cpu(e->start);
+		sector_t size = le32_to_cpu(e->size);
+
+		if (!(le32_to_cpu(e->flags) & XBOX_PARTINFO_IN_USE))
+			continue;
+		if (!size || from < XBOX_CACHE1_START || from >= last)
+			continue;
+		if (size > last - from)
+			size = last - from;
+		xbox_add_part(layout, from, size);
+	}
+	return layout->nr_parts;
+}
 
-	put_partition(state, slot++, XBOX_DATA_START, XBOX_DATA_SIZE);
-	put_partition(state, slot++, XBOX_SYSTEM_START, XBOX_SYSTEM_SIZE);
-	put_partition(state, slot++, XBOX_CACHE1_START, XBOX_CACHE1_SIZE);
-	put_partition(state, slot++, XBOX_CACHE2_START, XBOX_CACHE2_SIZE);
-	put_partition(state, slot++, XBOX_CACHE3_START, XBOX_CACHE3_SIZE);
+static void xbox_stock_layout(struct block_device *bdev, sector_t last,
+			      struct xbox_layout *layout)
+{
+	xbox_add_part(layout, XBOX_DATA_START, XBOX_DATA_SIZE);
+	xbox_add_part(layout, XBOX_SYSTEM_START, XBOX_SYSTEM_SIZE);
+	xbox_add_part(layout, XBOX_CACHE1_START, XBOX_CACHE1_SIZE);
+	xbox_add_part(layout, XBOX_CACHE2_START, XBOX_CACHE2_SIZE);
+	xbox_add_part(layout, XBOX_CACHE3_START, XBOX_CACHE3_SIZE);
 
 	/*
 	 * Xbox HDDs come in two sizes - 8GB and 10GB. The native Xbox kernel
 	 * will only acknowledge the first 8GB, regardless of actual disk
 	 * size. For disks larger than 8GB, anything above that limit is made
-	 * available as a seperate partition.
+	 * available as a seperate partition. On drives over 137GB, some
+	 * dashboards split that at the LBA28 limit into F and G; others
+	 * make it one F, so G is only split off if it has a FATX magic.
 	 */
-	last = bdev->bd_disk->part0.nr_sects; // LALEE: May need to call get_capacity() on bdev->bd_disk first?
-	if (last == XBOX_EXTEND_START)
-		goto out;
+	if (last <= XBOX_EXTEND_START)
+		return;
+	if (last <= XBOX_EXTEND_G_START ||
+	    xbox_check_magic(bdev, XBOX_EXTEND_G_START, "FATX") != 1) {
+		xbox_add_part(layout, XBOX_EXTEND_START,
+			      last - XBOX_EXTEND_START);
+		return;
+	}
+	xbox_add_part(layout, XBOX_EXTEND_START, XBOX_EXTEND_F_SIZE);
+	xbox_add_part(layout, XBOX_EXTEND_G_START,
+		      last - XBOX_EXTEND_G_START);
+}
 
-	printk(" <");
-	size = last - XBOX_EXTEND_START;
-	put_partition(state, slot++, XBOX_EXTEND_START, size);
-	printk(" >");
+int xbox_partition(struct parsed_partitions *state, struct block_device *bdev)
+{
+	struct xbox_layout layout;
+	sector_t last;
+	Sector sect;
+	unsigned char *data;
+	int i, slot, err;
 
-out:
+	last = get_capacity(bdev->bd_disk);
+
+	/*
+	 * The whole header area is in one page of the page cache, so this
+	 * is the only read of a disk which is not an Xbox drive.
+	 */
+	data = read_dev_sector(bdev, XBOX_CONFIG_START, &sect);
+	if (!data)
+		return -1;
+	if (memcmp(data, XBOX_PARTINFO_MAGIC, 16) &&
+	    memcmp(data + (XBOX_MAGIC_SECT << 9), "BRFR", 4)) {
+		put_dev_sector(sect);
+		return -ENODEV;
+	}
+
+	memset(&layout, 0, sizeof(layout));
+	if (!xbox_parse_partinfo((struct xbox_partinfo *)data, last,
+				 &layout)) {
+		put_dev_sector(sect);
+		err = xbox_drive_detect(bdev);
+		if (err)
+			return err;
+		xbox_stock_layout(bdev, last, &layout);
+	} else
+		put_dev_sector(sect);
+
+	slot = 50;
+	printk(" [xbox]");
+	for (i = 0; i < layout.nr_parts; i++) {
+		if (i == 5)
+			printk(" <");
+		put_partition(state, slot++, layout.part[i].from,
+			      layout.part[i].size);
+	}
+	if (i > 5)
+		printk(" >");
 	printk("\n");
 	return 1;
 }
@@ -34,6 +34,11 @@
 #define MADV_REMOVE	9		/* remove these pages & resources */
 #define MADV_DONTFORK	10		/* don't inherit across fork */
 #define MADV_DOFORK	11		/* do inherit across fork */
+#define MADV_MERGEABLE	12		/* KSM may merge identical pages */
+#define MADV_UNMERGEABLE 13		/* KSM may not merge identical pages */
+
+#define MADV_HUGEPAGE	14		/* worth mapping with huge pages */
+#define MADV_NOHUGEPAGE	15		/* not worth huge pages */
 
 /* compatibility flags */
 #define MAP_FILE	0
@@ -26,6 +26,10 @@ enum bdi_state {
 	BDI_pdflush,		/* A pdflush thread is working this device */
 	BDI_write_congested,	/* The write queue is getting full */
 	BDI_read_congested,	/* The read queue is getting full */
+	BDI_wb_pending,		/* Needs a flusher thread */
+	BDI_wb_creating,	/* Its flusher thread is being created */
+	BDI_wb_background,	/* Background writeout was requested */
+	BDI_listed,		/* On bdi_list, bdi_init() succeeded */
 	BDI_unused,		/* Available bits start here */
 };
 
@@ -34,6 +38,8 @@ typedef int (congested_fn)(void *, int);
 enum bdi_stat_item {
 	BDI_RECLAIMABLE,
 	BDI_WRITEBACK,
+	BDI_DIRTIED,
+	BDI_WRITTEN,
 	NR_BDI_STAT_ITEMS
 };
 
@@ -58,6 +64,12 @@ struct backing_dev_info {
 
 	struct device *dev;
 
+	struct list_head bdi_list;	/* on the global list, for the forker */
+	struct task_struct *wb_task;	/* flusher thread, or NULL */
+	atomic_long_t wb_nr_pages;	/* pages the thread was asked to write */
+	unsigned long wb_last_active;	/* jiffies the thread last wrote */
+	unsigned long wb_dirtied;	/* jiffies an inode was last dirtied */
+
 #ifdef CONFIG_DEBUG_FS
 	struct dentry *debug_dir;
 	struct dentry *debug_stats;
@@ -71,6 +83,9 @@ int bdi_register(struct backing_dev_info *bdi, struct device *parent,
 		const char *fmt, ...);
 int bdi_register_dev(struct backing_dev_info *bdi, dev_t dev);
 void bdi_unregister(struct backing_dev_info *bdi);
+void bdi_start_writeback(struct backing_dev_info *bdi, long nr_pages);
+void bdi_inode_dirtied(struct backing_dev_info *bdi);
+void bdi_wakeup_all(void);
 
 static inline void __add_bdi_stat(struct backing_dev_info *bdi,
 		enum bdi_stat_item item, s64 amount)
@@ -25,6 +25,7 @@
 struct scsi_ioctl_command;
 
 struct request_queue;
+struct blk_stage;
 struct elevator_queue;
 struct request_pm_state;
 struct blk_trace;
@@ -33,6 +34,7 @@ struct sg_io_hdr;
 
 #define BLKDEV_MIN_RQ	4
 #define BLKDEV_MAX_RQ	128	/* Default maximum */
+#define BLK_STAGE_MAX_BATCH	128	/* see blk_queue_stage() */
 
 struct request;
 typedef void (rq_end_io_fn)(struct request *, int);
@@ -347,6 +349,13 @@ struct request_queue
 	unsigned long		unplug_delay;	/* After this many jiffies */
 	struct work_struct	unplug_work;
 
+	/*
+	 * Per-cpu bio staging, see blk_queue_stage()
+	 */
+	struct blk_stage	*stage;
+	unsigned int		stage_batch;
+	struct work_struct	stage_work;
+
 	struct backing_dev_info	backing_dev_info;
 
 	/*
@@ -884,6 +893,37 @@ extern bool blk_ordered_complete_seq(struct request_queue *, unsigned, int);
 extern int blk_rq_map_sg(struct request_queue *, struct request *, struct scatterlist *);
 extern void blk_dump_rq_flags(struct request *, char *);
 extern void generic_unplug_device(struct request_queue *);
+extern int blk_queue_stage(struct request_queue *, unsigned int);
+
+/*
+ * A task can hold back the IO it submits in a plug and queue it in one
+ * go, see blk_start_plug().
+ */
+struct blk_plug {
+	struct list_head list;		/* requests, by queue and sector */
+	unsigned int count;
+};
+#define BLK_MAX_PLUG_REQUESTS	16
+
+extern void blk_start_plug(struct blk_plug *);
+extern void blk_finish_plug(struct blk_plug *);
+extern void blk_flush_plug_list(struct blk_plug *, int);
+
+static inline void blk_flush_plug(struct task_struct *tsk)
+{
+	struct blk_plug *plug = tsk->plug;
+
+	if (plug)
+		blk_flush_plug_list(plug, 0);
+}
+
+static inline void blk_schedule_flush_plug(struct task_struct *tsk)
+{
+	struct blk_plug *plug = tsk->plug;
+
+	if (plug)
+		blk_flush_plug_list(plug, 1);
+}
 extern long nr_blockdev_pages(void);
 
 int blk_get_queue(struct request_queue *);
@@ -1088,6 +1128,8 @@ struct block_device_operations {
 	int (*media_changed) (struct gendisk *);
 	int (*revalidate_disk) (struct gendisk *);
 	int (*getgeo)(struct block_device *, struct hd_geometry *);
+	/* this callback is with swap_lock and sometimes page table lock held */
+	void (*swap_slot_free_notify) (struct block_device *, unsigned long);
 	struct module *owner;
 };
 
@@ -1099,6 +1141,25 @@ extern int __blkdev_driver_ioctl(struct block_device *, fmode_t, unsigned int,
  */
 #define buffer_heads_over_limit 0
 
+struct blk_plug {
+};
+
+static inline void blk_start_plug(struct blk_plug *plug)
+{
+}
+
+static inline void blk_finish_plug(struct blk_plug *plug)
+{
+}
+
+static inline void blk_flush_plug(struct task_struct *tsk)
+{
+}
+
+static inline void blk_schedule_flush_plug(struct task_struct *tsk)
+{
+}
+
 static inline long nr_blockdev_pages(void)
 {
 	return 0;
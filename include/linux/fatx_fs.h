@@ -8,6 +8,7 @@
 #define FATX_DPS_BITS	4		/* log2(FATX_DPS) */
 
 #define FATX_SUPER_MAGIC cpu_to_le32(0x58544146)
+#define FATX_FAT_START	4096	/* bytes, the FAT follows the superblock */
 
 #define FATX32_MAX_NON_LFS     ((1UL<<32) - 1)
 #define FATX16_MAX_NON_LFS     ((1UL<<30) - 1)
@@ -71,6 +72,13 @@ struct fatx_dir_entry {
 //	struct buffer_head *bh;
 //};
 
+struct fatx_super_block {
+	__le32	magic;		/* "FATX" */
+	__le32	volume_id;
+	__le32	sec_per_clus;
+	__le16	root_cluster;	/* always 1 */
+};
+
 extern int fatx_date_dos2unix(unsigned short time, unsigned short date);
 extern void fatx_date_unix2dos(int unix_date, __le16 *time, __le16 *date);
 
@@ -0,0 +1,111 @@
+#ifndef _LINUX_HUGE_MM_H
+#define _LINUX_HUGE_MM_H
+
+/*
+ * Transparent huge pmd mappings of anonymous memory.
+ *
+ * A huge pmd maps HPAGE_PMD_NR ordinary small pages which happen to be
+ * physically contiguous and aligned: they are split at allocation, each
+ * has its own count, rmap and LRU position.  Only the mapping is huge,
+ * so anything which wants to look at a single pte splits the pmd back
+ * into a page table first, with split_huge_pmd().
+ */
+
+struct mm_struct;
+struct vm_area_struct;
+
+extern int do_huge_anonymous_page(struct mm_struct *mm,
+		struct vm_area_struct *vma, unsigned long address,
+		pmd_t *pmd);
+extern struct page *follow_trans_huge_pmd(struct mm_struct *mm,
+		unsigned long address, pmd_t *pmd, unsigned int flags);
+extern void __split_huge_pmd(struct mm_struct *mm, pmd_t *pmd);
+extern int huge_pmd_referenced(struct vm_area_struct *vma,
+		unsigned long address, pmd_t *pmd, struct page *page);
+extern int hugepage_madvise(unsigned long *vm_flags, int advice);
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+
+#define HPAGE_PMD_SHIFT	PMD_SHIFT
+#define HPAGE_PMD_SIZE	(1UL << HPAGE_PMD_SHIFT)
+#define HPAGE_PMD_MASK	(~(HPAGE_PMD_SIZE - 1))
+#define HPAGE_PMD_ORDER	(HPAGE_PMD_SHIFT - PAGE_SHIFT)
+#define HPAGE_PMD_NR	(1 << HPAGE_PMD_ORDER)
+
+enum transparent_hugepage_flag {
+	TRANSPARENT_HUGEPAGE_FLAG,		/* every anonymous vma */
+	TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,	/* MADV_HUGEPAGE vmas only */
+};
+
+extern unsigned long transparent_hugepage_flags;
+
+/*
+ * hugetlbfs pmds map compound pages and are left to hugetlbfs.
+ */
+static inline int pmd_trans_huge(pmd_t pmd)
+{
+	return pmd_large(pmd) && !PageCompound(pfn_to_page(pmd_pfn(pmd)));
+}
+
+#define split_huge_pmd(__mm, __pmd)				\
+	do {							\
+		if (unlikely(pmd_trans_huge(*(__pmd))))		\
+			__split_huge_pmd(__mm, __pmd);		\
+	} while (0)
+
+static inline int transparent_hugepage_enabled(struct vm_area_struct *vma)
+{
+	if (vma->vm_flags & (VM_NOHUGEPAGE | VM_GROWSDOWN | VM_GROWSUP))
+		return 0;
+	if (test_bit(TRANSPARENT_HUGEPAGE_FLAG, &transparent_hugepage_flags))
+		return 1;
+	return test_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			&transparent_hugepage_flags) &&
+		(vma->vm_flags & VM_HUGEPAGE);
+}
+
+#else /* !CONFIG_TRANSPARENT_HUGEPAGE */
+
+#define pmd_trans_huge(pmd)			0
+#define split_huge_pmd(__mm, __pmd)		do { } while (0)
+#define transparent_hugepage_enabled(vma)	0
+
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
+/*
+ * pmd_none_or_clear_bad() for walkers holding mmap_sem only for read: a
+ * huge pmd can be faulted in at any time, even right after
+ * split_huge_pmd(), and must not be taken for a bad pmd and cleared,
+ * which would leak the huge block and the page table deposited with it.
+ * The pmd is read once.  Returns 1 if there is no page table to walk.
+ */
+static inline int pmd_none_or_trans_huge_or_clear_bad(pmd_t *pmd)
+{
+	pmd_t pmdval = *pmd;
+
+	barrier();
+	if (pmd_none(pmdval) || pmd_trans_huge(pmdval))
+		return 1;
+	if (unlikely(pmd_bad(pmdval))) {
+		pmd_clear_bad(pmd);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Split @pmd if it is huge and tell whether there is a page table under
+ * it, splitting again if a huge fault raced in.
+ */
+static inline int split_huge_pmd_none_or_clear_bad(struct mm_struct *mm,
+						   pmd_t *pmd)
+{
+	do {
+		split_huge_pmd(mm, pmd);
+		if (!pmd_none_or_trans_huge_or_clear_bad(pmd))
+			return 0;
+	} while (pmd_trans_huge(*pmd));
+	return 1;
+}
+
+#endif /* _LINUX_HUGE_MM_H */
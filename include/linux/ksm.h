@@ -0,0 +1,62 @@
+#ifndef __LINUX_KSM_H
+#define __LINUX_KSM_H
+/*
+ * Kernel same-page merging of anonymous memory: ksmd merges the pages
+ * with identical contents of the vmas registered with MADV_MERGEABLE.
+ * See mm/ksm.c and Documentation/vm/ksm.txt.
+ */
+
+#include <linux/bitops.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+
+#ifdef CONFIG_KSM
+int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
+		unsigned long end, int advice, unsigned long *vm_flags);
+int __ksm_enter(struct mm_struct *mm);
+void __ksm_exit(struct mm_struct *mm);
+
+static inline int ksm_fork(struct mm_struct *mm, struct mm_struct *oldmm)
+{
+	if (test_bit(MMF_VM_MERGEABLE, &oldmm->flags))
+		return __ksm_enter(mm);
+	return 0;
+}
+
+static inline void ksm_exit(struct mm_struct *mm)
+{
+	if (test_bit(MMF_VM_MERGEABLE, &mm->flags))
+		__ksm_exit(mm);
+}
+
+/*
+ * A KSM page is anonymous but belongs to no anon_vma: its mapping is
+ * PAGE_MAPPING_ANON alone.  It is write-protected wherever it is mapped.
+ */
+static inline int PageKsm(struct page *page)
+{
+	return (unsigned long)page->mapping == PAGE_MAPPING_ANON;
+}
+#else  /* !CONFIG_KSM */
+static inline int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
+		unsigned long end, int advice, unsigned long *vm_flags)
+{
+	return 0;
+}
+
+static inline int ksm_fork(struct mm_struct *mm, struct mm_struct *oldmm)
+{
+	return 0;
+}
+
+static inline void ksm_exit(struct mm_struct *mm)
+{
+}
+
+static inline int PageKsm(struct page *page)
+{
+	return 0;
+}
+#endif /* !CONFIG_KSM */
+
+#endif /* __LINUX_KSM_H */
@@ -28,6 +28,16 @@ enum {
 
 struct loop_func_table;
 
+/*
+ * A run of loop device sectors stored contiguously on lo_direct_bdev,
+ * for LO_FLAGS_DIRECT_IO.
+ */
+struct loop_extent {
+	sector_t	lo_sector;
+	sector_t	nr_sects;
+	sector_t	disk_sector;
+};
+
 struct loop_device {
 	int		lo_number;
 	int		lo_refcnt;
@@ -66,6 +76,12 @@ struct loop_device {
 	struct request_queue	*lo_queue;
 	struct gendisk		*lo_disk;
 	struct list_head	lo_list;
+
+	struct block_device	*lo_direct_bdev;
+	struct loop_extent	*lo_extents;	/* sorted by lo_sector */
+	unsigned int		lo_nr_extents;
+	atomic_t		lo_direct_pending;	/* bios in flight */
+	wait_queue_head_t	lo_direct_wait;
 };
 
 #endif /* __KERNEL__ */
@@ -77,6 +93,7 @@ enum {
 	LO_FLAGS_READ_ONLY	= 1,
 	LO_FLAGS_USE_AOPS	= 2,
 	LO_FLAGS_AUTOCLEAR	= 4,
+	LO_FLAGS_DIRECT_IO	= 16,	/* remap bios to the backing blocks */
 };
 
 #include <asm/posix_types.h>	/* for __kernel_old_dev_t */
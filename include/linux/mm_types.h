@@ -274,6 +274,10 @@ struct mm_struct {
 #ifdef CONFIG_MMU_NOTIFIER
 	struct mmu_notifier_mm *mmu_notifier_mm;
 #endif
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	/* page tables set aside for splitting huge pmds, page_table_lock */
+	pgtable_t pmd_huge_pte;
+#endif
 };
 
 /* Future-safe accessor for struct mm_struct's cpu_vm_mask. */
@@ -330,6 +330,9 @@ struct zone {
 
 	struct zone_reclaim_stat reclaim_stat;
 
+	/* Evictions and activations of file pages, see mm/workingset.c */
+	atomic_long_t		inactive_age;
+
 	unsigned long		pages_scanned;	   /* since last reclaim */
 	unsigned long		flags;		   /* zone flags, see below */
 
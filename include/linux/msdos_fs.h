@@ -100,6 +100,25 @@ struct __fat_dirent {
 /* <linux/videotext.h> has used 0x72 ('r') in collision, so skip a few */
 #define FAT_IOCTL_GET_ATTRIBUTES	_IOR('r', 0x10, __u32)
 #define FAT_IOCTL_SET_ATTRIBUTES	_IOW('r', 0x11, __u32)
+#define FAT_IOCTL_VERIFY		_IOR('r', 0x12, struct fat_verify_info)
+
+/*
+ * Result of FAT_IOCTL_VERIFY.  The counts are exact only if the volume
+ * isn't modified while the check runs.
+ */
+struct fat_verify_info {
+	__u32	clusters;	/* data clusters of the volume */
+	__u32	free_clusters;	/* free ones */
+	__u32	invalid;	/* entries pointing out of the volume or to
+				   a free cluster */
+	__u32	cross_linked;	/* clusters referenced more than once */
+	__u32	lost_chains;	/* chains no directory entry refers to */
+	__u32	lost_clusters;	/* clusters of those chains */
+	__u32	inodes_checked;	/* cached files whose chain was measured */
+	__u32	size_mismatch;	/* files whose chain doesn't fit their size */
+	__u32	bad_clusters;	/* clusters marked bad */
+	__u32	reserved[7];
+};
 
 struct fat_boot_sector {
 	__u8	ignored[3];	/* Boot strap short or near jump */
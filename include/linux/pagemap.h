@@ -209,11 +209,19 @@ static inline void page_unfreeze_refs(struct page *page, int count)
 
 #ifdef CONFIG_NUMA
 extern struct page *__page_cache_alloc(gfp_t gfp);
+extern unsigned long __page_cache_alloc_bulk(gfp_t gfp, unsigned long nr,
+					     struct list_head *list);
 #else
 static inline struct page *__page_cache_alloc(gfp_t gfp)
 {
 	return alloc_pages(gfp, 0);
 }
+
+static inline unsigned long __page_cache_alloc_bulk(gfp_t gfp,
+				unsigned long nr, struct list_head *list)
+{
+	return alloc_pages_bulk(gfp, nr, list);
+}
 #endif
 
 static inline struct page *page_cache_alloc(struct address_space *x)
@@ -226,8 +234,16 @@ static inline struct page *page_cache_alloc_cold(struct address_space *x)
 	return __page_cache_alloc(mapping_gfp_mask(x)|__GFP_COLD);
 }
 
+static inline unsigned long page_cache_alloc_cold_bulk(struct address_space *x,
+				unsigned long nr, struct list_head *list)
+{
+	return __page_cache_alloc_bulk(mapping_gfp_mask(x)|__GFP_COLD, nr, list);
+}
+
 typedef int filler_t(void *, struct page *);
 
+pgoff_t page_cache_next_hole(struct address_space *mapping,
+			     pgoff_t index, unsigned long max_scan);
 extern struct page * find_get_page(struct address_space *mapping,
 				pgoff_t index);
 extern struct page * find_lock_page(struct address_space *mapping,
@@ -435,7 +451,7 @@ int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 				pgoff_t index, gfp_t gfp_mask);
 extern void remove_from_page_cache(struct page *page);
-extern void __remove_from_page_cache(struct page *page);
+extern void __remove_from_page_cache(struct page *page, void *shadow);
 
 /*
  * Like add_to_page_cache_locked, but used to add newly allocated pages:
@@ -38,6 +38,16 @@
 #define RADIX_TREE_INDIRECT_PTR	1
 #define RADIX_TREE_RETRY ((void *)-1UL)
 
+/*
+ * An exceptional entry is a value rather than a pointer stored in the tree,
+ * e.g. the shadow entry the page cache leaves behind for an evicted page.
+ * It has bit 1 set, which no pointer to an item does, and carries its data
+ * above RADIX_TREE_EXCEPTIONAL_SHIFT.  The tree itself doesn't care about
+ * them: lookups return them like any other item.
+ */
+#define RADIX_TREE_EXCEPTIONAL_ENTRY	2
+#define RADIX_TREE_EXCEPTIONAL_SHIFT	2
+
 static inline void *radix_tree_ptr_to_indirect(void *ptr)
 {
 	return (void *)((unsigned long)ptr | RADIX_TREE_INDIRECT_PTR);
@@ -53,6 +63,15 @@ static inline int radix_tree_is_indirect_ptr(void *ptr)
 	return (int)((unsigned long)ptr & RADIX_TREE_INDIRECT_PTR);
 }
 
+/*
+ * RADIX_TREE_RETRY looks exceptional too: callers of radix_tree_deref_slot()
+ * must test for it first.
+ */
+static inline int radix_tree_exceptional_entry(void *arg)
+{
+	return (int)((unsigned long)arg & RADIX_TREE_EXCEPTIONAL_ENTRY);
+}
+
 /*** radix-tree API starts here ***/
 
 #define RADIX_TREE_MAX_TAGS 2
@@ -164,7 +183,8 @@ radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
 			unsigned long first_index, unsigned int max_items);
 unsigned int
 radix_tree_gang_lookup_slot(struct radix_tree_root *root, void ***results,
-			unsigned long first_index, unsigned int max_items);
+			unsigned long *indices, unsigned long first_index,
+			unsigned int max_items);
 unsigned long radix_tree_next_hole(struct radix_tree_root *root,
 				unsigned long index, unsigned long max_scan);
 int radix_tree_preload(gfp_t gfp_mask);
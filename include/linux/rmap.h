@@ -69,6 +69,7 @@ void __anon_vma_link(struct vm_area_struct *);
 void page_add_anon_rmap(struct page *, struct vm_area_struct *, unsigned long);
 void page_add_new_anon_rmap(struct page *, struct vm_area_struct *, unsigned long);
 void page_add_file_rmap(struct page *);
+void page_add_ksm_rmap(struct page *);
 void page_remove_rmap(struct page *);
 
 #ifdef CONFIG_DEBUG_VM
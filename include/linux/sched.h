@@ -96,6 +96,7 @@ struct exec_domain;
 struct futex_pi_state;
 struct robust_list_head;
 struct bio;
+struct blk_plug;
 struct bts_tracer;
 
 /*
@@ -423,6 +424,12 @@ extern int get_dumpable(struct mm_struct *mm);
 # define MMF_DUMP_MASK_DEFAULT_ELF	0
 #endif
 
+#define MMF_VM_MERGEABLE	16	/* KSM may merge identical pages */
+
+/* the flags a new mm inherits from its creator's */
+#define MMF_INIT_MASK		(((1 << MMF_DUMPABLE_BITS) - 1) | \
+				 MMF_DUMP_FILTER_MASK)
+
 struct sighand_struct {
 	atomic_t		count;
 	struct k_sigaction	action[_NSIG];
@@ -1336,6 +1343,9 @@ struct task_struct {
 /* stacked block device info */
 	struct bio *bio_list, **bio_tail;
 
+/* IO held back by blk_start_plug() */
+	struct blk_plug *plug;
+
 /* VM state */
 	struct reclaim_state *reclaim_state;
 
@@ -30,6 +30,8 @@ enum stat_item {
 	DEACTIVATE_TO_TAIL,	/* Cpu slab was moved to the tail of partials */
 	DEACTIVATE_REMOTE_FREES,/* Slab contained remotely freed objects */
 	ORDER_FALLBACK,		/* Number of times fallback was necessary */
+	FREE_REMOTE_BATCHED,	/* Freeing to the remote free batch */
+	FREE_REMOTE_FLUSH,	/* Remote free batch returned to its slab */
 	NR_SLUB_STAT_ITEMS };
 
 struct kmem_cache_cpu {
@@ -38,6 +40,11 @@ struct kmem_cache_cpu {
 	int node;		/* The node of the page (or -1 for debug) */
 	unsigned int offset;	/* Freepointer offset (in word units) */
 	unsigned int objsize;	/* Size of an object (from kmem_cache) */
+	/* Objects freed to another slab, not yet returned to it */
+	struct page *remote_page;	/* The slab they belong to */
+	void **remote_free;	/* First object of the batch */
+	void **remote_tail;	/* Last object of the batch */
+	int remote_count;	/* Number of objects in the batch */
 #ifdef CONFIG_SLUB_STATS
 	unsigned stat[NR_SLUB_STAT_ITEMS];
 #endif
@@ -123,12 +123,26 @@ enum {
 	SWP_DISCARDABLE = (1 << 2),	/* blkdev supports discard */
 	SWP_DISCARDING	= (1 << 3),	/* now discarding a free cluster */
 	SWP_SOLIDSTATE	= (1 << 4),	/* blkdev seeks are cheap */
+	SWP_BLKDEV	= (1 << 5),	/* its a block device */
 					/* add others here before... */
 	SWP_SCANNING	= (1 << 8),	/* refcount in scan_swap_map */
 };
 
 #define SWAP_CLUSTER_MAX 32
 
+/*
+ * Swap slots allocated in one go for the anonymous pages of a reclaim
+ * pass, and the bio gathering their writes: see shrink_page_list().
+ */
+#define SWAP_BATCH_MAX	SWAP_CLUSTER_MAX
+
+struct swap_batch {
+	struct bio *bio;		/* writes not submitted yet */
+	int nr_slots;			/* slots allocated */
+	int next_slot;			/* the next one to use */
+	swp_entry_t slots[SWAP_BATCH_MAX];
+};
+
 #define SWAP_MAP_MAX	0x7fff
 #define SWAP_MAP_BAD	0x8000
 
@@ -164,6 +178,12 @@ struct swap_list_t {
 /* Swap 50% full? Release swapcache more aggressively.. */
 #define vm_swap_full() (nr_swap_pages*2 < total_swap_pages)
 
+/* linux/mm/workingset.c */
+extern void *workingset_eviction(struct address_space *mapping,
+				 struct page *page);
+extern int workingset_refault(void *shadow);
+extern void workingset_activation(struct page *page);
+
 /* linux/mm/page_alloc.c */
 extern unsigned long totalram_pages;
 extern unsigned long totalreserve_pages;
@@ -277,12 +297,14 @@ extern void swap_unplug_io_fn(struct backing_dev_info *, struct page *);
 extern int swap_readpage(struct file *, struct page *);
 extern int swap_writepage(struct page *page, struct writeback_control *wbc);
 extern void end_swap_bio_read(struct bio *bio, int err);
+extern void swap_batch_finish(struct swap_batch *batch);
 
 /* linux/mm/swap_state.c */
 extern struct address_space swapper_space;
 #define total_swapcache_pages  swapper_space.nrpages
 extern void show_swap_cache_info(void);
-extern int add_to_swap(struct page *);
+extern void swap_batch_reserve(struct swap_batch *batch, int nr);
+extern int add_to_swap(struct page *, struct swap_batch *);
 extern int add_to_swap_cache(struct page *, swp_entry_t, gfp_t);
 extern void __delete_from_swap_cache(struct page *);
 extern void delete_from_swap_cache(struct page *);
@@ -293,12 +315,17 @@ extern struct page *read_swap_cache_async(swp_entry_t, gfp_t,
 			struct vm_area_struct *vma, unsigned long addr);
 extern struct page *swapin_readahead(swp_entry_t, gfp_t,
 			struct vm_area_struct *vma, unsigned long addr);
+extern struct page *swapin_readahead_vma(swp_entry_t, gfp_t,
+			struct vm_area_struct *vma, unsigned long addr,
+			pmd_t *pmd);
+extern int swap_vma_readahead;
 
 /* linux/mm/swapfile.c */
 extern long nr_swap_pages;
 extern long total_swap_pages;
 extern void si_swapinfo(struct sysinfo *);
 extern swp_entry_t get_swap_page(void);
+extern int get_swap_pages(int, swp_entry_t []);
 extern swp_entry_t get_swap_page_of_type(int);
 extern int swap_duplicate(swp_entry_t);
 extern int valid_swaphandles(swp_entry_t, unsigned long *);
@@ -382,12 +409,27 @@ static inline struct page *swapin_readahead(swp_entry_t swp, gfp_t gfp_mask,
 	return NULL;
 }
 
+static inline struct page *swapin_readahead_vma(swp_entry_t swp,
+			gfp_t gfp_mask, struct vm_area_struct *vma,
+			unsigned long addr, pmd_t *pmd)
+{
+	return NULL;
+}
+
 static inline struct page *lookup_swap_cache(swp_entry_t swp)
 {
 	return NULL;
 }
 
-static inline int add_to_swap(struct page *page)
+static inline void swap_batch_reserve(struct swap_batch *batch, int nr)
+{
+}
+
+static inline void swap_batch_finish(struct swap_batch *batch)
+{
+}
+
+static inline int add_to_swap(struct page *page, struct swap_batch *batch)
 {
 	return 0;
 }
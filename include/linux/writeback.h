@@ -8,6 +8,7 @@
 #include <linux/fs.h>
 
 struct backing_dev_info;
+struct swap_batch;
 
 extern spinlock_t inode_lock;
 extern struct list_head inode_in_use;
@@ -55,6 +56,9 @@ struct writeback_control {
 	loff_t range_start;
 	loff_t range_end;
 
+	struct swap_batch *swap_batch;	/* If !NULL, reclaim gathers the
+					   swap writes here */
+
 	unsigned nonblocking:1;		/* Don't get stuck on request queues */
 	unsigned encountered_congestion:1; /* An output: a queue is full */
 	unsigned for_kupdate:1;		/* A kupdate writeback */
@@ -96,10 +100,16 @@ static inline void inode_sync_wait(struct inode *inode)
 }
 
 
+/*
+ * mm/backing-dev.c
+ */
+void wakeup_flusher_threads(long nr_pages);
+
 /*
  * mm/page-writeback.c
  */
-int wakeup_pdflush(long nr_pages);
+long bdi_writeback(struct backing_dev_info *bdi, long min_pages);
+long bdi_kupdate(struct backing_dev_info *bdi);
 void laptop_io_completion(void);
 void laptop_sync_completion(void);
 void throttle_vm_writeout(gfp_t gfp_mask);
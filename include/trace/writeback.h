@@ -0,0 +1,23 @@
+#ifndef _TRACE_WRITEBACK_H
+#define _TRACE_WRITEBACK_H
+
+#include <linux/backing-dev.h>
+#include <linux/tracepoint.h>
+
+DECLARE_TRACE(writeback_start,
+	TPPROTO(struct backing_dev_info *bdi, long min_pages, int for_kupdate),
+		TPARGS(bdi, min_pages, for_kupdate));
+
+DECLARE_TRACE(writeback_done,
+	TPPROTO(struct backing_dev_info *bdi, long written, int for_kupdate),
+		TPARGS(bdi, written, for_kupdate));
+
+DECLARE_TRACE(writeback_thread_start,
+	TPPROTO(struct backing_dev_info *bdi),
+		TPARGS(bdi));
+
+DECLARE_TRACE(writeback_thread_stop,
+	TPPROTO(struct backing_dev_info *bdi),
+		TPARGS(bdi));
+
+#endif
@@ -4550,6 +4550,13 @@ asmlinkage void __sched schedule(void)
 	struct rq *rq;
 	int cpu;
 
+	/*
+	 * A task going to sleep might be waiting for the IO it holds
+	 * back in a plug: queue it first.  io_schedule() has done so.
+	 */
+	if (current->state && !(preempt_count() & PREEMPT_ACTIVE))
+		blk_schedule_flush_plug(current);
+
 need_resched:
 	preempt_disable();
 	cpu = smp_processor_id();
@@ -5796,6 +5803,7 @@ void __sched io_schedule(void)
 {
 	struct rq *rq = &__raw_get_cpu_var(runqueues);
 
+	blk_flush_plug(current);
 	delayacct_blkio_start();
 	atomic_inc(&rq->nr_iowait);
 	schedule();
@@ -5809,6 +5817,7 @@ long __sched io_schedule_timeout(long timeout)
 	struct rq *rq = &__raw_get_cpu_var(runqueues);
 	long ret;
 
+	blk_flush_plug(current);
 	delayacct_blkio_start();
 	atomic_inc(&rq->nr_iowait);
 	ret = schedule_timeout(timeout);
@@ -6,10 +6,28 @@
 #include <linux/module.h>
 #include <linux/writeback.h>
 #include <linux/device.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <trace/writeback.h>
 
 
 static struct class *bdi_class;
 
+/*
+ * Every initialised bdi is on bdi_list.  bdi_lock also protects the
+ * wb_task of each, and the names of the registered ones.
+ */
+static DEFINE_SPINLOCK(bdi_lock);
+static LIST_HEAD(bdi_list);
+static struct task_struct *bdi_forker_task;
+static struct task_struct *sync_supers_task;
+
+/* A flusher thread with nothing to do for this long exits */
+#define BDI_IDLE_TIMEOUT	(300 * HZ)
+
+DEFINE_TRACE(writeback_thread_start);
+DEFINE_TRACE(writeback_thread_stop);
+
 #ifdef CONFIG_DEBUG_FS
 #include <linux/debugfs.h>
 #include <linux/seq_file.h>
@@ -36,12 +54,18 @@ static int bdi_debug_stats_show(struct seq_file *m, void *v)
 		   "BdiReclaimable:   %8lu kB\n"
 		   "BdiDirtyThresh:   %8lu kB\n"
 		   "DirtyThresh:      %8lu kB\n"
-		   "BackgroundThresh: %8lu kB\n",
+		   "BackgroundThresh: %8lu kB\n"
+		   "BdiDirtied:       %8lu kB\n"
+		   "BdiWritten:       %8lu kB\n"
+		   "FlusherThread:    %8s\n",
 		   (unsigned long) K(bdi_stat(bdi, BDI_WRITEBACK)),
 		   (unsigned long) K(bdi_stat(bdi, BDI_RECLAIMABLE)),
 		   K(bdi_thresh),
 		   K(dirty_thresh),
-		   K(background_thresh));
+		   K(background_thresh),
+		   (unsigned long) K(bdi_stat(bdi, BDI_DIRTIED)),
+		   (unsigned long) K(bdi_stat(bdi, BDI_WRITTEN)),
+		   bdi->wb_task ? "running" : "none");
 #undef K
 
 	return 0;
@@ -203,14 +227,380 @@ EXPORT_SYMBOL(bdi_register_dev);
 
 void bdi_unregister(struct backing_dev_info *bdi)
 {
-	if (bdi->dev) {
+	struct device *dev = bdi->dev;
+
+	if (dev) {
 		bdi_debug_unregister(bdi);
-		device_unregister(bdi->dev);
+		spin_lock(&bdi_lock);
 		bdi->dev = NULL;
+		spin_unlock(&bdi_lock);
+		device_unregister(dev);
 	}
 }
 EXPORT_SYMBOL(bdi_unregister);
 
+/*
+ * Per-device flusher threads.
+ *
+ * Background and periodic ("kupdate") writeback of each device is done by a
+ * thread of its own, so that a slow device doesn't hold up the writeback of
+ * the others.  The threads are created on demand by the forker thread, when
+ * a device gets its first dirty inode or a writeback request, and exit after
+ * BDI_IDLE_TIMEOUT without work.  The superblocks are written back every
+ * dirty_writeback_interval by a thread of their own, so that a slow
+ * ->write_super() doesn't hold up the creation of the flusher threads.
+ */
+
+static unsigned long bdi_idle_timeout(void)
+{
+	return max_t(unsigned long, BDI_IDLE_TIMEOUT,
+		     dirty_expire_interval + dirty_writeback_interval);
+}
+
+/* Nothing to write now, and nothing dirtied which kupdate could write */
+static int bdi_wb_idle(struct backing_dev_info *bdi)
+{
+	unsigned long timeout = bdi_idle_timeout();
+
+	return !atomic_long_read(&bdi->wb_nr_pages) &&
+		!test_bit(BDI_wb_background, &bdi->state) &&
+		time_after(jiffies, bdi->wb_last_active + timeout) &&
+		time_after(jiffies, bdi->wb_dirtied + timeout) &&
+		!bdi_stat(bdi, BDI_RECLAIMABLE);
+}
+
+/*
+ * Returns 1 if the flusher thread of @bdi may exit.  If bdi_wb_shutdown()
+ * took wb_task, it must wait for kthread_stop() instead.  Once wb_task is
+ * cleared and bdi_lock dropped, @bdi may be freed under the thread, so the
+ * stop is traced here.
+ */
+static int bdi_wb_exit(struct backing_dev_info *bdi)
+{
+	int ret = 0;
+
+	spin_lock(&bdi_lock);
+	if (bdi->wb_task == current) {
+		bdi->wb_task = NULL;
+		/* pairs with the barrier in bdi_inode_dirtied() */
+		smp_mb();
+		if (bdi_wb_idle(bdi)) {
+			trace_writeback_thread_stop(bdi);
+			ret = 1;
+		} else
+			bdi->wb_task = current;
+	}
+	spin_unlock(&bdi_lock);
+	return ret;
+}
+
+static int bdi_writeback_task(void *data)
+{
+	struct backing_dev_info *bdi = data;
+	unsigned long interval = dirty_writeback_interval;
+	unsigned long next_kupdate = jiffies + interval;
+	long nr_pages, written, timeout;
+
+	current->flags |= PF_FLUSHER | PF_SWAPWRITE;
+	set_freezable();
+	bdi->wb_last_active = jiffies;
+	trace_writeback_thread_start(bdi);
+
+	while (!kthread_should_stop()) {
+		written = 0;
+		nr_pages = atomic_long_xchg(&bdi->wb_nr_pages, 0);
+		if (test_and_clear_bit(BDI_wb_background, &bdi->state) ||
+		    nr_pages)
+			written += bdi_writeback(bdi, nr_pages);
+
+		/* the sysctl handler wakes us up when the interval changes */
+		if (interval != dirty_writeback_interval) {
+			interval = dirty_writeback_interval;
+			next_kupdate = jiffies + interval;
+		}
+		if (interval && time_after_eq(jiffies, next_kupdate)) {
+			next_kupdate = jiffies + interval;
+			written += bdi_kupdate(bdi);
+			if (time_before(next_kupdate, jiffies + HZ))
+				next_kupdate = jiffies + HZ;
+		}
+
+		if (written)
+			bdi->wb_last_active = jiffies;
+		else if (bdi_wb_idle(bdi) && bdi_wb_exit(bdi))
+			return 0;	/* @bdi may be gone already */
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!atomic_long_read(&bdi->wb_nr_pages) &&
+		    !test_bit(BDI_wb_background, &bdi->state) &&
+		    !kthread_should_stop()) {
+			if (interval)
+				timeout = next_kupdate - jiffies;
+			else
+				timeout = bdi_idle_timeout();
+			if (timeout > 0)
+				schedule_timeout(timeout);
+		}
+		__set_current_state(TASK_RUNNING);
+		try_to_freeze();
+	}
+
+	trace_writeback_thread_stop(bdi);
+	return 0;
+}
+
+/* Called with bdi_lock held */
+static void bdi_wakeup_locked(struct backing_dev_info *bdi)
+{
+	if (bdi->wb_task)
+		wake_up_process(bdi->wb_task);
+	else {
+		set_bit(BDI_wb_pending, &bdi->state);
+		if (bdi_forker_task)
+			wake_up_process(bdi_forker_task);
+	}
+}
+
+/**
+ * bdi_start_writeback - start background writeout of a device
+ * @bdi: the device
+ * @nr_pages: pages to write at least, or 0
+ *
+ * Has the flusher thread of @bdi write back at least @nr_pages pages, and
+ * keep writing while the dirty memory is above the background threshold.
+ * Creates the thread if there is none.
+ */
+void bdi_start_writeback(struct backing_dev_info *bdi, long nr_pages)
+{
+	if (!bdi_cap_writeback_dirty(bdi))
+		return;
+	if (nr_pages)
+		atomic_long_add(nr_pages, &bdi->wb_nr_pages);
+	else if (test_and_set_bit(BDI_wb_background, &bdi->state))
+		return;		/* already asked for */
+
+	spin_lock(&bdi_lock);
+	bdi_wakeup_locked(bdi);
+	spin_unlock(&bdi_lock);
+}
+EXPORT_SYMBOL(bdi_start_writeback);
+
+/**
+ * bdi_inode_dirtied - an inode of a device became dirty
+ * @bdi: the device
+ *
+ * Makes sure that @bdi has a flusher thread, to write the inode back
+ * after dirty_expire_interval.
+ */
+void bdi_inode_dirtied(struct backing_dev_info *bdi)
+{
+	if (!bdi_cap_writeback_dirty(bdi))
+		return;
+	bdi->wb_dirtied = jiffies;
+	/* pairs with the barrier in bdi_wb_exit() */
+	smp_mb();
+	if (bdi->wb_task || test_bit(BDI_wb_pending, &bdi->state))
+		return;
+
+	spin_lock(&bdi_lock);
+	if (!bdi->wb_task)
+		bdi_wakeup_locked(bdi);
+	spin_unlock(&bdi_lock);
+}
+
+/**
+ * wakeup_flusher_threads - start writeback of all devices
+ * @nr_pages: pages to write on each device at least, or 0 for all of them
+ */
+void wakeup_flusher_threads(long nr_pages)
+{
+	struct backing_dev_info *bdi;
+	long nr;
+
+	spin_lock(&bdi_lock);
+	list_for_each_entry(bdi, &bdi_list, bdi_list) {
+		if (!bdi_cap_writeback_dirty(bdi))
+			continue;
+		nr = bdi_stat(bdi, BDI_RECLAIMABLE);
+		if (!nr)
+			continue;
+		if (nr_pages)
+			nr = min(nr, nr_pages);
+		atomic_long_add(nr, &bdi->wb_nr_pages);
+		bdi_wakeup_locked(bdi);
+	}
+	spin_unlock(&bdi_lock);
+}
+
+/* Wakes all the flusher threads, to pick up a new dirty_writeback_interval */
+void bdi_wakeup_all(void)
+{
+	struct backing_dev_info *bdi;
+
+	spin_lock(&bdi_lock);
+	list_for_each_entry(bdi, &bdi_list, bdi_list) {
+		if (bdi->wb_task)
+			wake_up_process(bdi->wb_task);
+	}
+	if (sync_supers_task)
+		wake_up_process(sync_supers_task);
+	spin_unlock(&bdi_lock);
+}
+
+static int bdi_sched_wait(void *word)
+{
+	schedule();
+	return 0;
+}
+
+static void bdi_fork_flusher(struct backing_dev_info *bdi, const char *name)
+{
+	struct task_struct *task;
+
+	task = kthread_create(bdi_writeback_task, bdi, "flush-%s", name);
+	if (IS_ERR(task)) {
+		/* no thread: do what was asked for ourselves, once */
+		clear_bit(BDI_wb_background, &bdi->state);
+		bdi_writeback(bdi, atomic_long_xchg(&bdi->wb_nr_pages, 0));
+		task = NULL;
+	}
+
+	spin_lock(&bdi_lock);
+	bdi->wb_task = task;
+	if (task)
+		wake_up_process(task);
+	spin_unlock(&bdi_lock);
+
+	clear_bit(BDI_wb_creating, &bdi->state);
+	smp_mb__after_clear_bit();
+	wake_up_bit(&bdi->state, BDI_wb_creating);
+}
+
+/* Writes back the superblocks once per dirty_writeback_interval */
+static int bdi_sync_supers_fn(void *unused)
+{
+	unsigned long next_sync = jiffies + dirty_writeback_interval;
+	long timeout;
+
+	set_freezable();
+	while (!kthread_should_stop()) {
+		if (dirty_writeback_interval &&
+		    time_after_eq(jiffies, next_sync)) {
+			sync_supers();
+			next_sync = jiffies + dirty_writeback_interval;
+		}
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop()) {
+			__set_current_state(TASK_RUNNING);
+			break;
+		}
+		if (dirty_writeback_interval) {
+			timeout = next_sync - jiffies;
+			if (timeout > (long)dirty_writeback_interval) {
+				/* the interval was shortened */
+				next_sync = jiffies + dirty_writeback_interval;
+				timeout = dirty_writeback_interval;
+			}
+		} else
+			timeout = MAX_SCHEDULE_TIMEOUT;
+		if (timeout > 0)
+			schedule_timeout(timeout);
+		__set_current_state(TASK_RUNNING);
+		try_to_freeze();
+	}
+	return 0;
+}
+
+/*
+ * The forker thread creates the flusher threads of the devices which ask for
+ * one.
+ */
+static int bdi_forker_task_fn(void *unused)
+{
+	struct backing_dev_info *bdi, *found;
+	char name[TASK_COMM_LEN];
+
+	set_freezable();
+	for ( ; ; ) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		found = NULL;
+		spin_lock(&bdi_lock);
+		list_for_each_entry(bdi, &bdi_list, bdi_list) {
+			if (!test_and_clear_bit(BDI_wb_pending, &bdi->state) ||
+			    bdi->wb_task)
+				continue;
+			set_bit(BDI_wb_creating, &bdi->state);
+			strlcpy(name, bdi->dev ? dev_name(bdi->dev) : "anon",
+				sizeof(name));
+			found = bdi;
+			break;
+		}
+		spin_unlock(&bdi_lock);
+
+		if (found) {
+			__set_current_state(TASK_RUNNING);
+			bdi_fork_flusher(found, name);
+			continue;
+		}
+
+		schedule();
+		__set_current_state(TASK_RUNNING);
+		try_to_freeze();
+	}
+	return 0;
+}
+
+static int __init bdi_forker_init(void)
+{
+	struct task_struct *task, *sync_task;
+
+	sync_task = kthread_run(bdi_sync_supers_fn, NULL, "sync_supers");
+	if (IS_ERR(sync_task))
+		return PTR_ERR(sync_task);
+	task = kthread_run(bdi_forker_task_fn, NULL, "bdi-default");
+	if (IS_ERR(task)) {
+		kthread_stop(sync_task);
+		return PTR_ERR(task);
+	}
+
+	/* it looks at the devices which asked for a thread before, too */
+	spin_lock(&bdi_lock);
+	sync_supers_task = sync_task;
+	bdi_forker_task = task;
+	spin_unlock(&bdi_lock);
+	return 0;
+}
+module_init(bdi_forker_init);
+
+/*
+ * Stops the flusher thread of @bdi, for good.  bdi_destroy() is also
+ * called on bdis which bdi_init() never set up, those have no thread.
+ */
+static void bdi_wb_shutdown(struct backing_dev_info *bdi)
+{
+	struct task_struct *task;
+
+	spin_lock(&bdi_lock);
+	if (!test_and_clear_bit(BDI_listed, &bdi->state)) {
+		spin_unlock(&bdi_lock);
+		return;
+	}
+	list_del_init(&bdi->bdi_list);
+	spin_unlock(&bdi_lock);
+
+	wait_on_bit(&bdi->state, BDI_wb_creating, bdi_sched_wait,
+		    TASK_UNINTERRUPTIBLE);
+
+	spin_lock(&bdi_lock);
+	task = bdi->wb_task;
+	bdi->wb_task = NULL;
+	spin_unlock(&bdi_lock);
+
+	if (task)
+		kthread_stop(task);
+}
+
 int bdi_init(struct backing_dev_info *bdi)
 {
 	int i;
@@ -235,8 +625,17 @@ int bdi_init(struct backing_dev_info *bdi)
 err:
 		while (i--)
 			percpu_counter_destroy(&bdi->bdi_stat[i]);
+		return err;
 	}
 
+	bdi->wb_task = NULL;
+	atomic_long_set(&bdi->wb_nr_pages, 0);
+	bdi->wb_last_active = bdi->wb_dirtied = jiffies;
+	spin_lock(&bdi_lock);
+	list_add_tail(&bdi->bdi_list, &bdi_list);
+	set_bit(BDI_listed, &bdi->state);
+	spin_unlock(&bdi_lock);
+
 	return err;
 }
 EXPORT_SYMBOL(bdi_init);
@@ -245,6 +644,7 @@ void bdi_destroy(struct backing_dev_info *bdi)
 {
 	int i;
 
+	bdi_wb_shutdown(bdi);
 	bdi_unregister(bdi);
 
 	for (i = 0; i < NR_BDI_STAT_ITEMS; i++)
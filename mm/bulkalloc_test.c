@@ -0,0 +1,102 @@
+/*
+ * Benchmark of alloc_pages_bulk() against alloc_page() in a loop
+ *
+ * Allocates nr_pages pages and keeps them until the end of the run, the
+ * way readahead fills the page cache, once one page at a time and once
+ * in bulk at a few batch sizes, both hot and cold.  Reports the time per
+ * page and how many times zone->lock was taken, from the
+ * pgalloc_zone_lock vm event.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <linux/vmstat.h>
+#include <linux/ktime.h>
+
+static unsigned long nr_pages = 4096;
+module_param(nr_pages, ulong, 0);
+MODULE_PARM_DESC(nr_pages, "Number of pages allocated by each run");
+
+static unsigned long events[NR_VM_EVENT_ITEMS];
+
+static unsigned long zone_locks(void)
+{
+	all_vm_events(events);
+	return events[PGALLOC_ZONE_LOCK];
+}
+
+/* Returns the number of pages allocated, 0 if the batch failed */
+static unsigned long bulkalloc_run(gfp_t gfp_mask, unsigned long batch)
+{
+	unsigned long allocated = 0, n, locks;
+	ktime_t start;
+	s64 ns;
+	LIST_HEAD(pages);
+
+	locks = zone_locks();
+	start = ktime_get();
+	while (allocated < nr_pages) {
+		n = min(batch, nr_pages - allocated);
+		if (batch == 1) {
+			struct page *page = alloc_page(gfp_mask);
+
+			if (!page)
+				break;
+			list_add(&page->lru, &pages);
+			n = 1;
+		} else {
+			n = alloc_pages_bulk(gfp_mask, n, &pages);
+			if (!n)
+				break;
+		}
+		allocated += n;
+	}
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	locks = zone_locks() - locks;
+	put_pages_list(&pages);
+
+	if (allocated < nr_pages) {
+		printk(KERN_INFO "bulkalloc: %s batch %lu: allocation failed\n",
+		       gfp_mask & __GFP_COLD ? "cold" : "hot", batch);
+		return 0;
+	}
+	printk(KERN_INFO "bulkalloc: %s batch %2lu: %5lld ns/page, "
+	       "%5lu zone->lock holds\n",
+	       gfp_mask & __GFP_COLD ? "cold" : "hot ", batch,
+	       ns / (s64)nr_pages, locks);
+	return allocated;
+}
+
+static int __init bulkalloc_test(void)
+{
+	static const unsigned long batches[] = { 1, 8, 16, 32, 64 };
+	gfp_t gfp_mask = GFP_KERNEL;
+	int cold, i;
+
+	printk(KERN_INFO "====[ bulk page allocator test, %lu pages ]====\n",
+	       nr_pages);
+	for (cold = 0; cold < 2; cold++) {
+		for (i = 0; i < ARRAY_SIZE(batches); i++) {
+			if (!bulkalloc_run(gfp_mask, batches[i]))
+				break;
+		}
+		gfp_mask |= __GFP_COLD;
+	}
+	printk(KERN_INFO "====[ end of bulk page allocator test ]====\n");
+	return 0;
+}
+
+static void __exit bulkalloc_test_exit(void)
+{
+}
+
+module_init(bulkalloc_test);
+module_exit(bulkalloc_test_exit);
+MODULE_LICENSE("GPL");
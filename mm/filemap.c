@@ -107,16 +107,39 @@
  *    ->dcache_lock		(proc_pid_lookup)
  */
 
+static void page_cache_tree_delete(struct address_space *mapping,
+				   struct page *page, void *shadow)
+{
+	void **slot;
+
+	if (!shadow) {
+		radix_tree_delete(&mapping->page_tree, page->index);
+		return;
+	}
+
+	/* radix_tree_delete() would have cleared the tags, too */
+	radix_tree_tag_clear(&mapping->page_tree, page->index,
+			     PAGECACHE_TAG_DIRTY);
+	radix_tree_tag_clear(&mapping->page_tree, page->index,
+			     PAGECACHE_TAG_WRITEBACK);
+	slot = radix_tree_lookup_slot(&mapping->page_tree, page->index);
+	radix_tree_replace_slot(slot, shadow);
+	mapping->nrshadows++;
+}
+
 /*
  * Remove a page from the page cache and free it. Caller has to make
  * sure the page is locked and that nobody else uses it - or that usage
  * is safe.  The caller must hold the mapping's tree_lock.
+ *
+ * If @shadow isn't NULL, it is left in the page's slot: see
+ * mm/workingset.c.
  */
-void __remove_from_page_cache(struct page *page)
+void __remove_from_page_cache(struct page *page, void *shadow)
 {
 	struct address_space *mapping = page->mapping;
 
-	radix_tree_delete(&mapping->page_tree, page->index);
+	page_cache_tree_delete(mapping, page, shadow);
 	page->mapping = NULL;
 	mapping->nrpages--;
 	__dec_zone_page_state(page, NR_FILE_PAGES);
@@ -143,7 +166,7 @@ void remove_from_page_cache(struct page *page)
 	BUG_ON(!PageLocked(page));
 
 	spin_lock_irq(&mapping->tree_lock);
-	__remove_from_page_cache(page);
+	__remove_from_page_cache(page, NULL);
 	spin_unlock_irq(&mapping->tree_lock);
 }
 
@@ -442,18 +465,33 @@ int filemap_write_and_wait_range(struct address_space *mapping,
 	return err;
 }
 
-/**
- * add_to_page_cache_locked - add a locked page to the pagecache
- * @page:	page to add
- * @mapping:	the page's address_space
- * @offset:	page index
- * @gfp_mask:	page allocation mode
- *
- * This function is used to add a page to the pagecache. It must be locked.
- * This function does not add the page to the LRU.  The caller must do that.
+/*
+ * Inserts @page at its index, in place of the shadow entry of an evicted
+ * page if there is one.  The shadow is returned in *@shadowp.
  */
-int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
-		pgoff_t offset, gfp_t gfp_mask)
+static int page_cache_tree_insert(struct address_space *mapping,
+				  struct page *page, void **shadowp)
+{
+	void **slot;
+	void *p;
+
+	slot = radix_tree_lookup_slot(&mapping->page_tree, page->index);
+	if (slot) {
+		p = radix_tree_deref_slot(slot);
+		if (!radix_tree_exceptional_entry(p))
+			return -EEXIST;
+		radix_tree_replace_slot(slot, page);
+		mapping->nrshadows--;
+		if (shadowp)
+			*shadowp = p;
+		return 0;
+	}
+	return radix_tree_insert(&mapping->page_tree, page->index, page);
+}
+
+static int __add_to_page_cache_locked(struct page *page,
+		struct address_space *mapping, pgoff_t offset, gfp_t gfp_mask,
+		void **shadowp)
 {
 	int error;
 
@@ -471,7 +509,7 @@ int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 		page->index = offset;
 
 		spin_lock_irq(&mapping->tree_lock);
-		error = radix_tree_insert(&mapping->page_tree, offset, page);
+		error = page_cache_tree_insert(mapping, page, shadowp);
 		if (likely(!error)) {
 			mapping->nrpages++;
 			__inc_zone_page_state(page, NR_FILE_PAGES);
@@ -488,11 +526,28 @@ int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 out:
 	return error;
 }
+
+/**
+ * add_to_page_cache_locked - add a locked page to the pagecache
+ * @page:	page to add
+ * @mapping:	the page's address_space
+ * @offset:	page index
+ * @gfp_mask:	page allocation mode
+ *
+ * This function is used to add a page to the pagecache. It must be locked.
+ * This function does not add the page to the LRU.  The caller must do that.
+ */
+int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
+		pgoff_t offset, gfp_t gfp_mask)
+{
+	return __add_to_page_cache_locked(page, mapping, offset, gfp_mask, NULL);
+}
 EXPORT_SYMBOL(add_to_page_cache_locked);
 
 int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 				pgoff_t offset, gfp_t gfp_mask)
 {
+	void *shadow = NULL;
 	int ret;
 
 	/*
@@ -504,14 +559,21 @@ int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 	if (mapping_cap_swap_backed(mapping))
 		SetPageSwapBacked(page);
 
-	ret = add_to_page_cache(page, mapping, offset, gfp_mask);
-	if (ret == 0) {
-		if (page_is_file_cache(page))
-			lru_cache_add_file(page);
-		else
-			lru_cache_add_active_anon(page);
+	__set_page_locked(page);
+	ret = __add_to_page_cache_locked(page, mapping, offset, gfp_mask,
+					 &shadow);
+	if (unlikely(ret)) {
+		__clear_page_locked(page);
+		return ret;
 	}
-	return ret;
+
+	if (!page_is_file_cache(page))
+		lru_cache_add_active_anon(page);
+	else if (shadow && workingset_refault(shadow))
+		lru_cache_add_active_file(page);	/* a working set page */
+	else
+		lru_cache_add_file(page);
+	return 0;
 }
 
 #ifdef CONFIG_NUMA
@@ -524,6 +586,22 @@ struct page *__page_cache_alloc(gfp_t gfp)
 	return alloc_pages(gfp, 0);
 }
 EXPORT_SYMBOL(__page_cache_alloc);
+
+unsigned long __page_cache_alloc_bulk(gfp_t gfp, unsigned long nr,
+				      struct list_head *list)
+{
+	struct page *page;
+
+	/* spreading goes page by page */
+	if (cpuset_do_page_mem_spread()) {
+		page = __page_cache_alloc(gfp);
+		if (!page)
+			return 0;
+		list_add_tail(&page->lru, list);
+		return 1;
+	}
+	return alloc_pages_bulk(gfp, nr, list);
+}
 #endif
 
 static int __sleep_on_page_lock(void *word)
@@ -642,6 +720,34 @@ void __lock_page_nosync(struct page *page)
 							TASK_UNINTERRUPTIBLE);
 }
 
+/**
+ * page_cache_next_hole - find the next hole (not-present entry)
+ * @mapping: mapping
+ * @index: index
+ * @max_scan: maximum range to search
+ *
+ * Like radix_tree_next_hole(), but the shadow entries of evicted pages
+ * count as holes.  May be called under rcu_read_lock.
+ */
+pgoff_t page_cache_next_hole(struct address_space *mapping,
+			     pgoff_t index, unsigned long max_scan)
+{
+	unsigned long i;
+	void *page;
+
+	for (i = 0; i < max_scan; i++) {
+		page = radix_tree_lookup(&mapping->page_tree, index);
+		if (!page || radix_tree_exceptional_entry(page))
+			break;
+		index++;
+		if (index == 0)
+			break;
+	}
+
+	return index;
+}
+EXPORT_SYMBOL(page_cache_next_hole);
+
 /**
  * find_get_page - find and get a page reference
  * @mapping: the address_space to search
@@ -663,6 +769,11 @@ repeat:
 		page = radix_tree_deref_slot(pagep);
 		if (unlikely(!page || page == RADIX_TREE_RETRY))
 			goto repeat;
+		/* the shadow entry of an evicted page */
+		if (radix_tree_exceptional_entry(page)) {
+			page = NULL;
+			goto out;
+		}
 
 		if (!page_cache_get_speculative(page))
 			goto repeat;
@@ -677,6 +788,7 @@ repeat:
 			goto repeat;
 		}
 	}
+out:
 	rcu_read_unlock();
 
 	return page;
@@ -772,46 +884,63 @@ EXPORT_SYMBOL(find_or_create_page);
  * find_get_pages() takes a reference against the returned pages.
  *
  * The search returns a group of mapping-contiguous pages with ascending
- * indexes.  There may be holes in the indices due to not-present pages.
+ * indexes.  There may be holes in the indices due to not-present or evicted
+ * pages.
  *
  * find_get_pages() returns the number of pages which were found.
  */
 unsigned find_get_pages(struct address_space *mapping, pgoff_t start,
 			    unsigned int nr_pages, struct page **pages)
 {
+	void **slots[PAGEVEC_SIZE];
+	unsigned long indices[PAGEVEC_SIZE];
 	unsigned int i;
-	unsigned int ret;
-	unsigned int nr_found;
+	unsigned int ret = 0;
+	unsigned int nr_found, nr_wanted;
 
 	rcu_read_lock();
+	/*
+	 * Look up in batches, and go on from the index of the last entry
+	 * of each: there may be only shadow entries in some of them.
+	 */
+	while (ret < nr_pages) {
+		nr_wanted = min_t(unsigned int, nr_pages - ret, PAGEVEC_SIZE);
 restart:
-	nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
-				(void ***)pages, start, nr_pages);
-	ret = 0;
-	for (i = 0; i < nr_found; i++) {
-		struct page *page;
+		nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
+					slots, indices, start, nr_wanted);
+		for (i = 0; i < nr_found; i++) {
+			struct page *page;
 repeat:
-		page = radix_tree_deref_slot((void **)pages[i]);
-		if (unlikely(!page))
-			continue;
-		/*
-		 * this can only trigger if nr_found == 1, making livelock
-		 * a non issue.
-		 */
-		if (unlikely(page == RADIX_TREE_RETRY))
-			goto restart;
+			page = radix_tree_deref_slot(slots[i]);
+			if (unlikely(!page))
+				continue;
+			/*
+			 * this can only trigger if nr_found == 1, making
+			 * livelock a non issue.
+			 */
+			if (unlikely(page == RADIX_TREE_RETRY))
+				goto restart;
+			/* the shadow entry of an evicted page */
+			if (radix_tree_exceptional_entry(page))
+				continue;
 
-		if (!page_cache_get_speculative(page))
-			goto repeat;
+			if (!page_cache_get_speculative(page))
+				goto repeat;
 
-		/* Has the page moved? */
-		if (unlikely(page != *((void **)pages[i]))) {
-			page_cache_release(page);
-			goto repeat;
-		}
+			/* Has the page moved? */
+			if (unlikely(page != *slots[i])) {
+				page_cache_release(page);
+				goto repeat;
+			}
 
-		pages[ret] = page;
-		ret++;
+			pages[ret] = page;
+			ret++;
+		}
+		if (nr_found < nr_wanted)
+			break;		/* no more entries */
+		start = indices[nr_found - 1] + 1;
+		if (!start)
+			break;		/* wrapped */
 	}
 	rcu_read_unlock();
 	return ret;
@@ -839,7 +968,7 @@ unsigned find_get_pages_contig(struct address_space *mapping, pgoff_t index,
 	rcu_read_lock();
 restart:
 	nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
-				(void ***)pages, index, nr_pages);
+				(void ***)pages, NULL, index, nr_pages);
 	ret = 0;
 	for (i = 0; i < nr_found; i++) {
 		struct page *page;
@@ -854,6 +983,10 @@ repeat:
 		if (unlikely(page == RADIX_TREE_RETRY))
 			goto restart;
 
+		/* the shadow entry of an evicted page is a hole */
+		if (radix_tree_exceptional_entry(page))
+			break;
+
 		if (page->mapping == NULL || page->index != index)
 			break;
 
@@ -0,0 +1,379 @@
+/*
+ *  mm/huge_memory.c
+ *
+ *  Transparent huge pmd mappings of anonymous memory.
+ *
+ *  When an anonymous vma covers a whole, empty, aligned pmd, the fault
+ *  handler tries to allocate HPAGE_PMD_NR contiguous pages at once and
+ *  to map them with a single pmd, so that one TLB entry covers 2MB (4MB
+ *  without PAE) instead of 4kB.  If no such block is free the fault is
+ *  handled with a small page as usual.
+ *
+ *  The block is split_page()d right away: each small page keeps its own
+ *  count, anon rmap and LRU position, exactly as if it had been faulted
+ *  in alone, and reclaim, migration and the rest of the VM never see a
+ *  compound page.  Only the mapping is huge.  Anything that wants a pte
+ *  (mprotect, munmap, mremap, fork, unmapping for reclaim, ...) calls
+ *  split_huge_pmd(), which replaces the pmd with a page table mapping
+ *  the same pages.  The page table is allocated at fault time and set
+ *  aside on the mm, so splitting cannot fail.  Aging the pages for
+ *  reclaim uses the accessed bit of the pmd, see huge_pmd_referenced().
+ */
+
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/highmem.h>
+#include <linux/rmap.h>
+#include <linux/swap.h>
+#include <linux/mman.h>
+#include <linux/memcontrol.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/init.h>
+#include <asm/tlbflush.h>
+#include <asm/pgalloc.h>
+
+unsigned long transparent_hugepage_flags __read_mostly =
+	(1 << TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG);
+
+/*
+ * The page tables set aside by the fault handler are chained through
+ * their lru field, under page_table_lock.  They are accounted in nr_ptes
+ * from the start.
+ */
+static void pgtable_deposit(struct mm_struct *mm, pgtable_t pgtable)
+{
+	assert_spin_locked(&mm->page_table_lock);
+
+	if (!mm->pmd_huge_pte)
+		INIT_LIST_HEAD(&pgtable->lru);
+	else
+		list_add(&pgtable->lru, &mm->pmd_huge_pte->lru);
+	mm->pmd_huge_pte = pgtable;
+}
+
+static pgtable_t pgtable_withdraw(struct mm_struct *mm)
+{
+	pgtable_t pgtable;
+
+	assert_spin_locked(&mm->page_table_lock);
+
+	pgtable = mm->pmd_huge_pte;
+	VM_BUG_ON(!pgtable);
+	if (list_empty(&pgtable->lru))
+		mm->pmd_huge_pte = NULL;
+	else {
+		mm->pmd_huge_pte = list_entry(pgtable->lru.next,
+					      struct page, lru);
+		list_del(&pgtable->lru);
+	}
+	return pgtable;
+}
+
+static void release_huge_block(struct page *page, int charged)
+{
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (i < charged)
+			mem_cgroup_uncharge_page(page + i);
+		page_cache_release(page + i);
+	}
+}
+
+/**
+ * do_huge_anonymous_page - fault in a huge pmd of anonymous memory
+ * @mm: the mm of @vma
+ * @vma: the anonymous vma which faulted
+ * @address: the faulting address
+ * @pmd: the empty pmd covering @address
+ *
+ * Returns VM_FAULT_FALLBACK if the caller should fault in a small page
+ * instead: the pmd isn't entirely inside @vma or no aligned block of
+ * memory is free.  Called with mmap_sem held for reading.
+ */
+int do_huge_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
+			   unsigned long address, pmd_t *pmd)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page *page;
+	pgtable_t pgtable;
+	pmdval_t entry;
+	int i;
+
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
+		return VM_FAULT_FALLBACK;
+	if (unlikely(anon_vma_prepare(vma)))
+		return VM_FAULT_OOM;
+
+	page = alloc_pages(GFP_HIGHUSER_MOVABLE | __GFP_NORETRY | __GFP_NOWARN,
+			   HPAGE_PMD_ORDER);
+	if (!page) {
+		count_vm_event(THP_FAULT_FALLBACK);
+		return VM_FAULT_FALLBACK;
+	}
+	split_page(page, HPAGE_PMD_ORDER);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (mem_cgroup_newpage_charge(page + i, mm, GFP_KERNEL))
+			goto fallback;
+		clear_user_highpage(page + i, haddr + i * PAGE_SIZE);
+		__SetPageUptodate(page + i);
+	}
+
+	pgtable = pte_alloc_one(mm, haddr);
+	if (!pgtable)
+		goto fallback;
+
+	entry = pmd_val(pfn_pmd(page_to_pfn(page), vma->vm_page_prot));
+	entry |= _PAGE_PSE | _PAGE_DIRTY;
+	/* the pages are ours alone, no need to wait for a write fault */
+	if (vma->vm_flags & VM_WRITE)
+		entry |= _PAGE_RW;
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_none(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		pte_free(mm, pgtable);
+		release_huge_block(page, HPAGE_PMD_NR);
+		return 0;
+	}
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		page_add_new_anon_rmap(page + i, vma, haddr + i * PAGE_SIZE);
+	add_mm_counter(mm, anon_rss, HPAGE_PMD_NR);
+	pgtable_deposit(mm, pgtable);
+	mm->nr_ptes++;
+	set_pmd(pmd, __pmd(entry));
+	spin_unlock(&mm->page_table_lock);
+
+	count_vm_event(THP_FAULT_ALLOC);
+	return 0;
+
+fallback:
+	release_huge_block(page, i);
+	count_vm_event(THP_FAULT_FALLBACK);
+	return VM_FAULT_FALLBACK;
+}
+
+/*
+ * follow_page() of an address mapped by a huge pmd, page_table_lock
+ * held.  Returns NULL if a write fault is needed first.
+ */
+struct page *follow_trans_huge_pmd(struct mm_struct *mm, unsigned long address,
+				   pmd_t *pmd, unsigned int flags)
+{
+	struct page *page;
+
+	assert_spin_locked(&mm->page_table_lock);
+
+	if ((flags & FOLL_WRITE) && !(pmd_val(*pmd) & _PAGE_RW))
+		return NULL;
+
+	page = pfn_to_page(pmd_pfn(*pmd)) +
+		((address & ~HPAGE_PMD_MASK) >> PAGE_SHIFT);
+	if (flags & FOLL_GET)
+		get_page(page);
+	if (flags & FOLL_TOUCH)
+		mark_page_accessed(page);
+	return page;
+}
+
+/*
+ * page_referenced() of @page, mapped at @address by a huge pmd,
+ * page_table_lock held.  The pmd has one accessed bit for all the pages
+ * it maps, which reclaim ages one at a time: a reference found through
+ * it is passed on to the other pages as PG_referenced, which
+ * page_referenced() looks at first, so the pmd isn't split for aging.
+ */
+int huge_pmd_referenced(struct vm_area_struct *vma, unsigned long address,
+			pmd_t *pmd, struct page *page)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page *first;
+	int i;
+
+	assert_spin_locked(&vma->vm_mm->page_table_lock);
+
+	if (!test_and_clear_bit(_PAGE_BIT_ACCESSED, (unsigned long *)pmd))
+		return 0;
+	flush_tlb_range(vma, haddr, haddr + HPAGE_PMD_SIZE);
+
+	first = pfn_to_page(pmd_pfn(*pmd));
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		if (first + i != page)
+			SetPageReferenced(first + i);
+	return 1;
+}
+
+/**
+ * __split_huge_pmd - replace a huge pmd with a page table
+ * @mm: the mm @pmd belongs to
+ * @pmd: the pmd to split
+ *
+ * The page table maps the same pages with the same protections, so the
+ * pmd can be switched over in place, without a window during which the
+ * range looks unmapped to a lockless walker.  Use split_huge_pmd(),
+ * which only calls this when @pmd is huge.
+ */
+void __split_huge_pmd(struct mm_struct *mm, pmd_t *pmd)
+{
+	pgtable_t pgtable;
+	unsigned long pfn;
+	pgprot_t prot;
+	pmd_t old, _pmd;
+	pte_t *pte;
+	int i;
+
+	spin_lock(&mm->page_table_lock);
+	old = *pmd;
+	if (unlikely(!pmd_trans_huge(old))) {
+		/* someone else split it */
+		spin_unlock(&mm->page_table_lock);
+		return;
+	}
+
+	pgtable = pgtable_withdraw(mm);
+	pfn = pmd_pfn(old);
+	prot = __pgprot(pmd_val(old) & PTE_FLAGS_MASK & ~_PAGE_PSE);
+
+	/* fill it in before the hardware can see it */
+	pmd_populate(mm, &_pmd, pgtable);
+	pte = pte_offset_map(&_pmd, 0);
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		set_pte(pte + i, pfn_pte(pfn + i, prot));
+	pte_unmap(pte);
+
+	smp_wmb(); /* See comment in __pte_alloc */
+	pmd_populate(mm, pmd, pgtable);
+	flush_tlb_mm(mm);
+	spin_unlock(&mm->page_table_lock);
+
+	count_vm_event(THP_SPLIT);
+}
+
+int hugepage_madvise(unsigned long *vm_flags, int advice)
+{
+	switch (advice) {
+	case MADV_HUGEPAGE:
+		if (*vm_flags & (VM_SHARED | VM_HUGETLB | VM_SPECIAL))
+			return -EINVAL;
+		*vm_flags &= ~VM_NOHUGEPAGE;
+		*vm_flags |= VM_HUGEPAGE;
+		break;
+	case MADV_NOHUGEPAGE:
+		*vm_flags &= ~VM_HUGEPAGE;
+		*vm_flags |= VM_NOHUGEPAGE;
+		break;
+	}
+	return 0;
+}
+
+static const char *hugepage_modes[] = { "always", "madvise", "never" };
+
+static void set_hugepage_mode(int mode)
+{
+	if (mode == 0)
+		set_bit(TRANSPARENT_HUGEPAGE_FLAG, &transparent_hugepage_flags);
+	else
+		clear_bit(TRANSPARENT_HUGEPAGE_FLAG,
+			  &transparent_hugepage_flags);
+	if (mode == 1)
+		set_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			&transparent_hugepage_flags);
+	else
+		clear_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			  &transparent_hugepage_flags);
+}
+
+static int parse_hugepage_mode(const char *buf)
+{
+	int mode;
+
+	for (mode = 0; mode < ARRAY_SIZE(hugepage_modes); mode++)
+		if (sysfs_streq(buf, hugepage_modes[mode]))
+			return mode;
+	return -EINVAL;
+}
+
+static ssize_t enabled_show(struct kobject *kobj,
+			    struct kobj_attribute *attr, char *buf)
+{
+	int mode = 2;
+
+	if (test_bit(TRANSPARENT_HUGEPAGE_FLAG, &transparent_hugepage_flags))
+		mode = 0;
+	else if (test_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			  &transparent_hugepage_flags))
+		mode = 1;
+
+	return sprintf(buf, "%s%s%s %s%s%s %s%s%s\n",
+		       mode == 0 ? "[" : "", hugepage_modes[0],
+		       mode == 0 ? "]" : "",
+		       mode == 1 ? "[" : "", hugepage_modes[1],
+		       mode == 1 ? "]" : "",
+		       mode == 2 ? "[" : "", hugepage_modes[2],
+		       mode == 2 ? "]" : "");
+}
+
+static ssize_t enabled_store(struct kobject *kobj,
+			     struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	int mode = parse_hugepage_mode(buf);
+
+	if (mode < 0)
+		return mode;
+	set_hugepage_mode(mode);
+	return count;
+}
+
+static struct kobj_attribute enabled_attr =
+	__ATTR(enabled, 0644, enabled_show, enabled_store);
+
+static struct attribute *hugepage_attrs[] = {
+	&enabled_attr.attr,
+	NULL,
+};
+
+static struct attribute_group hugepage_attr_group = {
+	.attrs = hugepage_attrs,
+};
+
+static int __init setup_transparent_hugepage(char *str)
+{
+	int mode = parse_hugepage_mode(str);
+
+	if (mode < 0) {
+		printk(KERN_WARNING "transparent_hugepage= must be always, "
+		       "madvise or never\n");
+		return 0;
+	}
+	set_hugepage_mode(mode);
+	return 1;
+}
+__setup("transparent_hugepage=", setup_transparent_hugepage);
+
+static int __init hugepage_init(void)
+{
+	struct kobject *hugepage_kobj;
+	int err;
+
+	if (!cpu_has_pse) {
+		set_hugepage_mode(2);
+		return -EINVAL;
+	}
+
+	hugepage_kobj = kobject_create_and_add("transparent_hugepage",
+					       mm_kobj);
+	if (!hugepage_kobj)
+		return -ENOMEM;
+
+	err = sysfs_create_group(hugepage_kobj, &hugepage_attr_group);
+	if (err) {
+		printk(KERN_ERR "transparent_hugepage: sysfs registration "
+		       "failed\n");
+		kobject_put(hugepage_kobj);
+	}
+	return err;
+}
+module_init(hugepage_init)
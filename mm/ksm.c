@@ -0,0 +1,999 @@
+/*
+ *  mm/ksm.c
+ *
+ *  Kernel same-page merging of anonymous memory.
+ *
+ *  ksmd scans the anonymous pages of the vmas registered with
+ *  madvise(MADV_MERGEABLE), pages_to_scan at a time, and replaces the
+ *  ones with identical contents by a single write-protected "KSM page".
+ *  A write to it takes the ordinary copy-on-write fault in do_wp_page().
+ *
+ *  Each page scanned is checksummed.  If a KSM page has the same checksum
+ *  and, compared byte by byte, the same contents, the page is merged into
+ *  it at once.  Otherwise, if the checksum is the same as at the previous
+ *  scan (a page being written to is not worth merging), the page is
+ *  looked up in the "unstable" table of the pages met during this scan,
+ *  and if one of them has the same contents, both are replaced by a new
+ *  KSM page.  Else it is entered in the unstable table itself.  The
+ *  unstable table is emptied lazily: an entry from an earlier scan is
+ *  ignored, and removed when its page is met again.
+ *
+ *  A KSM page is shared by anon_vmas which don't know about each other,
+ *  so it belongs to none of them and the rmap cannot find its ptes: KSM
+ *  pages are kept off the LRU and never swapped, max_kernel_pages bounds
+ *  their number.  One whose last mapping went away is freed at the end
+ *  of the following full scan.
+ */
+
+#include <linux/errno.h>
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/mman.h>
+#include <linux/sched.h>
+#include <linux/rmap.h>
+#include <linux/swap.h>
+#include <linux/pagemap.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/highmem.h>
+#include <linux/jhash.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/wait.h>
+#include <linux/mmu_notifier.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/ksm.h>
+
+#include <asm/tlbflush.h>
+
+/*
+ * A registered mm: it is pinned by mm_count and forgotten when its last
+ * user is gone, by ksm_exit(), or by ksmd if ksmd dropped that user.
+ */
+struct mm_slot {
+	struct hlist_node link;		/* in mm_slots_hash */
+	struct list_head mm_list;	/* in ksm_mm_head */
+	struct list_head rmap_list;	/* of rmap_items, by address */
+	struct mm_struct *mm;
+};
+
+/*
+ * A page ksmd has met at @address of @mm.
+ */
+struct rmap_item {
+	struct list_head link;		/* in mm_slot->rmap_list */
+	struct hlist_node hash;		/* in unstable_hash, if hashed */
+	struct mm_struct *mm;
+	unsigned long address;
+	unsigned int checksum;		/* at the last scan */
+	unsigned int seqnr;		/* of the scan which hashed it */
+};
+
+/*
+ * A KSM page, pinned until it is mapped nowhere.
+ */
+struct stable_node {
+	struct hlist_node hash;		/* in stable_hash */
+	struct page *kpage;
+	unsigned int checksum;
+};
+
+static struct mm_slot ksm_mm_head = {
+	.mm_list = LIST_HEAD_INIT(ksm_mm_head.mm_list),
+};
+
+/* where ksmd is in its scan, under ksm_thread_mutex */
+static struct ksm_scan {
+	struct mm_slot *mm_slot;
+	unsigned long address;
+	struct list_head *rmap_list;	/* the next rmap_item to consider */
+	unsigned int seqnr;
+} ksm_scan = {
+	.mm_slot = &ksm_mm_head,
+};
+
+#define MM_SLOTS_HASH_SHIFT	10
+static struct hlist_head mm_slots_hash[1 << MM_SLOTS_HASH_SHIFT];
+
+static struct task_struct *ksm_thread;
+
+static unsigned int ksm_hash_shift;
+static struct hlist_head *stable_hash;
+static struct hlist_head *unstable_hash;
+
+static struct kmem_cache *rmap_item_cache;
+static struct kmem_cache *mm_slot_cache;
+static struct kmem_cache *stable_node_cache;
+
+/* KSM pages, and the mappings of them beyond the first */
+static unsigned long ksm_pages_shared;
+static unsigned long ksm_pages_sharing;
+static unsigned long ksm_full_scans;
+
+static unsigned long ksm_max_kernel_pages;
+static unsigned int ksm_thread_pages_to_scan = 100;
+static unsigned int ksm_thread_sleep_millisecs = 20;
+
+#define KSM_RUN_STOP	0
+#define KSM_RUN_MERGE	1
+static unsigned long ksm_run = KSM_RUN_STOP;
+
+static DECLARE_WAIT_QUEUE_HEAD(ksm_thread_wait);
+static DEFINE_MUTEX(ksm_thread_mutex);
+static DEFINE_SPINLOCK(ksm_mmlist_lock);
+
+static inline struct hlist_head *ksm_bucket(struct hlist_head *table,
+					    unsigned int checksum)
+{
+	return &table[hash_32(checksum, ksm_hash_shift)];
+}
+
+/* Called with ksm_mmlist_lock held */
+static struct mm_slot *get_mm_slot(struct mm_struct *mm)
+{
+	struct mm_slot *mm_slot;
+	struct hlist_node *node;
+
+	hlist_for_each_entry(mm_slot, node,
+			     &mm_slots_hash[hash_ptr(mm, MM_SLOTS_HASH_SHIFT)],
+			     link) {
+		if (mm_slot->mm == mm)
+			return mm_slot;
+	}
+	return NULL;
+}
+
+static unsigned int calc_checksum(struct page *page)
+{
+	void *addr = kmap_atomic(page, KM_USER0);
+	unsigned int checksum = jhash2(addr, PAGE_SIZE / 4, 17);
+
+	kunmap_atomic(addr, KM_USER0);
+	return checksum;
+}
+
+static int pages_identical(struct page *page1, struct page *page2)
+{
+	char *addr1, *addr2;
+	int ret;
+
+	addr1 = kmap_atomic(page1, KM_USER0);
+	addr2 = kmap_atomic(page2, KM_USER1);
+	ret = !memcmp(addr1, addr2, PAGE_SIZE);
+	kunmap_atomic(addr2, KM_USER1);
+	kunmap_atomic(addr1, KM_USER0);
+	return ret;
+}
+
+static void free_rmap_item(struct rmap_item *rmap_item)
+{
+	if (!hlist_unhashed(&rmap_item->hash))
+		hlist_del(&rmap_item->hash);
+	list_del(&rmap_item->link);
+	kmem_cache_free(rmap_item_cache, rmap_item);
+}
+
+/*
+ * Write-protects the pte mapping @page, and fails if anything but the
+ * ptes and our own reference holds @page: a write through get_user_pages
+ * (O_DIRECT, say) could still change it after the merge.
+ */
+static int write_protect_page(struct vm_area_struct *vma, struct page *page,
+			      pte_t *orig_pte)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long addr;
+	spinlock_t *ptl;
+	pte_t *ptep;
+	int err = -EFAULT;
+
+	addr = page_address_in_vma(page, vma);
+	if (addr == -EFAULT)
+		goto out;
+
+	ptep = page_check_address(page, mm, addr, &ptl, 0);
+	if (!ptep)
+		goto out;
+
+	if (pte_write(*ptep) || pte_dirty(*ptep)) {
+		pte_t entry;
+
+		flush_cache_page(vma, addr, page_to_pfn(page));
+		entry = ptep_clear_flush_notify(vma, addr, ptep);
+		if (page_mapcount(page) + 1 + PageSwapCache(page) !=
+		    page_count(page)) {
+			set_pte_at(mm, addr, ptep, entry);
+			goto out_unlock;
+		}
+		if (pte_dirty(entry))
+			set_page_dirty(page);
+		entry = pte_mkclean(pte_wrprotect(entry));
+		set_pte_at(mm, addr, ptep, entry);
+	}
+	*orig_pte = *ptep;
+	err = 0;
+
+out_unlock:
+	pte_unmap_unlock(ptep, ptl);
+out:
+	return err;
+}
+
+/*
+ * Maps @kpage where @page was mapped, if the pte is still @orig_pte.
+ */
+static int replace_page(struct vm_area_struct *vma, struct page *page,
+			struct page *kpage, pte_t orig_pte)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long addr;
+	spinlock_t *ptl;
+	pte_t *ptep;
+	int err = -EFAULT;
+
+	addr = page_address_in_vma(page, vma);
+	if (addr == -EFAULT)
+		goto out;
+
+	ptep = page_check_address(page, mm, addr, &ptl, 0);
+	if (!ptep)
+		goto out;
+	if (!pte_same(*ptep, orig_pte))
+		goto out_unlock;
+
+	get_page(kpage);
+	page_add_ksm_rmap(kpage);
+
+	flush_cache_page(vma, addr, pte_pfn(*ptep));
+	ptep_clear_flush_notify(vma, addr, ptep);
+	set_pte_at(mm, addr, ptep,
+		   pte_wrprotect(mk_pte(kpage, vma->vm_page_prot)));
+
+	page_remove_rmap(page);
+	put_page(page);
+	err = 0;
+
+out_unlock:
+	pte_unmap_unlock(ptep, ptl);
+out:
+	return err;
+}
+
+/*
+ * Replaces @page, mapped in @vma, by @kpage if they are identical once
+ * @page is write-protected.  mmap_sem of @vma's mm held.
+ */
+static int try_to_merge_one_page(struct vm_area_struct *vma,
+				 struct page *page, struct page *kpage)
+{
+	pte_t orig_pte = __pte(0);
+	int err = -EFAULT;
+
+	if (!(vma->vm_flags & VM_MERGEABLE))
+		goto out;
+	if (!PageAnon(page) || PageKsm(page))
+		goto out;
+	/* don't wait behind swapout or migration */
+	if (!trylock_page(page))
+		goto out;
+
+	if (write_protect_page(vma, page, &orig_pte) == 0 &&
+	    pages_identical(page, kpage))
+		err = replace_page(vma, page, kpage, orig_pte);
+
+	unlock_page(page);
+out:
+	return err;
+}
+
+static struct page *stable_lookup(struct page *page, unsigned int checksum)
+{
+	struct stable_node *stable_node;
+	struct hlist_node *node;
+
+	hlist_for_each_entry(stable_node, node,
+			     ksm_bucket(stable_hash, checksum), hash) {
+		if (stable_node->checksum == checksum &&
+		    pages_identical(page, stable_node->kpage))
+			return stable_node->kpage;
+	}
+	return NULL;
+}
+
+/*
+ * Looks up the page of @rmap_item, for merging with another page.
+ * mmap_sem of its mm held.
+ */
+static struct page *get_mergeable_page(struct rmap_item *rmap_item,
+				       struct vm_area_struct **vmap)
+{
+	struct vm_area_struct *vma;
+	struct page *page;
+
+	vma = find_vma(rmap_item->mm, rmap_item->address);
+	if (!vma || vma->vm_start > rmap_item->address ||
+	    !(vma->vm_flags & VM_MERGEABLE) || !vma->anon_vma)
+		return NULL;
+
+	page = follow_page(vma, rmap_item->address, FOLL_GET);
+	if (!page)
+		return NULL;
+	if (!PageAnon(page) || PageKsm(page)) {
+		put_page(page);
+		return NULL;
+	}
+	flush_anon_page(vma, page, rmap_item->address);
+	flush_dcache_page(page);
+	*vmap = vma;
+	return page;
+}
+
+/*
+ * Merges @page, mapped at @address of @vma, and the page of @tree_item
+ * into a new KSM page.  The other mm is only locked if that can be done
+ * without waiting.
+ */
+static int try_to_merge_with_unstable(struct vm_area_struct *vma,
+				      struct page *page, unsigned long address,
+				      struct rmap_item *tree_item,
+				      unsigned int checksum)
+{
+	struct mm_struct *mm = tree_item->mm;
+	struct vm_area_struct *tree_vma;
+	struct stable_node *stable_node;
+	struct page *tree_page, *kpage;
+	int other_mm = mm != vma->vm_mm;
+	int err = -EFAULT;
+
+	if (ksm_max_kernel_pages && ksm_pages_shared >= ksm_max_kernel_pages)
+		return -ENOSPC;
+
+	if (other_mm) {
+		if (!atomic_inc_not_zero(&mm->mm_users))
+			return -EFAULT;
+		if (!down_read_trylock(&mm->mmap_sem)) {
+			mmput(mm);
+			return -EBUSY;
+		}
+	}
+
+	tree_page = get_mergeable_page(tree_item, &tree_vma);
+	if (!tree_page)
+		goto out;
+	if (tree_page == page || !pages_identical(page, tree_page))
+		goto out_put;
+
+	err = -ENOMEM;
+	stable_node = kmem_cache_alloc(stable_node_cache, GFP_KERNEL);
+	if (!stable_node)
+		goto out_put;
+	kpage = alloc_page(GFP_HIGHUSER);
+	if (!kpage) {
+		kmem_cache_free(stable_node_cache, stable_node);
+		goto out_put;
+	}
+	copy_user_highpage(kpage, page, address, vma);
+
+	err = try_to_merge_one_page(vma, page, kpage);
+	if (err) {
+		put_page(kpage);
+		kmem_cache_free(stable_node_cache, stable_node);
+		goto out_put;
+	}
+	/* even if this one fails, kpage now replaces page */
+	try_to_merge_one_page(tree_vma, tree_page, kpage);
+
+	stable_node->kpage = kpage;
+	stable_node->checksum = checksum;
+	hlist_add_head(&stable_node->hash, ksm_bucket(stable_hash, checksum));
+	ksm_pages_shared++;
+
+out_put:
+	put_page(tree_page);
+out:
+	if (other_mm) {
+		up_read(&mm->mmap_sem);
+		mmput(mm);
+	}
+	return err;
+}
+
+/*
+ * The heart of ksmd: @page, mapped at @rmap_item->address of @vma, has
+ * just been met.  mmap_sem of @vma's mm held.
+ */
+static void cmp_and_merge_page(struct vm_area_struct *vma, struct page *page,
+			       struct rmap_item *rmap_item)
+{
+	struct rmap_item *tree_item;
+	struct hlist_node *node;
+	struct page *kpage;
+	unsigned int checksum;
+
+	/* the unstable table is rebuilt at each scan */
+	hlist_del_init(&rmap_item->hash);
+
+	checksum = calc_checksum(page);
+
+	kpage = stable_lookup(page, checksum);
+	if (kpage) {
+		try_to_merge_one_page(vma, page, kpage);
+		return;
+	}
+
+	if (rmap_item->checksum != checksum) {
+		rmap_item->checksum = checksum;
+		return;
+	}
+
+	hlist_for_each_entry(tree_item, node,
+			     ksm_bucket(unstable_hash, checksum), hash) {
+		if (tree_item->checksum != checksum ||
+		    tree_item->seqnr != ksm_scan.seqnr)
+			continue;
+		if (!try_to_merge_with_unstable(vma, page, rmap_item->address,
+						tree_item, checksum)) {
+			hlist_del_init(&tree_item->hash);
+			return;
+		}
+	}
+
+	rmap_item->seqnr = ksm_scan.seqnr;
+	hlist_add_head(&rmap_item->hash, ksm_bucket(unstable_hash, checksum));
+}
+
+/*
+ * Returns the rmap_item of @addr, at or after the scan cursor in the
+ * address ordered list of @mm_slot, freeing the ones of the addresses
+ * skipped, and moves the cursor past it.
+ */
+static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
+					    unsigned long addr)
+{
+	struct list_head *cur = ksm_scan.rmap_list;
+	struct rmap_item *rmap_item;
+
+	while (cur != &mm_slot->rmap_list) {
+		rmap_item = list_entry(cur, struct rmap_item, link);
+		if (rmap_item->address == addr)
+			goto found;
+		if (rmap_item->address > addr)
+			break;
+		cur = cur->next;
+		free_rmap_item(rmap_item);
+	}
+	ksm_scan.rmap_list = cur;
+
+	rmap_item = kmem_cache_zalloc(rmap_item_cache, GFP_KERNEL);
+	if (!rmap_item)
+		return NULL;
+	rmap_item->mm = mm_slot->mm;
+	rmap_item->address = addr;
+	list_add_tail(&rmap_item->link, cur);
+found:
+	ksm_scan.rmap_list = rmap_item->link.next;
+	return rmap_item;
+}
+
+static void remove_rmap_items_from(struct mm_slot *mm_slot,
+				   struct list_head *cur)
+{
+	struct rmap_item *rmap_item;
+
+	while (cur != &mm_slot->rmap_list) {
+		rmap_item = list_entry(cur, struct rmap_item, link);
+		cur = cur->next;
+		free_rmap_item(rmap_item);
+	}
+}
+
+/*
+ * At the end of a full scan: free the KSM pages mapped nowhere any more,
+ * and count the mappings of the others.  Nothing but ksmd maps a KSM
+ * page which isn't mapped already.
+ */
+static void ksm_scan_done(void)
+{
+	struct stable_node *stable_node;
+	struct hlist_node *node, *next;
+	unsigned long sharing = 0;
+	int i, mapcount;
+
+	for (i = 0; i < (1 << ksm_hash_shift); i++) {
+		hlist_for_each_entry_safe(stable_node, node, next,
+					  &stable_hash[i], hash) {
+			mapcount = page_mapcount(stable_node->kpage);
+			if (mapcount) {
+				sharing += mapcount - 1;
+				continue;
+			}
+			hlist_del(&stable_node->hash);
+			put_page(stable_node->kpage);
+			kmem_cache_free(stable_node_cache, stable_node);
+			ksm_pages_shared--;
+		}
+		cond_resched();
+	}
+	ksm_pages_sharing = sharing;
+	ksm_scan.seqnr++;
+	ksm_full_scans++;
+}
+
+/*
+ * Scans the current mm from ksm_scan.address.  Returns how much of
+ * @budget is left: if anything, the mm has been scanned to its end.
+ */
+static unsigned int ksm_scan_mm(struct mm_slot *mm_slot, unsigned int budget)
+{
+	struct mm_struct *mm = mm_slot->mm;
+	struct vm_area_struct *vma;
+	struct rmap_item *rmap_item;
+	struct mm_slot *next;
+	struct page *page;
+	int exited = 0;
+
+	if (!atomic_inc_not_zero(&mm->mm_users)) {
+		exited = 1;
+		goto next_mm;
+	}
+	down_read(&mm->mmap_sem);
+	for (vma = find_vma(mm, ksm_scan.address); vma; vma = vma->vm_next) {
+		if (!(vma->vm_flags & VM_MERGEABLE) || !vma->anon_vma)
+			continue;
+		if (ksm_scan.address < vma->vm_start)
+			ksm_scan.address = vma->vm_start;
+		while (ksm_scan.address < vma->vm_end) {
+			if (!budget) {
+				up_read(&mm->mmap_sem);
+				mmput(mm);
+				/* ksm_exit() leaves the last user to us */
+				if (!atomic_read(&mm->mm_users)) {
+					exited = 1;
+					goto next_mm;
+				}
+				return 0;
+			}
+			page = follow_page(vma, ksm_scan.address, FOLL_GET);
+			if (page && PageAnon(page) && !PageKsm(page)) {
+				flush_anon_page(vma, page, ksm_scan.address);
+				flush_dcache_page(page);
+				rmap_item = get_next_rmap_item(mm_slot,
+							       ksm_scan.address);
+				if (rmap_item)
+					cmp_and_merge_page(vma, page,
+							   rmap_item);
+				budget--;
+			}
+			if (page)
+				put_page(page);
+			ksm_scan.address += PAGE_SIZE;
+			cond_resched();
+		}
+	}
+	/* the pages after the last one met went away */
+	remove_rmap_items_from(mm_slot, ksm_scan.rmap_list);
+	up_read(&mm->mmap_sem);
+	mmput(mm);
+	if (!atomic_read(&mm->mm_users))
+		exited = 1;
+
+next_mm:
+	spin_lock(&ksm_mmlist_lock);
+	next = list_entry(mm_slot->mm_list.next, struct mm_slot, mm_list);
+	if (exited) {
+		hlist_del(&mm_slot->link);
+		list_del(&mm_slot->mm_list);
+	}
+	spin_unlock(&ksm_mmlist_lock);
+
+	ksm_scan.mm_slot = next;
+	ksm_scan.address = 0;
+	ksm_scan.rmap_list = next->rmap_list.next;
+
+	if (exited) {
+		remove_rmap_items_from(mm_slot, mm_slot->rmap_list.next);
+		kmem_cache_free(mm_slot_cache, mm_slot);
+		mmdrop(mm);
+	}
+	if (next == &ksm_mm_head)
+		ksm_scan_done();
+	return budget;
+}
+
+static void ksm_do_scan(unsigned int budget)
+{
+	struct mm_slot *mm_slot;
+
+	while (budget) {
+		spin_lock(&ksm_mmlist_lock);
+		if (list_empty(&ksm_mm_head.mm_list)) {
+			spin_unlock(&ksm_mmlist_lock);
+			return;
+		}
+		mm_slot = ksm_scan.mm_slot;
+		if (mm_slot == &ksm_mm_head) {
+			mm_slot = list_entry(ksm_mm_head.mm_list.next,
+					     struct mm_slot, mm_list);
+			ksm_scan.mm_slot = mm_slot;
+			ksm_scan.address = 0;
+			ksm_scan.rmap_list = mm_slot->rmap_list.next;
+		}
+		spin_unlock(&ksm_mmlist_lock);
+
+		budget = ksm_scan_mm(mm_slot, budget);
+	}
+}
+
+static int ksmd_should_run(void)
+{
+	return (ksm_run & KSM_RUN_MERGE) && !list_empty(&ksm_mm_head.mm_list);
+}
+
+static int ksm_scan_thread(void *nothing)
+{
+	set_freezable();
+	set_user_nice(current, 5);
+
+	while (!kthread_should_stop()) {
+		mutex_lock(&ksm_thread_mutex);
+		if (ksmd_should_run())
+			ksm_do_scan(ksm_thread_pages_to_scan);
+		mutex_unlock(&ksm_thread_mutex);
+
+		try_to_freeze();
+
+		if (ksmd_should_run()) {
+			schedule_timeout_interruptible(
+				msecs_to_jiffies(ksm_thread_sleep_millisecs));
+		} else {
+			wait_event_freezable(ksm_thread_wait,
+				ksmd_should_run() || kthread_should_stop());
+		}
+	}
+	return 0;
+}
+
+/*
+ * Breaks the sharing of the KSM page mapped at @addr, if any, by
+ * faulting as for a write.
+ */
+static int break_ksm(struct vm_area_struct *vma, unsigned long addr)
+{
+	struct page *page;
+	int ret = 0;
+
+	do {
+		cond_resched();
+		page = follow_page(vma, addr, FOLL_GET);
+		if (!page)
+			break;
+		if (PageKsm(page))
+			ret = handle_mm_fault(vma->vm_mm, vma, addr, 1);
+		else
+			ret = VM_FAULT_WRITE;
+		put_page(page);
+	} while (!(ret & (VM_FAULT_WRITE | VM_FAULT_SIGBUS | VM_FAULT_OOM)));
+
+	return (ret & VM_FAULT_OOM) ? -ENOMEM : 0;
+}
+
+static int unmerge_ksm_pages(struct vm_area_struct *vma,
+			     unsigned long start, unsigned long end)
+{
+	unsigned long addr;
+	int err = 0;
+
+	for (addr = start; addr < end && !err; addr += PAGE_SIZE) {
+		if (signal_pending(current))
+			err = -ERESTARTSYS;
+		else
+			err = break_ksm(vma, addr);
+	}
+	return err;
+}
+
+int __ksm_enter(struct mm_struct *mm)
+{
+	struct mm_slot *mm_slot;
+	int needs_wakeup;
+
+	mm_slot = kmem_cache_zalloc(mm_slot_cache, GFP_KERNEL);
+	if (!mm_slot)
+		return -ENOMEM;
+	INIT_LIST_HEAD(&mm_slot->rmap_list);
+	mm_slot->mm = mm;
+	atomic_inc(&mm->mm_count);
+
+	spin_lock(&ksm_mmlist_lock);
+	needs_wakeup = list_empty(&ksm_mm_head.mm_list);
+	hlist_add_head(&mm_slot->link,
+		       &mm_slots_hash[hash_ptr(mm, MM_SLOTS_HASH_SHIFT)]);
+	list_add_tail(&mm_slot->mm_list, &ksm_mm_head.mm_list);
+	spin_unlock(&ksm_mmlist_lock);
+
+	set_bit(MMF_VM_MERGEABLE, &mm->flags);
+
+	if (needs_wakeup)
+		wake_up_interruptible(&ksm_thread_wait);
+	return 0;
+}
+
+/**
+ * __ksm_exit - forget an mm whose last user is gone
+ * @mm: the mm, from mmput()
+ *
+ * Frees the mm_slot and its rmap_items and drops their pin on @mm, so
+ * that an exited mm isn't kept until ksmd next scans it, which may be
+ * never while ksmd is stopped.  When ksmd itself dropped the last user,
+ * it holds ksm_thread_mutex and frees the slot when mmput() returns.
+ */
+void __ksm_exit(struct mm_struct *mm)
+{
+	struct mm_slot *mm_slot, *next;
+
+	if (current == ksm_thread)
+		return;
+
+	mutex_lock(&ksm_thread_mutex);
+	spin_lock(&ksm_mmlist_lock);
+	mm_slot = get_mm_slot(mm);
+	if (!mm_slot) {
+		spin_unlock(&ksm_mmlist_lock);
+		mutex_unlock(&ksm_thread_mutex);
+		return;
+	}
+	next = list_entry(mm_slot->mm_list.next, struct mm_slot, mm_list);
+	hlist_del(&mm_slot->link);
+	list_del(&mm_slot->mm_list);
+	spin_unlock(&ksm_mmlist_lock);
+
+	/* move ksmd's cursor off it, as ksm_scan_mm() does */
+	if (ksm_scan.mm_slot == mm_slot) {
+		ksm_scan.mm_slot = next;
+		ksm_scan.address = 0;
+		ksm_scan.rmap_list = next->rmap_list.next;
+		if (next == &ksm_mm_head)
+			ksm_scan_done();
+	}
+	remove_rmap_items_from(mm_slot, mm_slot->rmap_list.next);
+	mutex_unlock(&ksm_thread_mutex);
+
+	kmem_cache_free(mm_slot_cache, mm_slot);
+	clear_bit(MMF_VM_MERGEABLE, &mm->flags);
+	mmdrop(mm);
+}
+
+/**
+ * ksm_madvise - MADV_MERGEABLE and MADV_UNMERGEABLE
+ * @vma: the vma advised, mmap_sem held for writing
+ * @start: start of the range advised
+ * @end: end of the range advised
+ * @advice: MADV_MERGEABLE or MADV_UNMERGEABLE
+ * @vm_flags: the new flags of the range, updated
+ *
+ * Ranges KSM can't merge (shared, special or hugetlb ones) are silently
+ * left alone.  Unmerging copies the KSM pages mapped in the range.
+ */
+int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
+		unsigned long end, int advice, unsigned long *vm_flags)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	int err;
+
+	switch (advice) {
+	case MADV_MERGEABLE:
+		if (*vm_flags & (VM_MERGEABLE | VM_SHARED | VM_MAYSHARE |
+				 VM_HUGETLB | VM_INSERTPAGE | VM_MIXEDMAP |
+				 VM_SAO | VM_SPECIAL))
+			return 0;
+		if (!test_bit(MMF_VM_MERGEABLE, &mm->flags)) {
+			err = __ksm_enter(mm);
+			if (err)
+				return err;
+		}
+		*vm_flags |= VM_MERGEABLE;
+		break;
+
+	case MADV_UNMERGEABLE:
+		if (!(*vm_flags & VM_MERGEABLE))
+			return 0;
+		if (vma->anon_vma) {
+			err = unmerge_ksm_pages(vma, start, end);
+			if (err)
+				return err;
+		}
+		*vm_flags &= ~VM_MERGEABLE;
+		break;
+	}
+	return 0;
+}
+
+#define KSM_ATTR_RO(_name) \
+	static struct kobj_attribute _name##_attr = __ATTR_RO(_name)
+#define KSM_ATTR(_name) \
+	static struct kobj_attribute _name##_attr = \
+		__ATTR(_name, 0644, _name##_show, _name##_store)
+
+static ssize_t sleep_millisecs_show(struct kobject *kobj,
+				    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_thread_sleep_millisecs);
+}
+
+static ssize_t sleep_millisecs_store(struct kobject *kobj,
+				     struct kobj_attribute *attr,
+				     const char *buf, size_t count)
+{
+	unsigned long msecs;
+	int err;
+
+	err = strict_strtoul(buf, 10, &msecs);
+	if (err || msecs > UINT_MAX)
+		return -EINVAL;
+
+	ksm_thread_sleep_millisecs = msecs;
+	return count;
+}
+KSM_ATTR(sleep_millisecs);
+
+static ssize_t pages_to_scan_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_thread_pages_to_scan);
+}
+
+static ssize_t pages_to_scan_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	unsigned long nr_pages;
+	int err;
+
+	err = strict_strtoul(buf, 10, &nr_pages);
+	if (err || nr_pages > UINT_MAX)
+		return -EINVAL;
+
+	ksm_thread_pages_to_scan = nr_pages;
+	return count;
+}
+KSM_ATTR(pages_to_scan);
+
+static ssize_t run_show(struct kobject *kobj, struct kobj_attribute *attr,
+			char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_run);
+}
+
+static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
+			 const char *buf, size_t count)
+{
+	unsigned long flags;
+	int err;
+
+	err = strict_strtoul(buf, 10, &flags);
+	if (err || flags > KSM_RUN_MERGE)
+		return -EINVAL;
+
+	mutex_lock(&ksm_thread_mutex);
+	ksm_run = flags;
+	mutex_unlock(&ksm_thread_mutex);
+
+	if (flags & KSM_RUN_MERGE)
+		wake_up_interruptible(&ksm_thread_wait);
+	return count;
+}
+KSM_ATTR(run);
+
+static ssize_t max_kernel_pages_show(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_max_kernel_pages);
+}
+
+static ssize_t max_kernel_pages_store(struct kobject *kobj,
+				      struct kobj_attribute *attr,
+				      const char *buf, size_t count)
+{
+	unsigned long nr_pages;
+	int err;
+
+	err = strict_strtoul(buf, 10, &nr_pages);
+	if (err)
+		return -EINVAL;
+
+	ksm_max_kernel_pages = nr_pages;
+	return count;
+}
+KSM_ATTR(max_kernel_pages);
+
+static ssize_t pages_shared_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_shared);
+}
+KSM_ATTR_RO(pages_shared);
+
+static ssize_t pages_sharing_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_sharing);
+}
+KSM_ATTR_RO(pages_sharing);
+
+static ssize_t full_scans_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_full_scans);
+}
+KSM_ATTR_RO(full_scans);
+
+static struct attribute *ksm_attrs[] = {
+	&sleep_millisecs_attr.attr,
+	&pages_to_scan_attr.attr,
+	&run_attr.attr,
+	&max_kernel_pages_attr.attr,
+	&pages_shared_attr.attr,
+	&pages_sharing_attr.attr,
+	&full_scans_attr.attr,
+	NULL,
+};
+
+static struct attribute_group ksm_attr_group = {
+	.attrs = ksm_attrs,
+	.name = "ksm",
+};
+
+static int __init ksm_init(void)
+{
+	unsigned long size;
+	int err = -ENOMEM;
+
+	/* about a bucket per 16 pages of memory */
+	ksm_hash_shift = clamp_t(int, ilog2(totalram_pages) - 4, 8, 16);
+	size = (1UL << ksm_hash_shift) * sizeof(struct hlist_head);
+	stable_hash = vmalloc(size);
+	unstable_hash = vmalloc(size);
+	if (!stable_hash || !unstable_hash)
+		goto out_free;
+	memset(stable_hash, 0, size);
+	memset(unstable_hash, 0, size);
+
+	rmap_item_cache = KMEM_CACHE(rmap_item, 0);
+	mm_slot_cache = KMEM_CACHE(mm_slot, 0);
+	stable_node_cache = KMEM_CACHE(stable_node, 0);
+	if (!rmap_item_cache || !mm_slot_cache || !stable_node_cache)
+		goto out_free;
+
+	/* KSM pages can't be swapped: a quarter of the memory at most */
+	ksm_max_kernel_pages = totalram_pages / 4;
+
+	ksm_thread = kthread_run(ksm_scan_thread, NULL, "ksmd");
+	if (IS_ERR(ksm_thread)) {
+		printk(KERN_ERR "ksm: creating kthread failed\n");
+		err = PTR_ERR(ksm_thread);
+		goto out_free;
+	}
+
+	err = sysfs_create_group(mm_kobj, &ksm_attr_group);
+	if (err) {
+		printk(KERN_ERR "ksm: register sysfs failed\n");
+		kthread_stop(ksm_thread);
+		goto out_free;
+	}
+	return 0;
+
+out_free:
+	if (stable_node_cache)
+		kmem_cache_destroy(stable_node_cache);
+	if (mm_slot_cache)
+		kmem_cache_destroy(mm_slot_cache);
+	if (rmap_item_cache)
+		kmem_cache_destroy(rmap_item_cache);
+	vfree(unstable_hash);
+	vfree(stable_hash);
+	return err;
+}
+module_init(ksm_init)
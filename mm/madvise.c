@@ -11,6 +11,7 @@
 #include <linux/mempolicy.h>
 #include <linux/hugetlb.h>
 #include <linux/sched.h>
+#include <linux/ksm.h>
 
 /*
  * Any behaviour which results in changes to the vma->vm_flags needs to
@@ -41,7 +42,7 @@ static long madvise_behavior(struct vm_area_struct * vma,
 	struct mm_struct * mm = vma->vm_mm;
 	int error = 0;
 	pgoff_t pgoff;
-	int new_flags = vma->vm_flags;
+	unsigned long new_flags = vma->vm_flags;
 
 	switch (behavior) {
 	case MADV_NORMAL:
@@ -59,6 +60,22 @@ static long madvise_behavior(struct vm_area_struct * vma,
 	case MADV_DOFORK:
 		new_flags &= ~VM_DONTCOPY;
 		break;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	case MADV_HUGEPAGE:
+	case MADV_NOHUGEPAGE:
+		error = hugepage_madvise(&new_flags, behavior);
+		if (error)
+			goto out;
+		break;
+#endif
+#ifdef CONFIG_KSM
+	case MADV_MERGEABLE:
+	case MADV_UNMERGEABLE:
+		error = ksm_madvise(vma, start, end, behavior, &new_flags);
+		if (error)
+			goto out;
+		break;
+#endif
 	}
 
 	if (new_flags == vma->vm_flags) {
@@ -224,6 +241,14 @@ madvise_vma(struct vm_area_struct *vma, struct vm_area_struct **prev,
 	case MADV_NORMAL:
 	case MADV_SEQUENTIAL:
 	case MADV_RANDOM:
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	case MADV_HUGEPAGE:
+	case MADV_NOHUGEPAGE:
+#endif
+#ifdef CONFIG_KSM
+	case MADV_MERGEABLE:
+	case MADV_UNMERGEABLE:
+#endif
 		error = madvise_behavior(vma, prev, start, end, behavior);
 		break;
 	case MADV_REMOVE:
@@ -269,6 +294,12 @@ madvise_vma(struct vm_area_struct *vma, struct vm_area_struct **prev,
  *		so the kernel can free resources associated with it.
  *  MADV_REMOVE - the application wants to free up the given range of
  *		pages and associated backing store.
+ *  MADV_HUGEPAGE - the range is worth backing with transparent huge
+ *		pages, see Documentation/vm/transhuge.txt.
+ *  MADV_NOHUGEPAGE - the range is not worth backing with huge pages.
+ *  MADV_MERGEABLE - the range is worth scanning for pages with identical
+ *		contents, to be merged, see Documentation/vm/ksm.txt.
+ *  MADV_UNMERGEABLE - undo MADV_MERGEABLE, copying the merged pages.
  *
  * return values:
  *  zero    - success
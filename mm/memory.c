@@ -52,6 +52,7 @@
 #include <linux/writeback.h>
 #include <linux/memcontrol.h>
 #include <linux/mmu_notifier.h>
+#include <linux/ksm.h>
 #include <linux/kallsyms.h>
 #include <linux/swapops.h>
 #include <linux/elf.h>
@@ -665,6 +666,7 @@ static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src
 	src_pmd = pmd_offset(src_pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		split_huge_pmd(src_mm, src_pmd);
 		if (pmd_none_or_clear_bad(src_pmd))
 			continue;
 		if (copy_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
@@ -861,7 +863,7 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		if (pmd_none_or_clear_bad(pmd)) {
+		if (split_huge_pmd_none_or_clear_bad(vma->vm_mm, pmd)) {
 			(*zap_work)--;
 			continue;
 		}
@@ -1126,6 +1128,15 @@ struct page *follow_page(struct vm_area_struct *vma, unsigned long address,
 	pmd = pmd_offset(pud, address);
 	if (pmd_none(*pmd))
 		goto no_page_table;
+	if (pmd_trans_huge(*pmd)) {
+		spin_lock(&mm->page_table_lock);
+		if (likely(pmd_trans_huge(*pmd))) {
+			page = follow_trans_huge_pmd(mm, address, pmd, flags);
+			spin_unlock(&mm->page_table_lock);
+			goto out;
+		}
+		spin_unlock(&mm->page_table_lock);
+	}
 	if (pmd_huge(*pmd)) {
 		BUG_ON(flags & FOLL_GET);
 		page = follow_huge_pmd(mm, address, pmd, flags & FOLL_WRITE);
@@ -1750,6 +1761,7 @@ static int apply_to_pmd_range(struct mm_struct *mm, pud_t *pud,
 		return -ENOMEM;
 	do {
 		next = pmd_addr_end(addr, end);
+		split_huge_pmd(mm, pmd);
 		err = apply_to_pte_range(mm, pmd, addr, next, fn, data);
 		if (err)
 			break;
@@ -1912,9 +1924,10 @@ static int do_wp_page(struct mm_struct *mm, struct vm_area_struct *vma,
 
 	/*
 	 * Take out anonymous pages first, anonymous shared vmas are
-	 * not dirty accountable.
+	 * not dirty accountable.  A KSM page is always copied, even
+	 * when this is its last mapping.
 	 */
-	if (PageAnon(old_page)) {
+	if (PageAnon(old_page) && !PageKsm(old_page)) {
 		if (!trylock_page(old_page)) {
 			page_cache_get(old_page);
 			pte_unmap_unlock(page_table, ptl);
@@ -2414,8 +2427,8 @@ static int do_swap_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	page = lookup_swap_cache(entry);
 	if (!page) {
 		grab_swap_token(); /* Contend for token _before_ read-in */
-		page = swapin_readahead(entry,
-					GFP_HIGHUSER_MOVABLE, vma, address);
+		page = swapin_readahead_vma(entry, GFP_HIGHUSER_MOVABLE,
+					    vma, address, pmd);
 		if (!page) {
 			/*
 			 * Back out if somebody else faulted in this pte
@@ -2863,9 +2876,21 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	pmd = pmd_alloc(mm, pud, address);
 	if (!pmd)
 		return VM_FAULT_OOM;
-	pte = pte_alloc_map(mm, pmd, address);
-	if (!pte)
+	if (pmd_none(*pmd) && !vma->vm_ops &&
+	    transparent_hugepage_enabled(vma)) {
+		int ret = do_huge_anonymous_page(mm, vma, address, pmd);
+
+		if (!(ret & VM_FAULT_FALLBACK))
+			return ret;
+	}
+	/* a fault on a huge pmd wants a pte: a write after mprotect etc. */
+	split_huge_pmd(mm, pmd);
+	if (unlikely(!pmd_present(*pmd)) && __pte_alloc(mm, pmd, address))
 		return VM_FAULT_OOM;
+	/* raced with a huge fault of another thread, retry */
+	if (unlikely(pmd_trans_huge(*pmd)))
+		return 0;
+	pte = pte_offset_map(pmd, address);
 
 	return handle_pte_fault(mm, vma, address, pte, pmd, write_access);
 }
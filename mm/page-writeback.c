@@ -34,6 +34,7 @@
 #include <linux/syscalls.h>
 #include <linux/buffer_head.h>
 #include <linux/pagevec.h>
+#include <trace/writeback.h>
 
 /*
  * The maximum number of pages to writeout in a single bdflush/kupdate
@@ -64,7 +65,7 @@ static inline long sync_writeback_pages(void)
 /* The following parameters are exported via /proc/sys/vm */
 
 /*
- * Start background writeback (via pdflush) at this percentage
+ * Start background writeback (via the flusher threads) at this percentage
  */
 int dirty_background_ratio = 5;
 
@@ -117,8 +118,6 @@ EXPORT_SYMBOL(laptop_mode);
 /* End of sysctl-exported parameters */
 
 
-static void background_writeout(unsigned long _min_pages);
-
 /*
  * Scale the writeback cache size proportional to the relative writeout speeds.
  *
@@ -228,6 +227,7 @@ static inline void __bdi_writeout_inc(struct backing_dev_info *bdi)
 {
 	__prop_inc_percpu_max(&vm_completions, &bdi->completions,
 			      bdi->max_prop_frac);
+	__inc_bdi_stat(bdi, BDI_WRITTEN);
 }
 
 void bdi_writeout_inc(struct backing_dev_info *bdi)
@@ -486,8 +486,8 @@ get_dirty_limits(unsigned long *pbackground, unsigned long *pdirty,
  * balance_dirty_pages() must be called by processes which are generating dirty
  * data.  It looks at the number of dirty pages in the machine and will force
  * the caller to perform writeback if the system is over `vm_dirty_ratio'.
- * If we're over `background_thresh' then pdflush is woken to perform some
- * writeout.
+ * If we're over `background_thresh' then the flusher thread of the device is
+ * woken to perform some writeout.
  */
 static void balance_dirty_pages(struct address_space *mapping)
 {
@@ -579,7 +579,7 @@ static void balance_dirty_pages(struct address_space *mapping)
 		bdi->dirty_exceeded = 0;
 
 	if (writeback_in_progress(bdi))
-		return;		/* pdflush is already working this queue */
+		return;		/* a flusher is already working this queue */
 
 	/*
 	 * In laptop mode, we wait until hitting the higher threshold before
@@ -593,7 +593,7 @@ static void balance_dirty_pages(struct address_space *mapping)
 			(!laptop_mode && (global_page_state(NR_FILE_DIRTY)
 					  + global_page_state(NR_UNSTABLE_NFS)
 					  > background_thresh)))
-		pdflush_operation(background_writeout, 0);
+		bdi_start_writeback(bdi, 0);
 }
 
 void set_page_dirty_balance(struct page *page, int page_mkwrite)
@@ -677,15 +677,24 @@ void throttle_vm_writeout(gfp_t gfp_mask)
         }
 }
 
-/*
- * writeback at least _min_pages, and keep writing until the amount of dirty
- * memory is less than the background threshold, or until we're all clean.
+DEFINE_TRACE(writeback_start);
+DEFINE_TRACE(writeback_done);
+
+/**
+ * bdi_writeback - background writeout of one device
+ * @bdi: the device
+ * @min_pages: pages to write at least
+ *
+ * Writes back at least @min_pages pages of @bdi, and keeps writing until the
+ * amount of dirty memory is less than the background threshold, or until
+ * @bdi is all clean.  Called by the flusher thread of @bdi.  Returns the
+ * number of pages written.
  */
-static void background_writeout(unsigned long _min_pages)
+long bdi_writeback(struct backing_dev_info *bdi, long min_pages)
 {
-	long min_pages = _min_pages;
+	long written = 0;
 	struct writeback_control wbc = {
-		.bdi		= NULL,
+		.bdi		= bdi,
 		.sync_mode	= WB_SYNC_NONE,
 		.older_than_this = NULL,
 		.nr_to_write	= 0,
@@ -693,6 +702,7 @@ static void background_writeout(unsigned long _min_pages)
 		.range_cyclic	= 1,
 	};
 
+	trace_writeback_start(bdi, min_pages, 0);
 	for ( ; ; ) {
 		unsigned long background_thresh;
 		unsigned long dirty_thresh;
@@ -708,6 +718,7 @@ static void background_writeout(unsigned long _min_pages)
 		wbc.pages_skipped = 0;
 		writeback_inodes(&wbc);
 		min_pages -= MAX_WRITEBACK_PAGES - wbc.nr_to_write;
+		written += MAX_WRITEBACK_PAGES - wbc.nr_to_write;
 		if (wbc.nr_to_write > 0 || wbc.pages_skipped > 0) {
 			/* Wrote less than expected */
 			if (wbc.encountered_congestion || wbc.more_io)
@@ -716,50 +727,39 @@ static void background_writeout(unsigned long _min_pages)
 				break;
 		}
 	}
+	trace_writeback_done(bdi, written, 0);
+	return written;
 }
 
-/*
- * Start writeback of `nr_pages' pages.  If `nr_pages' is zero, write back
- * the whole world.  Returns 0 if a pdflush thread was dispatched.  Returns
- * -1 if all pdflush threads were busy.
- */
-int wakeup_pdflush(long nr_pages)
-{
-	if (nr_pages == 0)
-		nr_pages = global_page_state(NR_FILE_DIRTY) +
-				global_page_state(NR_UNSTABLE_NFS);
-	return pdflush_operation(background_writeout, nr_pages);
-}
-
-static void wb_timer_fn(unsigned long unused);
 static void laptop_timer_fn(unsigned long unused);
 
-static DEFINE_TIMER(wb_timer, wb_timer_fn, 0, 0);
 static DEFINE_TIMER(laptop_mode_wb_timer, laptop_timer_fn, 0, 0);
 
-/*
- * Periodic writeback of "old" data.
+/**
+ * bdi_kupdate - periodic writeback of "old" data of one device
+ * @bdi: the device
  *
  * Define "old": the first time one of an inode's pages is dirtied, we mark the
  * dirtying-time in the inode's address_space.  So this periodic writeback code
- * just walks the superblock inode list, writing back any inodes which are
- * older than a specific point in time.
+ * just walks the superblock inode list, writing back any inodes of @bdi which
+ * are older than a specific point in time.
  *
- * Try to run once per dirty_writeback_interval.  But if a writeback event
- * takes longer than a dirty_writeback_interval interval, then leave a
- * one-second gap.
+ * The flusher thread of @bdi runs this once per dirty_writeback_interval.
+ * But if a writeback event takes longer than a dirty_writeback_interval
+ * interval, then it leaves a one-second gap.
  *
  * older_than_this takes precedence over nr_to_write.  So we'll only write back
  * all dirty pages if they are all attached to "old" mappings.
+ *
+ * Returns the number of pages written.
  */
-static void wb_kupdate(unsigned long arg)
+long bdi_kupdate(struct backing_dev_info *bdi)
 {
 	unsigned long oldest_jif;
-	unsigned long start_jif;
-	unsigned long next_jif;
 	long nr_to_write;
+	long written = 0;
 	struct writeback_control wbc = {
-		.bdi		= NULL,
+		.bdi		= bdi,
 		.sync_mode	= WB_SYNC_NONE,
 		.older_than_this = &oldest_jif,
 		.nr_to_write	= 0,
@@ -768,19 +768,16 @@ static void wb_kupdate(unsigned long arg)
 		.range_cyclic	= 1,
 	};
 
-	sync_supers();
-
 	oldest_jif = jiffies - dirty_expire_interval;
-	start_jif = jiffies;
-	next_jif = start_jif + dirty_writeback_interval;
-	nr_to_write = global_page_state(NR_FILE_DIRTY) +
-			global_page_state(NR_UNSTABLE_NFS) +
+	nr_to_write = bdi_stat(bdi, BDI_RECLAIMABLE) +
 			(inodes_stat.nr_inodes - inodes_stat.nr_unused);
+	trace_writeback_start(bdi, nr_to_write, 1);
 	while (nr_to_write > 0) {
 		wbc.more_io = 0;
 		wbc.encountered_congestion = 0;
 		wbc.nr_to_write = MAX_WRITEBACK_PAGES;
 		writeback_inodes(&wbc);
+		written += MAX_WRITEBACK_PAGES - wbc.nr_to_write;
 		if (wbc.nr_to_write > 0) {
 			if (wbc.encountered_congestion || wbc.more_io)
 				congestion_wait(WRITE, HZ/10);
@@ -789,10 +786,8 @@ static void wb_kupdate(unsigned long arg)
 		}
 		nr_to_write -= MAX_WRITEBACK_PAGES - wbc.nr_to_write;
 	}
-	if (time_before(next_jif, jiffies + HZ))
-		next_jif = jiffies + HZ;
-	if (dirty_writeback_interval)
-		mod_timer(&wb_timer, next_jif);
+	trace_writeback_done(bdi, written, 1);
+	return written;
 }
 
 /*
@@ -802,19 +797,10 @@ int dirty_writeback_centisecs_handler(ctl_table *table, int write,
 	struct file *file, void __user *buffer, size_t *length, loff_t *ppos)
 {
 	proc_dointvec_userhz_jiffies(table, write, file, buffer, length, ppos);
-	if (dirty_writeback_interval)
-		mod_timer(&wb_timer, jiffies + dirty_writeback_interval);
-	else
-		del_timer(&wb_timer);
+	bdi_wakeup_all();
 	return 0;
 }
 
-static void wb_timer_fn(unsigned long unused)
-{
-	if (pdflush_operation(wb_kupdate, 0) < 0)
-		mod_timer(&wb_timer, jiffies + HZ); /* delay 1 second */
-}
-
 static void laptop_flush(unsigned long unused)
 {
 	sys_sync();
@@ -905,7 +891,6 @@ void __init page_writeback_init(void)
 {
 	int shift;
 
-	mod_timer(&wb_timer, jiffies + dirty_writeback_interval);
 	writeback_set_ratelimit();
 	register_cpu_notifier(&ratelimit_nb);
 
@@ -945,12 +930,14 @@ int write_cache_pages(struct address_space *mapping,
 	int cycled;
 	int range_whole = 0;
 	long nr_to_write = wbc->nr_to_write;
+	struct blk_plug plug;
 
 	if (wbc->nonblocking && bdi_write_congested(bdi)) {
 		wbc->encountered_congestion = 1;
 		return 0;
 	}
 
+	blk_start_plug(&plug);
 	pagevec_init(&pvec, 0);
 	if (wbc->range_cyclic) {
 		writeback_index = mapping->writeback_index; /* prev offset */
@@ -1095,6 +1082,7 @@ continue_unlock:
 			mapping->writeback_index = done_index;
 		wbc->nr_to_write = nr_to_write;
 	}
+	blk_finish_plug(&plug);
 
 	return ret;
 }
@@ -1230,6 +1218,8 @@ int __set_page_dirty_nobuffers(struct page *page)
 				__inc_zone_page_state(page, NR_FILE_DIRTY);
 				__inc_bdi_stat(mapping->backing_dev_info,
 						BDI_RECLAIMABLE);
+				__inc_bdi_stat(mapping->backing_dev_info,
+						BDI_DIRTIED);
 				task_dirty_inc(current);
 				task_io_account_write(PAGE_CACHE_SIZE);
 			}
@@ -863,6 +863,7 @@ static int rmqueue_bulk(struct zone *zone, unsigned int order,
 	int i;
 	
 	spin_lock(&zone->lock);
+	__count_vm_event(PGALLOC_ZONE_LOCK);
 	for (i = 0; i < count; ++i) {
 		struct page *page = __rmqueue(zone, order, migratetype);
 		if (unlikely(page == NULL))
@@ -1107,6 +1108,7 @@ again:
 		pcp->count--;
 	} else {
 		spin_lock_irqsave(&zone->lock, flags);
+		__count_vm_event(PGALLOC_ZONE_LOCK);
 		page = __rmqueue(zone, order, migratetype);
 		spin_unlock(&zone->lock);
 		if (!page)
@@ -1672,6 +1674,102 @@ got_pg:
 }
 EXPORT_SYMBOL(__alloc_pages_internal);
 
+/* Bounds the time alloc_pages_bulk() runs with interrupts disabled */
+#define ALLOC_BULK_MAX	64
+
+/**
+ * alloc_pages_bulk - allocate a number of order-0 pages at once
+ * @gfp_mask: GFP flags for the allocation
+ * @nr: number of pages wanted
+ * @list: list the pages are added to, through page->lru
+ *
+ * The pages come from the first zone of the zonelist, provided it stays
+ * above its low watermark: from the per-cpu list first, unless
+ * __GFP_COLD is given, and the rest from the buddy lists under a single
+ * hold of zone->lock.  Otherwise this falls back to a single
+ * alloc_pages(), with the usual zone fallback and reclaim.
+ *
+ * Returns the number of pages added to @list.  It may be less than @nr,
+ * never more than ALLOC_BULK_MAX, and is 0 only if alloc_pages() failed
+ * as well.
+ */
+unsigned long alloc_pages_bulk(gfp_t gfp_mask, unsigned long nr,
+			       struct list_head *list)
+{
+	enum zone_type high_zoneidx = gfp_zone(gfp_mask);
+	int migratetype = allocflags_to_migratetype(gfp_mask);
+	unsigned long flags, i, taken = 0, allocated = 0;
+	struct zonelist *zonelist;
+	struct per_cpu_pages *pcp;
+	struct page *page, *next;
+	struct zone *zone;
+	LIST_HEAD(pages);
+
+	if (!nr)
+		return 0;
+	nr = min_t(unsigned long, nr, ALLOC_BULK_MAX);
+	might_sleep_if(gfp_mask & __GFP_WAIT);
+	if (nr == 1 || should_fail_alloc_page(gfp_mask, 0))
+		goto single;
+#ifdef CONFIG_NUMA
+	/* interleaving and binding are left to alloc_pages() */
+	if (current->mempolicy && !in_interrupt())
+		goto single;
+#endif
+
+	zonelist = node_zonelist(numa_node_id(), gfp_mask);
+	first_zones_zonelist(zonelist, high_zoneidx, NULL, &zone);
+	if (!zone ||
+	    !cpuset_zone_allowed_softwall(zone, gfp_mask | __GFP_HARDWALL))
+		goto single;
+	if (!zone_watermark_ok(zone, 0, zone->pages_low + nr, zone_idx(zone),
+			       ALLOC_WMARK_LOW | ALLOC_CPUSET))
+		goto single;
+
+	pcp = &zone_pcp(zone, get_cpu())->pcp;
+	local_irq_save(flags);
+	if (!(gfp_mask & __GFP_COLD)) {
+		list_for_each_entry_safe(page, next, &pcp->list, lru) {
+			if (page_private(page) != migratetype)
+				continue;
+			list_move_tail(&page->lru, &pages);
+			pcp->count--;
+			if (++taken == nr)
+				break;
+		}
+	}
+	if (taken < nr)
+		taken += rmqueue_bulk(zone, 0, nr - taken, pages.prev,
+				      migratetype);
+	__count_zone_vm_events(PGALLOC, zone, taken);
+	__count_vm_events(PGALLOC_BULK, taken);
+	for (i = 0; i < taken; i++)
+		zone_statistics(zone, zone);
+	local_irq_restore(flags);
+	put_cpu();
+
+	list_for_each_entry_safe(page, next, &pages, lru) {
+		VM_BUG_ON(bad_range(zone, page));
+		/* a bad page is leaked, as in buffered_rmqueue() */
+		if (prep_new_page(page, 0, gfp_mask)) {
+			list_del(&page->lru);
+			continue;
+		}
+		allocated++;
+	}
+	list_splice_tail(&pages, list);
+	if (allocated)
+		return allocated;
+
+single:
+	page = alloc_pages(gfp_mask, 0);
+	if (!page)
+		return 0;
+	list_add_tail(&page->lru, list);
+	return 1;
+}
+EXPORT_SYMBOL(alloc_pages_bulk);
+
 /*
  * Common helper functions.
  */
@@ -3550,6 +3648,7 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 		zone->reclaim_stat.recent_rotated[1] = 0;
 		zone->reclaim_stat.recent_scanned[0] = 0;
 		zone->reclaim_stat.recent_scanned[1] = 0;
+		atomic_long_set(&zone->inactive_age, 0);
 		zap_zone_vm_stats(zone);
 		zone->flags = 0;
 		if (!size)
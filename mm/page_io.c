@@ -44,29 +44,37 @@ static struct bio *get_swap_bio(gfp_t gfp_flags, pgoff_t index,
 	return bio;
 }
 
+/* The bio may hold several pages gathered by swap_batch_add() */
 static void end_swap_bio_write(struct bio *bio, int err)
 {
 	const int uptodate = test_bit(BIO_UPTODATE, &bio->bi_flags);
-	struct page *page = bio->bi_io_vec[0].bv_page;
+	struct page *page;
+	int i;
 
-	if (!uptodate) {
-		SetPageError(page);
-		/*
-		 * We failed to write the page out to swap-space.
-		 * Re-dirty the page in order to avoid it being reclaimed.
-		 * Also print a dire warning that things will go BAD (tm)
-		 * very quickly.
-		 *
-		 * Also clear PG_reclaim to avoid rotate_reclaimable_page()
-		 */
-		set_page_dirty(page);
-		printk(KERN_ALERT "Write-error on swap-device (%u:%u:%Lu)\n",
+	for (i = 0; i < bio->bi_vcnt; i++) {
+		page = bio->bi_io_vec[i].bv_page;
+		if (!uptodate) {
+			SetPageError(page);
+			/*
+			 * We failed to write the page out to swap-space.
+			 * Re-dirty the page in order to avoid it being
+			 * reclaimed.  Also print a dire warning that things
+			 * will go BAD (tm) very quickly.
+			 *
+			 * Also clear PG_reclaim to avoid
+			 * rotate_reclaimable_page()
+			 */
+			set_page_dirty(page);
+			printk(KERN_ALERT "Write-error on swap-device "
+				"(%u:%u:%Lu)\n",
 				imajor(bio->bi_bdev->bd_inode),
 				iminor(bio->bi_bdev->bd_inode),
-				(unsigned long long)bio->bi_sector);
-		ClearPageReclaim(page);
+				(unsigned long long)bio->bi_sector +
+					i * (PAGE_SIZE >> 9));
+			ClearPageReclaim(page);
+		}
+		end_page_writeback(page);
 	}
-	end_page_writeback(page);
 	bio_put(bio);
 }
 
@@ -89,9 +97,66 @@ void end_swap_bio_read(struct bio *bio, int err)
 	bio_put(bio);
 }
 
+/*
+ * Adds the page to the bio of @batch if it follows the last page of the
+ * bio on the swap device, otherwise submits that bio and starts another.
+ */
+static int swap_batch_add(struct swap_batch *batch, struct page *page)
+{
+	swp_entry_t entry = { .val = page_private(page), };
+	struct swap_info_struct *sis;
+	struct bio *bio = batch->bio;
+	sector_t sector;
+
+	sis = get_swap_info_struct(swp_type(entry));
+	sector = map_swap_page(sis, swp_offset(entry)) * (PAGE_SIZE >> 9);
+	if (bio) {
+		if (bio->bi_bdev == sis->bdev &&
+		    bio->bi_sector + (bio->bi_size >> 9) == sector &&
+		    bio_add_page(bio, page, PAGE_SIZE, 0) == PAGE_SIZE)
+			return 0;
+		submit_bio(WRITE, bio);
+		batch->bio = NULL;
+	}
+
+	bio = bio_alloc(GFP_NOIO, SWAP_BATCH_MAX);
+	if (!bio)
+		return -ENOMEM;
+	bio->bi_sector = sector;
+	bio->bi_bdev = sis->bdev;
+	bio->bi_end_io = end_swap_bio_write;
+	if (bio_add_page(bio, page, PAGE_SIZE, 0) != PAGE_SIZE) {
+		bio_put(bio);
+		return -EIO;
+	}
+	batch->bio = bio;
+	return 0;
+}
+
+/**
+ * swap_batch_finish - end a batch of swap-outs
+ * @batch: the batch
+ *
+ * Submits the writes gathered by swap_writepage(), and frees the slots
+ * swap_batch_reserve() allocated which weren't used.
+ */
+void swap_batch_finish(struct swap_batch *batch)
+{
+	if (batch->bio) {
+		submit_bio(WRITE, batch->bio);
+		batch->bio = NULL;
+	}
+	while (batch->next_slot < batch->nr_slots)
+		swap_free(batch->slots[batch->next_slot++]);
+}
+
 /*
  * We may have stale swap cache pages in memory: notice
  * them here and get rid of the unnecessary final write.
+ *
+ * When reclaim passes a swap batch, the page is added to the batch's bio,
+ * which is submitted when the next page doesn't follow it on the swap
+ * device, or by swap_batch_finish().
  */
 int swap_writepage(struct page *page, struct writeback_control *wbc)
 {
@@ -102,6 +167,13 @@ int swap_writepage(struct page *page, struct writeback_control *wbc)
 		unlock_page(page);
 		goto out;
 	}
+	if (wbc->swap_batch && wbc->sync_mode == WB_SYNC_NONE &&
+	    !swap_batch_add(wbc->swap_batch, page)) {
+		count_vm_event(PSWPOUT);
+		set_page_writeback(page);
+		unlock_page(page);
+		goto out;
+	}
 	bio = get_swap_bio(GFP_NOIO, page_private(page), page,
 				end_swap_bio_write);
 	if (bio == NULL) {
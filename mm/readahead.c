@@ -38,6 +38,7 @@ void
 file_ra_state_init(struct file_ra_state *ra, struct address_space *mapping)
 {
 	ra->ra_pages = mapping->backing_dev_info->ra_pages;
+	ra->ra_limit = 0;
 	ra->prev_pos = -1;
 }
 EXPORT_SYMBOL_GPL(file_ra_state_init);
@@ -129,6 +130,7 @@ __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 	struct page *page;
 	unsigned long end_index;	/* The last page we want to read */
 	LIST_HEAD(page_pool);
+	LIST_HEAD(spare);	/* allocated, not needed yet */
 	int page_idx;
 	int ret = 0;
 	loff_t isize = i_size_read(inode);
@@ -139,7 +141,9 @@ __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 	end_index = ((isize - 1) >> PAGE_CACHE_SHIFT);
 
 	/*
-	 * Preallocate as many pages as we will need.
+	 * Preallocate as many pages as we will need.  They are allocated
+	 * in bulk, for the rest of the window at each hole; the ones left
+	 * over because the pages were cached further on are freed.
 	 */
 	for (page_idx = 0; page_idx < nr_to_read; page_idx++) {
 		pgoff_t page_offset = offset + page_idx;
@@ -150,18 +154,23 @@ __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 		rcu_read_lock();
 		page = radix_tree_lookup(&mapping->page_tree, page_offset);
 		rcu_read_unlock();
-		if (page)
+		if (page && !radix_tree_exceptional_entry(page))
 			continue;
 
-		page = page_cache_alloc_cold(mapping);
-		if (!page)
+		if (list_empty(&spare) &&
+		    !page_cache_alloc_cold_bulk(mapping,
+				min_t(unsigned long, nr_to_read - page_idx,
+				      end_index - page_offset + 1), &spare))
 			break;
+		page = list_first_entry(&spare, struct page, lru);
+		list_del(&page->lru);
 		page->index = page_offset;
 		list_add(&page->lru, &page_pool);
 		if (page_idx == nr_to_read - lookahead_size)
 			SetPageReadahead(page);
 		ret++;
 	}
+	put_pages_list(&spare);
 
 	/*
 	 * Now start the IO.  We ignore I/O errors - if the page is not
@@ -334,8 +343,40 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
  *
  * The code ramps up the readahead size aggressively at first, but slow down as
  * it approaches max_readhead.
+ *
+ * A cache miss on a page of the current window means that the page was
+ * evicted before the application got to it: the readahead pages are
+ * thrashing.  With the readahead_adaptive sysctl set, the window is then
+ * limited to half its size in ra_limit, and the limit is raised again by
+ * an eighth for every window the application reads through, until it is
+ * back at ra_pages.  The readahead_hit and readahead_waste vm events count
+ * the pages of the windows read through and of those thrashing, in all
+ * modes.
  */
 
+int readahead_adaptive;
+
+#define MIN_RA_LIMIT	(VM_MIN_READAHEAD * 1024 / PAGE_CACHE_SIZE)
+
+/* The application missed @offset in the current window */
+static void ra_thrashed(struct file_ra_state *ra, pgoff_t offset)
+{
+	count_vm_events(READAHEAD_WASTE, ra->start + ra->size - offset);
+	if (readahead_adaptive)
+		ra->ra_limit = max_t(unsigned int, ra->size / 2, MIN_RA_LIMIT);
+}
+
+/* The application went on to the next window */
+static void ra_used(struct file_ra_state *ra)
+{
+	count_vm_events(READAHEAD_HIT, ra->size);
+	if (ra->ra_limit) {
+		ra->ra_limit += ra->ra_limit / 8 + 1;
+		if (ra->ra_limit >= ra->ra_pages)
+			ra->ra_limit = 0;
+	}
+}
+
 /*
  * A minimal readahead algorithm for trivial sequential/random reads.
  */
@@ -349,12 +390,16 @@ ondemand_readahead(struct address_space *mapping,
 	pgoff_t prev_offset;
 	int	sequential;
 
+	if (readahead_adaptive && ra->ra_limit && ra->ra_limit < max)
+		max = ra->ra_limit;
+
 	/*
 	 * It's the expected callback offset, assume sequential access.
 	 * Ramp up sizes, and push forward the readahead window.
 	 */
 	if (offset && (offset == (ra->start + ra->size - ra->async_size) ||
 			offset == (ra->start + ra->size))) {
+		ra_used(ra);
 		ra->start += ra->size;
 		ra->size = get_next_ra_size(ra, max);
 		ra->async_size = ra->size;
@@ -383,7 +428,7 @@ ondemand_readahead(struct address_space *mapping,
 		pgoff_t start;
 
 		rcu_read_lock();
-		start = radix_tree_next_hole(&mapping->page_tree, offset,max+1);
+		start = page_cache_next_hole(mapping, offset, max + 1);
 		rcu_read_unlock();
 
 		if (!start || start - offset > max)
@@ -433,6 +478,9 @@ void page_cache_sync_readahead(struct address_space *mapping,
 	if (!ra->ra_pages)
 		return;
 
+	if (ra_has_index(ra, offset))
+		ra_thrashed(ra, offset);
+
 	/* do read-ahead */
 	ondemand_readahead(mapping, ra, filp, false, offset, req_size);
 }
@@ -45,6 +45,7 @@
 #include <linux/slab.h>
 #include <linux/init.h>
 #include <linux/rmap.h>
+#include <linux/ksm.h>
 #include <linux/rcupdate.h>
 #include <linux/module.h>
 #include <linux/memcontrol.h>
@@ -202,6 +203,9 @@ static struct anon_vma *page_lock_anon_vma(struct page *page)
 		goto out;
 	if (!page_mapped(page))
 		goto out;
+	/* a KSM page belongs to no anon_vma */
+	if (PageKsm(page))
+		goto out;
 
 	anon_vma = (struct anon_vma *) (anon_mapping - PAGE_MAPPING_ANON);
 	spin_lock(&anon_vma->lock);
@@ -284,6 +288,7 @@ pte_t *page_check_address(struct page *page, struct mm_struct *mm,
 	pmd = pmd_offset(pud, address);
 	if (!pmd_present(*pmd))
 		return NULL;
+	split_huge_pmd(mm, pmd);
 
 	pte = pte_offset_map(pmd, address);
 	/* Make a quick check before getting the lock */
@@ -302,6 +307,39 @@ pte_t *page_check_address(struct page *page, struct mm_struct *mm,
 	return NULL;
 }
 
+/*
+ * Check that @page is mapped at @address into @mm by a huge pmd, which
+ * page_check_address() would split.
+ *
+ * On success returns the pmd with mm->page_table_lock held.
+ */
+static pmd_t *page_check_huge_pmd(struct page *page, struct mm_struct *mm,
+				  unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return NULL;
+
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return NULL;
+
+	pmd = pmd_offset(pud, address);
+	if (!pmd_trans_huge(*pmd))
+		return NULL;
+
+	spin_lock(&mm->page_table_lock);
+	if (pmd_trans_huge(*pmd) && page_to_pfn(page) ==
+	    pmd_pfn(*pmd) + ((address & ~PMD_MASK) >> PAGE_SHIFT))
+		return pmd;
+	spin_unlock(&mm->page_table_lock);
+	return NULL;
+}
+
 /**
  * page_mapped_in_vma - check whether a page is really mapped in a VMA
  * @page: the page to test
@@ -320,6 +358,10 @@ static int page_mapped_in_vma(struct page *page, struct vm_area_struct *vma)
 	address = vma_address(page, vma);
 	if (address == -EFAULT)		/* out of vma range */
 		return 0;
+	if (page_check_huge_pmd(page, vma->vm_mm, address)) {
+		spin_unlock(&vma->vm_mm->page_table_lock);
+		return 1;
+	}
 	pte = page_check_address(page, vma->vm_mm, address, &ptl, 1);
 	if (!pte)			/* the page is not in this mm */
 		return 0;
@@ -337,17 +379,24 @@ static int page_referenced_one(struct page *page,
 {
 	struct mm_struct *mm = vma->vm_mm;
 	unsigned long address;
-	pte_t *pte;
+	pmd_t *pmd;
+	pte_t *pte = NULL;
 	spinlock_t *ptl;
-	int referenced = 0;
+	int referenced = 0, young;
 
 	address = vma_address(page, vma);
 	if (address == -EFAULT)
 		goto out;
 
-	pte = page_check_address(page, mm, address, &ptl, 0);
-	if (!pte)
-		goto out;
+	/* a huge pmd is aged as it is, it is only split to be unmapped */
+	pmd = page_check_huge_pmd(page, mm, address);
+	if (pmd)
+		ptl = &mm->page_table_lock;
+	else {
+		pte = page_check_address(page, mm, address, &ptl, 0);
+		if (!pte)
+			goto out;
+	}
 
 	/*
 	 * Don't want to elevate referenced for mlocked page that gets this far,
@@ -359,7 +408,12 @@ static int page_referenced_one(struct page *page,
 		goto out_unmap;
 	}
 
-	if (ptep_clear_flush_young_notify(vma, address, pte)) {
+	if (pmd)
+		young = huge_pmd_referenced(vma, address, pmd, page) |
+			mmu_notifier_clear_flush_young(mm, address);
+	else
+		young = ptep_clear_flush_young_notify(vma, address, pte);
+	if (young) {
 		/*
 		 * Don't treat a reference through a sequentially read
 		 * mapping as such.  If the page has been used in
@@ -379,7 +433,10 @@ static int page_referenced_one(struct page *page,
 
 out_unmap:
 	(*mapcount)--;
-	pte_unmap_unlock(pte, ptl);
+	if (pte)
+		pte_unmap_unlock(pte, ptl);
+	else
+		spin_unlock(ptl);
 out:
 	return referenced;
 }
@@ -680,6 +737,26 @@ void page_add_new_anon_rmap(struct page *page,
 		add_page_to_unevictable_list(page);
 }
 
+#ifdef CONFIG_KSM
+/**
+ * page_add_ksm_rmap - add pte mapping to a KSM page
+ * @page:	the page to add the mapping to
+ *
+ * A KSM page is anonymous, but shared by several anon_vmas, so it is
+ * attached to none of them and the rmap can't find its ptes.  KSM keeps
+ * it off the LRU: it is never unmapped behind the backs of its users.
+ *
+ * The caller needs to hold the pte lock.
+ */
+void page_add_ksm_rmap(struct page *page)
+{
+	if (atomic_inc_and_test(&page->_mapcount)) {
+		page->mapping = (struct address_space *) PAGE_MAPPING_ANON;
+		__inc_zone_page_state(page, NR_ANON_PAGES);
+	}
+}
+#endif
+
 /**
  * page_add_file_rmap - add pte mapping to a file page
  * @page: the page to add the mapping to
@@ -707,7 +784,7 @@ void page_add_file_rmap(struct page *page)
  */
 void page_dup_rmap(struct page *page, struct vm_area_struct *vma, unsigned long address)
 {
-	if (PageAnon(page))
+	if (PageAnon(page) && !PageKsm(page))
 		__page_check_anon_rmap(page, vma, address);
 	atomic_inc(&page->_mapcount);
 }
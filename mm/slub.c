@@ -1441,6 +1441,8 @@ static void deactivate_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
 	unfreeze_slab(s, page, tail);
 }
 
+static void flush_remote_frees(struct kmem_cache *s, struct kmem_cache_cpu *c);
+
 static inline void flush_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
 {
 	stat(c, CPUSLAB_FLUSH);
@@ -1457,7 +1459,11 @@ static inline void __flush_cpu_slab(struct kmem_cache *s, int cpu)
 {
 	struct kmem_cache_cpu *c = get_cpu_slab(s, cpu);
 
-	if (likely(c && c->page))
+	if (unlikely(!c))
+		return;
+	if (c->remote_page)
+		flush_remote_frees(s, c);
+	if (likely(c->page))
 		flush_slab(s, c);
 }
 
@@ -1542,6 +1548,9 @@ another_slab:
 	deactivate_slab(s, c);
 
 new_slab:
+	/* The batched objects may spare us a new slab */
+	if (c->remote_page)
+		flush_remote_frees(s, c);
 	new = get_partial(s, gfpflags, node);
 	if (new) {
 		c->page = new;
@@ -1644,23 +1653,24 @@ EXPORT_SYMBOL(kmem_cache_alloc_node);
  * handling required then we can return immediately.
  */
 static void __slab_free(struct kmem_cache *s, struct page *page,
-			void *x, unsigned long addr, unsigned int offset)
+			void *x, void *tail, int cnt, unsigned long addr,
+			unsigned int offset)
 {
 	void *prior;
 	void **object = (void *)x;
+	void **last = tail;
 	struct kmem_cache_cpu *c;
 
 	c = get_cpu_slab(s, raw_smp_processor_id());
-	stat(c, FREE_SLOWPATH);
 	slab_lock(page);
 
 	if (unlikely(SLABDEBUG && PageSlubDebug(page)))
 		goto debug;
 
 checks_ok:
-	prior = object[offset] = page->freelist;
+	prior = last[offset] = page->freelist;
 	page->freelist = object;
-	page->inuse--;
+	page->inuse -= cnt;
 
 	if (unlikely(PageSlubFrozen(page))) {
 		stat(c, FREE_FROZEN);
@@ -1702,6 +1712,48 @@ debug:
 	goto checks_ok;
 }
 
+/*
+ * Return the remote free batch of this cpu to its slab, under a single
+ * slab lock.
+ */
+static void flush_remote_frees(struct kmem_cache *s, struct kmem_cache_cpu *c)
+{
+	struct page *page = c->remote_page;
+
+	c->remote_page = NULL;
+	stat(c, FREE_REMOTE_FLUSH);
+	__slab_free(s, page, c->remote_free, c->remote_tail, c->remote_count,
+		    0, c->offset);
+}
+
+/*
+ * Objects freed to a slab other than the cpu slab, typically allocated on
+ * another processor, are gathered as long as they belong to the same slab
+ * and returned to it at once, when an object of another slab is freed.
+ * This saves taking the slab lock for every object when a stream of
+ * objects is allocated on one processor and freed on another.  The batch
+ * is also flushed when the cpu needs a new slab and with the cpu slab, so
+ * at most one slab per cpu is kept from being freed.
+ *
+ * Debug slabs are not batched: their objects are checked as they are
+ * freed.
+ */
+static void slab_free_remote(struct kmem_cache *s, struct kmem_cache_cpu *c,
+			     struct page *page, void **object)
+{
+	if (c->remote_page != page) {
+		if (c->remote_page)
+			flush_remote_frees(s, c);
+		c->remote_page = page;
+		c->remote_tail = object;
+		c->remote_count = 0;
+	} else
+		object[c->offset] = c->remote_free;
+	c->remote_free = object;
+	c->remote_count++;
+	stat(c, FREE_REMOTE_BATCHED);
+}
+
 /*
  * Fastpath with forced inlining to produce a kfree and kmem_cache_free that
  * can perform fastpath freeing without additional function calls.
@@ -1729,8 +1781,13 @@ static __always_inline void slab_free(struct kmem_cache *s,
 		object[c->offset] = c->freelist;
 		c->freelist = object;
 		stat(c, FREE_FASTPATH);
-	} else
-		__slab_free(s, page, x, addr, c->offset);
+	} else {
+		stat(c, FREE_SLOWPATH);
+		if (likely(!(SLABDEBUG && PageSlubDebug(page))))
+			slab_free_remote(s, c, page, object);
+		else
+			__slab_free(s, page, x, x, 1, addr, c->offset);
+	}
 
 	local_irq_restore(flags);
 }
@@ -1919,6 +1976,10 @@ static void init_kmem_cache_cpu(struct kmem_cache *s,
 	c->node = 0;
 	c->offset = s->offset / sizeof(void *);
 	c->objsize = s->objsize;
+	c->remote_page = NULL;
+	c->remote_free = NULL;
+	c->remote_tail = NULL;
+	c->remote_count = 0;
 #ifdef CONFIG_SLUB_STATS
 	memset(c->stat, 0, NR_SLUB_STAT_ITEMS * sizeof(unsigned));
 #endif
@@ -4144,6 +4205,8 @@ STAT_ATTR(DEACTIVATE_TO_HEAD, deactivate_to_head);
 STAT_ATTR(DEACTIVATE_TO_TAIL, deactivate_to_tail);
 STAT_ATTR(DEACTIVATE_REMOTE_FREES, deactivate_remote_frees);
 STAT_ATTR(ORDER_FALLBACK, order_fallback);
+STAT_ATTR(FREE_REMOTE_BATCHED, free_remote_batched);
+STAT_ATTR(FREE_REMOTE_FLUSH, free_remote_flush);
 #endif
 
 static struct attribute *slab_attrs[] = {
@@ -4197,6 +4260,8 @@ static struct attribute *slab_attrs[] = {
 	&deactivate_to_tail_attr.attr,
 	&deactivate_remote_frees_attr.attr,
 	&order_fallback_attr.attr,
+	&free_remote_batched_attr.attr,
+	&free_remote_flush_attr.attr,
 #endif
 	NULL
 };
@@ -118,21 +118,41 @@ void __delete_from_swap_cache(struct page *page)
 	radix_tree_delete(&swapper_space.page_tree, page_private(page));
 	set_page_private(page, 0);
 	ClearPageSwapCache(page);
+	ClearPageSwapReadahead(page);
 	total_swapcache_pages--;
 	__dec_zone_page_state(page, NR_FILE_PAGES);
 	INC_CACHE_INFO(del_total);
 	mem_cgroup_uncharge_swapcache(page, ent);
 }
 
+/**
+ * swap_batch_reserve - allocate swap slots for the next pages to swap out
+ * @batch: the batch, all of its slots must be used
+ * @nr: number of slots wanted
+ *
+ * The slots come in a run when the swap area allows it, so that the
+ * writes of the pages can be merged.  The slots which aren't used are
+ * freed by swap_batch_finish().
+ */
+void swap_batch_reserve(struct swap_batch *batch, int nr)
+{
+	VM_BUG_ON(batch->next_slot < batch->nr_slots);
+
+	batch->next_slot = 0;
+	batch->nr_slots = get_swap_pages(min(nr, SWAP_BATCH_MAX),
+					 batch->slots);
+}
+
 /**
  * add_to_swap - allocate swap space for a page
  * @page: page we want to move to swap
- * @gfp_mask: memory allocation flags
+ * @batch: slots allocated ahead, or NULL
  *
- * Allocate swap space for the page and add the page to the
- * swap cache.  Caller needs to hold the page lock. 
+ * Allocate swap space for the page, from @batch if it has slots left,
+ * and add the page to the swap cache.  Caller needs to hold the page
+ * lock.
  */
-int add_to_swap(struct page *page)
+int add_to_swap(struct page *page, struct swap_batch *batch)
 {
 	swp_entry_t entry;
 	int err;
@@ -141,7 +161,10 @@ int add_to_swap(struct page *page)
 	VM_BUG_ON(!PageUptodate(page));
 
 	for (;;) {
-		entry = get_swap_page();
+		if (batch && batch->next_slot < batch->nr_slots)
+			entry = batch->slots[batch->next_slot++];
+		else
+			entry = get_swap_page();
 		if (!entry.val)
 			return 0;
 
@@ -254,8 +277,11 @@ struct page * lookup_swap_cache(swp_entry_t entry)
 
 	page = find_get_page(&swapper_space, entry.val);
 
-	if (page)
+	if (page) {
 		INC_CACHE_INFO(find_success);
+		if (TestClearPageSwapReadahead(page))
+			count_vm_event(SWAP_RA_HIT);
+	}
 
 	INC_CACHE_INFO(find_total);
 	return page;
@@ -327,6 +353,32 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 	return found_page;
 }
 
+/*
+ * Starts the read of @ent, in the readahead window of the fault on
+ * @entry.  A page read ahead is marked PG_swapra, so that
+ * lookup_swap_cache() counts a hit when it is faulted in.  PG_readahead
+ * can't be used, it is PG_reclaim, which pageout sets on swap cache.
+ */
+static int swapin_readahead_one(swp_entry_t ent, swp_entry_t entry,
+			gfp_t gfp_mask, struct vm_area_struct *vma,
+			unsigned long addr)
+{
+	struct page *page;
+
+	page = find_get_page(&swapper_space, ent.val);
+	if (!page) {
+		page = read_swap_cache_async(ent, gfp_mask, vma, addr);
+		if (!page)
+			return -ENOMEM;
+		if (ent.val != entry.val) {
+			SetPageSwapReadahead(page);
+			count_vm_event(SWAP_RA);
+		}
+	}
+	page_cache_release(page);
+	return 0;
+}
+
 /**
  * swapin_readahead - swap in pages in hope we need them soon
  * @entry: swap entry of this memory
@@ -350,7 +402,6 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 			struct vm_area_struct *vma, unsigned long addr)
 {
 	int nr_pages;
-	struct page *page;
 	unsigned long offset;
 	unsigned long end_offset;
 
@@ -364,12 +415,87 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 	nr_pages = valid_swaphandles(entry, &offset);
 	for (end_offset = offset + nr_pages; offset < end_offset; offset++) {
 		/* Ok, do the async read-ahead now */
-		page = read_swap_cache_async(swp_entry(swp_type(entry), offset),
-						gfp_mask, vma, addr);
-		if (!page)
+		if (swapin_readahead_one(swp_entry(swp_type(entry), offset),
+					 entry, gfp_mask, vma, addr))
+			break;
+	}
+	lru_add_drain();	/* Push any new pages onto the LRU now */
+	return read_swap_cache_async(entry, gfp_mask, vma, addr);
+}
+
+/*
+ * Read ahead the swap entries mapped around the faulting address
+ * instead of the ones around the faulting entry in the swap area.
+ */
+int swap_vma_readahead;
+
+/* Bounds the window, so that its entries fit on the stack */
+#define SWAP_RA_VMA_MAX		32
+
+/**
+ * swapin_readahead_vma - swap in a page for a fault, with readahead
+ * @entry: swap entry of this memory
+ * @gfp_mask: memory allocation flags
+ * @vma: user vma this address belongs to
+ * @addr: faulting address
+ * @pmd: pmd of @addr, the pte must not be mapped
+ *
+ * Returns the struct page for entry and addr, after queueing swapin.
+ *
+ * Unless swap_vma_readahead is set, this is swapin_readahead().
+ * Otherwise it reads the swap entries found in the ptes of an aligned
+ * window of (1 << page_cluster) pages around @addr, within @vma and the
+ * page table of @addr.  When the swap area is fragmented, the slots
+ * next to @entry often hold pages of other processes, while the pages
+ * next to @addr are likely to be used soon.  The entries are read in
+ * address order, @entry among them, as swapin_readahead() reads the
+ * slots in swap order.
+ *
+ * Caller must hold down_read on the vma->vm_mm.
+ */
+struct page *swapin_readahead_vma(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr,
+			pmd_t *pmd)
+{
+	swp_entry_t entries[SWAP_RA_VMA_MAX];
+	unsigned long start, end, window, ra_addr;
+	int i, nr = 0;
+	spinlock_t *ptl;
+	pte_t *pte;
+
+	if (!swap_vma_readahead)
+		return swapin_readahead(entry, gfp_mask, vma, addr);
+
+	window = min(1UL << page_cluster, (unsigned long)SWAP_RA_VMA_MAX);
+	if (window <= 1)
+		goto out;
+	window <<= PAGE_SHIFT;
+	start = addr & ~(window - 1);
+	end = start + window;
+	start = max(start, max(vma->vm_start, addr & PMD_MASK));
+	end = min(end, min(vma->vm_end, (addr & PMD_MASK) + PMD_SIZE));
+
+	/* collect the entries under the pte lock, read them without it */
+	pte = pte_offset_map_lock(vma->vm_mm, pmd, start, &ptl);
+	for (ra_addr = start; ra_addr < end; ra_addr += PAGE_SIZE, pte++) {
+		pte_t ptent = *pte;
+		swp_entry_t ent;
+
+		if (pte_none(ptent) || pte_present(ptent) || pte_file(ptent))
+			continue;
+		ent = pte_to_swp_entry(ptent);
+		if (is_migration_entry(ent))
+			continue;
+		entries[nr++] = ent;
+	}
+	pte_unmap_unlock(pte - 1, ptl);
+
+	for (i = 0; i < nr; i++) {
+		if (swapin_readahead_one(entries[i], entry, gfp_mask,
+					 vma, addr))
 			break;
-		page_cache_release(page);
 	}
 	lru_add_drain();	/* Push any new pages onto the LRU now */
+out:
 	return read_swap_cache_async(entry, gfp_mask, vma, addr);
 }
@@ -374,17 +374,29 @@ no_page:
 	return 0;
 }
 
-swp_entry_t get_swap_page(void)
+/**
+ * get_swap_pages - allocate swap slots
+ * @nr: number of slots wanted
+ * @entries: where to store them
+ *
+ * All the slots are taken from the same swap area, so that scan_swap_map()
+ * hands them out in a run when it can, rather than interleaving them with
+ * the areas of equal priority.  Returns the number of slots allocated.
+ */
+int get_swap_pages(int nr, swp_entry_t entries[])
 {
 	struct swap_info_struct *si;
 	pgoff_t offset;
 	int type, next;
 	int wrapped = 0;
+	int n = 0;
 
 	spin_lock(&swap_lock);
 	if (nr_swap_pages <= 0)
 		goto noswap;
-	nr_swap_pages--;
+	if (nr > nr_swap_pages)
+		nr = nr_swap_pages;
+	nr_swap_pages -= nr;
 
 	for (type = swap_list.next; type >= 0 && wrapped < 2; type = next) {
 		si = swap_info + type;
@@ -401,18 +413,30 @@ swp_entry_t get_swap_page(void)
 			continue;
 
 		swap_list.next = next;
-		offset = scan_swap_map(si);
-		if (offset) {
-			spin_unlock(&swap_lock);
-			return swp_entry(type, offset);
+		while (n < nr) {
+			offset = scan_swap_map(si);
+			if (!offset)
+				break;
+			entries[n++] = swp_entry(type, offset);
 		}
+		if (n)
+			break;
 		next = swap_list.next;
 	}
 
-	nr_swap_pages++;
+	nr_swap_pages += nr - n;
 noswap:
 	spin_unlock(&swap_lock);
-	return (swp_entry_t) {0};
+	return n;
+}
+
+swp_entry_t get_swap_page(void)
+{
+	swp_entry_t entry;
+
+	if (!get_swap_pages(1, &entry))
+		entry.val = 0;
+	return entry;
 }
 
 swp_entry_t get_swap_page_of_type(int type)
@@ -489,6 +513,12 @@ static int swap_entry_free(struct swap_info_struct *p, swp_entry_t ent)
 			nr_swap_pages++;
 			p->inuse_pages--;
 			mem_cgroup_uncharge_swap(ent);
+			if (p->flags & SWP_BLKDEV) {
+				struct gendisk *disk = p->bdev->bd_disk;
+				if (disk->fops->swap_slot_free_notify)
+					disk->fops->swap_slot_free_notify(
+							p->bdev, offset);
+			}
 		}
 	}
 	return count;
@@ -776,7 +806,8 @@ static inline int unuse_pmd_range(struct vm_area_struct *vma, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		if (pmd_none_or_clear_bad(pmd))
+		/* a huge pmd maps no swap entries */
+		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
 			continue;
 		ret = unuse_pte_range(vma, pmd, addr, next, entry, page);
 		if (ret)
@@ -1717,6 +1748,7 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 		if (error < 0)
 			goto bad_swap;
 		p->bdev = bdev;
+		p->flags |= SWP_BLKDEV;
 	} else if (S_ISREG(inode->i_mode)) {
 		p->bdev = inode->i_sb->s_bdev;
 		mutex_lock(&inode->i_mutex);
@@ -47,6 +47,46 @@ void do_invalidatepage(struct page *page, unsigned long offset)
 		(*invalidatepage)(page, offset);
 }
 
+/*
+ * Removes the shadow entries of evicted pages from [start, end], see
+ * mm/workingset.c.
+ */
+static void clear_shadow_entries(struct address_space *mapping,
+				 pgoff_t start, pgoff_t end)
+{
+	void **slots[PAGEVEC_SIZE];
+	unsigned long indices[PAGEVEC_SIZE];
+	unsigned int i, nr, nr_shadows;
+	void *p;
+
+	while (start <= end) {
+		spin_lock_irq(&mapping->tree_lock);
+		if (!mapping->nrshadows) {
+			spin_unlock_irq(&mapping->tree_lock);
+			break;
+		}
+		nr = radix_tree_gang_lookup_slot(&mapping->page_tree, slots,
+						 indices, start, PAGEVEC_SIZE);
+		/* collect them first: deleting may free the nodes of slots */
+		nr_shadows = 0;
+		for (i = 0; i < nr && indices[i] <= end; i++) {
+			p = radix_tree_deref_slot(slots[i]);
+			if (radix_tree_exceptional_entry(p))
+				indices[nr_shadows++] = indices[i];
+		}
+		if (nr)
+			start = indices[nr - 1] + 1;
+		for (i = 0; i < nr_shadows; i++) {
+			radix_tree_delete(&mapping->page_tree, indices[i]);
+			mapping->nrshadows--;
+		}
+		spin_unlock_irq(&mapping->tree_lock);
+		if (nr < PAGEVEC_SIZE || !start)
+			break;
+		cond_resched();
+	}
+}
+
 static inline void truncate_partial_page(struct page *page, unsigned partial)
 {
 	zero_user_segment(page, partial, PAGE_CACHE_SIZE);
@@ -168,7 +208,7 @@ void truncate_inode_pages_range(struct address_space *mapping,
 	pgoff_t next;
 	int i;
 
-	if (mapping->nrpages == 0)
+	if (mapping->nrpages == 0 && mapping->nrshadows == 0)
 		return;
 
 	BUG_ON((lend & (PAGE_CACHE_SIZE - 1)) != (PAGE_CACHE_SIZE - 1));
@@ -251,6 +291,10 @@ void truncate_inode_pages_range(struct address_space *mapping,
 		}
 		pagevec_release(&pvec);
 	}
+
+	/* including those reclaim left while we were at it */
+	if (mapping->nrshadows)
+		clear_shadow_entries(mapping, start, end);
 }
 EXPORT_SYMBOL(truncate_inode_pages_range);
 
@@ -357,7 +401,7 @@ invalidate_complete_page2(struct address_space *mapping, struct page *page)
 
 	clear_page_mlock(page);
 	BUG_ON(PagePrivate(page));
-	__remove_from_page_cache(page);
+	__remove_from_page_cache(page, NULL);
 	spin_unlock_irq(&mapping->tree_lock);
 	page_cache_release(page);	/* pagecache ref */
 	return 1;
@@ -331,10 +331,12 @@ typedef enum {
 
 /*
  * pageout is called by shrink_page_list() for each dirty page.
- * Calls ->writepage().
+ * Calls ->writepage().  Unless the caller waits for each write, swap
+ * writes are gathered in @batch.
  */
 static pageout_t pageout(struct page *page, struct address_space *mapping,
-						enum pageout_io sync_writeback)
+			 enum pageout_io sync_writeback,
+			 struct swap_batch *batch)
 {
 	/*
 	 * If the page is dirty, only perform writeback if that write
@@ -383,6 +385,8 @@ static pageout_t pageout(struct page *page, struct address_space *mapping,
 			.range_end = LLONG_MAX,
 			.nonblocking = 1,
 			.for_reclaim = 1,
+			.swap_batch = sync_writeback == PAGEOUT_IO_ASYNC ?
+					batch : NULL,
 		};
 
 		SetPageReclaim(page);
@@ -415,9 +419,11 @@ static pageout_t pageout(struct page *page, struct address_space *mapping,
 
 /*
  * Same as remove_mapping, but if the page is removed from the mapping, it
- * gets returned with a refcount of 0.
+ * gets returned with a refcount of 0.  A file page which is @reclaimed
+ * leaves a shadow entry behind, see mm/workingset.c.
  */
-static int __remove_mapping(struct address_space *mapping, struct page *page)
+static int __remove_mapping(struct address_space *mapping, struct page *page,
+			    int reclaimed)
 {
 	BUG_ON(!PageLocked(page));
 	BUG_ON(mapping != page_mapping(page));
@@ -462,7 +468,11 @@ static int __remove_mapping(struct address_space *mapping, struct page *page)
 		spin_unlock_irq(&mapping->tree_lock);
 		swap_free(swap);
 	} else {
-		__remove_from_page_cache(page);
+		void *shadow = NULL;
+
+		if (reclaimed && page_is_file_cache(page))
+			shadow = workingset_eviction(mapping, page);
+		__remove_from_page_cache(page, shadow);
 		spin_unlock_irq(&mapping->tree_lock);
 	}
 
@@ -481,7 +491,7 @@ cannot_free:
  */
 int remove_mapping(struct address_space *mapping, struct page *page)
 {
-	if (__remove_mapping(mapping, page)) {
+	if (__remove_mapping(mapping, page, 0)) {
 		/*
 		 * Unfreezing the refcount with 1 rather than 2 effectively
 		 * drops the pagecache ref for us without requiring another
@@ -570,8 +580,29 @@ void putback_lru_page(struct page *page)
 #endif /* CONFIG_UNEVICTABLE_LRU */
 
 
+/*
+ * The anonymous pages left on @page_list which will need swap slots,
+ * so that shrink_page_list() allocates their slots in one run.
+ */
+static int nr_anon_to_swap(struct list_head *page_list)
+{
+	struct page *page;
+	int nr = 0;
+
+	list_for_each_entry(page, page_list, lru) {
+		if (PageAnon(page) && !PageSwapCache(page) &&
+		    ++nr == SWAP_BATCH_MAX)
+			break;
+	}
+	return nr;
+}
+
 /*
  * shrink_page_list() returns the number of reclaimed pages
+ *
+ * The anonymous pages get their swap slots from a batch allocated for
+ * all of them, and in the asynchronous pass their writes are gathered
+ * into multi-page bios, which are submitted at the end.
  */
 static unsigned long shrink_page_list(struct list_head *page_list,
 					struct scan_control *sc,
@@ -579,6 +610,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 {
 	LIST_HEAD(ret_pages);
 	struct pagevec freed_pvec;
+	struct swap_batch batch = { .bio = NULL, };
 	int pgactivate = 0;
 	unsigned long nr_reclaimed = 0;
 
@@ -644,7 +676,10 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		if (PageAnon(page) && !PageSwapCache(page)) {
 			if (!(sc->gfp_mask & __GFP_IO))
 				goto keep_locked;
-			if (!add_to_swap(page))
+			if (batch.next_slot == batch.nr_slots)
+				swap_batch_reserve(&batch,
+					1 + nr_anon_to_swap(page_list));
+			if (!add_to_swap(page, &batch))
 				goto activate_locked;
 			may_enter_fs = 1;
 		}
@@ -677,7 +712,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 				goto keep_locked;
 
 			/* Page is dirty, try to write it out here */
-			switch (pageout(page, mapping, sync_writeback)) {
+			switch (pageout(page, mapping, sync_writeback, &batch)) {
 			case PAGE_KEEP:
 				goto keep_locked;
 			case PAGE_ACTIVATE:
@@ -741,7 +776,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			}
 		}
 
-		if (!mapping || !__remove_mapping(mapping, page))
+		if (!mapping || !__remove_mapping(mapping, page, 1))
 			goto keep_locked;
 
 		/*
@@ -780,6 +815,7 @@ keep:
 		list_add(&page->lru, &ret_pages);
 		VM_BUG_ON(PageLRU(page) || PageUnevictable(page));
 	}
+	swap_batch_finish(&batch);
 	list_splice(&ret_pages, page_list);
 	if (pagevec_count(&freed_pvec))
 		__pagevec_free(&freed_pvec);
@@ -1581,10 +1617,10 @@ static void shrink_zones(int priority, struct zonelist *zonelist,
  *
  * If the caller is !__GFP_FS then the probability of a failure is reasonably
  * high - the zone may be full of dirty or under-writeback pages, which this
- * caller can't do much about.  We kick pdflush and take explicit naps in the
- * hope that some of these pages can be written.  But if the allocating task
- * holds filesystem locks which prevent writeout this might not work, and the
- * allocation attempt will fail.
+ * caller can't do much about.  We kick the flusher threads and take explicit
+ * naps in the hope that some of these pages can be written.  But if the
+ * allocating task holds filesystem locks which prevent writeout this might
+ * not work, and the allocation attempt will fail.
  *
  * returns:	0, if no pages reclaimed
  * 		else, the number of pages reclaimed
@@ -1649,7 +1685,7 @@ static unsigned long do_try_to_free_pages(struct zonelist *zonelist,
 		 */
 		if (total_scanned > sc->swap_cluster_max +
 					sc->swap_cluster_max / 2) {
-			wakeup_pdflush(laptop_mode ? 0 : total_scanned);
+			wakeup_flusher_threads(laptop_mode ? 0 : total_scanned);
 			sc->may_writepage = 1;
 		}
 
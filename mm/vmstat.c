@@ -680,6 +680,8 @@ static const char * const vmstat_text[] = {
 	"pswpout",
 
 	TEXTS_FOR_ZONES("pgalloc")
+	"pgalloc_bulk",
+	"pgalloc_zone_lock",
 
 	"pgfree",
 	"pgactivate",
@@ -701,10 +703,23 @@ static const char * const vmstat_text[] = {
 	"allocstall",
 
 	"pgrotated",
+	"readahead_hit",
+	"readahead_waste",
+	"workingset_refault",
+	"workingset_activate",
+#ifdef CONFIG_SWAP
+	"swap_ra",
+	"swap_ra_hit",
+#endif
 #ifdef CONFIG_HUGETLB_PAGE
 	"htlb_buddy_alloc_success",
 	"htlb_buddy_alloc_fail",
 #endif
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	"thp_fault_alloc",
+	"thp_fault_fallback",
+	"thp_split",
+#endif
 #ifdef CONFIG_UNEVICTABLE_LRU
 	"unevictable_pgs_culled",
 	"unevictable_pgs_scanned",
@@ -0,0 +1,124 @@
+/*
+ * mm/workingset.c
+ *
+ * Working set detection: telling the refaults of a working set which is
+ * being thrashed from the faults of streaming IO.
+ *
+ * A page cache page starts out on the inactive file list, and is promoted
+ * to the active list when it is accessed a second time.  If the inactive
+ * list is too small for the distance between two accesses, a working set
+ * bigger than it but smaller than the memory is evicted before its second
+ * access, every time, and never gets activated: reclaim can't tell it from
+ * a read-once stream.
+ *
+ * So when a file page is evicted, a shadow entry is left in its slot of
+ * the page cache radix tree.  It records the zone's inactive_age, a clock
+ * which ticks at every eviction and activation of a file page, i.e. every
+ * time a page leaves the inactive list.  When the page is faulted back in,
+ *
+ *	refault distance = inactive_age now - inactive_age at eviction
+ *
+ * is the number of pages the inactive list would have needed to have in
+ * addition to keep it until this access.  The active list could give up
+ * that many: if the distance is no larger than the active file list, the
+ * page is activated right away, to compete with the active pages on equal
+ * terms.  Being added to the active list, it also counts as rotated in the
+ * zone's reclaim_stat, which moves get_scan_ratio() towards sparing the
+ * file cache.  Pages refaulting from further away are treated as use-once.
+ *
+ * Shadow entries older than the file LRU can never activate anything, so
+ * a mapping doesn't get more of them than there are file pages in memory.
+ * They go away when the page comes back, at truncation, and when the inode
+ * is freed.
+ */
+
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/swap.h>
+#include <linux/radix-tree.h>
+#include <linux/vmstat.h>
+
+/* The shadow entry packs the eviction time, the node and the zone index */
+#define EVICTION_SHIFT	(RADIX_TREE_EXCEPTIONAL_SHIFT + \
+			 NODES_SHIFT + ZONES_SHIFT)
+#define EVICTION_MASK	(~0UL >> EVICTION_SHIFT)
+
+static void *pack_shadow(unsigned long eviction, struct zone *zone)
+{
+	eviction = (eviction << NODES_SHIFT) | zone_to_nid(zone);
+	eviction = (eviction << ZONES_SHIFT) | zone_idx(zone);
+	eviction = (eviction << RADIX_TREE_EXCEPTIONAL_SHIFT);
+
+	return (void *)(eviction | RADIX_TREE_EXCEPTIONAL_ENTRY);
+}
+
+static void unpack_shadow(void *shadow, struct zone **zone,
+			  unsigned long *evictionp)
+{
+	unsigned long entry = (unsigned long)shadow;
+	int zid;
+
+	entry >>= RADIX_TREE_EXCEPTIONAL_SHIFT;
+	zid = entry & ((1UL << ZONES_SHIFT) - 1);
+	entry >>= ZONES_SHIFT;
+	*zone = NODE_DATA(entry & ((1UL << NODES_SHIFT) - 1))->node_zones + zid;
+	entry >>= NODES_SHIFT;
+
+	*evictionp = entry;
+}
+
+/**
+ * workingset_eviction - note the eviction of a file page
+ * @mapping: the address_space the page is evicted from
+ * @page: the page, locked and still in the page cache
+ *
+ * Returns the shadow entry to store in the page's slot, or NULL if the
+ * mapping already has as many as could be of use.  Called under the
+ * mapping's tree_lock.
+ */
+void *workingset_eviction(struct address_space *mapping, struct page *page)
+{
+	struct zone *zone = page_zone(page);
+	unsigned long eviction;
+
+	if (mapping->nrshadows >= global_page_state(NR_ACTIVE_FILE) +
+				  global_page_state(NR_INACTIVE_FILE))
+		return NULL;
+
+	eviction = atomic_long_inc_return(&zone->inactive_age);
+	return pack_shadow(eviction, zone);
+}
+
+/**
+ * workingset_refault - evaluate the refault of a previously evicted page
+ * @shadow: the shadow entry the page left behind
+ *
+ * Returns 1 if the page should be activated as it is added to the LRU,
+ * because it was evicted within the size of the active file list.
+ */
+int workingset_refault(void *shadow)
+{
+	unsigned long refault_distance;
+	unsigned long eviction;
+	struct zone *zone;
+
+	unpack_shadow(shadow, &zone, &eviction);
+	refault_distance = (atomic_long_read(&zone->inactive_age) - eviction) &
+				EVICTION_MASK;
+
+	count_vm_event(WORKINGSET_REFAULT);
+	if (refault_distance <= zone_page_state(zone, NR_ACTIVE_FILE)) {
+		count_vm_event(WORKINGSET_ACTIVATE);
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * workingset_activation - note a page activation
+ * @page: the file page being activated
+ */
+void workingset_activation(struct page *page)
+{
+	atomic_long_inc(&page_zone(page)->inactive_age);
+}